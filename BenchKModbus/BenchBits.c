@@ -0,0 +1,77 @@
+﻿#include <stdio.h>
+#include "KModbusAtomic.h"
+#include "BenchKModbus.h"
+
+/*
+	Coil access from the application: KModbus_BitSet/BitClear against
+	KModbus_Write of one packed bit, then THREADS threads setting and
+	clearing their own coil of the same 64-bit word. A lost update shows
+	as a previous state that is not the one the thread left. With
+	KMODBUS_PROCESS_IMAGE the bits belong to the commit thread like
+	KModbus_Set, so the threaded part runs on that thread alone.
+*/
+
+#define	ROUNDS		(2000000)
+#define	THREADS		(4)
+
+static KMODBUS_ATOMIC	Lost;
+
+static void	Toggler(int no)
+{
+	int		i, lost;
+
+	lost = 0;
+	for (i = 0; i < ROUNDS / THREADS; i++) {
+		lost += (KModbus_BitSet(1 + no) != 0);
+		lost += (KModbus_BitClear(1 + no) != 1);
+	}
+	KMODBUS_ATOMIC_FETCH_ADD(&Lost, lost);
+}
+
+int		Bench_Bits(void)
+{
+	static KModbus_t	hd;
+	unsigned char		on, off;
+	double				t0, bit, write;
+	int					i, n;
+
+	KModbus_Init(&hd);
+	on = 0x01;
+	off = 0x00;
+
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		KModbus_BitSet(1);
+		KModbus_BitClear(1);
+	}
+	bit = BENCH_NS(t0, ROUNDS * 2);
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		KModbus_Write(0, 0, &on, 1);
+		KModbus_Write(0, 0, &off, 1);
+	}
+	write = BENCH_NS(t0, ROUNDS * 2);
+	printf("%s  BitSet/Clear %.1f ns  Write %.1f ns\n",
+		KMODBUS_PROCESS_IMAGE ? "process image " : "lock per write", bit, write);
+
+	Lost = 0;
+	n = KMODBUS_PROCESS_IMAGE ? 1 : THREADS;
+	t0 = Bench_Now();
+	if (n == 1) {
+		for (i = 0; i < THREADS; i++) {
+			Toggler(i);
+		}
+	}
+	else {
+		Bench_Threads(n, Toggler);
+	}
+	printf("%d thread%s on one word  %.1f ns/op  %ld lost\n", n, (n == 1) ? "" : "s",
+		BENCH_NS(t0, ROUNDS / THREADS * THREADS * 2), (long)Lost);
+	KModbus_Commit();
+	for (i = 0; i < THREADS; i++) {
+		if (KModbus_BitTest(1 + i) != 0) {
+			Lost++;
+		}
+	}
+	return Lost != 0;
+}
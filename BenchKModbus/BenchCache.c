@@ -0,0 +1,88 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusMaster.h"
+#include "BenchKModbus.h"
+
+/*
+	FC03/FC04 response cache: 8 hot queries of 100 to 125 registers, round
+	robin through KModbus_Execute on a handle without and with a cache,
+	while the application writes one register every N requests. The CPU
+	saved is the difference per request, and per hit once divided by the
+	hit rate. Every response of the cached handle must match the plain
+	one byte for byte.
+*/
+
+#define	ROUNDS		(400000)
+#define	QUERIES		(8)
+
+static unsigned char	Query[QUERIES][KMODBUS_MAX_TXBUF];
+static int				QueryLen[QUERIES];
+
+/* ns per request of ROUNDS requests, one application write every every requests (0: none) */
+static double	Run(PKModbus_t hd, int every)
+{
+	double	t0;
+	int		i;
+
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		if (every != 0 && i % every == 0) {
+			KModbus_Set(40001 + (i / every) % 1000, (unsigned short)i);
+			KModbus_Commit();
+		}
+		KModbus_Execute(hd, Query[i % QUERIES], QueryLen[i % QUERIES]);
+	}
+	return BENCH_NS(t0, ROUNDS);
+}
+
+int		Bench_Cache(void)
+{
+	static const int		every[] = { 10, 100, 0 };
+	static KModbus_t		plain, cached;
+	static KModbusCache_t	cache;
+	unsigned char			rsp[KMODBUS_MAX_TXBUF];
+	double					ns[2], hit;
+	int						i, k, len, bad;
+
+	KModbus_Init(&plain);
+	KModbus_InitHandle(&cached);
+	KModbus_CacheInit(&cached, &cache);
+	for (i = 0; i < QUERIES; i++) {
+		QueryLen[i] = KModbusMaster_BuildRead(Query[i], KMODBUS_ID, (i & 1) ? 4 : 3, i * 125, 100 + i * 3);
+	}
+
+	/* Same frames, with writes in between */
+	bad = 0;
+	for (i = 0; i < 20000; i++) {
+		if (i % 50 == 0) {
+			KModbus_Set(((i & 1) ? 30001 : 40001) + (i * 13) % 1000, (unsigned short)i);
+			KModbus_Commit();
+		}
+		KModbus_Execute(&plain, Query[i % QUERIES], QueryLen[i % QUERIES]);
+		memcpy(rsp, Bench_TxBuf, Bench_TxLen);
+		len = Bench_TxLen;
+		KModbus_Execute(&cached, Query[i % QUERIES], QueryLen[i % QUERIES]);
+		bad += (len != Bench_TxLen || memcmp(rsp, Bench_TxBuf, len) != 0);
+	}
+	if (bad != 0 || cache.Hits == 0) {
+		printf("%d cached responses differ, %lu hits\n", bad, cache.Hits);
+		return 1;
+	}
+
+	printf("%s\n", KMODBUS_PROCESS_IMAGE ? "process image (a write is a commit)" : "lock per write");
+	for (k = 0; k < (int)(sizeof(every) / sizeof(every[0])); k++) {
+		ns[0] = Run(&plain, every[k]);
+		KModbus_CacheInit(&cached, &cache);
+		ns[1] = Run(&cached, every[k]);
+		hit = (double)cache.Hits / (double)(cache.Hits + cache.Misses);
+		if (every[k] != 0) {
+			printf("1 write / %3d req", every[k]);
+		}
+		else {
+			printf("no writes        ");
+		}
+		printf("  no cache %6.1f ns  cache %6.1f ns  hits %5.1f%%  saved %6.1f ns/req  %6.1f ns/hit\n",
+			ns[0], ns[1], hit * 100.0, ns[0] - ns[1], (ns[0] - ns[1]) / hit);
+	}
+	return 0;
+}
@@ -0,0 +1,167 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusUdp.h"
+#include "KModbusClient.hpp"
+#include "BenchKModbus.h"
+
+/*
+	KModbus::Client over loopback: a UDP server with RTU framing on its own
+	thread, 1 to LINKS master handles each on its own socket, TASKS
+	coroutines per link writing a register of their own with FC06 and
+	reading it back with FC03. The links run their transactions at the
+	same time, the tasks of one link queue on it. Reports transactions
+	per second; every one must succeed with the value written. The
+	executor is turned by RunOnce and a yield, Run sleeps a tick when idle.
+*/
+
+#define	PORT		(15041)
+#define	LINKS		(4)
+#define	TASKS		(4)
+#define	ROUNDS		(2000)
+
+/* One master handle's end of the loopback, a datagram is read out byte by byte */
+struct Port {
+	KMODBUS_SOCKET	Socket;
+	unsigned char	Buf[KMODBUS_UDP_MAX_DATAGRAM];
+	int				Pos;
+	int				Len;
+};
+
+static KModbus_t		Hd;
+static KModbusUdp_t		Udp;
+static KModbus_t		Master[LINKS];
+static Port				Ports[LINKS];
+static int				Links;
+static int				Quit;
+static int				Finished;
+static unsigned long	Answered;
+static unsigned long	Failed;
+
+/* KModbusIF_t has no context, so each port gets its own instance */
+template<int N>
+static KMODBUS_STATUS	PortGet(unsigned char* c)
+{
+	Port&	p = Ports[N];
+
+	if (p.Pos == p.Len) {
+		if (KModbusSocket_WaitRead(p.Socket, 0) <= 0) {
+			return KMODBUS_NODATA;
+		}
+		p.Len = recv(p.Socket, (char*)p.Buf, sizeof(p.Buf), 0);
+		p.Pos = 0;
+		if (p.Len <= 0) {
+			p.Len = 0;
+			return KMODBUS_NODATA;
+		}
+	}
+	*c = p.Buf[p.Pos++];
+	return KMODBUS_OK;
+}
+
+template<int N>
+static KMODBUS_STATUS	PortPuts(unsigned char* buf, int len)
+{
+	return (send(Ports[N].Socket, (const char*)buf, len, 0) == len) ? KMODBUS_OK : KMODBUS_NOT_RESPONSE;
+}
+
+static const KModbusIF_t	PortIF[LINKS] = {
+	{ PortGet<0>, 0, 0, PortPuts<0> },
+	{ PortGet<1>, 0, 0, PortPuts<1> },
+	{ PortGet<2>, 0, 0, PortPuts<2> },
+	{ PortGet<3>, 0, 0, PortPuts<3> },
+};
+
+static KModbus::Task<>	Worker(KModbus::Client& c, KMODBUS_ADDRESS ad)
+{
+	for (int i = 0; i < ROUNDS; i++) {
+		KModbus::Reply	w = co_await c.PresetSingleRegister(KMODBUS_ID, ad, (KMODBUS_HOLDING_REGISTER)(ad + i));
+		KModbus::Reply	r = co_await c.ReadHoldingRegister(KMODBUS_ID, ad, 1);
+
+		if (!w || !r || r.values[0] != (unsigned short)(ad + i)) {
+			Failed++;
+			continue;
+		}
+		Answered += 2;
+	}
+	Finished++;
+}
+
+static void	Clients(void)
+{
+	KModbus::Executor	ex(Bench_Tick);
+	KModbus::Link*		link[LINKS];
+	KModbus::Client*	client[LINKS];
+	int					i, t;
+
+	for (i = 0; i < Links; i++) {
+		link[i] = new KModbus::Link(ex, &Master[i]);
+		client[i] = new KModbus::Client(*link[i]);
+		for (t = 0; t < TASKS; t++) {
+			ex.Spawn(Worker(*client[i], (KMODBUS_ADDRESS)(i * TASKS + t)));
+		}
+	}
+	while (Finished < Links * TASKS) {
+		if (!ex.RunOnce()) {
+			Bench_Yield();
+		}
+	}
+	for (i = 0; i < Links; i++) {
+		delete client[i];
+		delete link[i];
+	}
+	Quit = 1;
+}
+
+static void	Run(int no)
+{
+	if (no == 0) {
+		KModbusUdpServer(&Udp, &Quit);
+	}
+	else {
+		Clients();
+	}
+}
+
+int		Bench_Client(void)
+{
+	struct sockaddr_in	sa;
+	double				t0, s;
+	int					i, bad;
+
+	KModbus_Init(&Hd);
+	if (KModbusUdp_Open(&Udp, &Hd, PORT, KMODBUS_UDP_RTU) != KMODBUS_OK) {
+		printf("cannot listen on %d\n", PORT);
+		return 1;
+	}
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(PORT);
+	for (i = 0; i < LINKS; i++) {
+		KModbusMaster_Init(&Master[i]);
+		Master[i].Interface = PortIF[i];
+		Ports[i].Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		Ports[i].Pos = 0;
+		Ports[i].Len = 0;
+		connect(Ports[i].Socket, (struct sockaddr*)&sa, sizeof(sa));
+	}
+
+	bad = 0;
+	for (Links = 1; Links <= LINKS; Links *= 2) {
+		Quit = 0;
+		Finished = 0;
+		Answered = 0;
+		Failed = 0;
+		t0 = Bench_Now();
+		Bench_Threads(2, Run);
+		s = Bench_Now() - t0;
+		printf("%d links x %d tasks  %8.0f transactions/s  failed %lu\n", Links, TASKS, (double)Answered / s, Failed);
+		bad += (Failed != 0 || Answered != (unsigned long)Links * TASKS * ROUNDS * 2);
+	}
+
+	for (i = 0; i < LINKS; i++) {
+		KMODBUS_CLOSESOCKET(Ports[i].Socket);
+	}
+	KModbusUdp_Close(&Udp);
+	return bad;
+}
@@ -0,0 +1,93 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbus.hpp"
+#include "KModbusMaster.h"
+#include "BenchKModbus.h"
+
+/*
+	KModbus::Server dispatch against the C tables: the same queries run
+	through KModbus_Execute on a plain handle and on one driven by the
+	front end, then KModbus_Dispatch alone on a query already in RxBuf.
+	A code left out of Functions<> must get exception 01 from the front end.
+*/
+
+#define	ROUNDS		(2000000)
+
+struct BenchCom {
+	static KMODBUS_STATUS	Get(unsigned char* c)
+	{
+		return GetCom(c);
+	}
+	static KMODBUS_STATUS	Puts(unsigned char* buf, int len)
+	{
+		return PutsCom(buf, len);
+	}
+	static KMODBUS_TICK		Tick(void)
+	{
+		return Bench_Tick();
+	}
+};
+
+typedef KModbus::Server<BenchCom, KModbus::Units<1>, KModbus::DefaultBanks,
+	KModbus::Functions<1, 3, 6, 16>>	BenchServer;
+
+int		Bench_Dispatch(void)
+{
+	static KModbus_t	c, cpp;
+	unsigned char		q[5][KMODBUS_MAX_RXBUF], rsp[KMODBUS_MAX_TXBUF];
+	unsigned short		regs[4] = { 1, 2, 3, 4 };
+	unsigned long		sent;
+	int					qlen[5], i, k, rlen, bad;
+	double				t0, ns[2], dns[2];
+
+	KModbus_Init(&c);
+	BenchServer		server(cpp);
+
+	qlen[0] = KModbusMaster_BuildRead(q[0], 1, 3, 0, 10);
+	qlen[1] = KModbusMaster_BuildRead(q[1], 1, 1, 0, 16);
+	qlen[2] = KModbusMaster_BuildWriteSingle(q[2], 1, 6, 20, 0x1234);
+	qlen[3] = KModbusMaster_BuildWriteMultiple(q[3], 1, 16, 30, 4, regs);
+	qlen[4] = KModbusMaster_BuildRead(q[4], 1, 4, 0, 10);
+
+	/* Both paths answer alike */
+	bad = 0;
+	for (i = 0; i < 4; i++) {
+		KModbus_Execute(&c, q[i], qlen[i]);
+		memcpy(rsp, Bench_TxBuf, Bench_TxLen);
+		rlen = Bench_TxLen;
+		KModbus_Execute(&cpp, q[i], qlen[i]);
+		if (rlen != Bench_TxLen || memcmp(rsp, Bench_TxBuf, rlen) != 0) {
+			printf("function %d: responses differ\n", q[i][1]);
+			bad++;
+		}
+	}
+
+	/* FC04 is not in the list */
+	sent = Bench_TxCount;
+	KModbus_Execute(&cpp, q[4], qlen[4]);
+	if (Bench_TxCount == sent || Bench_TxLen != 5 || Bench_TxBuf[1] != 0x84 || Bench_TxBuf[2] != 0x01) {
+		printf("function 4: no exception 01\n");
+		bad++;
+	}
+
+	for (k = 0; k < 2; k++) {
+		PKModbus_t	hd = k ? &cpp : &c;
+
+		t0 = Bench_Now();
+		for (i = 0; i < ROUNDS; i++) {
+			KModbus_Execute(hd, q[i & 3], qlen[i & 3]);
+		}
+		ns[k] = BENCH_NS(t0, ROUNDS);
+
+		/* FC06 costs the least around the dispatch */
+		memcpy(hd->RxBuf, q[2], qlen[2]);
+		t0 = Bench_Now();
+		for (i = 0; i < ROUNDS; i++) {
+			KModbus_Dispatch(hd);
+		}
+		dns[k] = BENCH_NS(t0, ROUNDS);
+	}
+	printf("Execute   FC03/01/06/16: C %6.1f ns  C++ %6.1f ns\n", ns[0], ns[1]);
+	printf("Dispatch  FC06:          C %6.1f ns  C++ %6.1f ns\n", dns[0], dns[1]);
+	return bad;
+}
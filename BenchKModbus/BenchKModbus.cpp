@@ -0,0 +1,259 @@
+﻿#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TestKModbus.h"
+#include "BenchKModbus.h"
+
+/*
+	Benchmarks of the KModbus features. Each prints its figures and returns
+	0, or non-zero when the run did not behave (wrong responses, lost
+	frames). Build Release; the numbers in the commit messages are from
+	this program. Benches of a build option (KMODBUS_PROCESS_IMAGE,
+	KMODBUS_WIRE_ORDER) report
+	the variant they were built with, define it in the project to get the
+	other one.
+
+	BenchKModbus [name...]
+*/
+
+static const struct {
+	const char*	Name;
+	int			(*Run)(void);
+} Benches[] = {
+	{ "bits",		Bench_Bits },			/* Atomic coil access, one and several threads */
+	{ "cache",		Bench_Cache },			/* FC03/FC04 response cache, CPU saved per hit */
+	{ "client",		Bench_Client },			/* Coroutine client, concurrent transactions over loopback */
+	{ "dispatch",	Bench_Dispatch },		/* C++ front end against the C dispatch */
+	{ "image",		Bench_Image },			/* Process image against the lock per write */
+	{ "lite",		Bench_Lite },			/* Compact handles against full ones, 100k endpoints */
+	{ "repl",		Bench_Repl },			/* Hot-standby replication to a second process */
+	{ "ring",		Bench_Ring },			/* SPSC byte ring between two threads */
+	{ "rt",			Bench_Rt },				/* Periodic query turnaround, plain and real-time thread */
+	{ "sched",		Bench_Sched },			/* Transaction classes on a simulated RTU line */
+	{ "tag",		Bench_Tag },			/* Tag map parse, lookup and scaled access */
+	{ "tcp",		Bench_Tcp },			/* Sharded TCP server, 1 to 4 workers */
+	{ "tcpclient",	Bench_TcpClient },		/* Pipelined TCP master, windows and reconnects */
+	{ "udp",		Bench_Udp },			/* UDP against TCP and serial, req/s and CPU per request */
+	{ "wire",		Bench_Wire },			/* Register banks in host or wire byte order */
+};
+
+int main(int argc, char* argv[])
+{
+	int		i, j, ran, failed;
+
+	/* The second process of the repl bench */
+	if (argc > 2 && strcmp(argv[1], "--repl-standby") == 0) {
+		return Bench_ReplStandby(atoi(argv[2]));
+	}
+	ran = 0;
+	failed = 0;
+	for (i = 0; i < (int)(sizeof(Benches) / sizeof(Benches[0])); i++) {
+		if (argc > 1) {
+			for (j = 1; j < argc && strcmp(argv[j], Benches[i].Name) != 0; j++) {
+			}
+			if (j == argc) {
+				continue;
+			}
+		}
+		printf("== %s\n", Benches[i].Name);
+		fflush(stdout);
+		if ((*Benches[i].Run)() != 0) {
+			printf("** %s FAILED\n", Benches[i].Name);
+			failed++;
+		}
+		ran++;
+	}
+	if (ran == 0) {
+		printf("usage: BenchKModbus [name...]\n");
+		for (i = 0; i < (int)(sizeof(Benches) / sizeof(Benches[0])); i++) {
+			printf("  %s\n", Benches[i].Name);
+		}
+		return 2;
+	}
+	return failed ? 1 : 0;
+}
+
+double	Bench_Now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER	freq;
+	LARGE_INTEGER			now;
+
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+KMODBUS_TICK	Bench_Tick(void)
+{
+	return (KMODBUS_TICK)(Bench_Now() * 1000.0);
+}
+
+double	Bench_Cpu(void)
+{
+#ifdef _WIN32
+	FILETIME	create, exit, kernel, user;
+
+	GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+	return ((double)((unsigned long long)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime)
+		+ (double)((unsigned long long)user.dwHighDateTime << 32 | user.dwLowDateTime)) * 1e-7;
+#else
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* Loopback port: nothing to receive, responses are kept for the checks */
+unsigned char	Bench_TxBuf[KMODBUS_MAX_TXBUF];
+int				Bench_TxLen;
+unsigned long	Bench_TxCount;
+
+KMODBUS_STATUS	GetCom(unsigned char* c)
+{
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	GetsCom(unsigned char* buf, int len)
+{
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	PutCom(unsigned char c)
+{
+	return KMODBUS_OK;
+}
+KMODBUS_STATUS	PutsCom(unsigned char* buf, int len)
+{
+	if (len > (int)sizeof(Bench_TxBuf)) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memcpy(Bench_TxBuf, buf, len);
+	Bench_TxLen = len;
+	Bench_TxCount++;
+	return KMODBUS_OK;
+}
+
+/* Worker threads of the multi-threaded benchmarks */
+#define	MAX_THREADS		(16)
+
+typedef struct BenchThread_t {
+	void	(*Fn)(int);
+	int		No;
+
+} BenchThread_t;
+
+#ifdef _WIN32
+static DWORD WINAPI	ThreadMain(LPVOID arg)
+{
+	BenchThread_t*	th = (BenchThread_t*)arg;
+
+	(*th->Fn)(th->No);
+	return 0;
+}
+
+void	Bench_Threads(int n, void (*fn)(int))
+{
+	BenchThread_t	th[MAX_THREADS];
+	HANDLE			h[MAX_THREADS];
+	int				i;
+
+	for (i = 0; i < n && i < MAX_THREADS; i++) {
+		th[i].Fn = fn;
+		th[i].No = i;
+		h[i] = CreateThread(NULL, 0, ThreadMain, &th[i], 0, NULL);
+	}
+	WaitForMultipleObjects(i, h, TRUE, INFINITE);
+	while (i-- > 0) {
+		CloseHandle(h[i]);
+	}
+}
+#else
+static void*	ThreadMain(void* arg)
+{
+	BenchThread_t*	th = (BenchThread_t*)arg;
+
+	(*th->Fn)(th->No);
+	return 0;
+}
+
+void	Bench_Threads(int n, void (*fn)(int))
+{
+	BenchThread_t	th[MAX_THREADS];
+	pthread_t		h[MAX_THREADS];
+	int				i;
+
+	for (i = 0; i < n && i < MAX_THREADS; i++) {
+		th[i].Fn = fn;
+		th[i].No = i;
+		pthread_create(&h[i], NULL, ThreadMain, &th[i]);
+	}
+	while (i-- > 0) {
+		pthread_join(h[i], NULL);
+	}
+}
+#endif
+
+void	Bench_Yield(void)
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+/* Bank lock, readers share it */
+#ifdef _WIN32
+static SRWLOCK	g_lock = SRWLOCK_INIT;
+
+void	CriLock(void)
+{
+	AcquireSRWLockExclusive(&g_lock);
+}
+void	CriUnlock(void)
+{
+	ReleaseSRWLockExclusive(&g_lock);
+}
+void	CriReadLock(void)
+{
+	AcquireSRWLockShared(&g_lock);
+}
+void	CriReadUnlock(void)
+{
+	ReleaseSRWLockShared(&g_lock);
+}
+#else
+static pthread_rwlock_t	g_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+void	CriLock(void)
+{
+	pthread_rwlock_wrlock(&g_lock);
+}
+void	CriUnlock(void)
+{
+	pthread_rwlock_unlock(&g_lock);
+}
+void	CriReadLock(void)
+{
+	pthread_rwlock_rdlock(&g_lock);
+}
+void	CriReadUnlock(void)
+{
+	pthread_rwlock_unlock(&g_lock);
+}
+#endif
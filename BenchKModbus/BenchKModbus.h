@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/* Benchmarks, by name on the command line, all when none is given */
+int		Bench_Bits(void);
+int		Bench_Cache(void);
+int		Bench_Client(void);
+int		Bench_Dispatch(void);
+int		Bench_Image(void);
+int		Bench_Lite(void);
+int		Bench_Repl(void);
+int		Bench_Ring(void);
+int		Bench_Rt(void);
+int		Bench_Sched(void);
+int		Bench_Tag(void);
+int		Bench_Tcp(void);
+int		Bench_TcpClient(void);
+int		Bench_Udp(void);
+int		Bench_Wire(void);
+
+/* Standby process of Bench_Repl, started as BenchKModbus --repl-standby port */
+int		Bench_ReplStandby(int port);
+
+/* Seconds of a monotonic clock */
+double			Bench_Now(void);
+/* Milliseconds, for KModbus_t.GetTick */
+KMODBUS_TICK	Bench_Tick(void);
+/* Seconds of processor time used by every thread of the process */
+double			Bench_Cpu(void);
+
+/* Run fn(0) .. fn(n - 1) on n threads and wait for all of them */
+void			Bench_Threads(int n, void (*fn)(int));
+/* Give the processor to another thread */
+void			Bench_Yield(void);
+
+/* Frames sent through PutsCom, the last one is kept */
+extern unsigned char	Bench_TxBuf[KMODBUS_MAX_TXBUF];
+extern int				Bench_TxLen;
+extern unsigned long	Bench_TxCount;
+
+/* Nanoseconds per operation of n operations since t0 */
+#define	BENCH_NS(t0, n)		((Bench_Now() - (t0)) * 1e9 / (double)(n))
+
+#ifdef __cplusplus
+	}
+#endif
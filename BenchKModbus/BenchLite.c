@@ -0,0 +1,94 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include "KModbusLite.h"
+#include "KModbusMaster.h"
+#include "BenchKModbus.h"
+
+/*
+	HANDLES emulated slaves on 247 unit IDs, FC03 of 10 registers to a
+	random endpoint each: full handles through KModbus_Execute, compact
+	handles through KModbusLite_Execute on one engine, and the compact
+	byte stream, Feed of the query then Tick after the silent interval,
+	with a slab of SLABS buffers. Every query must be answered.
+*/
+
+#define	HANDLES		(100000)
+#define	QUERIES		(4000000)
+#define	SLABS		(64)
+
+static KModbusLite_t	Lite[HANDLES];
+static unsigned char	SlabBuf[SLABS][KMODBUS_MAX_RXBUF];
+static unsigned short	SlabFree[SLABS];
+static unsigned char	Query[248][KMODBUS_MAX_TXBUF];
+static int				QueryLen[248];
+
+int		Bench_Lite(void)
+{
+	static KModbus_t	engine;
+	KModbusSlab_t		slab;
+	PKModbus_t			full;
+	int*				pick;
+	unsigned long		sent;
+	double				t0;
+	int					i, k, id, bad;
+
+	full = (PKModbus_t)malloc(sizeof(KModbus_t) * HANDLES);
+	pick = (int*)malloc(sizeof(int) * QUERIES);
+	if (full == 0 || pick == 0) {
+		free(full);
+		free(pick);
+		return 1;
+	}
+	KModbus_Init(&engine);
+	KModbusSlab_Init(&slab, SlabBuf, SlabFree, SLABS);
+	for (i = 0; i < HANDLES; i++) {
+		KModbus_InitHandle(&full[i]);
+		full[i].ID = (unsigned char)(1 + i % 247);
+		KModbusLite_Init(&Lite[i], (unsigned char)(1 + i % 247));
+	}
+	for (id = 1; id <= 247; id++) {
+		QueryLen[id] = KModbusMaster_BuildRead(Query[id], (unsigned char)id, 3, (id * 7) % 900, 10);
+	}
+	srand(3);
+	for (k = 0; k < QUERIES; k++) {
+		pick[k] = (int)(((unsigned long)rand() * ((unsigned long)RAND_MAX + 1) + (unsigned long)rand()) % HANDLES);
+	}
+
+	printf("%d handles  full %lu B each, %.1f MB  compact %lu B each, %.1f MB + slab %.1f KB\n", HANDLES,
+		(unsigned long)sizeof(KModbus_t), (double)sizeof(KModbus_t) * HANDLES / 1e6,
+		(unsigned long)sizeof(KModbusLite_t), (double)sizeof(KModbusLite_t) * HANDLES / 1e6,
+		(double)sizeof(SlabBuf) / 1024.0);
+
+	sent = Bench_TxCount;
+	t0 = Bench_Now();
+	for (k = 0; k < QUERIES; k++) {
+		id = 1 + pick[k] % 247;
+		KModbus_Execute(&full[pick[k]], Query[id], QueryLen[id]);
+	}
+	printf("KModbus_Execute      %5.2f Mframes/s\n", QUERIES / (Bench_Now() - t0) / 1e6);
+	bad = (Bench_TxCount - sent != QUERIES);
+
+	sent = Bench_TxCount;
+	t0 = Bench_Now();
+	for (k = 0; k < QUERIES; k++) {
+		id = 1 + pick[k] % 247;
+		KModbusLite_Execute(&engine, &Lite[pick[k]], Query[id], QueryLen[id]);
+	}
+	printf("KModbusLite_Execute  %5.2f Mframes/s\n", QUERIES / (Bench_Now() - t0) / 1e6);
+	bad += (Bench_TxCount - sent != QUERIES);
+
+	sent = Bench_TxCount;
+	t0 = Bench_Now();
+	for (k = 0; k < QUERIES / 4; k++) {
+		id = 1 + pick[k] % 247;
+		KModbusLite_Feed(&engine, &slab, &Lite[pick[k]], Query[id], QueryLen[id], 100);
+		KModbusLite_Tick(&engine, &slab, &Lite[pick[k]], 100 + engine.NoCommunicationTime + 1);
+	}
+	printf("Feed + Tick          %5.2f Mframes/s  slab peak %d, exhausted %lu\n",
+		QUERIES / 4 / (Bench_Now() - t0) / 1e6, slab.Peak, slab.Exhausted);
+	bad += (Bench_TxCount - sent != QUERIES / 4 || slab.Top != SLABS);
+
+	free(full);
+	free(pick);
+	return bad != 0;
+}
@@ -0,0 +1,215 @@
+﻿#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L		/* fork and waitpid */
+#endif
+#include "KModbusRepl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+#include "BenchKModbus.h"
+
+/*
+	Hot-standby replication between two processes over loopback. The
+	bench starts the standby as a second process of this program, then
+	writes WRITES registers anywhere in the bank and a few coils every
+	millisecond for SECONDS, with its tick in 40001/40002 for the standby
+	to time the lag by. Once the writes stop a checksum round has to find
+	the banks equal. Run unthrottled, then with RATE bytes per second.
+*/
+
+#define	PORT		(15030)
+#define	SECONDS		(3.0)
+#define	WRITES		(200)
+#define	SPREAD		(KMODBUS_X4_SIZE - 4)
+#define	RATE		(200000)
+
+static unsigned char	Bank[KMODBUS_X4_SIZE * 2 + KMODBUS_X3_SIZE * 2 + KMODBUS_X0_SIZE];
+
+/* FNV-1a of the coils and both register banks */
+static unsigned long	BankSum(void)
+{
+	unsigned long	h = 2166136261UL;
+	int				i, n;
+
+	n = 0;
+	KModbus_Read(0, 0, &Bank[n], KMODBUS_X0_SIZE);
+	n += (KMODBUS_X0_SIZE + 7) / 8;
+	KModbus_Read(3, 0, &Bank[n], KMODBUS_X3_SIZE);
+	n += KMODBUS_X3_SIZE * 2;
+	KModbus_Read(4, 0, &Bank[n], KMODBUS_X4_SIZE);
+	n += KMODBUS_X4_SIZE * 2;
+	for (i = 0; i < n; i++) {
+		h = ((h ^ Bank[i]) * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return h;
+}
+
+/* Second process: apply until the primary closes, 0 when every page and checksum was taken */
+int		Bench_ReplStandby(int port)
+{
+	static KModbusRepl_t	r;
+	static KModbus_t		hd;
+	unsigned long			stamp, last, lag, lagmax;
+	double					t0, lagsum;
+	long					n;
+
+	KModbus_Init(&hd);
+	if (KModbusRepl_Standby(&r, (unsigned short)port) != KMODBUS_OK) {
+		printf("standby: port %d unavailable\n", port);
+		return 1;
+	}
+	r.GetTick = Bench_Tick;
+	last = 0;
+	lagsum = 0;
+	lagmax = 0;
+	n = 0;
+	t0 = Bench_Now();
+	while (Bench_Now() - t0 < SECONDS + 30.0 && !(r.Connects > 0 && r.Socket == KMODBUS_INVALID_SOCKET)) {
+		KModbusRepl_Poll(&r, 5);
+		KModbus_Commit();
+		stamp = ((unsigned long)KModbus_Get(40001) << 16) | KModbus_Get(40002);
+		lag = ((unsigned long)Bench_Tick() - stamp) & 0xFFFFFFFFUL;
+		if (stamp != last && lag < 60000) {		/* Not the initial values */
+			last = stamp;
+			lagsum += (double)lag;
+			lagmax = (lag > lagmax) ? lag : lagmax;
+			n++;
+		}
+	}
+	printf("  standby  records %lu, checksums %lu, mismatches %lu, lag mean %.1f max %lu ms, banks %08lX\n",
+		r.Records, r.Sums, r.Mismatches, n ? lagsum / (double)n : 0.0, lagmax, BankSum());
+	fflush(stdout);
+	KModbusRepl_Close(&r);
+	return (r.Records == 0 || r.Mismatches != 0);
+}
+
+#ifdef _WIN32
+typedef PROCESS_INFORMATION	Child_t;
+
+static int	Spawn(Child_t* child, int port)
+{
+	STARTUPINFOA	si;
+	char			exe[MAX_PATH], cmd[MAX_PATH + 32];
+
+	GetModuleFileNameA(NULL, exe, sizeof(exe));
+	sprintf(cmd, "\"%s\" --repl-standby %d", exe, port);
+	memset(&si, 0x00, sizeof(si));
+	si.cb = sizeof(si);
+	return CreateProcessA(exe, cmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, child) ? 0 : -1;
+}
+
+static int	Wait(Child_t* child)
+{
+	DWORD	code = 1;
+
+	WaitForSingleObject(child->hProcess, INFINITE);
+	GetExitCodeProcess(child->hProcess, &code);
+	CloseHandle(child->hProcess);
+	CloseHandle(child->hThread);
+	return (int)code;
+}
+#else
+typedef pid_t	Child_t;
+
+static int	Spawn(Child_t* child, int port)
+{
+	fflush(stdout);
+	*child = fork();
+	if (*child == 0) {
+		_exit(Bench_ReplStandby(port));
+	}
+	return (*child < 0) ? -1 : 0;
+}
+
+static int	Wait(Child_t* child)
+{
+	int		status;
+
+	if (waitpid(*child, &status, 0) != *child || !WIFEXITED(status)) {
+		return 1;
+	}
+	return WEXITSTATUS(status);
+}
+#endif
+
+static int	Run(int port, unsigned long rate)
+{
+	static KModbusRepl_t	r;
+	Child_t					child;
+	unsigned long			writes;
+	double					t0, next, secs;
+	KMODBUS_TICK			now;
+	int						i, bad;
+
+	for (i = 0; i < KMODBUS_X4_SIZE; i++) {
+		KModbus_Set(40001 + i, (unsigned short)(i * 31));
+	}
+	KModbus_Commit();
+	if (Spawn(&child, port) != 0) {
+		printf("cannot start the standby\n");
+		return 1;
+	}
+	KModbusRepl_Primary(&r, "127.0.0.1", (unsigned short)port, 10, rate);
+	r.GetTick = Bench_Tick;
+	r.SumPeriod = 500;
+	t0 = Bench_Now();
+	while (r.Connects == 0 && Bench_Now() - t0 < 10.0) {
+		KModbusRepl_Poll(&r, 10);
+	}
+
+	srand(7);
+	writes = 0;
+	t0 = Bench_Now();
+	next = t0;
+	while (r.Connects != 0 && Bench_Now() - t0 < SECONDS) {
+		if (Bench_Now() >= next) {
+			for (i = 0; i < WRITES; i++) {
+				KModbus_Set(40003 + rand() % SPREAD, (unsigned short)rand());
+				if ((i & 7) == 0) {
+					KModbus_BitToggle(1 + rand() % KMODBUS_X0_SIZE);
+				}
+			}
+			now = Bench_Tick();
+			KModbus_Set(40001, (unsigned short)((unsigned long)now >> 16));
+			KModbus_Set(40002, (unsigned short)now);
+			KModbus_Commit();
+			writes += WRITES;
+			next += 0.001;
+		}
+		KModbusRepl_Poll(&r, 1);
+	}
+	secs = Bench_Now() - t0;
+
+	/* The last batches, then a checksum round */
+	t0 = Bench_Now();
+	while (Bench_Now() - t0 < 0.5) {
+		KModbusRepl_Poll(&r, 5);
+	}
+	r.NextSum = Bench_Tick();
+	t0 = Bench_Now();
+	while (Bench_Now() - t0 < 0.5) {
+		KModbusRepl_Poll(&r, 5);
+	}
+	printf("  primary  %lu writes, %lu batches, %lu records, %.1f KB/s, throttled %lu, banks resent %lu, lag max %lu ms, banks %08lX\n",
+		writes, r.Batches, r.Records, (double)r.Bytes / secs / 1024.0, r.Throttled, r.Mismatches,
+		(unsigned long)r.LagMax, BankSum());
+	fflush(stdout);
+	bad = (r.Connects == 0 || r.Mismatches != 0);
+	KModbusRepl_Close(&r);
+	return Wait(&child) != 0 || bad;
+}
+
+int		Bench_Repl(void)
+{
+	static KModbus_t	hd;
+	int					bad;
+
+	KModbus_Init(&hd);
+	printf("no rate limit\n");
+	bad = Run(PORT, 0);
+	printf("%d bytes/s\n", RATE);
+	bad += Run(PORT + 1, RATE);
+	return bad != 0;
+}
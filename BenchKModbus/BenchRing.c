@@ -0,0 +1,90 @@
+﻿#include <stdio.h>
+#include "KModbusRing.h"
+#include "BenchKModbus.h"
+
+/*
+	KModbusRing throughput: a producer thread writes a counting byte
+	pattern in 97-byte bursts and writes again what did not fit (counted
+	as refused in Overruns), the consumer alternates KModbusRing_Read and
+	KModbusRing_Get and checks every byte. Both yield when they cannot go
+	on. Reported in MB/s and as
+	the line rate in Mbaud (10 bits per byte) that the ring keeps up with.
+*/
+
+#define	BYTES		(20000000L)
+
+static KModbusRing_t	Ring;
+static long				Bad;
+
+static void	Producer(void)
+{
+	unsigned char	b[97];
+	long			sent;
+	int				i, n, w;
+
+	for (sent = 0; sent < BYTES; sent += n) {
+		n = (BYTES - sent < (long)sizeof(b)) ? (int)(BYTES - sent) : (int)sizeof(b);
+		for (i = 0; i < n; i++) {
+			b[i] = (unsigned char)(sent + i);
+		}
+		for (w = 0; w < n; ) {
+			i = KModbusRing_Write(&Ring, &b[w], n - w);
+			if (i == 0) {
+				Bench_Yield();		/* Full, the consumer has to run */
+			}
+			w += i;
+		}
+	}
+}
+
+static void	Consumer(void)
+{
+	unsigned char	buf[64], c;
+	long			got;
+	int				i, n;
+
+	for (got = 0; got < BYTES; ) {
+		if (got & 1) {
+			if (KModbusRing_Get(&Ring, &c) == KMODBUS_OK) {
+				Bad += (c != (unsigned char)got);
+				got++;
+			}
+			else {
+				Bench_Yield();
+			}
+			continue;
+		}
+		n = KModbusRing_Read(&Ring, buf, sizeof(buf));
+		for (i = 0; i < n; i++) {
+			Bad += (buf[i] != (unsigned char)(got + i));
+		}
+		got += n;
+		if (n == 0) {
+			Bench_Yield();
+		}
+	}
+}
+
+static void	Side(int no)
+{
+	if (no == 0) {
+		Producer();
+	}
+	else {
+		Consumer();
+	}
+}
+
+int		Bench_Ring(void)
+{
+	double	t0, s;
+
+	KModbusRing_Init(&Ring);
+	Bad = 0;
+	t0 = Bench_Now();
+	Bench_Threads(2, Side);
+	s = Bench_Now() - t0;
+	printf("%ld bytes  %.1f MB/s  (~%.0f Mbaud)  refused %lu  bad %ld\n",
+		BYTES, BYTES / s / 1e6, BYTES * 10 / s / 1e6, Ring.Overruns, Bad);
+	return (Bad != 0);
+}
@@ -0,0 +1,123 @@
+﻿#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L		/* clock_nanosleep */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KModbusRt.h"
+#include "KModbusMaster.h"
+#include "BenchKModbus.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+/*
+	Turnaround of a periodic query: every PERIOD_US an FC03 read of 10
+	registers is due, the thread sleeps until then and executes it. A
+	sample is the time from the due time to the end of the response, so
+	wake-up latency counts as it does for a real request. Runs once on a
+	plain thread and once after KModbusRt_Enter and the prefaults; what
+	Enter could set depends on the privileges of the process.
+*/
+
+#define	SAMPLES		(20000)
+#define	PERIOD_US	(200)
+
+static KModbus_t		Hd;
+static unsigned long	Samples[SAMPLES];
+static int				Result;
+
+static unsigned long long	NowNs(void)
+{
+	return (unsigned long long)(Bench_Now() * 1e9);
+}
+
+#ifdef _WIN32
+/* Sleep most of the way, spin the last millisecond */
+static void	SleepUntil(unsigned long long due)
+{
+	unsigned long long	now;
+
+	now = NowNs();
+	if (due > now + 2000000ULL) {
+		Sleep((DWORD)((due - now) / 1000000ULL) - 1);
+	}
+	while (NowNs() < due) {
+		YieldProcessor();
+	}
+}
+#else
+static void	SleepUntil(unsigned long long due)
+{
+	struct timespec	ts;
+
+	ts.tv_sec = (time_t)(due / 1000000000ULL);
+	ts.tv_nsec = (long)(due % 1000000000ULL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+#endif
+
+static int	CompareSample(const void* a, const void* b)
+{
+	unsigned long	x = *(const unsigned long*)a;
+	unsigned long	y = *(const unsigned long*)b;
+
+	return (x > y) - (x < y);
+}
+
+static int	Measure(const char* name)
+{
+	unsigned char		q[KMODBUS_MAX_TXBUF];
+	unsigned long long	due, done;
+	unsigned long		count;
+	int					i, len;
+
+	len = KModbusMaster_BuildRead(q, 1, 0x03, 0, 10);
+	count = Bench_TxCount;
+	due = NowNs() + PERIOD_US * 1000ULL;
+	for (i = 0; i < SAMPLES; i++) {
+		SleepUntil(due);
+		KModbus_Execute(&Hd, q, len);
+		done = NowNs();
+		Samples[i] = (done > due) ? (unsigned long)(done - due) : 0;
+		due += PERIOD_US * 1000ULL;
+		if (done > due) {
+			due = done;		/* Overran the period, restart the schedule */
+		}
+	}
+	qsort(Samples, SAMPLES, sizeof(Samples[0]), CompareSample);
+	printf("%-28s min %6lu  p50 %6lu  p99 %7lu  p99.99 %8lu  max %8lu ns\n", name, Samples[0],
+		Samples[SAMPLES / 2], Samples[(int)(SAMPLES * 0.99)], Samples[(int)(SAMPLES * 0.9999)], Samples[SAMPLES - 1]);
+	return Bench_TxCount - count != SAMPLES;
+}
+
+static void	Run(int no)
+{
+	KModbusRtConfig_t	cfg;
+	char				name[64];
+	int					done;
+
+	KModbusRt_DefaultConfig(&cfg);
+	cfg.Cpu = 0;
+	cfg.Priority = 80;
+	cfg.LockMemory = 1;
+	done = KModbusRt_Enter(&cfg);
+	KModbusRt_PrefaultHandle(&Hd);
+	KModbusRt_Prefault(Samples, sizeof(Samples));
+	sprintf(name, "rt (%s%s%s)", (done & KMODBUS_RT_AFFINITY) ? "cpu " : "",
+		(done & KMODBUS_RT_PRIORITY) ? "fifo " : "", (done & KMODBUS_RT_LOCKED) ? "locked" : "");
+	Result += Measure(name);
+}
+
+int		Bench_Rt(void)
+{
+	KModbus_Init(&Hd);
+	Result = Measure("plain thread");
+	Bench_Threads(1, Run);
+	return Result;
+}
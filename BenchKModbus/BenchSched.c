@@ -0,0 +1,204 @@
+﻿#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L		/* pthread_rwlock_t of KModbusLock.h */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KModbusSched.h"
+#include "BenchKModbus.h"
+
+/*
+	Transaction scheduler on a simulated 19200 8E1 line with a slave that
+	answers after 1 ms, in virtual time (one tick is a microsecond). Two
+	polls every 100 ms, an urgent write every 200-300 ms and a background
+	scan of 300 reads that restarts when it is done, for SECONDS:
+	everything in one FIFO class, then each in its own class. Then both
+	normal and background kept saturated, to show the 4:1 weights. The
+	client handle runs its FuncTable through the queue.
+*/
+
+#define	SECONDS		(60)
+#define	URGENT_MAX	(1000)
+#define	CHAR_US		(11.0 * 1e6 / 19200.0)
+
+static KModbus_t		Slave, Master;
+static KModbusSched_t	Sched;
+static unsigned char	Rsp[KMODBUS_MAX_TXBUF];
+static int				RspLen, RspPos;
+static double			Now;
+static unsigned short	Junk[KMODBUS_MAX_READ_REGS];
+
+static int				Done[KMODBUS_SCHED_CLASSES];
+static double			Arrived[URGENT_MAX], Latency[URGENT_MAX];
+static int				Urgent;
+
+static KMODBUS_STATUS	SlavePuts(unsigned char* buf, int len)
+{
+	memcpy(Rsp, buf, len);
+	RspLen = len;
+	RspPos = 0;
+	return KMODBUS_OK;
+}
+
+static KMODBUS_STATUS	LineGet(unsigned char* c)
+{
+	if (RspPos < RspLen) {
+		*c = Rsp[RspPos++];
+		return KMODBUS_OK;
+	}
+	return KMODBUS_NODATA;
+}
+
+/* The request and the response take the line, plus two gaps of 3.5 characters and the turnaround */
+static KMODBUS_STATUS	LinePuts(unsigned char* buf, int len)
+{
+	RspLen = 0;
+	KModbus_Execute(&Slave, buf, len);
+	Now += (len + RspLen + 7) * CHAR_US + 1000.0;
+	return KMODBUS_OK;
+}
+
+static KMODBUS_TICK	LineTick(void)
+{
+	return (KMODBUS_TICK)Now;
+}
+
+static void	Complete(void* context, KMODBUS_STATUS status, unsigned short* buf)
+{
+	long	k = (long)context;
+
+	if (k >= KMODBUS_SCHED_CLASSES) {
+		Latency[k - KMODBUS_SCHED_CLASSES] = Now - Arrived[k - KMODBUS_SCHED_CLASSES];
+		Done[KMODBUS_SCHED_URGENT]++;
+	}
+	else {
+		Done[k]++;
+	}
+}
+
+static int	CompareDouble(const void* a, const void* b)
+{
+	double	x = *(const double*)a;
+	double	y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Submit stamped with an arrival time that fell inside the last transaction */
+static void	SubmitAt(double at, int cls, const unsigned char* f, int n, long context)
+{
+	double	save = Now;
+
+	Now = at;
+	KModbusSched_Submit(&Sched, cls, f, n, Junk, 0, Complete, (void*)context);
+	Now = save;
+}
+
+static void	Run(int fifo, int saturate)
+{
+	unsigned char	f[KMODBUS_MAX_TXBUF];
+	double			poll, urgent;
+	int				i, n, scan;
+
+	Now = 0;
+	KModbusSched_Init(&Sched, &Master);
+	Sched.Budget[KMODBUS_SCHED_URGENT] = 50000;
+	Sched.Budget[KMODBUS_SCHED_NORMAL] = 1000000;
+	Sched.Budget[KMODBUS_SCHED_BACKGROUND] = 10000000;
+	memset(Done, 0x00, sizeof(Done));
+	Urgent = 0;
+	poll = 0;
+	urgent = 50000;
+	scan = 0;
+	srand(1);
+	while (Now < SECONDS * 1e6) {
+		if (saturate) {
+			n = KModbusMaster_BuildRead(f, 1, 3, 0, 10);
+			while (Sched.Stats[KMODBUS_SCHED_NORMAL].Queued < 8) {
+				KModbusSched_Submit(&Sched, KMODBUS_SCHED_NORMAL, f, n, Junk, 0, Complete, (void*)KMODBUS_SCHED_NORMAL);
+			}
+			n = KModbusMaster_BuildRead(f, 1, 4, 0, 16);
+			while (Sched.Stats[KMODBUS_SCHED_BACKGROUND].Queued < 8) {
+				KModbusSched_Submit(&Sched, KMODBUS_SCHED_BACKGROUND, f, n, Junk, 0, Complete, (void*)KMODBUS_SCHED_BACKGROUND);
+			}
+		}
+		else {
+			while (Now >= urgent && Urgent < URGENT_MAX) {
+				n = KModbusMaster_BuildWriteSingle(f, 1, 6, 100, (unsigned short)Urgent);
+				Arrived[Urgent] = urgent;
+				SubmitAt(urgent, fifo ? KMODBUS_SCHED_BACKGROUND : KMODBUS_SCHED_URGENT, f, n, KMODBUS_SCHED_CLASSES + Urgent);
+				Urgent++;
+				urgent += 200000 + rand() % 100000;
+			}
+			while (Now >= poll) {
+				for (i = 0; i < 2; i++) {
+					n = KModbusMaster_BuildRead(f, 1, 3, i * 10, 10);
+					SubmitAt(poll, fifo ? KMODBUS_SCHED_BACKGROUND : KMODBUS_SCHED_NORMAL, f, n, KMODBUS_SCHED_NORMAL);
+				}
+				poll += 100000;
+			}
+			/* Background scan, queued while there is room */
+			while (Sched.Stats[KMODBUS_SCHED_BACKGROUND].Queued < 32) {
+				n = KModbusMaster_BuildRead(f, 1, 4, (scan++ % 300) * 16, 16);
+				KModbusSched_Submit(&Sched, KMODBUS_SCHED_BACKGROUND, f, n, Junk, 0, Complete, (void*)KMODBUS_SCHED_BACKGROUND);
+			}
+		}
+		if (KModbusSched_Step(&Sched) == KMODBUS_NODATA) {
+			Now += 1000;
+		}
+	}
+}
+
+static void	Report(const char* name)
+{
+	int		n;
+
+	n = Done[KMODBUS_SCHED_URGENT];
+	if (n == 0) {
+		return;
+	}
+	qsort(Latency, n, sizeof(Latency[0]), CompareDouble);
+	printf("%-10s urgent write submit to done  p50 %7.1f  p99 %7.1f  max %7.1f ms  (%d)\n", name,
+		Latency[n / 2] / 1000.0, Latency[n * 99 / 100] / 1000.0, Latency[n - 1] / 1000.0, n);
+}
+
+int		Bench_Sched(void)
+{
+	static KModbusSchedClient_t	client;
+	unsigned short				r[3];
+	KMODBUS_EVENTCOUNTER		ec;
+	PKModbus_t					hd;
+	int							bad;
+
+	KModbus_Init(&Slave);
+	Slave.Interface.Puts = SlavePuts;
+	KModbusMaster_Init(&Master);
+	Master.ID = 1;
+	Master.Interface.Get = LineGet;
+	Master.Interface.Puts = LinePuts;
+	Master.GetTick = LineTick;
+	Master.ResponseTimeout = 100000;
+
+	Run(1, 0);
+	Report("FIFO");
+	Run(0, 0);
+	Report("scheduled");
+	printf("           polls waited p99 <= %lu ms, the scan got %d reads\n",
+		(unsigned long)KModbusSched_Percentile(&Sched, KMODBUS_SCHED_NORMAL, 99.0) / 1000, Done[KMODBUS_SCHED_BACKGROUND]);
+	bad = (Done[KMODBUS_SCHED_URGENT] == 0 || Sched.Stats[KMODBUS_SCHED_URGENT].Late != 0);
+	Run(0, 1);
+	printf("saturated  normal %d, background %d transactions (%.2f:1, weights %d:%d)\n",
+		Done[KMODBUS_SCHED_NORMAL], Done[KMODBUS_SCHED_BACKGROUND],
+		(double)Done[KMODBUS_SCHED_NORMAL] / (double)Done[KMODBUS_SCHED_BACKGROUND],
+		Sched.Weight[KMODBUS_SCHED_NORMAL], Sched.Weight[KMODBUS_SCHED_BACKGROUND]);
+
+	/* The master wrappers through a client handle */
+	KModbusSched_Init(&Sched, &Master);
+	KModbusSched_Client(&Sched, &client, KMODBUS_SCHED_URGENT, 1);
+	hd = &client.Handle;
+	bad += (hd->FuncTable.PresetSingleRegister(hd, 5, 0x1234) != KMODBUS_OK);
+	bad += (hd->FuncTable.ReadHoldingRegister(hd, 4, 3, r) != KMODBUS_OK || r[1] != 0x1234);
+	bad += (hd->FuncTable.FetchCommunicationEventCounter(hd, &ec) != KMODBUS_OK);
+	bad += (Sched.Stats[KMODBUS_SCHED_URGENT].Completed != 3);
+	return bad != 0;
+}
@@ -0,0 +1,102 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KModbusTag.h"
+#include "BenchKModbus.h"
+
+/*
+	Tag map of TAGS generated tags over both register banks and the coils:
+	the parse, a lookup by name, Get/Set on a resolved tag, and the plain
+	KModbus_Get of the same register numbers as the floor. The lookups go
+	in a random order over all tags.
+*/
+
+#define	TAGS		(100000)
+#define	ROUNDS		(1000000)
+#define	NAME		(40)
+
+static char				Names[TAGS][NAME];
+static PKModbusTag_t	Resolved[TAGS];
+static int				Order[ROUNDS];
+
+int		Bench_Tag(void)
+{
+	static const char*	type[] = { "uint16", "int16", "int32", "float32", "float64", "bool" };
+	static KModbus_t	hd;
+	KModbusTagMap_t		map;
+	PKModbusTag_t		tag;
+	char*				text;
+	double				t0, v;
+	volatile double		sink;
+	long				len;
+	int					i, bad;
+
+	KModbus_Init(&hd);
+	text = (char*)malloc((size_t)TAGS * 96);
+	if (text == 0) {
+		return 1;
+	}
+	len = sprintf(text, "name,table,address,type,order,scale\n");
+	for (i = 0; i < TAGS; i++) {
+		sprintf(Names[i], "plant.area%02d.unit%03d.tag%05d", i % 40, i % 997, i);
+		if (i % 6 == 5) {
+			len += sprintf(&text[len], "%s,coil,%d,bool\n", Names[i], i % KMODBUS_X0_SIZE);
+		}
+		else {
+			len += sprintf(&text[len], "%s,%s,%d,%s,%s,%s\n", Names[i], (i & 1) ? "hreg" : "ireg",
+				i % ((i & 1) ? KMODBUS_X4_SIZE - 4 : KMODBUS_X3_SIZE - 4), type[i % 6],
+				(i % 3) ? "ABCD" : "CDAB", (i % 7) ? "1" : "0.01");
+		}
+	}
+	t0 = Bench_Now();
+	if (KModbusTag_Parse(&map, text, len) != KMODBUS_OK) {
+		printf("parse failed at line %d\n", map.Line);
+		free(text);
+		return 1;
+	}
+	printf("parse %d tags  %.1f ms  %lu index slots\n", map.Count, (Bench_Now() - t0) * 1e3, map.Mask + 1);
+	free(text);
+
+	bad = 0;
+	for (i = 0; i < TAGS; i++) {
+		Resolved[i] = KModbusTag_Find(&map, Names[i]);
+		bad += (Resolved[i] == 0);
+	}
+	srand(3);
+	for (i = 0; i < ROUNDS; i++) {
+		Order[i] = rand() % TAGS;
+	}
+
+	sink = 0;
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		tag = KModbusTag_Find(&map, Names[Order[i]]);
+		sink += tag->Adrs;
+	}
+	printf("Find          %6.1f ns\n", BENCH_NS(t0, ROUNDS));
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		KModbusTag_Read(&map, Names[Order[i]], &v);
+		sink += v;
+	}
+	printf("Read by name  %6.1f ns\n", BENCH_NS(t0, ROUNDS));
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		KModbusTag_Get(Resolved[Order[i]], &v);
+		sink += v;
+	}
+	printf("Get           %6.1f ns\n", BENCH_NS(t0, ROUNDS));
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		bad += (KModbusTag_Set(Resolved[Order[i]], i & 1) != KMODBUS_OK);
+	}
+	printf("Set           %6.1f ns\n", BENCH_NS(t0, ROUNDS));
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		sink += KModbus_Get(40001 + Resolved[Order[i]]->Adrs % KMODBUS_X4_SIZE);
+	}
+	printf("KModbus_Get   %6.1f ns\n", BENCH_NS(t0, ROUNDS));
+	KModbus_Commit();
+	KModbusTag_Free(&map);
+	return bad != 0;
+}
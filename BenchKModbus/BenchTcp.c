@@ -0,0 +1,103 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusTcp.h"
+#include "KModbusAtomic.h"
+#include "BenchKModbus.h"
+
+/*
+	Sharded Modbus TCP server: 1, 2 and 4 workers on one port, 8 loopback
+	clients each sending FC03 reads of 100 registers back to back. Reports
+	requests per second and how the connections spread over the workers.
+*/
+
+#define	PORT		(15020)
+#define	WORKERS		(4)
+#define	CLIENTS		(8)
+#define	ROUNDS		(2000)
+
+static KModbus_t		Hd[WORKERS];
+static KModbusTcp_t		Tw[WORKERS];
+static int				Workers;
+static int				Quit;
+static KMODBUS_ATOMIC	Done;
+static KMODBUS_ATOMIC	Answered;
+
+static void	Client(void)
+{
+	unsigned char		q[12] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x64 };
+	unsigned char		r[300];
+	struct sockaddr_in	sa;
+	KMODBUS_SOCKET		s;
+	int					i, got, n;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(PORT);
+	if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) == 0) {
+		for (i = 0; i < ROUNDS; i++) {
+			send(s, (const char*)q, sizeof(q), 0);
+			for (got = 0; got < 209; got += n) {
+				n = recv(s, (char*)&r[got], sizeof(r) - got, 0);
+				if (n <= 0) {
+					break;
+				}
+			}
+			if (got != 209 || r[7] != 0x03 || r[8] != 200) {
+				break;
+			}
+			KMODBUS_ATOMIC_FETCH_ADD(&Answered, 1);
+		}
+	}
+	KMODBUS_CLOSESOCKET(s);
+	if (KMODBUS_ATOMIC_FETCH_ADD(&Done, 1) == CLIENTS - 1) {
+		Quit = 1;
+	}
+}
+
+static void	Run(int no)
+{
+	if (no < Workers) {
+		KModbusTcpServer(&Tw[no], &Quit);
+	}
+	else {
+		Client();
+	}
+}
+
+int		Bench_Tcp(void)
+{
+	double	t0, s;
+	int		i, bad;
+
+	KModbus_InitBanks();
+	bad = 0;
+	for (Workers = 1; Workers <= WORKERS; Workers *= 2) {
+		for (i = 0; i < Workers; i++) {
+			KModbus_InitHandle(&Hd[i]);
+		}
+		if (KModbusTcp_OpenShards(Tw, Hd, Workers, PORT) != KMODBUS_OK) {
+			printf("%d workers: cannot listen on %d\n", Workers, PORT);
+			return 1;
+		}
+		Quit = 0;
+		Done = 0;
+		Answered = 0;
+		t0 = Bench_Now();
+		Bench_Threads(Workers + CLIENTS, Run);
+		s = Bench_Now() - t0;
+
+		printf("%d workers%s  %8.0f req/s  connections:", Workers, Tw[0].ReusePort ? " (SO_REUSEPORT)" : "",
+			(double)Answered / s);
+		for (i = 0; i < Workers; i++) {
+			printf(" %lu", Tw[i].Accepted);
+		}
+		printf("\n");
+		bad += (Answered != CLIENTS * ROUNDS);
+		for (i = 0; i < Workers; i++) {
+			KModbusTcp_Close(&Tw[i]);
+		}
+	}
+	return bad;
+}
@@ -0,0 +1,240 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusTcpClient.h"
+#include "KModbusMaster.h"
+#include "KModbusMbap.h"
+#include "BenchKModbus.h"
+
+/*
+	Pipelined Modbus TCP master against a loopback device that answers
+	each request RTT ms after it arrived. FC03 reads of 10 registers with
+	windows of 1 to 32 outstanding requests, then one write in four while
+	the device drops the connection every DROP answers: every read must
+	complete, and only writes that went out may fail.
+*/
+
+#define	PORT		(15021)
+#define	RTT			(20)
+#define	SECONDS		(1.0)
+#define	DROP		(37)
+#define	REQUESTS	(2000)
+#define	PENDING		(256)
+
+#ifdef	MSG_NOSIGNAL
+#define	SEND_FLAGS	MSG_NOSIGNAL
+#else
+#define	SEND_FLAGS	0
+#endif
+
+typedef struct Pending_t {
+	KMODBUS_TICK	Due;
+	int				Len;
+	unsigned char	Adu[KMODBUS_TCP_MAX_ADU];
+
+} Pending_t;
+
+static KModbus_t		Hd;
+static KMODBUS_SOCKET	Listen;
+static volatile int		Quit;
+static volatile int		Drop;
+static int				Result;
+
+static unsigned short	Buf[125];
+static unsigned long	ReadsOk, WritesOk, WritesFailed, Bad;
+
+/* Answers in arrival order once RTT has passed, hangs up after Drop answers */
+static void	Device(void)
+{
+	static Pending_t	q[PENDING];
+	unsigned char		rx[KMODBUS_TCP_MAX_ADU * 4];
+	KMODBUS_SOCKET		s;
+	int					head, tail, rxlen, len, n, ofs, answered;
+
+	KModbusMbap_Attach(&Hd);
+	while (!Quit) {
+		if (KModbusSocket_WaitRead(Listen, 10) <= 0) {
+			continue;
+		}
+		s = accept(Listen, NULL, NULL);
+		if (s == KMODBUS_INVALID_SOCKET) {
+			continue;
+		}
+		head = 0;
+		tail = 0;
+		rxlen = 0;
+		answered = 0;
+		while (!Quit && (Drop == 0 || answered < Drop)) {
+			while (head != tail && (long)(Bench_Tick() - q[head].Due) >= 0 && (Drop == 0 || answered < Drop)) {
+				send(s, (const char*)q[head].Adu, q[head].Len, SEND_FLAGS);
+				head = (head + 1) % PENDING;
+				answered++;
+			}
+			if (KModbusSocket_WaitRead(s, 1) <= 0) {
+				continue;
+			}
+			n = recv(s, (char*)&rx[rxlen], sizeof(rx) - rxlen, 0);
+			if (n <= 0) {
+				break;
+			}
+			rxlen += n;
+			for (ofs = 0; rxlen - ofs >= KMODBUS_MBAP_HEADER; ofs += len) {
+				len = KModbud_B2N(&rx[ofs + 4]) + KMODBUS_MBAP_HEADER;
+				if (rxlen - ofs < len) {
+					break;
+				}
+				q[tail].Len = KModbusMbap_Execute(&Hd, &rx[ofs], len, q[tail].Adu, sizeof(q[tail].Adu));
+				if (q[tail].Len > 0) {
+					q[tail].Due = Bench_Tick() + RTT;
+					tail = (tail + 1) % PENDING;
+				}
+			}
+			memmove(rx, &rx[ofs], rxlen - ofs);
+			rxlen -= ofs;
+		}
+		KMODBUS_CLOSESOCKET(s);
+	}
+}
+
+static void	ReadDone(void* context, KMODBUS_STATUS status)
+{
+	int		i;
+
+	for (i = 0; i < 10 && status == KMODBUS_OK; i++) {
+		if (Buf[i] != (unsigned short)(0x0100 + i)) {
+			status = KMODBUS_INVALID_PARAM;
+		}
+	}
+	if (status == KMODBUS_OK) {
+		ReadsOk++;
+	}
+	else {
+		Bad++;
+	}
+}
+
+static void	WriteDone(void* context, KMODBUS_STATUS status)
+{
+	if (status == KMODBUS_OK) {
+		WritesOk++;
+	}
+	else if (status == KMODBUS_NOT_RESPONSE) {
+		WritesFailed++;
+	}
+	else {
+		Bad++;
+	}
+}
+
+static int	Windows(void)
+{
+	static const int	window[] = { 1, 4, 8, 16, 32 };
+	KModbusTcpClient_t	c;
+	PKModbusTcpLink_t	l;
+	unsigned char		f[KMODBUS_MAX_TXBUF];
+	double				t0, s;
+	int					i, n, bad;
+
+	bad = 0;
+	n = KModbusMaster_BuildRead(f, 1, 0x03, 0, 10);
+	for (i = 0; i < (int)(sizeof(window) / sizeof(window[0])); i++) {
+		KModbusTcpClient_Init(&c, Bench_Tick, 1000);
+		l = KModbusTcpClient_Link(&c, "127.0.0.1", PORT, window[i]);
+		ReadsOk = 0;
+		Bad = 0;
+		t0 = Bench_Now();
+		while (Bench_Now() - t0 < SECONDS) {
+			while (KModbusTcpClient_Submit(l, f, n, Buf, ReadDone, NULL) == KMODBUS_OK) {
+			}
+			KModbusTcpClient_Poll(&c, 5);
+		}
+		s = Bench_Now() - t0;
+		printf("window %2d  %8.1f req/s  %5.1f per RTT  bad %lu\n", window[i], (double)ReadsOk / s,
+			(double)ReadsOk / s * RTT / 1000.0, Bad);
+		bad += (Bad != 0 || ReadsOk == 0);
+		KModbusTcpClient_Close(&c);
+	}
+	return bad;
+}
+
+static int	Drops(void)
+{
+	KModbusTcpClient_t	c;
+	PKModbusTcpLink_t	l;
+	unsigned char		rf[KMODBUS_MAX_TXBUF], wf[KMODBUS_MAX_TXBUF];
+	unsigned long		reads;
+	int					rn, wn, sub;
+	KMODBUS_STATUS		st;
+
+	rn = KModbusMaster_BuildRead(rf, 1, 0x03, 0, 10);
+	wn = KModbusMaster_BuildWriteSingle(wf, 1, 0x06, 0, 0x0100);
+	KModbusTcpClient_Init(&c, Bench_Tick, 1000);
+	l = KModbusTcpClient_Link(&c, "127.0.0.1", PORT, 8);
+	ReadsOk = 0;
+	WritesOk = 0;
+	WritesFailed = 0;
+	Bad = 0;
+	reads = 0;
+	for (sub = 0; sub < REQUESTS || l->Queued + l->InFlight > 0; ) {
+		for (st = KMODBUS_OK; sub < REQUESTS && st == KMODBUS_OK; ) {
+			if ((sub % 4) == 3) {
+				st = KModbusTcpClient_Submit(l, wf, wn, NULL, WriteDone, NULL);
+			}
+			else {
+				st = KModbusTcpClient_Submit(l, rf, rn, Buf, ReadDone, NULL);
+				reads += (st == KMODBUS_OK);
+			}
+			sub += (st == KMODBUS_OK);
+		}
+		KModbusTcpClient_Poll(&c, 5);
+	}
+	printf("drop every %d  reads %lu/%lu  writes ok %lu failed %lu  resent %lu lost %lu connects %lu timeouts %lu\n",
+		DROP, ReadsOk, reads, WritesOk, WritesFailed, l->Resent, l->Lost, l->Connects, l->Timeouts);
+	KModbusTcpClient_Close(&c);
+	return Bad != 0 || ReadsOk != reads || WritesFailed != l->Lost || ReadsOk + WritesOk + WritesFailed != REQUESTS;
+}
+
+static void	Run(int no)
+{
+	if (no == 0) {
+		Device();
+	}
+	else {
+		Drop = 0;
+		Result = Windows();
+		Drop = DROP;
+		Result += Drops();
+		Quit = 1;
+	}
+}
+
+int		Bench_TcpClient(void)
+{
+	struct sockaddr_in	sa;
+	int					i, on;
+
+	KModbus_InitBanks();
+	KModbus_InitHandle(&Hd);
+	for (i = 0; i < 10; i++) {
+		KModbus_Set(40001 + i, (unsigned short)(0x0100 + i));
+	}
+	KModbus_Commit();
+
+	KModbusSocket_Startup();
+	Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	on = 1;
+	setsockopt(Listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(PORT);
+	if (bind(Listen, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(Listen, 4) != 0) {
+		printf("cannot listen on %d\n", PORT);
+		KMODBUS_CLOSESOCKET(Listen);
+		return 1;
+	}
+	Quit = 0;
+	Result = 0;
+	Bench_Threads(2, Run);
+	KMODBUS_CLOSESOCKET(Listen);
+	return Result;
+}
@@ -0,0 +1,163 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusUdp.h"
+#include "KModbusTcp.h"
+#include "KModbusMaster.h"
+#include "KModbusAtomic.h"
+#include "BenchKModbus.h"
+
+/*
+	One server handle over UDP with RTU and MBAP framing and over TCP, 4
+	loopback clients each sending FC03 reads of 100 registers with one
+	request outstanding. Reports requests per second and the processor
+	time of the whole process (server and clients) per request. Serial
+	RTU goes through KModbus_Feed in process, which is the server's share
+	only; its rate is bounded by the line, shown for 115200 baud 8E1.
+*/
+
+#define	PORT		(15040)
+#define	CLIENTS		(4)
+#define	ROUNDS		(20000)
+#define	REGS		(100)
+
+static KModbus_t		Hd;
+static KModbusUdp_t		Udp;
+static KModbusTcp_t		Tcp;
+static int				Mode;			/* 0: UDP RTU, 1: UDP MBAP, 2: TCP */
+static int				Quit;
+static KMODBUS_ATOMIC	Done;
+static KMODBUS_ATOMIC	Answered;
+static KMODBUS_ATOMIC	Lost;
+
+/* The query of the current mode and the length of its answer */
+static int	Query(unsigned char* q, int* rsp)
+{
+	int		n;
+
+	n = KModbusMaster_BuildRead(&q[6], KMODBUS_ID, 3, 0, REGS);
+	if (Mode == 0) {
+		memmove(q, &q[6], n);
+		*rsp = 5 + REGS * 2;
+		return n;
+	}
+	n -= 2;			/* No CRC under MBAP */
+	q[0] = 0x00;
+	q[1] = 0x01;
+	q[2] = 0x00;
+	q[3] = 0x00;
+	q[4] = (unsigned char)(n >> 8);
+	q[5] = (unsigned char)(n & 0x00FF);
+	*rsp = 9 + REGS * 2;
+	return n + 6;
+}
+
+static void	Client(void)
+{
+	unsigned char		q[KMODBUS_MAX_TXBUF + 6], r[KMODBUS_UDP_MAX_DATAGRAM];
+	struct sockaddr_in	sa;
+	KMODBUS_SOCKET		s;
+	int					i, n, got, len, rsp;
+
+	len = Query(q, &rsp);
+	s = socket(AF_INET, (Mode == 2) ? SOCK_STREAM : SOCK_DGRAM, (Mode == 2) ? IPPROTO_TCP : IPPROTO_UDP);
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(PORT);
+	if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) == 0) {
+		for (i = 0; i < ROUNDS; i++) {
+			send(s, (const char*)q, len, 0);
+			for (got = 0; got < rsp; got += n) {
+				/* A datagram may be lost, the request is then counted and skipped */
+				if (KModbusSocket_WaitRead(s, 1000) <= 0) {
+					break;
+				}
+				n = recv(s, (char*)&r[got], (int)sizeof(r) - got, 0);
+				if (n <= 0) {
+					break;
+				}
+			}
+			if (got != rsp || r[(Mode == 0) ? 1 : 7] != 0x03) {
+				KMODBUS_ATOMIC_FETCH_ADD(&Lost, 1);
+				if (Mode == 2) {
+					break;
+				}
+				continue;
+			}
+			KMODBUS_ATOMIC_FETCH_ADD(&Answered, 1);
+		}
+	}
+	KMODBUS_CLOSESOCKET(s);
+	if (KMODBUS_ATOMIC_FETCH_ADD(&Done, 1) == CLIENTS - 1) {
+		Quit = 1;
+	}
+}
+
+static void	Run(int no)
+{
+	if (no > 0) {
+		Client();
+	}
+	else if (Mode == 2) {
+		KModbusTcpServer(&Tcp, &Quit);
+	}
+	else {
+		KModbusUdpServer(&Udp, &Quit);
+	}
+}
+
+int		Bench_Udp(void)
+{
+	static const char*	name[] = { "UDP RTU ", "UDP MBAP", "TCP     " };
+	unsigned char		q[KMODBUS_MAX_TXBUF];
+	double				t0, c0, s, line;
+	int					i, n, bad;
+	KMODBUS_TICK		tick;
+
+	KModbus_Init(&Hd);
+	bad = 0;
+	for (Mode = 0; Mode < 3; Mode++) {
+		KModbus_InitHandle(&Hd);
+		if ((Mode == 2) ? KModbusTcp_Open(&Tcp, &Hd, PORT, KMODBUS_INVALID_SOCKET) != KMODBUS_OK
+			: KModbusUdp_Open(&Udp, &Hd, PORT, (Mode == 0) ? KMODBUS_UDP_RTU : KMODBUS_UDP_MBAP) != KMODBUS_OK) {
+			printf("%s cannot listen on %d\n", name[Mode], PORT);
+			return 1;
+		}
+		Quit = 0;
+		Done = 0;
+		Answered = 0;
+		Lost = 0;
+		t0 = Bench_Now();
+		c0 = Bench_Cpu();
+		Bench_Threads(1 + CLIENTS, Run);
+		s = Bench_Now() - t0;
+		printf("%s  %8.0f req/s  %5.1f us CPU/req  lost %lu\n", name[Mode], (double)Answered / s,
+			(Bench_Cpu() - c0) * 1e6 / (double)Answered, (unsigned long)Lost);
+		bad += (Answered + Lost != CLIENTS * ROUNDS || (Mode == 2 && Lost != 0));
+		if (Mode == 2) {
+			KModbusTcp_Close(&Tcp);
+		}
+		else {
+			KModbusUdp_Close(&Udp);
+		}
+	}
+
+	/* Serial: the byte parser and the handler, then the silent interval */
+	KModbus_InitHandle(&Hd);
+	n = KModbusMaster_BuildRead(q, KMODBUS_ID, 3, 0, REGS);
+	Bench_TxCount = 0;
+	tick = 0;
+	t0 = Bench_Now();
+	c0 = Bench_Cpu();
+	for (i = 0; i < CLIENTS * ROUNDS; i++) {
+		KModbus_Feed(&Hd, q, n, tick);
+		tick += Hd.NoCommunicationTime + 1;
+		KModbus_Tick(&Hd, tick);
+	}
+	s = Bench_Now() - t0;
+	line = 115200.0 / 11.0 / (double)(n + 5 + REGS * 2 + 7);
+	printf("RTU feed  %8.0f req/s  %5.1f us CPU/req  on the line %.0f req/s\n", (double)Bench_TxCount / s,
+		(Bench_Cpu() - c0) * 1e6 / (double)Bench_TxCount, line);
+	bad += (Bench_TxCount != CLIENTS * ROUNDS);
+	return bad != 0;
+}
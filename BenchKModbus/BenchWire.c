@@ -0,0 +1,98 @@
+﻿#include <stdio.h>
+#include "KModbusMaster.h"
+#include "BenchKModbus.h"
+
+/*
+	Register bank layout: FC03/FC04/FC16 of 123-125 registers through
+	KModbus_Execute, a read-heavy (one FC16 in 20) and a write-heavy (one
+	in 2) mix, and KModbus_Get/Set. Built with KMODBUS_WIRE_ORDER the banks
+	hold the frame bytes, otherwise host order; build both to compare.
+	Bus and host writes must read back the same either way.
+*/
+
+#define	ROUNDS		(500000)
+
+static KModbus_t		Hd;
+static unsigned char	Rd[2][KMODBUS_MAX_TXBUF], Wr[KMODBUS_MAX_TXBUF];
+static int				RdLen[2], WrLen;
+
+/* ns per request of a mix with one FC16 every every requests (1: FC16 only, 0: reads only) */
+static double	Mix(int fc, int every)
+{
+	double	t0;
+	int		i;
+
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS; i++) {
+		if (every != 0 && i % every == 0) {
+			KModbus_Execute(&Hd, Wr, WrLen);
+		}
+		else {
+			KModbus_Execute(&Hd, Rd[fc - 3], RdLen[fc - 3]);
+		}
+	}
+	return BENCH_NS(t0, ROUNDS);
+}
+
+int		Bench_Wire(void)
+{
+	unsigned short	w[KMODBUS_MAX_WRITE_REGS], r[KMODBUS_MAX_READ_REGS];
+	unsigned char	mask[KMODBUS_MAX_TXBUF];
+	volatile long	sink;
+	double			t0;
+	int				i, n, bad;
+
+	KModbus_Init(&Hd);
+	for (i = 0; i < KMODBUS_MAX_WRITE_REGS; i++) {
+		w[i] = (unsigned short)(i * 0x0101 + 7);
+	}
+	WrLen = KModbusMaster_BuildWriteMultiple(Wr, KMODBUS_ID, 16, 0, KMODBUS_MAX_WRITE_REGS, w);
+	RdLen[0] = KModbusMaster_BuildRead(Rd[0], KMODBUS_ID, 3, 0, KMODBUS_MAX_READ_REGS);
+	RdLen[1] = KModbusMaster_BuildRead(Rd[1], KMODBUS_ID, 4, 0, KMODBUS_MAX_READ_REGS);
+
+	/* FC16, FC22, KModbus_Set and FC03 agree */
+	bad = 0;
+	KModbus_Execute(&Hd, Wr, WrLen);
+	KModbus_Commit();
+	KModbus_Set(40002, 0xBEEF);
+	KModbus_Commit();
+	n = KModbusMaster_BuildMaskWrite(mask, KMODBUS_ID, 2, 0x00FF, 0x1200);
+	KModbus_Execute(&Hd, mask, n);
+	KModbus_Commit();
+	KModbus_Execute(&Hd, Rd[0], RdLen[0]);
+	if (KModbusMaster_Decode(Rd[0], Bench_TxBuf, Bench_TxLen, r) != KMODBUS_OK) {
+		bad++;
+	}
+	for (i = 0; i < KMODBUS_MAX_WRITE_REGS; i++) {
+		if (r[i] != ((i == 1) ? 0xBEEF : (i == 2) ? (((w[2] & 0x00FF) | 0x1200)) : w[i])) {
+			bad++;
+		}
+		if (KModbus_Get(40001 + i) != r[i]) {
+			bad++;
+		}
+	}
+
+	printf("%s\n", KMODBUS_WIRE_ORDER ? "wire order" : "host order");
+	printf("FC03 125 registers  %6.1f ns\n", Mix(3, 0));
+	printf("FC04 125 registers  %6.1f ns\n", Mix(4, 0));
+	printf("FC16 123 registers  %6.1f ns\n", Mix(3, 1));
+	printf("read-heavy  1/20    %6.1f ns\n", Mix(3, 20));
+	printf("write-heavy 1/2     %6.1f ns\n", Mix(3, 2));
+
+	sink = 0;
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS * 10; i++) {
+		sink += KModbus_Get(40001 + (i & 127));
+	}
+	printf("KModbus_Get         %6.1f ns\n", BENCH_NS(t0, ROUNDS * 10));
+	t0 = Bench_Now();
+	for (i = 0; i < ROUNDS * 10; i++) {
+		KModbus_Set(40001 + (i & 127), (unsigned short)i);
+	}
+	printf("KModbus_Set         %6.1f ns\n", BENCH_NS(t0, ROUNDS * 10));
+	KModbus_Commit();
+	if (bad != 0) {
+		printf("%d registers read back wrong\n", bad);
+	}
+	return bad != 0;
+}
@@ -0,0 +1,100 @@
+﻿#include <string.h>
+#include "KModbusCapture.h"
+#include "KModbusMaster.h"
+#include "CheckKModbus.h"
+
+/*
+	Frame capture and replay: writers lapping each other on the ring never
+	leave a record mixed from two frames, and replays running on two
+	handles at once keep their own response counts.
+*/
+
+#define	WRITERS		(4)
+#define	FRAMES		(200000)
+
+static KModbusCapture_t		Cap;
+static KModbusCapture_t		Src[2];
+static KModbus_t			Hd[2];
+static KModbusReplayStats_t	Stats[2];
+static KMODBUS_TICK			Clock;
+
+static KMODBUS_TICK	CaptureTick(void)
+{
+	return Clock;
+}
+
+/* Every frame is one byte value repeated, its length follows the value */
+static void	Writer(int no)
+{
+	unsigned char	buf[KMODBUS_CAPTURE_MAX_FRAME];
+	unsigned char	v;
+	int				i;
+
+	for (i = 0; i < FRAMES; i++) {
+		v = (unsigned char)(no * 61 + i);
+		memset(buf, v, sizeof(buf));
+		KModbusCapture_Frame(&Cap, KMODBUS_CAPTURE_RX, buf, 16 + v % 200, 1);
+	}
+}
+
+static void	Replayer(int no)
+{
+	KModbusCapture_Replay(&Src[no], &Hd[no], 0, &Stats[no]);
+}
+
+void	Check_Capture(void)
+{
+	static KModbusCaptureRecord_t	rec;
+	unsigned char					q[16];
+	unsigned long					first, end, no, ok;
+	int								i, n, mixed;
+
+	KModbusCapture_Init(&Cap, CaptureTick, 1000);
+	Check_Threads(WRITERS, Writer);
+	KModbusCapture_Range(&Cap, &first, &end);
+	CHECK(end == WRITERS * FRAMES);
+	mixed = 0;
+	ok = 0;
+	for (no = first; no != end; no++) {
+		if (!KModbusCapture_Read(&Cap, no, &rec)) {
+			continue;
+		}
+		ok++;
+		if (rec.Len != 16 + rec.Data[0] % 200 || rec.Unit != rec.Data[0]) {
+			mixed++;
+			continue;
+		}
+		for (i = 1; i < rec.Len; i++) {
+			if (rec.Data[i] != rec.Data[0]) {
+				mixed++;
+				break;
+			}
+		}
+	}
+	CHECK(mixed == 0);
+	CHECK(ok + Cap.Dropped >= KMODBUS_CAPTURE_RECORDS);
+
+	/* Source 0 holds 3 reads, source 1 holds 5, replayed at the same time */
+	n = KModbusMaster_BuildRead(q, KMODBUS_ID, 3, 0, 2);
+	for (i = 0; i < 2; i++) {
+		KModbusCapture_Init(&Src[i], CaptureTick, 1000);
+		KModbus_Init(&Hd[i]);
+		Hd[i].GetTick = CaptureTick;
+	}
+	for (i = 0; i < 3; i++) {
+		KModbusCapture_Frame(&Src[0], KMODBUS_CAPTURE_RX, q, n, 1);
+	}
+	for (i = 0; i < 5; i++) {
+		KModbusCapture_Frame(&Src[1], KMODBUS_CAPTURE_RX, q, n, 1);
+	}
+	KModbusCapture_Attach(&Cap, &Hd[1]);
+	KModbusCapture_Range(&Cap, &first, &end);
+	Check_Threads(2, Replayer);
+	CHECK(Stats[0].Frames == 3 && Stats[0].Responses == 3 && Stats[0].ResponseBytes == 3 * 9);
+	CHECK(Stats[1].Frames == 5 && Stats[1].Responses == 5 && Stats[1].ResponseBytes == 5 * 9);
+
+	/* The replay on Hd[1] was recorded into its capture, which is attached again */
+	KModbusCapture_Range(&Cap, &first, &no);
+	CHECK(no - end == 10);
+	CHECK(Hd[1].CaptureContext == &Cap && Hd[0].Capture == 0);
+}
@@ -0,0 +1,74 @@
+﻿#include <string.h>
+#include "KModbusMaster.h"
+#include "CheckKModbus.h"
+
+/*
+	RTU queries through KModbus_Execute: FC15 and FC16 take only the
+	quantities the protocol allows and a byte count that carries all of
+	them, else exception 03 goes back and the banks stay as they were.
+*/
+
+static KModbus_t	Hd;
+
+/* Append the CRC to the n bytes of q, execute it and return the function code answered, 0 for none */
+static int	Execute(unsigned char* q, int n)
+{
+	unsigned short	crc16;
+	unsigned long	sent;
+
+	crc16 = KModbus_CalcCRC16(q, n);
+	q[n++] = (unsigned char)(crc16 & 0x00FF);
+	q[n++] = (unsigned char)(crc16 >> 8);
+	sent = Check_TxCount;
+	KModbus_Execute(&Hd, q, n);
+	if (Check_TxCount == sent) {
+		return 0;
+	}
+	return (Check_TxBuf[1] & 0x80) ? (Check_TxBuf[1] << 8) | Check_TxBuf[2] : Check_TxBuf[1];
+}
+
+static int	Write(unsigned char fc, int qty, int bytes)
+{
+	unsigned char	q[7 + 255 + 2];		/* Any byte count, whatever RxBuf holds */
+
+	memset(q, 0xA5, sizeof(q));
+	q[0] = KMODBUS_ID;
+	q[1] = fc;
+	q[2] = 0x00;
+	q[3] = 0x00;
+	q[4] = (unsigned char)(qty >> 8);
+	q[5] = (unsigned char)(qty & 0x00FF);
+	q[6] = (unsigned char)bytes;
+	return Execute(q, 7 + bytes);
+}
+
+void	Check_Execute(void)
+{
+	KModbus_Init(&Hd);
+	KModbus_Set(40001, 0x1234);
+	KModbus_Commit();
+
+	/* 128 registers truncate to byte count 0, 129 to 2 */
+	CHECK(Write(16, 128, 0) == 0x9003);
+	CHECK(Write(16, 129, 2) == 0x9003);
+	CHECK(Write(16, 0, 0) == 0x9003);
+	CHECK(Write(16, 124, 248) == 0x9003 || KMODBUS_MAX_RXBUF < 7 + 248 + 2);
+	CHECK(Write(16, 2, 5) == 0x9003);
+	KModbus_Commit();
+	CHECK(KModbus_Get(40001) == 0x1234);
+	CHECK(Write(16, 2, 4) == 16);
+	KModbus_Commit();
+	CHECK(KModbus_Get(40001) == 0xA5A5 && KModbus_Get(40002) == 0xA5A5);
+
+	/* 1969 coils need 247 bytes, 2048 truncate to 0 */
+	CHECK(Write(15, 0, 0) == 0x8F03);
+	CHECK(Write(15, 2048, 0) == 0x8F03);
+	CHECK(Write(15, 1969, 247) == 0x8F03 || KMODBUS_MAX_RXBUF < 7 + 247 + 2);
+	CHECK(Write(15, 9, 1) == 0x8F03);
+	KModbus_Commit();
+	CHECK(KModbus_BitTest(1) == 0);
+	CHECK(Write(15, 9, 2) == 15);
+	KModbus_Commit();
+	CHECK(KModbus_BitTest(1) == 1 && KModbus_BitTest(2) == 0 && KModbus_BitTest(9) == 1 && KModbus_BitTest(10) == 0);
+	CHECK(Write(15, 1968, 246) == 15 || KMODBUS_MAX_RXBUF < 7 + 246 + 2);
+}
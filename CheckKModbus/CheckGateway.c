@@ -0,0 +1,247 @@
+﻿#include <string.h>
+#include "KModbusGateway.h"
+#include "CheckKModbus.h"
+
+/*
+	The gateway between loopback TCP clients and a scripted RTU slave
+	with 16 holding registers that answers a few ticks after each
+	request. A read queued behind a write of the same client has to see
+	that write, even while a covering read of another client is on the
+	bus, and merged reads are not counted as cache hits. Reads to unit 0
+	or of a quantity out of range are answered by the gateway itself and
+	keep no request.
+*/
+
+#define	PORT		(15502)
+#define	DELAY		(5)
+
+static KModbus_t		Bus;
+static KModbusGateway_t	Gw;
+static KMODBUS_TICK		Clock;
+
+static unsigned short	Regs[16];
+static unsigned char	Resp[KMODBUS_MAX_RXBUF];
+static int				RespLen;
+static int				RespPos;
+static KMODBUS_TICK		RespAt;
+
+static KMODBUS_TICK	SlaveTick(void)
+{
+	return Clock;
+}
+
+static KMODBUS_STATUS	SlaveGet(unsigned char* c)
+{
+	if (Clock < RespAt || RespPos >= RespLen) {
+		return KMODBUS_NODATA;
+	}
+	*c = Resp[RespPos++];
+	return KMODBUS_OK;
+}
+
+static KMODBUS_STATUS	SlavePut(unsigned char c)
+{
+	return KMODBUS_OK;
+}
+
+/* Execute FC03/FC06 on Regs and schedule the response */
+static KMODBUS_STATUS	SlavePuts(unsigned char* buf, int len)
+{
+	unsigned short	ad, cnt, crc16;
+	int				i;
+
+	ad = KModbud_B2N(&buf[2]);
+	cnt = KModbud_B2N(&buf[4]);
+	Resp[0] = buf[0];
+	Resp[1] = buf[1];
+	if (buf[1] == 3 && ad + cnt <= 16) {
+		Resp[2] = (unsigned char)(cnt * 2);
+		for (i = 0; i < cnt; i++) {
+			Resp[3 + i * 2] = (unsigned char)(Regs[ad + i] >> 8);
+			Resp[4 + i * 2] = (unsigned char)(Regs[ad + i] & 0x00FF);
+		}
+		RespLen = 3 + cnt * 2;
+	}
+	else if (buf[1] == 6 && ad < 16) {
+		Regs[ad] = cnt;
+		memcpy(&Resp[2], &buf[2], 4);
+		RespLen = 6;
+	}
+	else {
+		Resp[1] |= 0x80;
+		Resp[2] = 0x01;
+		RespLen = 3;
+	}
+	crc16 = KModbus_CalcCRC16(Resp, RespLen);
+	Resp[RespLen++] = (unsigned char)(crc16 & 0x00FF);
+	Resp[RespLen++] = (unsigned char)(crc16 >> 8);
+	RespPos = 0;
+	RespAt = Clock + DELAY;
+	return KMODBUS_OK;
+}
+
+static void	Pump(int n)
+{
+	while (n-- > 0) {
+		KModbusGateway_Poll(&Gw, 1);
+		++Clock;
+	}
+}
+
+static KMODBUS_SOCKET	Connect(void)
+{
+	struct sockaddr_in	sa;
+	KMODBUS_SOCKET		s;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(PORT);
+	if (connect(s, (struct sockaddr*)&sa, sizeof(sa)) != 0) {
+		KMODBUS_CLOSESOCKET(s);
+		return KMODBUS_INVALID_SOCKET;
+	}
+	KModbusSocket_NonBlocking(s);
+	Pump(2);
+	return s;
+}
+
+static void	Send(KMODBUS_SOCKET s, unsigned char unit, unsigned short tid, const unsigned char* pdu, int len)
+{
+	unsigned char	adu[KMODBUS_GW_MAX_ADU];
+
+	adu[0] = (unsigned char)(tid >> 8);
+	adu[1] = (unsigned char)(tid & 0x00FF);
+	adu[2] = 0;
+	adu[3] = 0;
+	adu[4] = (unsigned char)((len + 1) >> 8);
+	adu[5] = (unsigned char)((len + 1) & 0x00FF);
+	adu[6] = unit;
+	memcpy(&adu[7], pdu, len);
+	send(s, (const char*)adu, len + 7, 0);
+}
+
+/* Pump the gateway until one whole response arrived, its length or 0 */
+static int	Receive(KMODBUS_SOCKET s, unsigned char* adu)
+{
+	int		i, n, len;
+
+	len = 0;
+	for (i = 0; i < 200; i++) {
+		n = recv(s, (char*)&adu[len], (len < 6) ? 6 - len : KModbud_B2N(&adu[4]) + 6 - len, 0);
+		if (n > 0) {
+			len += n;
+			if (len >= 6 && len == KModbud_B2N(&adu[4]) + 6) {
+				return len;
+			}
+			continue;
+		}
+		Pump(1);
+	}
+	return 0;
+}
+
+static int	FreeRequests(void)
+{
+	PKModbusGwRequest_t	rq;
+	int					n;
+
+	n = 0;
+	for (rq = Gw.Free; rq; rq = rq->Next) {
+		n++;
+	}
+	return n;
+}
+
+void	Check_Gateway(void)
+{
+	static const unsigned char	ReadAll[] = { 0x03, 0x00, 0x00, 0x00, 0x0A };
+	static const unsigned char	ReadOne[] = { 0x03, 0x00, 0x00, 0x00, 0x01 };
+	static const unsigned char	WriteOne[] = { 0x06, 0x00, 0x00, 0x12, 0x34 };
+	static const unsigned char	ShortWrite[] = { 0x10, 0x00, 0x00, 0x00, 0x02, 0x04, 0x00 };
+	static const unsigned char	ReadNone[] = { 0x03, 0x00, 0x00, 0x00, 0x00 };
+	static const unsigned char	ReadTooMany[] = { 0x04, 0x00, 0x00, 0x00, 0x7E };
+	static const unsigned char	ReadCoilsTooMany[] = { 0x01, 0x00, 0x00, 0x07, 0xD1 };
+	unsigned char				adu[KMODBUS_GW_MAX_ADU];
+	KMODBUS_SOCKET				a, b;
+	int							len, idle;
+
+	KModbusMaster_Init(&Bus);
+	Bus.GetTick = SlaveTick;
+	Bus.Interface.Get = SlaveGet;
+	Bus.Interface.Put = SlavePut;
+	Bus.Interface.Puts = SlavePuts;
+	Bus.ResponseTimeout = 50;
+	memset(Regs, 0x00, sizeof(Regs));
+
+	CHECK(KModbusGateway_Open(&Gw, &Bus, PORT, 0) == KMODBUS_OK);
+	a = Connect();
+	b = Connect();
+	CHECK(a != KMODBUS_INVALID_SOCKET && b != KMODBUS_INVALID_SOCKET);
+	if (a == KMODBUS_INVALID_SOCKET || b == KMODBUS_INVALID_SOCKET) {
+		KModbusGateway_Close(&Gw);
+		return;
+	}
+
+	/* A's read is on the bus when B writes and reads back inside its range */
+	Send(a, 1, 1, ReadAll, sizeof(ReadAll));
+	Pump(2);
+	CHECK(Gw.Active != 0);
+	Send(b, 1, 2, WriteOne, sizeof(WriteOne));
+	Send(b, 1, 3, ReadOne, sizeof(ReadOne));
+	Pump(2);
+	CHECK(Gw.Merged == 0);
+
+	len = Receive(a, adu);
+	CHECK(len == 29 && adu[1] == 1 && adu[9] == 0x00 && adu[10] == 0x00);
+	len = Receive(b, adu);
+	CHECK(len == 12 && adu[1] == 2 && adu[7] == 0x06);
+	len = Receive(b, adu);
+	CHECK(len == 11 && adu[1] == 3 && adu[9] == 0x12 && adu[10] == 0x34);
+
+	/* Without a pending write B's read rides on A's */
+	Send(a, 1, 4, ReadAll, sizeof(ReadAll));
+	Pump(2);
+	Send(b, 1, 5, ReadOne, sizeof(ReadOne));
+	Pump(2);
+	CHECK(Gw.Merged == 1);
+	len = Receive(a, adu);
+	CHECK(len == 29 && adu[1] == 4);
+	len = Receive(b, adu);
+	CHECK(len == 11 && adu[1] == 5 && adu[9] == 0x12 && adu[10] == 0x34);
+	CHECK(KModbusGateway_HitRate(&Gw) == 0);
+
+	/* A write shorter than its byte count never reaches the bus */
+	len = (int)Gw.BusTransactions;
+	Send(b, 1, 6, ShortWrite, sizeof(ShortWrite));
+	len = Receive(b, adu) == 9 ? len : -1;
+	CHECK(len == (int)Gw.BusTransactions && adu[1] == 6 && adu[7] == 0x90 && adu[8] == 0x03);
+
+	/* Two clients reading unit 0: both refused, nothing merged or left in the pool */
+	idle = FreeRequests();
+	len = (int)Gw.BusTransactions;
+	Send(a, 0, 7, ReadAll, sizeof(ReadAll));
+	Send(b, 0, 8, ReadOne, sizeof(ReadOne));
+	CHECK(Receive(a, adu) == 9 && adu[1] == 7 && adu[6] == 0 && adu[7] == 0x83 && adu[8] == 0x01);
+	CHECK(Receive(b, adu) == 9 && adu[1] == 8 && adu[6] == 0 && adu[7] == 0x83 && adu[8] == 0x01);
+	CHECK(len == (int)Gw.BusTransactions && Gw.Merged == 1 && FreeRequests() == idle);
+
+	/* A broadcast write goes out unanswered and gives its request back */
+	Send(a, 0, 9, WriteOne, sizeof(WriteOne));
+	Pump(DELAY * 2 + (int)Bus.TurnaroundDelay);
+	CHECK(Gw.BusTransactions == (unsigned long)len + 1 && FreeRequests() == idle);
+
+	/* Read quantities of 0 or above the protocol limit */
+	Send(a, 1, 10, ReadNone, sizeof(ReadNone));
+	CHECK(Receive(a, adu) == 9 && adu[1] == 10 && adu[7] == 0x83 && adu[8] == 0x03);
+	Send(a, 1, 11, ReadTooMany, sizeof(ReadTooMany));
+	CHECK(Receive(a, adu) == 9 && adu[1] == 11 && adu[7] == 0x84 && adu[8] == 0x03);
+	Send(a, 1, 12, ReadCoilsTooMany, sizeof(ReadCoilsTooMany));
+	CHECK(Receive(a, adu) == 9 && adu[1] == 12 && adu[7] == 0x81 && adu[8] == 0x03);
+	CHECK(Gw.BusTransactions == (unsigned long)len + 1 && FreeRequests() == idle);
+
+	KMODBUS_CLOSESOCKET(a);
+	KMODBUS_CLOSESOCKET(b);
+	KModbusGateway_Close(&Gw);
+}
@@ -0,0 +1,84 @@
+﻿#include <string.h>
+#include "KModbusHistory.h"
+#include "CheckKModbus.h"
+
+/*
+	Register history: the record size of a slowly moving analog value at
+	a 1000 tick and a 100 tick period, and two histories served on two
+	vendor codes each answering from its own channels.
+*/
+
+#define	REGS		(2)
+#define	RING		(1024)
+
+static KModbusHistory_t		Hist[2];
+static KModbusHistoryReg_t	Reg[2][REGS];
+static unsigned char		Data[2][REGS * RING];
+static KModbus_t			Hd;
+
+/* 100 samples of a value climbing by one, period ticks apart */
+static double	Ramp(KMODBUS_TICK period)
+{
+	KModbusHistoryUsage_t	u;
+	KMODBUS_TICK			now;
+	int						i;
+
+	KModbusHistory_Init(&Hist[0]);
+	KModbusHistory_Add(&Hist[0], KMODBUS_HISTORY_X4, 0, REGS, KMODBUS_HISTORY_DELTA, period, Reg[0], Data[0], RING);
+	for (i = 0, now = 1000; i < 100; i++, now += period) {
+		KModbus_Set(40001, (unsigned short)(500 + i));
+		KModbus_Commit();
+		KModbusHistory_Sample(&Hist[0], now);
+	}
+	KModbusHistory_Usage(&Hist[0], &u);
+	CHECK(u.Samples == 100 * REGS);
+	return u.BytesPerSample;
+}
+
+/* Ask code cd for the samples of 40001 + adrs, the count answered */
+static int	Query(unsigned char cd, int adrs)
+{
+	unsigned char	q[12];
+	unsigned short	crc16;
+
+	q[0] = KMODBUS_ID;
+	q[1] = cd;
+	q[2] = KMODBUS_HISTORY_X4;
+	q[3] = (unsigned char)(adrs >> 8);
+	q[4] = (unsigned char)adrs;
+	memset(&q[5], 0x00, 5);
+	crc16 = KModbus_CalcCRC16(q, 10);
+	q[10] = (unsigned char)(crc16 & 0x00FF);
+	q[11] = (unsigned char)(crc16 >> 8);
+	Check_TxLen = 0;
+	KModbus_Execute(&Hd, q, sizeof(q));
+	if (Check_TxLen < 5 || Check_TxBuf[1] != cd) {
+		return -1;
+	}
+	return Check_TxBuf[4];
+}
+
+void	Check_History(void)
+{
+	KModbus_Init(&Hd);
+
+	CHECK(Ramp(1000) == 3.0);
+	CHECK(Ramp(100) == 2.0);
+
+	/* History 0 keeps 40001-40002 (100 samples in 206 bytes), history 1 keeps 40011 */
+	KModbusHistory_Init(&Hist[1]);
+	CHECK(KModbusHistory_Add(&Hist[1], KMODBUS_HISTORY_X4, 10, 1, KMODBUS_HISTORY_DELTA, 10,
+		Reg[1], Data[1], RING) == KMODBUS_OK);
+	KModbusHistory_Sample(&Hist[1], 5000);
+	KModbusHistory_Sample(&Hist[1], 5010);
+	CHECK(KModbusHistory_Serve(&Hist[0], 65) == KMODBUS_OK);
+	CHECK(KModbusHistory_Serve(&Hist[1], 66) == KMODBUS_OK);
+
+	CHECK(Query(65, 0) == 100);
+	CHECK(Query(66, 10) == 2);
+	CHECK(Query(65, 10) == -1);
+	CHECK(Query(66, 0) == -1);
+
+	KModbusHistory_Serve(0, 65);
+	KModbusHistory_Serve(0, 66);
+}
@@ -0,0 +1,201 @@
+﻿#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "TestKModbus.h"
+#include "CheckKModbus.h"
+
+/*
+	Behaviour checks of the KModbus modules. Every failed CHECK is printed
+	with its location; the exit code is the number of checks that failed.
+
+	CheckKModbus [name...]
+*/
+
+static const struct {
+	const char*	Name;
+	void		(*Run)(void);
+} Checks[] = {
+	{ "capture",	Check_Capture },		/* Ring writers lapping each other, concurrent replays */
+	{ "execute",	Check_Execute },		/* FC15/FC16 quantities and byte counts of RTU queries */
+	{ "gateway",	Check_Gateway },		/* Merge ordering and request checks of the TCP/RTU gateway */
+	{ "history",	Check_History },		/* Bytes per sample, histories on two vendor codes */
+	{ "lite",		Check_Lite },			/* Compact handles, slab buffers lent and given back */
+	{ "master",		Check_Master },			/* Response timeout of the blocking master */
+	{ "mbap",		Check_Mbap },			/* MBAP framing of the TCP and UDP transports */
+	{ "repl",		Check_Repl },			/* Page byte counts on the replication standby */
+	{ "tag",		Check_Tag },			/* Tag addresses inside their bank, bool tags per bank */
+};
+
+static int	Failures;
+
+void	Check_Fail(const char* file, int line, const char* expr)
+{
+	printf("%s(%d): CHECK(%s) failed\n", file, line, expr);
+	Failures++;
+}
+
+int main(int argc, char* argv[])
+{
+	int		i, j, ran, failed, before;
+
+	ran = 0;
+	failed = 0;
+	for (i = 0; i < (int)(sizeof(Checks) / sizeof(Checks[0])); i++) {
+		if (argc > 1) {
+			for (j = 1; j < argc && strcmp(argv[j], Checks[i].Name) != 0; j++) {
+			}
+			if (j == argc) {
+				continue;
+			}
+		}
+		before = Failures;
+		(*Checks[i].Run)();
+		printf("%-12s %s\n", Checks[i].Name, (Failures == before) ? "ok" : "FAILED");
+		fflush(stdout);
+		if (Failures != before) {
+			failed++;
+		}
+		ran++;
+	}
+	if (ran == 0) {
+		printf("usage: CheckKModbus [name...]\n");
+		for (i = 0; i < (int)(sizeof(Checks) / sizeof(Checks[0])); i++) {
+			printf("  %s\n", Checks[i].Name);
+		}
+		return -1;
+	}
+	return failed;
+}
+
+/* Loopback port: nothing to receive, responses are kept for the checks */
+unsigned char	Check_TxBuf[KMODBUS_MAX_TXBUF];
+int				Check_TxLen;
+unsigned long	Check_TxCount;
+
+KMODBUS_STATUS	GetCom(unsigned char* c)
+{
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	GetsCom(unsigned char* buf, int len)
+{
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	PutCom(unsigned char c)
+{
+	return KMODBUS_OK;
+}
+KMODBUS_STATUS	PutsCom(unsigned char* buf, int len)
+{
+	if (len > (int)sizeof(Check_TxBuf)) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memcpy(Check_TxBuf, buf, len);
+	Check_TxLen = len;
+	Check_TxCount++;
+	return KMODBUS_OK;
+}
+
+/* Worker threads of the concurrency checks */
+#define	MAX_THREADS		(16)
+
+typedef struct CheckThread_t {
+	void	(*Fn)(int);
+	int		No;
+
+} CheckThread_t;
+
+#ifdef _WIN32
+static DWORD WINAPI	ThreadMain(LPVOID arg)
+{
+	CheckThread_t*	th = (CheckThread_t*)arg;
+
+	(*th->Fn)(th->No);
+	return 0;
+}
+
+void	Check_Threads(int n, void (*fn)(int))
+{
+	CheckThread_t	th[MAX_THREADS];
+	HANDLE			h[MAX_THREADS];
+	int				i;
+
+	for (i = 0; i < n && i < MAX_THREADS; i++) {
+		th[i].Fn = fn;
+		th[i].No = i;
+		h[i] = CreateThread(NULL, 0, ThreadMain, &th[i], 0, NULL);
+	}
+	WaitForMultipleObjects(i, h, TRUE, INFINITE);
+	while (i-- > 0) {
+		CloseHandle(h[i]);
+	}
+}
+#else
+static void*	ThreadMain(void* arg)
+{
+	CheckThread_t*	th = (CheckThread_t*)arg;
+
+	(*th->Fn)(th->No);
+	return 0;
+}
+
+void	Check_Threads(int n, void (*fn)(int))
+{
+	CheckThread_t	th[MAX_THREADS];
+	pthread_t		h[MAX_THREADS];
+	int				i;
+
+	for (i = 0; i < n && i < MAX_THREADS; i++) {
+		th[i].Fn = fn;
+		th[i].No = i;
+		pthread_create(&h[i], NULL, ThreadMain, &th[i]);
+	}
+	while (i-- > 0) {
+		pthread_join(h[i], NULL);
+	}
+}
+#endif
+
+/* Bank lock, readers share it */
+#ifdef _WIN32
+static SRWLOCK	g_lock = SRWLOCK_INIT;
+
+void	CriLock(void)
+{
+	AcquireSRWLockExclusive(&g_lock);
+}
+void	CriUnlock(void)
+{
+	ReleaseSRWLockExclusive(&g_lock);
+}
+void	CriReadLock(void)
+{
+	AcquireSRWLockShared(&g_lock);
+}
+void	CriReadUnlock(void)
+{
+	ReleaseSRWLockShared(&g_lock);
+}
+#else
+static pthread_rwlock_t	g_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+void	CriLock(void)
+{
+	pthread_rwlock_wrlock(&g_lock);
+}
+void	CriUnlock(void)
+{
+	pthread_rwlock_unlock(&g_lock);
+}
+void	CriReadLock(void)
+{
+	pthread_rwlock_rdlock(&g_lock);
+}
+void	CriReadUnlock(void)
+{
+	pthread_rwlock_unlock(&g_lock);
+}
+#endif
@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/* Behaviour checks, by name on the command line, all when none is given */
+void	Check_Capture(void);
+void	Check_Execute(void);
+void	Check_Gateway(void);
+void	Check_History(void);
+void	Check_Lite(void);
+void	Check_Master(void);
+void	Check_Mbap(void);
+void	Check_Repl(void);
+void	Check_Tag(void);
+
+/* Count a failure and report it, the run goes on */
+#define	CHECK(cond)		do { if (!(cond)) Check_Fail(__FILE__, __LINE__, #cond); } while (0)
+
+void	Check_Fail(const char* file, int line, const char* expr);
+
+/* Run fn(0) .. fn(n - 1) on n threads and wait for all of them */
+void	Check_Threads(int n, void (*fn)(int));
+
+/* Frames sent through PutsCom, the last one is kept */
+extern unsigned char	Check_TxBuf[KMODBUS_MAX_TXBUF];
+extern int				Check_TxLen;
+extern unsigned long	Check_TxCount;
+
+#ifdef __cplusplus
+	}
+#endif
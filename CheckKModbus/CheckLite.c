@@ -0,0 +1,108 @@
+﻿#include <string.h>
+#include "KModbusLite.h"
+#include "KModbusMaster.h"
+#include "CheckKModbus.h"
+
+/*
+	Compact handles: the same responses and counters as full handles, and
+	slab buffers lent from the address byte until the query ran, was
+	dropped or timed out. A slab that runs dry skips the frame and counts
+	it, and every buffer comes back.
+*/
+
+#define	HANDLES		(100)
+#define	SLABS		(64)
+
+static KModbus_t		Engine, Full[HANDLES];
+static KModbusLite_t	Lite[HANDLES];
+static unsigned char	SlabBuf[SLABS][KMODBUS_MAX_RXBUF];
+static unsigned short	SlabFree[SLABS];
+
+static void	Equal(void)
+{
+	unsigned char	q[KMODBUS_MAX_TXBUF], rsp[KMODBUS_MAX_TXBUF];
+	int				i, k, n, len, same;
+	unsigned long	sent, messages, errors;
+
+	for (i = 0; i < HANDLES; i++) {
+		KModbus_InitHandle(&Full[i]);
+		Full[i].ID = (unsigned char)(1 + i % 10);
+		KModbusLite_Init(&Lite[i], (unsigned char)(1 + i % 10));
+	}
+	same = 1;
+	for (k = 0; k < 5000; k++) {
+		i = (k * 37) % HANDLES;
+		n = KModbusMaster_BuildRead(q, (unsigned char)(1 + k % 11), 3, k % 100, 1 + k % 10);
+		if (k % 7 == 0) {
+			q[3] ^= 1;			/* CRC error */
+		}
+		if (k % 13 == 0) {
+			n = KModbusMaster_BuildDiagnostics(q, Full[i].ID, 11, 0);		/* Bus message count */
+		}
+		sent = Check_TxCount;
+		KModbus_Execute(&Full[i], q, n);
+		len = (Check_TxCount != sent) ? Check_TxLen : 0;
+		memcpy(rsp, Check_TxBuf, len);
+		sent = Check_TxCount;
+		KModbusLite_Execute(&Engine, &Lite[i], q, n);
+		same &= ((Check_TxCount != sent) ? Check_TxLen : 0) == len && memcmp(rsp, Check_TxBuf, len) == 0;
+	}
+	CHECK(same);
+	messages = 0;
+	errors = 0;
+	for (i = 0; i < HANDLES; i++) {
+		messages += Lite[i].MessageCounter;
+		errors += Lite[i].CRCErrorCounter;
+		CHECK(Full[i].MessageCounter == Lite[i].MessageCounter && Full[i].CRCErrorCounter == Lite[i].CRCErrorCounter
+			&& Full[i].EventCounter == Lite[i].EventCounter && Full[i].ExceptionErrorCount == Lite[i].ExceptionErrorCount);
+	}
+	CHECK(messages != 0 && errors != 0);
+}
+
+void	Check_Lite(void)
+{
+	KModbusSlab_t	slab;
+	unsigned char	q[KMODBUS_MAX_TXBUF];
+	unsigned long	sent;
+	int				i, n;
+
+	KModbus_Init(&Engine);
+	Equal();
+
+	/* 100 partial queries on 64 buffers */
+	KModbusSlab_Init(&slab, SlabBuf, SlabFree, SLABS);
+	n = KModbusMaster_BuildRead(q, 1, 3, 0, 10);
+	for (i = 0; i < HANDLES; i++) {
+		KModbusLite_Init(&Lite[i], 1);
+		KModbusLite_Feed(&Engine, &slab, &Lite[i], q, 3, 100);
+	}
+	CHECK(slab.Top == 0 && slab.Peak == SLABS && slab.Exhausted == HANDLES - SLABS);
+	CHECK(Lite[SLABS - 1].Buf != 0 && Lite[SLABS].Buf == 0 && Lite[SLABS].RxState == KMODBUS_LITE_SKIP);
+	sent = Check_TxCount;
+	for (i = 0; i < HANDLES; i++) {
+		KModbusLite_Feed(&Engine, &slab, &Lite[i], &q[3], n - 3, 101);
+	}
+	for (i = 0; i < HANDLES; i++) {
+		KModbusLite_Tick(&Engine, &slab, &Lite[i], 200);
+	}
+	CHECK(Check_TxCount - sent == SLABS && slab.Top == SLABS);
+	for (i = 0; i < HANDLES; i++) {
+		CHECK(Lite[i].RxState == KMODBUS_LITE_IDLE && Lite[i].Buf == 0);
+	}
+
+	/* A partial query that times out, an unknown function, another unit */
+	KModbusLite_Feed(&Engine, &slab, &Lite[0], q, 3, 300);
+	CHECK(slab.Top == SLABS - 1);
+	KModbusLite_Tick(&Engine, &slab, &Lite[0], 300 + Engine.NoCommunicationTime);
+	CHECK(slab.Top == SLABS - 1);
+	KModbusLite_Tick(&Engine, &slab, &Lite[0], 301 + Engine.NoCommunicationTime);
+	CHECK(slab.Top == SLABS && Lite[0].RxState == KMODBUS_LITE_IDLE);
+
+	q[1] = 0x64;
+	KModbusLite_Feed(&Engine, &slab, &Lite[1], q, 2, 400);
+	CHECK(slab.Top == SLABS && Lite[1].RxState == KMODBUS_LITE_SKIP);
+	q[0] = 2;
+	KModbusLite_Feed(&Engine, &slab, &Lite[2], q, 1, 400);
+	CHECK(slab.Top == SLABS && Lite[2].RxState == KMODBUS_LITE_SKIP);
+	CHECK(slab.Peak == SLABS && slab.Exhausted == HANDLES - SLABS);
+}
@@ -0,0 +1,99 @@
+﻿#include <string.h>
+#include "KModbusMaster.h"
+#include "CheckKModbus.h"
+
+/*
+	The blocking master against a scripted line where every poll of the
+	port takes one tick: a clean response, a slave trickling a long
+	response slower than the timeout allows, and a line that never goes
+	quiet.
+*/
+
+static unsigned char	Line[KMODBUS_MAX_RXBUF];
+static int				LineLen;
+static int				LinePos;
+static int				LineNoise;
+static KMODBUS_TICK		Clock;
+
+static KMODBUS_TICK	LineTick(void)
+{
+	return Clock;
+}
+
+static KMODBUS_STATUS	LineGet(unsigned char* c)
+{
+	++Clock;
+	if (LineNoise) {
+		*c = 0x55;
+		return KMODBUS_OK;
+	}
+	if (LinePos < LineLen) {
+		*c = Line[LinePos++];
+		return KMODBUS_OK;
+	}
+	return KMODBUS_NODATA;
+}
+
+/* The scripted response starts once the request went out */
+static KMODBUS_STATUS	LinePuts(unsigned char* buf, int len)
+{
+	LinePos = 0;
+	return KMODBUS_OK;
+}
+
+/* FC03 response of n registers 0x1000 + i from unit 1 */
+static void	LineResponse(int n)
+{
+	unsigned short	crc16;
+	int				i;
+
+	Line[0] = 1;
+	Line[1] = 3;
+	Line[2] = (unsigned char)(n * 2);
+	for (i = 0; i < n; i++) {
+		Line[3 + i * 2] = 0x10;
+		Line[4 + i * 2] = (unsigned char)i;
+	}
+	crc16 = KModbus_CalcCRC16(Line, 3 + n * 2);
+	Line[3 + n * 2] = (unsigned char)(crc16 & 0x00FF);
+	Line[4 + n * 2] = (unsigned char)(crc16 >> 8);
+	LineLen = 5 + n * 2;
+	LinePos = LineLen;
+}
+
+void	Check_Master(void)
+{
+	KModbus_t		m;
+	unsigned short	regs[KMODBUS_MAX_READ_REGS];
+	KMODBUS_STATUS	ret;
+
+	KModbusMaster_Init(&m);
+	m.ID = 1;
+	m.GetTick = LineTick;
+	m.Interface.Get = LineGet;
+	m.Interface.Puts = LinePuts;
+	m.ResponseTimeout = 100;
+
+	LineResponse(2);
+	Clock = 0;
+	ret = KModbusMaster_ReadHoldingRegister(&m, 0, 2, regs);
+	CHECK(ret == KMODBUS_OK);
+	CHECK(regs[0] == 0x1000 && regs[1] == 0x1001);
+	CHECK(m.NoResponseCount == 0);
+
+	/* 255 bytes at one per tick cannot make a timeout of 100 */
+	LineResponse(125);
+	Clock = 0;
+	ret = KModbusMaster_ReadHoldingRegister(&m, 0, 125, regs);
+	CHECK(ret == KMODBUS_TIMEOUT);
+	CHECK(m.NoResponseCount == 1);
+	CHECK(Clock <= 110);
+
+	/* Bytes without end before and after the request */
+	LineNoise = 1;
+	Clock = 0;
+	ret = KModbusMaster_ReadHoldingRegister(&m, 0, 2, regs);
+	CHECK(ret == KMODBUS_INVALID_RESPONSE || ret == KMODBUS_TIMEOUT);
+	CHECK(Clock <= KMODBUS_MAX_RXBUF + 110);
+	LineNoise = 0;
+}
@@ -0,0 +1,66 @@
+﻿#include <string.h>
+#include "KModbusMbap.h"
+#include "CheckKModbus.h"
+
+/*
+	The MBAP framing shared by the TCP and UDP transports: the response
+	keeps the transaction and unit, its length covers the unit and PDU,
+	and frames for other units or with a broken header are discarded. A
+	PDU the receive buffer cannot hold is refused before it is copied.
+*/
+
+static KModbus_t	Hd;
+
+void	Check_Mbap(void)
+{
+	unsigned char	q[12] = { 0x12, 0x34, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x02 };
+	unsigned char	tx[KMODBUS_MAX_TXBUF + KMODBUS_MBAP_HEADER];
+	unsigned char	big[KMODBUS_MAX_RXBUF + 16];
+	int				len;
+
+	KModbus_Init(&Hd);
+	KModbusMbap_Attach(&Hd);
+	KModbus_Set(40001, 0xBEEF);
+	KModbus_Set(40002, 0x0102);
+	KModbus_Commit();
+
+	len = KModbusMbap_Execute(&Hd, q, sizeof(q), tx, sizeof(tx));
+	CHECK(len == 13);
+	CHECK(tx[0] == 0x12 && tx[1] == 0x34 && tx[2] == 0 && tx[3] == 0);
+	CHECK(tx[4] == 0 && tx[5] == 7 && tx[6] == 0x01);
+	CHECK(tx[7] == 0x03 && tx[8] == 4 && tx[9] == 0xBE && tx[10] == 0xEF && tx[11] == 0x01 && tx[12] == 0x02);
+
+	/* Unit 255 addresses the device over IP, unit 9 does not */
+	q[6] = 0xFF;
+	len = KModbusMbap_Execute(&Hd, q, sizeof(q), tx, sizeof(tx));
+	CHECK(len == 13 && tx[6] == 0xFF);
+	q[6] = 0x09;
+	CHECK(KModbusMbap_Execute(&Hd, q, sizeof(q), tx, sizeof(tx)) == -1);
+	q[6] = 0x01;
+
+	/* Length field disagreeing with the frame, or a foreign protocol */
+	q[5] = 0x07;
+	CHECK(KModbusMbap_Execute(&Hd, q, sizeof(q), tx, sizeof(tx)) == -1);
+	q[5] = 0x06;
+	q[3] = 0x01;
+	CHECK(KModbusMbap_Execute(&Hd, q, sizeof(q), tx, sizeof(tx)) == -1);
+	q[3] = 0x00;
+
+	/* A response that does not fit the buffer is not sent half */
+	len = KModbusMbap_Execute(&Hd, q, sizeof(q), tx, 12);
+	CHECK(len == 0);
+
+	/* One byte more than RxBuf holds with the unit */
+	memset(big, 0x00, sizeof(big));
+	len = 7 + KMODBUS_MAX_RXBUF;
+	big[0] = 0x56;
+	big[4] = (unsigned char)((len - 6) >> 8);
+	big[5] = (unsigned char)((len - 6) & 0x00FF);
+	big[6] = 0x01;
+	big[7] = 0x10;
+	len = KModbusMbap_Execute(&Hd, big, len, tx, sizeof(tx));
+	CHECK(len == 9 && tx[0] == 0x56 && tx[5] == 3 && tx[6] == 0x01 && tx[7] == 0x90 && tx[8] == 0x03);
+
+	/* No stray sink is left behind for the serial interface */
+	CHECK(Hd.Interface.Puts((unsigned char*)"x", 1) != KMODBUS_OK);
+}
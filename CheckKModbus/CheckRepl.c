@@ -0,0 +1,92 @@
+﻿#include <string.h>
+#include "KModbusRepl.h"
+#include "CheckKModbus.h"
+
+/*
+	Standby side of the replication stream, fed by hand over loopback:
+	a page is applied only when its byte count is what its count of
+	coils or registers takes. A refused page asks for its bank again and
+	the records after it still frame.
+*/
+
+#define	PORT		(15020)
+
+static int	Page(unsigned char* p, int bank, int adrs, int count, int len, unsigned char fill)
+{
+	p[0] = 1;
+	p[1] = (unsigned char)bank;
+	p[2] = (unsigned char)(adrs >> 8);
+	p[3] = (unsigned char)adrs;
+	p[4] = (unsigned char)(count >> 8);
+	p[5] = (unsigned char)count;
+	p[6] = (unsigned char)(len >> 8);
+	p[7] = (unsigned char)len;
+	memset(&p[8], fill, len);
+	return 8 + len;
+}
+
+void	Check_Repl(void)
+{
+	static KModbusRepl_t	r;
+	static KModbus_t		hd;
+	struct sockaddr_in		sa;
+	KMODBUS_SOCKET			s;
+	unsigned char			tx[256], rx[64];
+	int						i, n, len, port;
+
+	KModbus_Init(&hd);
+	for (port = PORT; port < PORT + 10 && KModbusRepl_Standby(&r, (unsigned short)port) != KMODBUS_OK; port++) {
+	}
+	CHECK(port < PORT + 10);
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons((unsigned short)port);
+	inet_pton(AF_INET, "127.0.0.1", &sa.sin_addr);
+	CHECK(connect(s, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+	for (i = 0; i < 100 && r.Connects == 0; i++) {
+		KModbusRepl_Poll(&r, 10);
+	}
+	CHECK(r.Connects == 1);
+
+	len = 0;
+	len += Page(&tx[len], 4, 10, 3, 6, 0x5A);			/* 40011..40013 */
+	len += Page(&tx[len], 4, 20, 50, 4, 0x11);			/* 50 registers in 4 bytes */
+	len += Page(&tx[len], 0, 3, 9, 2, 0xFF);			/* Coils 4..12 */
+	len += Page(&tx[len], 0, 100, 20, 2, 0xFF);			/* 20 coils in 2 bytes */
+	len += Page(&tx[len], 3, 0, 0, 0, 0x00);			/* Nothing */
+	len += Page(&tx[len], 3, 5, 1, 3, 0x22);			/* Odd byte count */
+	tx[len] = 3;										/* Mark, echoed */
+	memset(&tx[len + 1], 0x00, 5);
+	tx[len + 6] = 0;
+	tx[len + 7] = 4;
+	memcpy(&tx[len + 8], "\x01\x02\x03\x04", 4);
+	len += 12;
+	CHECK(send(s, (const char*)tx, len, 0) == len);
+
+	/* Four refusals, then the mark */
+	n = 0;
+	for (i = 0; i < 100 && n < 4 * 8 + 12; i++) {
+		KModbusRepl_Poll(&r, 10);
+		if (KModbusSocket_WaitRead(s, 0) > 0) {
+			len = recv(s, (char*)&rx[n], (int)sizeof(rx) - n, 0);
+			if (len <= 0) {
+				break;
+			}
+			n += len;
+		}
+	}
+	CHECK(n == 4 * 8 + 12);
+	CHECK(rx[0] == 4 && rx[1] == 4 && rx[8] == 4 && rx[9] == 0 && rx[16] == 4 && rx[17] == 3 && rx[24] == 4 && rx[25] == 3);
+	CHECK(rx[32] == 3 && memcmp(&rx[40], "\x01\x02\x03\x04", 4) == 0);
+	CHECK(r.Records == 2 && r.Mismatches == 4);
+
+	KModbus_Commit();
+	CHECK(KModbus_Get(40011) == 0x5A5A && KModbus_Get(40013) == 0x5A5A && KModbus_Get(40014) == 0);
+	CHECK(KModbus_Get(40021) == 0 && KModbus_Get(30006) == 0);
+	CHECK(KModbus_BitTest(3) == 0 && KModbus_BitTest(4) == 1 && KModbus_BitTest(12) == 1 && KModbus_BitTest(13) == 0);
+	CHECK(KModbus_BitTest(101) == 0);
+
+	KMODBUS_CLOSESOCKET(s);
+	KModbusRepl_Close(&r);
+}
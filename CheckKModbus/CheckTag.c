@@ -0,0 +1,80 @@
+﻿#include <stdio.h>
+#include <string.h>
+#include "KModbusTag.h"
+#include "CheckKModbus.h"
+
+/*
+	Tag maps: every bit or register of a tag has to be in its bank, the
+	line of the first bad tag is reported, and bool tags reach the bank
+	they name, never the neighbouring one. Integer tags saturate at the
+	limits of their type and refuse NaN.
+*/
+
+static int	Parse(PKModbusTagMap_t map, const char* text)
+{
+	return KModbusTag_Parse(map, text, (long)strlen(text)) == KMODBUS_OK;
+}
+
+void	Check_Tag(void)
+{
+	static KModbus_t	hd;
+	KModbusTagMap_t		map;
+	char				text[256];
+	double				v;
+
+	KModbus_Init(&hd);
+
+	/* Last bit and last register that fit, then one past */
+	sprintf(text, "name,table,address,type\nlast_coil,coil,%d,bool\nlast_input,input,%d,bool\n"
+		"last_float,hreg,%d,float64\nlast_ireg,ireg,%d,int16\n",
+		KMODBUS_X0_SIZE - 1, KMODBUS_X1_SIZE - 1, KMODBUS_X4_SIZE - 4, KMODBUS_X3_SIZE - 1);
+	CHECK(Parse(&map, text) && map.Count == 4);
+	KModbusTag_Free(&map);
+
+	sprintf(text, "a,coil,0,bool\nb,coil,%d,bool\n", KMODBUS_X0_SIZE);
+	CHECK(!Parse(&map, text) && map.Line == 2);
+	sprintf(text, "a,input,%d,bool\n", KMODBUS_X1_SIZE);
+	CHECK(!Parse(&map, text) && map.Line == 1);
+	sprintf(text, "# spans the end\n\na,hreg,%d,float64\n", KMODBUS_X4_SIZE - 3);
+	CHECK(!Parse(&map, text) && map.Line == 3);
+	sprintf(text, "a,ireg,%d,uint32\n", KMODBUS_X3_SIZE - 1);
+	CHECK(!Parse(&map, text) && map.Line == 1);
+	CHECK(!Parse(&map, "a,hreg,-1,int16\n") && map.Line == 1);
+	CHECK(!Parse(&map, "a,hreg,65536,int16\n") && map.Line == 1);
+
+	/* Bool tags read and write their own bank */
+	CHECK(Parse(&map, "run,coil,5,bool\nready,input,5,bool\nlevel,hreg,10,int16,,0.1\n"));
+	CHECK(KModbusTag_Write(&map, "run", 1.0) == KMODBUS_OK);
+	CHECK(KModbusTag_Read(&map, "run", &v) == KMODBUS_OK && v == 1.0);
+	CHECK(KModbusTag_Read(&map, "ready", &v) == KMODBUS_OK && v == 0.0);
+	KModbus_Commit();
+	CHECK(KModbus_BitTest(6) == 1 && KModbus_BitTest(10006) == 0);
+
+	CHECK(KModbusTag_Write(&map, "ready", 1.0) == KMODBUS_OK);
+	CHECK(KModbusTag_Write(&map, "run", 0.0) == KMODBUS_OK);
+	KModbus_Commit();
+	CHECK(KModbus_BitTest(6) == 0 && KModbus_BitTest(10006) == 1);
+	CHECK(KModbusTag_Read(&map, "ready", &v) == KMODBUS_OK && v == 1.0);
+
+	CHECK(KModbusTag_Write(&map, "level", 12.3) == KMODBUS_OK);
+	KModbus_Commit();
+	CHECK(KModbus_Get(40011) == 123);
+	CHECK(KModbusTag_Read(&map, "missing", &v) == KMODBUS_NON_EXISTENT_ADDRESS);
+	KModbusTag_Free(&map);
+
+	/* Out of range values saturate, NaN leaves the register alone */
+	CHECK(Parse(&map, "u,hreg,20,uint16\ns,hreg,21,int16\nl,hreg,22,int32\nul,hreg,24,uint32\n"));
+	CHECK(KModbusTag_Write(&map, "u", 1e20) == KMODBUS_OK && KModbusTag_Read(&map, "u", &v) == KMODBUS_OK && v == 65535.0);
+	CHECK(KModbusTag_Write(&map, "u", -1e20) == KMODBUS_OK && KModbusTag_Read(&map, "u", &v) == KMODBUS_OK && v == 0.0);
+	CHECK(KModbusTag_Write(&map, "s", 1e20) == KMODBUS_OK && KModbusTag_Read(&map, "s", &v) == KMODBUS_OK && v == 32767.0);
+	CHECK(KModbusTag_Write(&map, "s", -1e20) == KMODBUS_OK && KModbusTag_Read(&map, "s", &v) == KMODBUS_OK && v == -32768.0);
+	CHECK(KModbusTag_Write(&map, "l", 1e20) == KMODBUS_OK && KModbusTag_Read(&map, "l", &v) == KMODBUS_OK && v == 2147483647.0);
+	CHECK(KModbusTag_Write(&map, "l", -1e20) == KMODBUS_OK && KModbusTag_Read(&map, "l", &v) == KMODBUS_OK && v == -2147483648.0);
+	CHECK(KModbusTag_Write(&map, "ul", 1e20) == KMODBUS_OK && KModbusTag_Read(&map, "ul", &v) == KMODBUS_OK && v == 4294967295.0);
+	CHECK(KModbusTag_Write(&map, "s", -2.5) == KMODBUS_OK && KModbusTag_Read(&map, "s", &v) == KMODBUS_OK && v == -3.0);
+	CHECK(KModbusTag_Write(&map, "u", 7.0) == KMODBUS_OK);
+	v = 0.0;
+	CHECK(KModbusTag_Write(&map, "u", v / v) == KMODBUS_INVALID_PARAM);
+	CHECK(KModbusTag_Read(&map, "u", &v) == KMODBUS_OK && v == 7.0);
+	KModbusTag_Free(&map);
+}
@@ -1,1026 +1,2219 @@
-﻿/*
-MIT License
-
-Copyright © 2024 Koji Kobayashi All Rights Reserved.
-
-Permission is hereby granted, free of charge, to any person obtaining a copy of
-this software and associated documentation files (the “Software”), to deal in the
-Software without restriction, including without limitation the rights to use, copy,
-modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
-and to permit persons to whom the Software is furnished to do so, subject to the
-following conditions:
-
-The above copyright notice and this permission notice shall be included in all
-copies or substantial portions of the Software.
-
-THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
-EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
-MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
-NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
-HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
-WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
-OTHER DEALINGS IN THE SOFTWARE.
-
-*/
-#include	"KModbus.h"
-#include	<memory.h>
-
-#define	GET_TICK(fd)			(*((fd)->GetTick))()
-#define	GET_LAST_TICK(fd)		((fd)->LastTick)
-#define	SET_LAST_TICK(fd,d)		((fd)->LastTick=(d))
-#define	GET_NOCOMMTIME(fd)		((fd)->NoCommunicationTime)
-#define	SET_NOCOMMTIME(fd,d)	((fd)->NoCommunicationTime=(d))
-
-const int	QueryLength[18] = {
-	0,
-	6,		/* 01 */
-	6,		/* 02 */
-	6,		/* 03 */
-	6,		/* 04 */
-	6,		/* 05 */
-	6,		/* 06 */
-	0,
-	6,		/* 08 */
-	0,
-	0,
-	2,		/* 11 */
-	2,		/* 12 */
-	0,
-	0,
-	5,		/* 15 */
-	5,		/* 16 */
-	2		/* 17 */
-};
-
-static unsigned char	X0DM[ KMODBUS_X0_BUFSIZE ];
-static unsigned char	X1DM[ KMODBUS_X1_BUFSIZE ];
-static unsigned short	X3DM[ KMODBUS_X3_BUFSIZE ];
-static unsigned short	X4DM[ KMODBUS_X4_BUFSIZE ];
-
-static KMODBUS_STATUS	_SetXx(unsigned char *Base, int adrs, unsigned char *dt, int len)
-{
-	unsigned char	d, *pt;
-	int				bit_d;
-	int				idx_s;
-
-	idx_s = 0;
-	d = *dt++;
-	bit_d = adrs % 8;
-
-	pt = &Base[adrs / 8];
-
-	while(len--) {
-		if (d & (1 << idx_s)) {
-			*pt |= (1 << bit_d);
-		}
-		else {
-			*pt &= ~(1 << bit_d);
-		}
-		if (bit_d == 7) {
-			++pt;
-			bit_d = 0;
-		}
-		else {
-			++bit_d;
-		}
-		if (idx_s == 7) {
-			idx_s = 0;
-			d = *dt++;
-		}
-		else {
-			++idx_s;
-		}
-	}
-	return KMODBUS_OK;
-}
-
-static KMODBUS_STATUS	_SetRegXx(unsigned short* Base, int adrs, unsigned char* dt, int len)
-{
-	unsigned short	*pt, u16;
-
-	pt = &Base[adrs];
-
-	while (len--) {
-		u16 = ((unsigned short)(*dt++)) << 8;
-		u16 |= ((unsigned short)(*dt++));
-		*pt++ = u16;
-	}
-	return KMODBUS_OK;
-}
-
-KMODBUS_STATUS	SetX0(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X0_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _SetXx(X0DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	SetX1(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X1_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _SetXx(X1DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	SetX3(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X3_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _SetRegXx(X3DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	SetX4(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X4_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _SetRegXx(X4DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-static KMODBUS_STATUS	_GetXx(unsigned char* Base, int adrs, unsigned char* dt, int len)
-{
-	unsigned char	d, * pt;
-	int				bit_s;
-	int				idx_d;
-
-	idx_d = 0;
-	bit_s = adrs % 8;
-
-	pt = &Base[adrs / 8];
-	d = 0;
-
-	while (len--) {
-		if (*pt & (1 << bit_s)) {
-			d |= (1 << idx_d);
-		}
-		if (bit_s == 7) {
-			bit_s = 0;
-			++pt;
-		}
-		else {
-			++bit_s;
-		}
-		if (idx_d == 7) {
-			idx_d = 0;
-			*dt++ = d;
-			d = 0;
-		}
-		else {
-			++idx_d;
-		}
-	}
-	if (idx_d != 0) {
-		*dt = d;
-	}
-	return KMODBUS_OK;
-}
-
-static KMODBUS_STATUS	_GetRegXx(unsigned short* Base, int adrs, unsigned char* dt, int len)
-{
-	unsigned short* pt;
-	unsigned short	u16;
-
-	pt = &Base[adrs];
-
-	while (len--) {
-		u16 = *pt++;
-		*dt++ = (unsigned char)(u16 >> 8);
-		*dt++ = (unsigned char)(u16 & 0x00FF);
-	}
-	return KMODBUS_OK;
-}
-
-KMODBUS_STATUS	GetX0(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X0_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _GetXx(X0DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	GetX1(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X1_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _GetXx(X1DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	GetX3(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X3_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _GetRegXx(X3DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-KMODBUS_STATUS	GetX4(int adrs, unsigned char* dt, int len)
-{
-	KMODBUS_STATUS	ret;
-
-	if (adrs + len > KMODBUS_X4_SIZE) {
-		return KMODBUS_NON_EXISTENT_ADDRESS;
-	}
-	CRITICAL_SECTION_BEGIN
-	ret = _GetRegXx(X4DM, adrs, dt, len);
-	CRITICAL_SECTION_END
-	return ret;
-}
-
-
-unsigned short	KModbus_Get(int adrs)
-{
-	KMODBUS_STATUS		ret;
-	unsigned short		u16;
-	unsigned char		u8[2];
-
-	if (adrs < 1) {
-		return 0x0000;
-	}
-	if (adrs < 10001) {
-		ret = GetX0(adrs - 1, u8, 1);
-		if (ret != KMODBUS_OK ) {
-			return 0x0000;
-		}
-		return (u8[0] & 0x01) ? 0xFF00 : 0x0000;
-	}
-	if (adrs < 20001) {
-		ret = GetX1(adrs - 10001, u8, 1);
-		if (ret != KMODBUS_OK) {
-			return 0x0000;
-		}
-		return (u8[0] & 0x01) ? 0xFF00 : 0x0000;
-	}
-	if (adrs < 30001) {
-		return 0x0000;
-	}
-	if (adrs < 40001) {
-		ret = GetX3(adrs - 30001, u8, 1);
-		if (ret != KMODBUS_OK) {
-			return 0x0000;
-		}
-		u16 = KModbud_B2N(u8);
-		return u16;
-	}
-	if (adrs < 50001) {
-		ret = GetX4(adrs - 40001, u8, 1);
-		if (ret != KMODBUS_OK) {
-			return 0x0000;
-		}
-		u16 = KModbud_B2N(u8);
-		return u16;
-	}
-	return 0x0000;
-}
-void			KModbus_Set(int adrs, unsigned short reg)
-{
-	KMODBUS_STATUS		ret;
-	unsigned char		u8[2];
-
-	if (adrs < 1) {
-		return;
-	}
-	if (adrs < 10001) {
-		u8[0] = (reg == 0) ? 0x00 : 0x01;
-		ret = SetX0(adrs - 1, u8, 1);
-		return;
-	}
-	if (adrs < 20001) {
-		u8[0] = (reg == 0) ? 0x00 : 0x01;
-		ret = SetX1(adrs - 10001, u8, 1);
-		return;
-	}
-	if (adrs < 30001) {
-		return;
-	}
-	if (adrs < 40001) {
-		u8[0] = (unsigned char)(reg >> 8);
-		u8[1] = (unsigned char)(reg & 0x00FF);
-		ret = SetX3(adrs - 30001, u8, 1);
-		return;
-	}
-	if (adrs < 50001) {
-		u8[0] = (unsigned char)(reg >> 8);
-		u8[1] = (unsigned char)(reg & 0x00FF);
-		ret = SetX4(adrs - 40001, u8, 1);
-		return;
-	}
-}
-
-static void ExceptionResponse(PKModbus_t hd, KMODBUS_STATUS errcode)
-{
-	unsigned short		crc16;
-
-	hd->TxBuf[0] = hd->RxBuf[0];
-	hd->TxBuf[1] = hd->RxBuf[1] | 0x80;
-	switch (errcode) {
-		case KMODBUS_NON_EXISTENT_ADDRESS:
-			hd->TxBuf[2] = 0x02;
-			break;
-		case KMODBUS_UNSUPPORT_FUNCTION:
-			hd->TxBuf[2] = 0x01;
-			break;
-		case KMODBUS_INVALID_PARAM:
-		default:
-			hd->TxBuf[2] = 0x03;
-			break;
-	}
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 3);
-	hd->TxBuf[3] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[4] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	hd->Interface.Puts(hd->TxBuf, 5);
-}
-
-typedef	KMODBUS_STATUS(*ReadBitsFunc)(int adrs, unsigned char* dt, int len);
-typedef	KMODBUS_STATUS(*ReadRegsFunc)(int adrs, unsigned char* dt, int len);
-
-static KMODBUS_STATUS	entry_ReadBits(PKModbus_t hd, ReadBitsFunc func)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs, len, txlen;
-	unsigned char*	txptr;
-	unsigned char	bytecount;
-	unsigned short	crc16;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	len = KModbud_B2N(&hd->RxBuf[4]);
-	bytecount = (unsigned char)((len + 7) / 8);
-	txlen = (int)bytecount + 3;
-
-	txptr = hd->TxBuf;
-	*txptr++ = hd->RxBuf[0];
-	*txptr++ = hd->RxBuf[1];
-	*txptr++ = bytecount;
-	ret = (*func)(adrs, txptr, len);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-	txptr += bytecount;
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, txlen);
-	*txptr++ = (unsigned char)(crc16 & 0x00FF);
-	*txptr = (unsigned char)(crc16 >> 8);
-	txlen += 2;
-
-	hd->MessageCounter++;
-	return hd->Interface.Puts(hd->TxBuf, txlen);
-}
-
-static KMODBUS_STATUS	entry_ReadRegs(PKModbus_t hd, ReadRegsFunc func)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs, len, txlen;
-	unsigned char*	txptr;
-	unsigned char	bytecount;
-	unsigned short	crc16;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	len = KModbud_B2N(&hd->RxBuf[4]);
-	bytecount = (unsigned char)len * sizeof(unsigned short);
-	txlen = (int)bytecount + 3;
-
-	txptr = hd->TxBuf;
-	*txptr++ = hd->RxBuf[0];
-	*txptr++ = hd->RxBuf[1];
-	*txptr++ = bytecount;
-	ret = (*func)(adrs, txptr, len);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-	txptr += bytecount;
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, txlen);
-	*txptr++ = (unsigned char)(crc16 & 0x00FF);
-	*txptr = (unsigned char)(crc16 >> 8);
-	txlen += 2;
-
-	hd->MessageCounter++;
-	return hd->Interface.Puts(hd->TxBuf, txlen);
-}
-
-KMODBUS_STATUS	entry_ReadCoilStatus01(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-
-	ret = entry_ReadBits(hd, GetX0);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-KMODBUS_STATUS	entry_ReadInputStatus02(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-
-	ret = entry_ReadBits(hd, GetX1);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_ReadHoldingRegister03(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-
-	ret = entry_ReadRegs( hd, GetX4);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_ReadInputRegister04(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-
-	ret = entry_ReadRegs(hd, GetX3);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_ForceSingleCoil05(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs, data;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	data = KModbud_B2N(&hd->RxBuf[4]);
-	if (data != 0x0000 && data != 0xFF00) {
-		return KMODBUS_INVALID_PARAM;
-	}
-	ret = SetX0(adrs, &hd->RxBuf[4], 1);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->RxBuf, 8 );
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_PresetSingleRegister06(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	ret = SetX4(adrs, &hd->RxBuf[4], 1);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->RxBuf, 8);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-static KMODBUS_STATUS sub0_Diagnostics(PKModbus_t hd, unsigned short data)
-{
-	KMODBUS_STATUS	ret;
-
-	ret = hd->Interface.Puts(hd->RxBuf, 8);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-static KMODBUS_STATUS sub2_Diagnostics(PKModbus_t hd, unsigned short data)
-{
-	unsigned short	crc16;
-
-	memcpy(hd->TxBuf, hd->RxBuf, 4);
-	hd->TxBuf[4] = (unsigned char)(hd->DiagnosticRegister >> 8);
-	hd->TxBuf[5] = (unsigned char)(hd->DiagnosticRegister & 0x00FF);
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
-	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	return hd->Interface.Puts(hd->TxBuf, 8);
-}
-static KMODBUS_STATUS sub_resp_Diagnostics(PKModbus_t hd, unsigned short resp)
-{
-	unsigned short	crc16;
-
-	memcpy(hd->TxBuf, hd->RxBuf, 4);
-	hd->TxBuf[4] = (unsigned char)(resp >> 8);
-	hd->TxBuf[5] = (unsigned char)(resp & 0x00FF);
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
-	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	return hd->Interface.Puts(hd->TxBuf, 8);
-}
-KMODBUS_STATUS	entry_Diagnostics08(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	unsigned short	DiagnosticSubcode;
-	unsigned short	data;
-
-	DiagnosticSubcode = (unsigned short)KModbud_B2N(&hd->RxBuf[2]);
-	data = (unsigned short)KModbud_B2N(&hd->RxBuf[4]);
-
-	hd->MessageCounter++;
-
-	if (hd->ListenOnlyMode != 0) {
-		hd->NoResponseCount++;
-		if (DiagnosticSubcode != 1) {
-			return KMODBUS_OK;
-		}
-	}
-	switch (DiagnosticSubcode) {
-	case 0:
-		ret = sub0_Diagnostics(hd, data);
-		return ret;
-
-	case 1:
-		hd->MessageCounter = 0;
-		if (data == 0xFF00) {
-			hd->EventCounter = 0;
-		}
-		if (hd->ListenOnlyMode == 0) {
-			ret = sub0_Diagnostics(hd, data);
-		}
-		hd->ListenOnlyMode = 0;
-		return ret;
-
-	case 2:
-		ret = sub_resp_Diagnostics(hd, hd->DiagnosticRegister);
-		return ret;
-
-	case 4:
-		hd->ListenOnlyMode = 1;
-		return KMODBUS_OK;
-
-	case 10:
-		hd->MessageCounter = 0;
-		hd->EventCounter = 0;
-		hd->CRCErrorCounter = 0;
-		hd->DiagnosticRegister = 0;
-		hd->ExceptionErrorCount = 0;
-		hd->NoResponseCount = 0;
-		ret = sub0_Diagnostics(hd, data);
-		return ret;
-
-	case 11:
-	case 14:
-		ret = sub_resp_Diagnostics(hd, hd->MessageCounter);
-		return ret;
-
-	case 12:
-		ret = sub_resp_Diagnostics(hd, hd->CRCErrorCounter);
-		return ret;
-
-	case 13:
-	case 17:
-		ret = sub_resp_Diagnostics(hd, hd->ExceptionErrorCount);
-		return ret;
-
-	case 15:
-		ret = sub_resp_Diagnostics(hd, hd->NoResponseCount);
-		return ret;
-
-	case 18:
-		ret = sub_resp_Diagnostics(hd, 0 );
-		return ret;
-
-	}
-	ExceptionResponse(hd, 0x01);
-	return KMODBUS_UNSUPPORT_FUNCTION;
-}
-
-KMODBUS_STATUS	entry_FetchCommunicationEventCounter11(PKModbus_t hd)
-{
-	unsigned short	crc16;
-
-	hd->TxBuf[0] = hd->RxBuf[0];
-	hd->TxBuf[1] = hd->RxBuf[1];
-	hd->TxBuf[2] = 0x00;
-	hd->TxBuf[3] = 0x00;
-	hd->TxBuf[4] = (unsigned char)(hd->EventCounter >> 8);
-	hd->TxBuf[5] = (unsigned char)(hd->EventCounter & 0x00FF);
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
-	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	return hd->Interface.Puts(hd->TxBuf, 8);
-}
-
-KMODBUS_STATUS	entry_FetchCommunicationEventLog12(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	unsigned short	crc16;
-
-	hd->TxBuf[0] = hd->RxBuf[0];
-	hd->TxBuf[1] = hd->RxBuf[1];
-	hd->TxBuf[2] = 8;
-	hd->TxBuf[3] = 0x00;
-	hd->TxBuf[4] = 0x00;
-	hd->TxBuf[5] = (unsigned char)(hd->EventCounter >> 8);
-	hd->TxBuf[6] = (unsigned char)(hd->EventCounter & 0x00FF);
-	hd->TxBuf[7] = (unsigned char)(hd->MessageCounter >> 8);
-	hd->TxBuf[8] = (unsigned char)(hd->MessageCounter & 0x00FF);
-	hd->TxBuf[9] = 0;
-	hd->TxBuf[10] = 0;
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 11);
-	hd->TxBuf[11] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[12] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->TxBuf, 13);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_ForceMultipleCoils15(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs, len, i;
-	unsigned char	bytecount;
-	unsigned short	crc16;
-	unsigned char	*p_src, *p_des;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	len = KModbud_B2N(&hd->RxBuf[4]);
-	bytecount = (unsigned char)((len + 7) / 8);
-	if (hd->RxBuf[6] != bytecount) {
-		return KMODBUS_INVALID_PARAM;
-	}
-	ret = SetX0(adrs, &hd->RxBuf[7], len);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-	p_src = hd->RxBuf;
-	p_des = hd->TxBuf;
-	i = 6;
-	while (i--) {
-		*p_des++ = *p_src++;
-	}
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
-	*p_des++ = (unsigned char)(crc16 & 0x00FF);
-	*p_des++ = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->TxBuf, 8);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_PresetMultipleRegisters16(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	int				adrs, len, i;
-	unsigned char	bytecount;
-	unsigned short	crc16;
-	unsigned char* p_src, * p_des;
-
-	adrs = KModbud_B2N(&hd->RxBuf[2]);
-	len = KModbud_B2N(&hd->RxBuf[4]);
-	bytecount = (unsigned char)((len * sizeof(unsigned short)));
-	if (hd->RxBuf[6] != bytecount) {
-		return KMODBUS_INVALID_PARAM;
-	}
-	ret = SetX4(adrs, &hd->RxBuf[7], len);
-	if (ret != KMODBUS_OK) {
-		ExceptionResponse(hd, ret);
-		return ret;
-	}
-	p_src = hd->RxBuf;
-	p_des = hd->TxBuf;
-	i = 6;
-	while (i--) {
-		*p_des++ = *p_src++;
-	}
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
-	*p_des++ = (unsigned char)(crc16 & 0x00FF);
-	*p_des++ = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->TxBuf, 8);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-KMODBUS_STATUS	entry_ReportSlaveID17(PKModbus_t hd)
-{
-	KMODBUS_STATUS	ret;
-	unsigned short	crc16;
-
-	hd->TxBuf[0] = hd->RxBuf[0];
-	hd->TxBuf[1] = hd->RxBuf[1];
-	hd->TxBuf[2] = 8;
-	hd->TxBuf[3] = hd ->ID;
-	hd->TxBuf[4] = 0xFF;
-	hd->TxBuf[5] = 0x00;
-	hd->TxBuf[6] = 0x00;
-	hd->TxBuf[7] = 0x00;
-	hd->TxBuf[8] = 0x00;
-	hd->TxBuf[9] = 0x00;
-	hd->TxBuf[10] = 0x00;
-	crc16 = KModbus_CalcCRC16(hd->TxBuf, 11);
-	hd->TxBuf[11] = (unsigned char)(crc16 & 0x00FF);
-	hd->TxBuf[12] = (unsigned char)(crc16 >> 8);
-
-	hd->MessageCounter++;
-	ret = hd->Interface.Puts(hd->TxBuf, 13);
-	if (ret == KMODBUS_OK) {
-		hd->EventCounter++;
-	}
-	return ret;
-}
-
-typedef KMODBUS_STATUS (*KModbusHandler)(PKModbus_t);
-
-const KModbusHandler	KModbusHandler_Tbl[18] = {
-	0,
-	entry_ReadCoilStatus01,						/* 01 */
-	entry_ReadInputStatus02,					/* 02 */
-	entry_ReadHoldingRegister03,				/* 03 */
-	entry_ReadInputRegister04,					/* 04 */
-	entry_ForceSingleCoil05,					/* 05 */
-	entry_PresetSingleRegister06,				/* 06 */
-	0,
-	entry_Diagnostics08,						/* 08 */
-	0,
-	0,
-	entry_FetchCommunicationEventCounter11,		/* 11 */
-	entry_FetchCommunicationEventLog12,			/* 12 */
-	0,
-	0,
-	entry_ForceMultipleCoils15,					/* 15 */
-	entry_PresetMultipleRegisters16,			/* 16 */
-	entry_ReportSlaveID17						/* 17 */
-};
-
-KMODBUS_STATUS	KMODBUS_Get(unsigned char *c)
-{
-	
-	return KMODBUS_NODATA;
-}
-KMODBUS_STATUS	KMODBUS_Gets(unsigned char *buf, int len)
-{
-	
-	return KMODBUS_NODATA;
-}
-KMODBUS_STATUS	KMODBUS_Put(unsigned char c)
-{
-	
-	return KMODBUS_OK;
-}
-KMODBUS_STATUS	KMODBUS_Puts(unsigned char *buf, int len)
-{
-	
-	return KMODBUS_OK;
-}
-
-static KMODBUS_STATUS	KModbusGet( PKModbus_t hd, KMODBUS_TICK timeout, unsigned char *buf )
-{
-	KMODBUS_STATUS	ret;
-	KMODBUS_TICK	st;
-	
-	st = GET_TICK(hd);
-	
-	do{
-		ret = hd->Interface.Get(buf);
-		if( ret == KMODBUS_OK ){
-			return ret;
-		}
-		KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
-		
-	}while( (timeout == KMODBUS_FOREVER) || GET_TICK(hd) - st < timeout );
-	return KMODBUS_TIMEOUT;
-}
-
-/* Calculate the CRC16 of the buffer data */
-unsigned short	KModbus_CalcCRC16(unsigned char* buf, int len)
-{
-	int				i, lsb;
-	unsigned short	crc16 = 0xffff;
-	
-	while (len) {
-		crc16 ^= (unsigned short)*buf++;
-		for (i = 0; i < 8; i++) {
-			lsb = crc16 & 0x0001;
-			crc16 >>= 1;
-			if (lsb) {
-				crc16 ^= 0xA001;
-			}
-		}
-		--len;
-	}
-	return crc16;
-}
-
-/* Convert 16bit little endian to native order */
-unsigned short	KModbud_L2N(unsigned char* little16)
-{
-	unsigned short	naitive16;
-
-	naitive16 = (*little16);
-	++little16;
-	naitive16 |= ((unsigned short)(*little16)) << 8;
-	return naitive16;
-}
-
-/* Convert 16-bit big endian to native order */
-unsigned short	KModbud_B2N(unsigned char* big16)
-{
-	unsigned short	naitive16;
-
-	naitive16 = ((unsigned short)(*big16)) << 8;
-	++big16;
-	naitive16 |= (*big16);
-	return naitive16;
-}
-
-void	KModbus_Init(PKModbus_t hd)
-{
-	hd->ID = KMODBUS_ID;
-	hd->GetTick = KMODBUS_GETTICKCOUNT;
-	hd->Interface.Get = KMODBUS_GETCOM;
-	hd->Interface.Put = KMODBUS_PUTCOM;
-	hd->Interface.Puts = KMODBUS_PUTSCOM;
-
-	hd->ListenOnlyMode = 0;
-	hd->EventCounter = 0;
-	hd->MessageCounter = 0;
-	hd->DiagnosticRegister = 0;
-	hd->CRCErrorCounter = 0;
-	hd->ExceptionErrorCount = 0;
-	hd->NoResponseCount = 0;
-	hd->NoCommunicationTime = 10;
-
-	memset(X0DM, 0x00, sizeof(X0DM));
-	memset(X1DM, 0x00, sizeof(X1DM));
-	memset(X3DM, 0x00, sizeof(X3DM));
-	memset(X4DM, 0x00, sizeof(X4DM));
-}
-
-KMODBUS_STATUS	KModbusServer(PKModbus_t hd, int* ResQuit)
-{
-	KMODBUS_STATUS	ret;
-#ifdef _USE_NO_COMMNICATION_TIME_
-	KMODBUS_TICK	now;
-#endif
-	unsigned char	cd, * pt;
-	unsigned short	crc16;
-	int				len, cnt;
-
-	SET_LAST_TICK(hd, GET_TICK(hd));
-
-	for(;;){
-
-	sym_top:
-
-		KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
-
-		/* Monitor quit requests */
-		if (ResQuit) {
-			if (*ResQuit) {
-				return KMODBUS_OK;
-			}
-		}
-		/* Waiting for ID code reception */
-		ret = hd->Interface.Get(&cd);
-		if (ret != KMODBUS_OK || hd->ID != cd) {
-			goto sym_top;
-		}
-		SET_LAST_TICK(hd, GET_TICK(hd));
-		hd->RxBuf[0] = cd;
-
-		/* Function code reception */
-		ret = KModbusGet(hd, GET_NOCOMMTIME(hd), &cd);
-		if (ret != KMODBUS_OK) {
-			goto sym_top;
-		}
-		if (cd > 0x17) {
-			goto sym_top;
-		}
-		hd->RxBuf[1] = cd;
-
-		/* Fixed-length partial read */
-		len = QueryLength[cd];
-		pt = (unsigned char*)&hd->RxBuf[2];
-		cnt = len;
-		while (cnt--) {
-			ret = KModbusGet(hd, GET_NOCOMMTIME(hd), pt);
-			if (ret != KMODBUS_OK) {
-				goto sym_top;
-			}
-			++pt;
-		}
-		SET_LAST_TICK(hd, GET_TICK(hd));
-
-		/* Variable length partial read */
-		if (hd->RxBuf[1] == 15 || hd->RxBuf[1] == 16) {
-			cnt = hd->RxBuf[6] + 2;
-			len += cnt;
-			while (cnt--) {
-				ret = KModbusGet(hd, GET_NOCOMMTIME(hd), pt);
-				if (ret != KMODBUS_OK) {
-					goto sym_top;
-				}
-				++pt;
-			}
-			SET_LAST_TICK(hd, GET_TICK(hd));
-		}
-
-		/* Calculate the CRC16 of the buffer data */
-		crc16 = KModbus_CalcCRC16(&hd->RxBuf[0], len);
-		if (hd->RxBuf[len] != (crc16 & 0x00FF) || hd->RxBuf[len + 1] != (crc16 >> 8)) {
-			hd->CRCErrorCounter++;
-			goto sym_top;
-		}
-
-#ifdef _USE_NO_COMMNICATION_TIME_
-		/* Check no communication time */
-		for (;;) {
-			ret = hd->Interface.Get(&cd);
-			now = GET_TICK(hd);
-			if (ret != KMODBUS_OK) {
-				if (now - GET_LAST_TICK(hd) > GET_NOCOMMTIME(hd)) {
-					break;
-				}
-			}
-			else {
-				SET_LAST_TICK(hd, now);
-			}
-			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
-		}
-#endif
-		if (hd->RxBuf[1] > 0 && hd->RxBuf[1] < 18) {
-			if (hd->ListenOnlyMode == 0 || hd->RxBuf[1] == 8) {
-				if( KModbusHandler_Tbl[hd->RxBuf[1]] ){
-					ret = (*KModbusHandler_Tbl[hd->RxBuf[1]])(hd);
-				}
-			}
-		}
-
-		if (ResQuit) {
-			if (*ResQuit) {
-				break;
-			}
-		}
-	}
-	return KMODBUS_OK;
-}
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbus.h"
+#include	"KModbusAtomic.h"
+#include	<memory.h>
+
+#if KMODBUS_MAX_RXBUF < 16 || KMODBUS_MAX_TXBUF < 16
+#error	"KModbus.c: frame buffers below 16 bytes cannot hold the fixed responses"
+#endif
+
+/* Footprint report of the profile in the build output */
+#define	_KMODBUS_STR(x)			#x
+#define	KMODBUS_STR(x)			_KMODBUS_STR(x)
+#pragma message("KModbus profile " KMODBUS_PROFILE_NAME ": X0=" KMODBUS_STR(KMODBUS_X0_SIZE) " X1=" KMODBUS_STR(KMODBUS_X1_SIZE) " X3=" KMODBUS_STR(KMODBUS_X3_SIZE) " X4=" KMODBUS_STR(KMODBUS_X4_SIZE) " entries")
+#pragma message("KModbus profile " KMODBUS_PROFILE_NAME ": handle buffers " KMODBUS_STR(KMODBUS_MAX_RXBUF) "+" KMODBUS_STR(KMODBUS_MAX_TXBUF) " bytes, bank bytes in KModbus_BankBytes")
+#if KMODBUS_CRC_TABLE
+#pragma message("KModbus profile " KMODBUS_PROFILE_NAME ": CRC table (512 bytes)")
+#else
+#pragma message("KModbus profile " KMODBUS_PROFILE_NAME ": CRC bitwise")
+#endif
+
+#define	GET_TICK(fd)			(*((fd)->GetTick))()
+#define	GET_LAST_TICK(fd)		((fd)->LastTick)
+#define	SET_LAST_TICK(fd,d)		((fd)->LastTick=(d))
+#define	GET_NOCOMMTIME(fd)		((fd)->NoCommunicationTime)
+#define	SET_NOCOMMTIME(fd,d)	((fd)->NoCommunicationTime=(d))
+
+/* RxState of the frame parser */
+#define	RX_IDLE					(0)		/* Waiting for the address */
+#define	RX_FRAME				(1)		/* Collecting a query for this unit */
+#define	RX_SKIP					(2)		/* Ignoring bytes until the line is silent */
+#define	RX_PENDING				(3)		/* Complete query, waiting for the silent interval */
+
+const int	QueryLength[KMODBUS_FUNCTION_TBLSIZE] = {
+	0,
+	6,		/* 01 */
+	6,		/* 02 */
+	6,		/* 03 */
+	6,		/* 04 */
+	6,		/* 05 */
+	6,		/* 06 */
+	0,
+	6,		/* 08 */
+	0,
+	0,
+	2,		/* 11 */
+	2,		/* 12 */
+	0,
+	0,
+	5,		/* 15 */
+	5,		/* 16 */
+	2,		/* 17 */
+	0,
+	0,
+	0,
+	0,
+	8,		/* 22 */
+	9		/* 23 */
+};
+
+/* Position of the byte count of variable length queries */
+const int	QueryCountPos[KMODBUS_FUNCTION_TBLSIZE] = {
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0,
+	6,		/* 15 */
+	6,		/* 16 */
+	0, 0, 0, 0, 0, 0,
+	10		/* 23 */
+};
+
+/* Banks of size 0 are removed by the profile */
+#if KMODBUS_PROCESS_IMAGE
+/*
+	Process image: the server reads the front copy without the lock, the
+	application writes the back copy through KModbus_Set and publishes it
+	with KModbus_Commit. Bus writes are logged and merged at the commit.
+*/
+typedef struct KModbusImage_t {
+#if KMODBUS_X0_SIZE > 0
+	KMODBUS_ATOMIC64	X0DM[ KMODBUS_X0_BUFSIZE ];
+#endif
+#if KMODBUS_X1_SIZE > 0
+	KMODBUS_ATOMIC64	X1DM[ KMODBUS_X1_BUFSIZE ];
+#endif
+#if KMODBUS_X3_SIZE > 0
+	unsigned short	X3DM[ KMODBUS_X3_BUFSIZE ];
+#endif
+#if KMODBUS_X4_SIZE > 0
+	unsigned short	X4DM[ KMODBUS_X4_BUFSIZE ];
+#endif
+} KModbusImage_t, *PKModbusImage_t;
+
+static KModbusImage_t	Image[2];
+static KMODBUS_ATOMIC	ImageFront;
+static KMODBUS_ATOMIC	ImageSeq;		/* Commits, a reader retries when it moved */
+
+/* Bus writes since the last commit: bank, operation, address (2), count (2), data */
+static unsigned char	ImageLog[KMODBUS_IMAGE_LOG];
+static int				ImageLogLen;
+
+#define	LOG_HEADER			(6)
+#define	LOG_SET				(0)
+#define	LOG_MASK			(1)
+
+#define	BACK_IMAGE			(&Image[1 - ImageFront])	/* Application thread only */
+#else
+/* Coils and inputs are 64-bit words, single bits change with one atomic operation */
+#if KMODBUS_X0_SIZE > 0
+static KMODBUS_ATOMIC64	X0DM[ KMODBUS_X0_BUFSIZE ];
+#endif
+#if KMODBUS_X1_SIZE > 0
+static KMODBUS_ATOMIC64	X1DM[ KMODBUS_X1_BUFSIZE ];
+#endif
+#if KMODBUS_X3_SIZE > 0
+static unsigned short	X3DM[ KMODBUS_X3_BUFSIZE ];
+#endif
+#if KMODBUS_X4_SIZE > 0
+static unsigned short	X4DM[ KMODBUS_X4_BUFSIZE ];
+#endif
+#endif
+
+#if !KMODBUS_PROCESS_IMAGE
+/* Write versions of the register banks per 64 registers, see KModbusCache_t */
+#define	VERSION_SHIFT		(6)
+#if KMODBUS_X3_SIZE > 0
+static KMODBUS_ATOMIC	X3Version[((KMODBUS_X3_SIZE - 1) >> VERSION_SHIFT) + 1];
+#endif
+#if KMODBUS_X4_SIZE > 0
+static KMODBUS_ATOMIC	X4Version[((KMODBUS_X4_SIZE - 1) >> VERSION_SHIFT) + 1];
+#endif
+
+/* Called with the lock held, after the registers changed */
+static void	BumpVersion(KMODBUS_ATOMIC* ver, int adrs, int len)
+{
+	int		page;
+
+	for (page = adrs >> VERSION_SHIFT; page <= (adrs + len - 1) >> VERSION_SHIFT; page++) {
+		KMODBUS_ATOMIC_STORE(&ver[page], ver[page] + 1);
+	}
+}
+#endif
+
+/* Static RAM of the banks, shows in the map file */
+const unsigned long		KModbus_BankBytes = KMODBUS_BANK_BYTES;
+
+#if KMODBUS_X0_SIZE > 0 || KMODBUS_X1_SIZE > 0
+/* n (1-64) bits of the LSB-first string dt from bit off */
+static unsigned long long	LoadBits(const unsigned char* dt, int off, int n)
+{
+	unsigned long long	v;
+	int					i, bytes;
+
+	dt += off / 8;
+	off %= 8;
+	bytes = (off + n + 7) / 8;
+
+	v = 0;
+	for (i = 0; i < bytes && i < 8; i++) {
+		v |= (unsigned long long)dt[i] << (8 * i);
+	}
+	v >>= off;
+	if (bytes > 8) {
+		v |= (unsigned long long)dt[8] << (64 - off);
+	}
+	if (n < 64) {
+		v &= (1ULL << n) - 1;
+	}
+	return v;
+}
+
+/* Merge n bits of v into dt from bit off, the bits past them must be zero */
+static void	StoreBits(unsigned char* dt, int off, int n, unsigned long long v)
+{
+	dt += off / 8;
+	off %= 8;
+
+	*dt++ |= (unsigned char)(v << off);
+	v >>= 8 - off;
+	n -= 8 - off;
+	while (n > 0) {
+		*dt++ = (unsigned char)v;
+		v >>= 8;
+		n -= 8;
+	}
+}
+
+/*
+	Bulk writes replace each word with a compare-and-swap, so a concurrent
+	KModbus_BitSet/Clear/Toggle on the same word is never lost.
+*/
+static KMODBUS_STATUS	_SetXx(KMODBUS_ATOMIC64* Base, int adrs, const unsigned char* dt, int len)
+{
+	unsigned long long	old, mask, v;
+	int					bit, n, done;
+
+	Base += adrs / 64;
+	bit = adrs % 64;
+
+	for (done = 0; done < len; done += n) {
+		n = 64 - bit;
+		if (n > len - done) {
+			n = len - done;
+		}
+		mask = ((n < 64) ? ((1ULL << n) - 1) : ~0ULL) << bit;
+		v = LoadBits(dt, done, n) << bit;
+		do {
+			old = KMODBUS_ATOMIC64_LOAD(Base);
+		} while (!KMODBUS_ATOMIC64_CAS(Base, old, (old & ~mask) | v));
+		++Base;
+		bit = 0;
+	}
+	return KMODBUS_OK;
+}
+#endif
+
+#if KMODBUS_X3_SIZE > 0 || KMODBUS_X4_SIZE > 0
+static KMODBUS_STATUS	_SetRegXx(unsigned short* Base, int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_WIRE_ORDER
+	memcpy(&Base[adrs], dt, len * 2);
+#else
+	unsigned short	*pt, u16;
+
+	pt = &Base[adrs];
+
+	while (len--) {
+		u16 = ((unsigned short)(*dt++)) << 8;
+		u16 |= ((unsigned short)(*dt++));
+		*pt++ = u16;
+	}
+#endif
+	return KMODBUS_OK;
+}
+#endif
+
+#if KMODBUS_X4_SIZE > 0
+/* FC22 on one register, in the byte order of the bank */
+static void	_MaskReg(unsigned short* reg, unsigned short and_mask, unsigned short or_mask)
+{
+#if KMODBUS_WIRE_ORDER
+	unsigned char*	pt = (unsigned char*)reg;
+	unsigned short	u16;
+
+	u16 = KModbud_B2N(pt);
+	u16 = (u16 & and_mask) | (or_mask & ~and_mask);
+	pt[0] = (unsigned char)(u16 >> 8);
+	pt[1] = (unsigned char)(u16 & 0x00FF);
+#else
+	*reg = (*reg & and_mask) | (or_mask & ~and_mask);
+#endif
+}
+#endif
+
+#if KMODBUS_PROCESS_IMAGE
+static int	LogBytes(int bank, int op, int len)
+{
+	if (op == LOG_MASK) {
+		return 4;
+	}
+	if (bank == 0 || bank == 1) {
+		return (len + 7) / 8;
+	}
+	return len * 2;
+}
+
+/* Queue a bus write for the next commit */
+static KMODBUS_STATUS	LogWrite(int bank, int op, int adrs, unsigned char* dt, int len)
+{
+	KMODBUS_STATUS	ret;
+	unsigned char*	p;
+	int				bytes;
+
+	bytes = LogBytes(bank, op, len);
+	ret = KMODBUS_OK;
+	CRITICAL_SECTION_BEGIN
+	if (ImageLogLen + LOG_HEADER + bytes > KMODBUS_IMAGE_LOG) {
+		ret = KMODBUS_SLAVE_BUSY;		/* The master retries after the next commit */
+	}
+	else {
+		p = &ImageLog[ImageLogLen];
+		p[0] = (unsigned char)bank;
+		p[1] = (unsigned char)op;
+		p[2] = (unsigned char)(adrs >> 8);
+		p[3] = (unsigned char)(adrs & 0x00FF);
+		p[4] = (unsigned char)(len >> 8);
+		p[5] = (unsigned char)(len & 0x00FF);
+		memcpy(&p[LOG_HEADER], dt, bytes);
+		ImageLogLen += LOG_HEADER + bytes;
+	}
+	CRITICAL_SECTION_END
+	return ret;
+}
+
+/* Merge the logged bus writes into img in arrival order, the caller holds the lock */
+static void	ApplyLog(PKModbusImage_t img)
+{
+	unsigned char*	p;
+	int				pos, adrs, len;
+
+	pos = 0;
+	while (pos < ImageLogLen) {
+		p = &ImageLog[pos];
+		adrs = (p[2] << 8) | p[3];
+		len = (p[4] << 8) | p[5];
+
+		switch (p[0]) {
+#if KMODBUS_X0_SIZE > 0
+		case 0:
+			_SetXx(img->X0DM, adrs, &p[LOG_HEADER], len);
+			break;
+#endif
+#if KMODBUS_X1_SIZE > 0
+		case 1:
+			_SetXx(img->X1DM, adrs, &p[LOG_HEADER], len);
+			break;
+#endif
+#if KMODBUS_X3_SIZE > 0
+		case 3:
+			_SetRegXx(img->X3DM, adrs, &p[LOG_HEADER], len);
+			break;
+#endif
+#if KMODBUS_X4_SIZE > 0
+		case 4:
+			if (p[1] == LOG_MASK) {
+				_MaskReg(&img->X4DM[adrs], KModbud_B2N(&p[LOG_HEADER]), KModbud_B2N(&p[LOG_HEADER + 2]));
+			}
+			else {
+				_SetRegXx(img->X4DM, adrs, &p[LOG_HEADER], len);
+			}
+			break;
+#endif
+		}
+		pos += LOG_HEADER + LogBytes(p[0], p[1], len);
+	}
+	ImageLogLen = 0;
+}
+
+/* Lock-free read of the front image, retried when a commit overlapped it */
+static PKModbusImage_t	ReadBegin(long* seq)
+{
+	*seq = KMODBUS_ATOMIC_LOAD(&ImageSeq);
+	return &Image[KMODBUS_ATOMIC_LOAD(&ImageFront)];
+}
+
+static int	ReadRetry(long seq)
+{
+	KMODBUS_ATOMIC_FENCE();
+	return KMODBUS_ATOMIC_LOAD(&ImageSeq) != seq;
+}
+#endif
+
+KMODBUS_STATUS	SetX0(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X0_SIZE > 0
+	KMODBUS_STATUS	ret;
+
+	if (adrs + len > KMODBUS_X0_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	ret = LogWrite(0, LOG_SET, adrs, dt, len);
+#else
+	CRITICAL_SECTION_BEGIN
+	ret = _SetXx(X0DM, adrs, dt, len);
+	CRITICAL_SECTION_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	SetX1(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X1_SIZE > 0
+	KMODBUS_STATUS	ret;
+
+	if (adrs + len > KMODBUS_X1_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	ret = LogWrite(1, LOG_SET, adrs, dt, len);
+#else
+	CRITICAL_SECTION_BEGIN
+	ret = _SetXx(X1DM, adrs, dt, len);
+	CRITICAL_SECTION_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	SetX3(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X3_SIZE > 0
+	KMODBUS_STATUS	ret;
+
+	if (adrs + len > KMODBUS_X3_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	ret = LogWrite(3, LOG_SET, adrs, dt, len);
+#else
+	CRITICAL_SECTION_BEGIN
+	ret = _SetRegXx(X3DM, adrs, dt, len);
+	BumpVersion(X3Version, adrs, len);
+	CRITICAL_SECTION_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	SetX4(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X4_SIZE > 0
+	KMODBUS_STATUS	ret;
+
+	if (adrs + len > KMODBUS_X4_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	ret = LogWrite(4, LOG_SET, adrs, dt, len);
+#else
+	CRITICAL_SECTION_BEGIN
+	ret = _SetRegXx(X4DM, adrs, dt, len);
+	BumpVersion(X4Version, adrs, len);
+	CRITICAL_SECTION_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+#if KMODBUS_X0_SIZE > 0 || KMODBUS_X1_SIZE > 0
+/* One atomic load per word, the unused bits of the last byte are zero */
+static KMODBUS_STATUS	_GetXx(KMODBUS_ATOMIC64* Base, int adrs, unsigned char* dt, int len)
+{
+	unsigned long long	v;
+	int					bit, n, done;
+
+	memset(dt, 0x00, (len + 7) / 8);
+	Base += adrs / 64;
+	bit = adrs % 64;
+
+	for (done = 0; done < len; done += n) {
+		n = 64 - bit;
+		if (n > len - done) {
+			n = len - done;
+		}
+		v = KMODBUS_ATOMIC64_LOAD(Base) >> bit;
+		if (n < 64) {
+			v &= (1ULL << n) - 1;
+		}
+		StoreBits(dt, done, n, v);
+		++Base;
+		bit = 0;
+	}
+	return KMODBUS_OK;
+}
+#endif
+
+#if KMODBUS_X3_SIZE > 0 || KMODBUS_X4_SIZE > 0
+static KMODBUS_STATUS	_GetRegXx(unsigned short* Base, int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_WIRE_ORDER
+	memcpy(dt, &Base[adrs], len * 2);
+#else
+	unsigned short* pt;
+	unsigned short	u16;
+
+	pt = &Base[adrs];
+
+	while (len--) {
+		u16 = *pt++;
+		*dt++ = (unsigned char)(u16 >> 8);
+		*dt++ = (unsigned char)(u16 & 0x00FF);
+	}
+#endif
+	return KMODBUS_OK;
+}
+#endif
+
+KMODBUS_STATUS	GetX0(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X0_SIZE > 0
+	KMODBUS_STATUS	ret;
+#if KMODBUS_PROCESS_IMAGE
+	PKModbusImage_t	img;
+	long			seq;
+#endif
+
+	if (adrs + len > KMODBUS_X0_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	do {
+		img = ReadBegin(&seq);
+		ret = _GetXx(img->X0DM, adrs, dt, len);
+	} while (ReadRetry(seq));
+#else
+	CRITICAL_SECTION_READ_BEGIN
+	ret = _GetXx(X0DM, adrs, dt, len);
+	CRITICAL_SECTION_READ_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	GetX1(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X1_SIZE > 0
+	KMODBUS_STATUS	ret;
+#if KMODBUS_PROCESS_IMAGE
+	PKModbusImage_t	img;
+	long			seq;
+#endif
+
+	if (adrs + len > KMODBUS_X1_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	do {
+		img = ReadBegin(&seq);
+		ret = _GetXx(img->X1DM, adrs, dt, len);
+	} while (ReadRetry(seq));
+#else
+	CRITICAL_SECTION_READ_BEGIN
+	ret = _GetXx(X1DM, adrs, dt, len);
+	CRITICAL_SECTION_READ_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	GetX3(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X3_SIZE > 0
+	KMODBUS_STATUS	ret;
+#if KMODBUS_PROCESS_IMAGE
+	PKModbusImage_t	img;
+	long			seq;
+#endif
+
+	if (adrs + len > KMODBUS_X3_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	do {
+		img = ReadBegin(&seq);
+		ret = _GetRegXx(img->X3DM, adrs, dt, len);
+	} while (ReadRetry(seq));
+#else
+	CRITICAL_SECTION_READ_BEGIN
+	ret = _GetRegXx(X3DM, adrs, dt, len);
+	CRITICAL_SECTION_READ_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+KMODBUS_STATUS	GetX4(int adrs, unsigned char* dt, int len)
+{
+#if KMODBUS_X4_SIZE > 0
+	KMODBUS_STATUS	ret;
+#if KMODBUS_PROCESS_IMAGE
+	PKModbusImage_t	img;
+	long			seq;
+#endif
+
+	if (adrs + len > KMODBUS_X4_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	do {
+		img = ReadBegin(&seq);
+		ret = _GetRegXx(img->X4DM, adrs, dt, len);
+	} while (ReadRetry(seq));
+#else
+	CRITICAL_SECTION_READ_BEGIN
+	ret = _GetRegXx(X4DM, adrs, dt, len);
+	CRITICAL_SECTION_READ_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+/* Write then read the X4 bank under one lock acquisition */
+KMODBUS_STATUS	ReadWriteX4(int radrs, unsigned char* rdt, int rlen, int wadrs, unsigned char* wdt, int wlen)
+{
+#if KMODBUS_X4_SIZE > 0
+	KMODBUS_STATUS	ret;
+
+	if (radrs + rlen > KMODBUS_X4_SIZE || wadrs + wlen > KMODBUS_X4_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	/* The write shows from the next commit, the read sees the published scan */
+	ret = LogWrite(4, LOG_SET, wadrs, wdt, wlen);
+	if (ret == KMODBUS_OK) {
+		ret = GetX4(radrs, rdt, rlen);
+	}
+#else
+	CRITICAL_SECTION_BEGIN
+	ret = _SetRegXx(X4DM, wadrs, wdt, wlen);
+	BumpVersion(X4Version, wadrs, wlen);
+	if (ret == KMODBUS_OK) {
+		ret = _GetRegXx(X4DM, radrs, rdt, rlen);
+	}
+	CRITICAL_SECTION_END
+#endif
+	return ret;
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+/* Read-modify-write of one X4 register under the lock */
+KMODBUS_STATUS	MaskX4(int adrs, unsigned short and_mask, unsigned short or_mask)
+{
+#if KMODBUS_X4_SIZE > 0
+#if KMODBUS_PROCESS_IMAGE
+	unsigned char	mask[4];
+#endif
+
+	if (adrs + 1 > KMODBUS_X4_SIZE) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	mask[0] = (unsigned char)(and_mask >> 8);
+	mask[1] = (unsigned char)(and_mask & 0x00FF);
+	mask[2] = (unsigned char)(or_mask >> 8);
+	mask[3] = (unsigned char)(or_mask & 0x00FF);
+	return LogWrite(4, LOG_MASK, adrs, mask, 1);
+#else
+	CRITICAL_SECTION_BEGIN
+	_MaskReg(&X4DM[adrs], and_mask, or_mask);
+	BumpVersion(X4Version, adrs, 1);
+	CRITICAL_SECTION_END
+	return KMODBUS_OK;
+#endif
+#else
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+#endif
+}
+
+#if KMODBUS_PROCESS_IMAGE
+/* KModbus_Get/Set/Read/Write work on the back image without the lock, from the thread calling KModbus_Commit */
+static KMODBUS_STATUS	BackAccess(int bank, int adrs, unsigned char* dt, int len, int write)
+{
+	PKModbusImage_t	img;
+
+	img = BACK_IMAGE;
+	switch (bank) {
+#if KMODBUS_X0_SIZE > 0
+	case 0:
+		if (adrs + len > KMODBUS_X0_SIZE) {
+			break;
+		}
+		return write ? _SetXx(img->X0DM, adrs, dt, len) : _GetXx(img->X0DM, adrs, dt, len);
+#endif
+#if KMODBUS_X1_SIZE > 0
+	case 1:
+		if (adrs + len > KMODBUS_X1_SIZE) {
+			break;
+		}
+		return write ? _SetXx(img->X1DM, adrs, dt, len) : _GetXx(img->X1DM, adrs, dt, len);
+#endif
+#if KMODBUS_X3_SIZE > 0
+	case 3:
+		if (adrs + len > KMODBUS_X3_SIZE) {
+			break;
+		}
+		return write ? _SetRegXx(img->X3DM, adrs, dt, len) : _GetRegXx(img->X3DM, adrs, dt, len);
+#endif
+#if KMODBUS_X4_SIZE > 0
+	case 4:
+		if (adrs + len > KMODBUS_X4_SIZE) {
+			break;
+		}
+		return write ? _SetRegXx(img->X4DM, adrs, dt, len) : _GetRegXx(img->X4DM, adrs, dt, len);
+#endif
+	}
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+}
+#define	APP_GET(bank, adrs, dt, len)	BackAccess(bank, (adrs), (dt), (len), 0)
+#define	APP_SET(bank, adrs, dt, len)	BackAccess(bank, (adrs), (dt), (len), 1)
+#else
+#define	APP_GET(bank, adrs, dt, len)	GetX##bank((adrs), (dt), (len))
+#define	APP_SET(bank, adrs, dt, len)	SetX##bank((adrs), (dt), (len))
+#endif
+
+/*
+	Word and mask of coil 1-9999 or input 10001-19999, NULL when it does not
+	exist. With the process image the word is in the back copy, which only
+	the commit thread may touch: the atomics keep bus readers of a word
+	whole, they do not survive the copy at the commit.
+*/
+static KMODBUS_ATOMIC64*	BitWord(int adrs, unsigned long long* mask)
+{
+#if KMODBUS_PROCESS_IMAGE
+	PKModbusImage_t	img;
+
+	img = BACK_IMAGE;
+#define	BIT_BANK(x)		img->x
+#else
+#define	BIT_BANK(x)		x
+#endif
+	if (adrs < 1) {
+		return NULL;
+	}
+	if (adrs < 10001) {
+#if KMODBUS_X0_SIZE > 0
+		adrs -= 1;
+		if (adrs < KMODBUS_X0_SIZE) {
+			*mask = 1ULL << (adrs % 64);
+			return &BIT_BANK(X0DM)[adrs / 64];
+		}
+#endif
+		return NULL;
+	}
+	if (adrs < 20001) {
+#if KMODBUS_X1_SIZE > 0
+		adrs -= 10001;
+		if (adrs < KMODBUS_X1_SIZE) {
+			*mask = 1ULL << (adrs % 64);
+			return &BIT_BANK(X1DM)[adrs / 64];
+		}
+#endif
+		return NULL;
+	}
+#undef	BIT_BANK
+	return NULL;
+}
+
+int		KModbus_BitSet(int adrs)
+{
+	KMODBUS_ATOMIC64*	w;
+	unsigned long long	mask;
+
+	w = BitWord(adrs, &mask);
+	if (w == NULL) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return (KMODBUS_ATOMIC64_FETCH_OR(w, mask) & mask) != 0;
+}
+
+int		KModbus_BitClear(int adrs)
+{
+	KMODBUS_ATOMIC64*	w;
+	unsigned long long	mask;
+
+	w = BitWord(adrs, &mask);
+	if (w == NULL) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return (KMODBUS_ATOMIC64_FETCH_AND(w, ~mask) & mask) != 0;
+}
+
+int		KModbus_BitToggle(int adrs)
+{
+	KMODBUS_ATOMIC64*	w;
+	unsigned long long	mask;
+
+	w = BitWord(adrs, &mask);
+	if (w == NULL) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return (KMODBUS_ATOMIC64_FETCH_XOR(w, mask) & mask) != 0;
+}
+
+int		KModbus_BitTest(int adrs)
+{
+	KMODBUS_ATOMIC64*	w;
+	unsigned long long	mask;
+
+	w = BitWord(adrs, &mask);
+	if (w == NULL) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return (KMODBUS_ATOMIC64_LOAD(w) & mask) != 0;
+}
+
+/* Write every page back so it is present and private */
+static void	TouchPages(void* base, unsigned long bytes)
+{
+	volatile unsigned char*	p = (volatile unsigned char*)base;
+	unsigned long			i;
+
+	for (i = 0; i < bytes; i += 4096) {
+		p[i] = p[i];
+	}
+	if (bytes != 0) {
+		p[bytes - 1] = p[bytes - 1];
+	}
+}
+
+/* Fault in the banks up front, for real-time threads (see KModbusRt.h) */
+void	KModbus_Prefault(void (*touch)(void* p, unsigned long bytes))
+{
+	if (touch == 0) {
+		touch = TouchPages;
+	}
+#if KMODBUS_PROCESS_IMAGE
+	(*touch)(Image, sizeof(Image));
+	(*touch)(ImageLog, sizeof(ImageLog));
+#else
+#if KMODBUS_X0_SIZE > 0
+	(*touch)((void*)X0DM, sizeof(X0DM));
+#endif
+#if KMODBUS_X1_SIZE > 0
+	(*touch)((void*)X1DM, sizeof(X1DM));
+#endif
+#if KMODBUS_X3_SIZE > 0
+	(*touch)(X3DM, sizeof(X3DM));
+#endif
+#if KMODBUS_X4_SIZE > 0
+	(*touch)(X4DM, sizeof(X4DM));
+#endif
+#endif
+}
+
+/* Publish the back image as one scan, see KMODBUS_PROCESS_IMAGE */
+void	KModbus_Commit(void)
+{
+#if KMODBUS_PROCESS_IMAGE
+	long	back;
+
+	back = 1 - ImageFront;
+	CRITICAL_SECTION_BEGIN
+	ApplyLog(&Image[back]);
+	CRITICAL_SECTION_END
+
+	KMODBUS_ATOMIC_STORE(&ImageFront, back);
+	KMODBUS_ATOMIC_STORE(&ImageSeq, ImageSeq + 1);
+	KMODBUS_ATOMIC_FENCE();		/* Readers of the old front see the new sequence before it changes */
+
+	/* The next scan starts from the published one */
+	memcpy(&Image[1 - back], &Image[back], sizeof(KModbusImage_t));
+#endif
+}
+
+unsigned short	KModbus_Get(int adrs)
+{
+	KMODBUS_STATUS		ret;
+	unsigned short		u16;
+	unsigned char		u8[2];
+
+	if (adrs < 1) {
+		return 0x0000;
+	}
+	if (adrs < 20001) {
+		return (KModbus_BitTest(adrs) == 1) ? 0xFF00 : 0x0000;
+	}
+	if (adrs < 30001) {
+		return 0x0000;
+	}
+	if (adrs < 40001) {
+		ret = APP_GET(3, adrs - 30001, u8, 1);
+		if (ret != KMODBUS_OK) {
+			return 0x0000;
+		}
+		u16 = KModbud_B2N(u8);
+		return u16;
+	}
+	if (adrs < 50001) {
+		ret = APP_GET(4, adrs - 40001, u8, 1);
+		if (ret != KMODBUS_OK) {
+			return 0x0000;
+		}
+		u16 = KModbud_B2N(u8);
+		return u16;
+	}
+	return 0x0000;
+}
+void			KModbus_Set(int adrs, unsigned short reg)
+{
+	KMODBUS_STATUS		ret;
+	unsigned char		u8[2];
+
+	if (adrs < 1) {
+		return;
+	}
+	if (adrs < 20001) {
+		ret = (reg == 0) ? KModbus_BitClear(adrs) : KModbus_BitSet(adrs);
+		return;
+	}
+	if (adrs < 30001) {
+		return;
+	}
+	if (adrs < 40001) {
+		u8[0] = (unsigned char)(reg >> 8);
+		u8[1] = (unsigned char)(reg & 0x00FF);
+		ret = APP_SET(3, adrs - 30001, u8, 1);
+		return;
+	}
+	if (adrs < 50001) {
+		u8[0] = (unsigned char)(reg >> 8);
+		u8[1] = (unsigned char)(reg & 0x00FF);
+		ret = APP_SET(4, adrs - 40001, u8, 1);
+		return;
+	}
+}
+
+KMODBUS_STATUS	KModbus_Read(int bank, int adrs, unsigned char* dt, int len)
+{
+	if (adrs < 0 || len < 1) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	switch (bank) {
+	case 0:
+		return APP_GET(0, adrs, dt, len);
+	case 1:
+		return APP_GET(1, adrs, dt, len);
+	case 3:
+		return APP_GET(3, adrs, dt, len);
+	case 4:
+		return APP_GET(4, adrs, dt, len);
+	}
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+}
+
+KMODBUS_STATUS	KModbus_Write(int bank, int adrs, unsigned char* dt, int len)
+{
+	if (adrs < 0 || len < 1) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	switch (bank) {
+	case 0:
+		return APP_SET(0, adrs, dt, len);
+	case 1:
+		return APP_SET(1, adrs, dt, len);
+	case 3:
+		return APP_SET(3, adrs, dt, len);
+	case 4:
+		return APP_SET(4, adrs, dt, len);
+	}
+	return KMODBUS_NON_EXISTENT_ADDRESS;
+}
+
+unsigned long	KModbus_Version(int bank, int adrs, int len)
+{
+#if KMODBUS_PROCESS_IMAGE
+	return (unsigned long)KMODBUS_ATOMIC_LOAD(&ImageSeq);
+#else
+	KMODBUS_ATOMIC*	ver;
+	unsigned long	sum;
+	int				page, size;
+
+	switch (bank) {
+#if KMODBUS_X3_SIZE > 0
+	case 3:
+		ver = X3Version;
+		size = KMODBUS_X3_SIZE;
+		break;
+#endif
+#if KMODBUS_X4_SIZE > 0
+	case 4:
+		ver = X4Version;
+		size = KMODBUS_X4_SIZE;
+		break;
+#endif
+	default:
+		return 0;
+	}
+	if (adrs < 0 || len < 1 || adrs + len > size) {
+		return 0;		/* Answered with an exception, never cached */
+	}
+	sum = 0;
+	for (page = adrs >> VERSION_SHIFT; page <= (adrs + len - 1) >> VERSION_SHIFT; page++) {
+		sum += (unsigned long)KMODBUS_ATOMIC_LOAD(&ver[page]);
+	}
+	return sum;
+#endif
+}
+
+/* Send a response, nothing is sent for broadcast queries */
+static KMODBUS_STATUS	KModbusPuts(PKModbus_t hd, unsigned char* buf, int len)
+{
+	if (hd->RxBuf[0] == KMODBUS_BROADCAST_ID) {
+		return KMODBUS_OK;
+	}
+	KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_TX, buf, len, 1);
+	return hd->Interface.Puts(buf, len);
+}
+
+/* Function codes accepted from broadcast queries (writes only) */
+static int	IsBroadcastFunction(unsigned char cd)
+{
+	switch (cd) {
+	case 5:
+	case 6:
+	case 15:
+	case 16:
+	case 22:
+		return 1;
+	}
+	return 0;
+}
+
+static void ExceptionResponse(PKModbus_t hd, KMODBUS_STATUS errcode)
+{
+	unsigned short		crc16;
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1] | 0x80;
+	switch (errcode) {
+		case KMODBUS_NON_EXISTENT_ADDRESS:
+			hd->TxBuf[2] = 0x02;
+			break;
+		case KMODBUS_UNSUPPORT_FUNCTION:
+			hd->TxBuf[2] = 0x01;
+			break;
+		case KMODBUS_SLAVE_BUSY:
+			hd->TxBuf[2] = 0x06;
+			break;
+		case KMODBUS_INVALID_PARAM:
+		default:
+			hd->TxBuf[2] = 0x03;
+			break;
+	}
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 3);
+	hd->TxBuf[3] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[4] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	KModbusPuts(hd, hd->TxBuf, 5);
+}
+
+typedef	KMODBUS_STATUS(*ReadBitsFunc)(int adrs, unsigned char* dt, int len);
+typedef	KMODBUS_STATUS(*ReadRegsFunc)(int adrs, unsigned char* dt, int len);
+
+#if KMODBUS_USE_FC01 || KMODBUS_USE_FC02
+static KMODBUS_STATUS	entry_ReadBits(PKModbus_t hd, ReadBitsFunc func)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs, len, txlen;
+	unsigned char*	txptr;
+	unsigned char	bytecount;
+	unsigned short	crc16;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	len = KModbud_B2N(&hd->RxBuf[4]);
+	if (len < 1 || len > 2000 || (len + 7) / 8 + 5 > KMODBUS_MAX_TXBUF) {
+		ExceptionResponse(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	bytecount = (unsigned char)((len + 7) / 8);
+	txlen = (int)bytecount + 3;
+
+	txptr = hd->TxBuf;
+	*txptr++ = hd->RxBuf[0];
+	*txptr++ = hd->RxBuf[1];
+	*txptr++ = bytecount;
+	ret = (*func)(adrs, txptr, len);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	txptr += bytecount;
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, txlen);
+	*txptr++ = (unsigned char)(crc16 & 0x00FF);
+	*txptr = (unsigned char)(crc16 >> 8);
+	txlen += 2;
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, txlen);
+}
+#endif
+
+#if KMODBUS_USE_FC03 || KMODBUS_USE_FC04
+/* Version of the registers a FC03 (bank 4) or FC04 (bank 3) query reads */
+static unsigned long	RegVersion(unsigned char cd, int adrs, int len)
+{
+	return KModbus_Version(cd == 3 ? 4 : 3, adrs, len);
+}
+
+/* Entry of the query, or the least recently used one to replace (*found = 0) */
+static KModbusCacheEntry_t*	CacheSlot(PKModbusCache_t c, const unsigned char* q, int adrs, int len, int* found)
+{
+	KModbusCacheEntry_t*	e;
+	KModbusCacheEntry_t*	victim;
+	int						i;
+
+	victim = &c->Entry[0];
+	for (i = 0; i < KMODBUS_CACHE_ENTRIES; i++) {
+		e = &c->Entry[i];
+		if (e->Code == q[1] && e->Id == q[0] && e->Adrs == adrs && e->Count == len) {
+			*found = 1;
+			return e;
+		}
+		if (e->Used < victim->Used) {
+			victim = e;
+		}
+	}
+	*found = 0;
+	return victim;
+}
+
+static KMODBUS_STATUS	entry_ReadRegs(PKModbus_t hd, ReadRegsFunc func)
+{
+	KMODBUS_STATUS			ret;
+	int						adrs, len, txlen, found;
+	unsigned char*			txptr;
+	unsigned char			bytecount;
+	unsigned short			crc16;
+	KModbusCacheEntry_t*	e;
+	unsigned long			ver;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	len = KModbud_B2N(&hd->RxBuf[4]);
+	if (len < 1 || len > 125 || len * 2 + 5 > KMODBUS_MAX_TXBUF) {
+		ExceptionResponse(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+
+	/* A hit costs the version compare and the transmit */
+	e = 0;
+	ver = 0;
+	if (hd->Cache != 0) {
+		ver = RegVersion(hd->RxBuf[1], adrs, len);
+		e = CacheSlot(hd->Cache, hd->RxBuf, adrs, len, &found);
+		e->Used = ++hd->Cache->Clock;
+		if (found && e->Version == ver) {
+			hd->Cache->Hits++;
+			hd->MessageCounter++;
+			return KModbusPuts(hd, e->Frame, e->Length);
+		}
+		hd->Cache->Misses++;
+		if (found) {
+			hd->Cache->Stale++;
+		}
+		e->Code = 0;
+	}
+	bytecount = (unsigned char)len * sizeof(unsigned short);
+	txlen = (int)bytecount + 3;
+
+	txptr = hd->TxBuf;
+	*txptr++ = hd->RxBuf[0];
+	*txptr++ = hd->RxBuf[1];
+	*txptr++ = bytecount;
+	ret = (*func)(adrs, txptr, len);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	txptr += bytecount;
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, txlen);
+	*txptr++ = (unsigned char)(crc16 & 0x00FF);
+	*txptr = (unsigned char)(crc16 >> 8);
+	txlen += 2;
+
+	/* Kept only when no write came between the version and the read */
+	if (e != 0 && RegVersion(hd->RxBuf[1], adrs, len) == ver) {
+		memcpy(e->Frame, hd->TxBuf, txlen);
+		e->Length = (unsigned short)txlen;
+		e->Version = ver;
+		e->Id = hd->RxBuf[0];
+		e->Adrs = (unsigned short)adrs;
+		e->Count = (unsigned short)len;
+		e->Code = hd->RxBuf[1];
+	}
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, txlen);
+}
+#endif
+
+/* Attach a response cache to the handle, 0 removes it */
+void	KModbus_CacheInit(PKModbus_t hd, PKModbusCache_t cache)
+{
+	if (cache != 0) {
+		memset(cache, 0x00, sizeof(*cache));
+	}
+	hd->Cache = cache;
+}
+
+#if KMODBUS_USE_FC01
+KMODBUS_STATUS	entry_ReadCoilStatus01(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = entry_ReadBits(hd, GetX0);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+#if KMODBUS_USE_FC02
+KMODBUS_STATUS	entry_ReadInputStatus02(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = entry_ReadBits(hd, GetX1);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC03
+KMODBUS_STATUS	entry_ReadHoldingRegister03(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = entry_ReadRegs( hd, GetX4);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC04
+KMODBUS_STATUS	entry_ReadInputRegister04(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = entry_ReadRegs(hd, GetX3);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC05
+KMODBUS_STATUS	entry_ForceSingleCoil05(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs, data;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	data = KModbud_B2N(&hd->RxBuf[4]);
+	if (data != 0x0000 && data != 0xFF00) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	ret = SetX0(adrs, &hd->RxBuf[4], 1);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->RxBuf, 8);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC06
+KMODBUS_STATUS	entry_PresetSingleRegister06(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	ret = SetX4(adrs, &hd->RxBuf[4], 1);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->RxBuf, 8);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC08
+static KMODBUS_STATUS sub0_Diagnostics(PKModbus_t hd, unsigned short data)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = KModbusPuts(hd, hd->RxBuf, 8);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+static KMODBUS_STATUS sub2_Diagnostics(PKModbus_t hd, unsigned short data)
+{
+	unsigned short	crc16;
+
+	memcpy(hd->TxBuf, hd->RxBuf, 4);
+	hd->TxBuf[4] = (unsigned char)(hd->DiagnosticRegister >> 8);
+	hd->TxBuf[5] = (unsigned char)(hd->DiagnosticRegister & 0x00FF);
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
+	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, 8);
+}
+static KMODBUS_STATUS sub_resp_Diagnostics(PKModbus_t hd, unsigned short resp)
+{
+	unsigned short	crc16;
+
+	memcpy(hd->TxBuf, hd->RxBuf, 4);
+	hd->TxBuf[4] = (unsigned char)(resp >> 8);
+	hd->TxBuf[5] = (unsigned char)(resp & 0x00FF);
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
+	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, 8);
+}
+KMODBUS_STATUS	entry_Diagnostics08(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	unsigned short	DiagnosticSubcode;
+	unsigned short	data;
+
+	DiagnosticSubcode = (unsigned short)KModbud_B2N(&hd->RxBuf[2]);
+	data = (unsigned short)KModbud_B2N(&hd->RxBuf[4]);
+
+	hd->MessageCounter++;
+
+	if (hd->ListenOnlyMode != 0) {
+		hd->NoResponseCount++;
+		if (DiagnosticSubcode != 1) {
+			return KMODBUS_OK;
+		}
+	}
+	switch (DiagnosticSubcode) {
+	case 0:
+		ret = sub0_Diagnostics(hd, data);
+		return ret;
+
+	case 1:
+		hd->MessageCounter = 0;
+		if (data == 0xFF00) {
+			hd->EventCounter = 0;
+		}
+		if (hd->ListenOnlyMode == 0) {
+			ret = sub0_Diagnostics(hd, data);
+		}
+		hd->ListenOnlyMode = 0;
+		return ret;
+
+	case 2:
+		ret = sub_resp_Diagnostics(hd, hd->DiagnosticRegister);
+		return ret;
+
+	case 4:
+		hd->ListenOnlyMode = 1;
+		return KMODBUS_OK;
+
+	case 10:
+		hd->MessageCounter = 0;
+		hd->EventCounter = 0;
+		hd->CRCErrorCounter = 0;
+		hd->DiagnosticRegister = 0;
+		hd->ExceptionErrorCount = 0;
+		hd->NoResponseCount = 0;
+		hd->BroadcastCounter = 0;
+		ret = sub0_Diagnostics(hd, data);
+		return ret;
+
+	case 11:
+	case 14:
+		ret = sub_resp_Diagnostics(hd, hd->MessageCounter);
+		return ret;
+
+	case 12:
+		ret = sub_resp_Diagnostics(hd, hd->CRCErrorCounter);
+		return ret;
+
+	case 13:
+	case 17:
+		ret = sub_resp_Diagnostics(hd, hd->ExceptionErrorCount);
+		return ret;
+
+	case 15:
+		ret = sub_resp_Diagnostics(hd, hd->NoResponseCount);
+		return ret;
+
+	case 18:
+		ret = sub_resp_Diagnostics(hd, 0 );
+		return ret;
+
+	}
+	ExceptionResponse(hd, 0x01);
+	return KMODBUS_UNSUPPORT_FUNCTION;
+}
+#endif
+
+#if KMODBUS_USE_FC11
+KMODBUS_STATUS	entry_FetchCommunicationEventCounter11(PKModbus_t hd)
+{
+	unsigned short	crc16;
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1];
+	hd->TxBuf[2] = 0x00;
+	hd->TxBuf[3] = 0x00;
+	hd->TxBuf[4] = (unsigned char)(hd->EventCounter >> 8);
+	hd->TxBuf[5] = (unsigned char)(hd->EventCounter & 0x00FF);
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
+	hd->TxBuf[6] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[7] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, 8);
+}
+#endif
+
+#if KMODBUS_USE_FC12
+KMODBUS_STATUS	entry_FetchCommunicationEventLog12(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	unsigned short	crc16;
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1];
+	hd->TxBuf[2] = 8;
+	hd->TxBuf[3] = 0x00;
+	hd->TxBuf[4] = 0x00;
+	hd->TxBuf[5] = (unsigned char)(hd->EventCounter >> 8);
+	hd->TxBuf[6] = (unsigned char)(hd->EventCounter & 0x00FF);
+	hd->TxBuf[7] = (unsigned char)(hd->MessageCounter >> 8);
+	hd->TxBuf[8] = (unsigned char)(hd->MessageCounter & 0x00FF);
+	hd->TxBuf[9] = 0;
+	hd->TxBuf[10] = 0;
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 11);
+	hd->TxBuf[11] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[12] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->TxBuf, 13);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC15
+KMODBUS_STATUS	entry_ForceMultipleCoils15(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs, len, i;
+	unsigned short	crc16;
+	unsigned char	*p_src, *p_des;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	len = KModbud_B2N(&hd->RxBuf[4]);
+	/* The byte count has to carry every coil, SetX0 reads len bits from the frame */
+	if (len < 1 || len > 1968 || hd->RxBuf[6] != (len + 7) / 8) {
+		ExceptionResponse(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	ret = SetX0(adrs, &hd->RxBuf[7], len);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	p_src = hd->RxBuf;
+	p_des = hd->TxBuf;
+	i = 6;
+	while (i--) {
+		*p_des++ = *p_src++;
+	}
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
+	*p_des++ = (unsigned char)(crc16 & 0x00FF);
+	*p_des++ = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->TxBuf, 8);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC16
+KMODBUS_STATUS	entry_PresetMultipleRegisters16(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs, len, i;
+	unsigned short	crc16;
+	unsigned char* p_src, * p_des;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	len = KModbud_B2N(&hd->RxBuf[4]);
+	/* The byte count has to carry every register, SetX4 reads len * 2 bytes from the frame */
+	if (len < 1 || len > 123 || hd->RxBuf[6] != len * 2) {
+		ExceptionResponse(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	ret = SetX4(adrs, &hd->RxBuf[7], len);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	p_src = hd->RxBuf;
+	p_des = hd->TxBuf;
+	i = 6;
+	while (i--) {
+		*p_des++ = *p_src++;
+	}
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 6);
+	*p_des++ = (unsigned char)(crc16 & 0x00FF);
+	*p_des++ = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->TxBuf, 8);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC17
+KMODBUS_STATUS	entry_ReportSlaveID17(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	unsigned short	crc16;
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1];
+	hd->TxBuf[2] = 8;
+	hd->TxBuf[3] = hd ->ID;
+	hd->TxBuf[4] = 0xFF;
+	hd->TxBuf[5] = 0x00;
+	hd->TxBuf[6] = 0x00;
+	hd->TxBuf[7] = 0x00;
+	hd->TxBuf[8] = 0x00;
+	hd->TxBuf[9] = 0x00;
+	hd->TxBuf[10] = 0x00;
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, 11);
+	hd->TxBuf[11] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[12] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->TxBuf, 13);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC22
+KMODBUS_STATUS	entry_MaskWriteRegister22(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				adrs;
+
+	adrs = KModbud_B2N(&hd->RxBuf[2]);
+	ret = MaskX4(adrs, KModbud_B2N(&hd->RxBuf[4]), KModbud_B2N(&hd->RxBuf[6]));
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->RxBuf, 10);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+#if KMODBUS_USE_FC23
+KMODBUS_STATUS	entry_ReadWriteMultipleRegisters23(PKModbus_t hd)
+{
+	KMODBUS_STATUS	ret;
+	int				radrs, rlen, wadrs, wlen, txlen;
+	unsigned char*	txptr;
+	unsigned char	bytecount;
+	unsigned short	crc16;
+
+	radrs = KModbud_B2N(&hd->RxBuf[2]);
+	rlen = KModbud_B2N(&hd->RxBuf[4]);
+	wadrs = KModbud_B2N(&hd->RxBuf[6]);
+	wlen = KModbud_B2N(&hd->RxBuf[8]);
+	if (rlen < 1 || rlen > 125 || wlen < 1 || wlen > 121 || hd->RxBuf[10] != wlen * 2 || rlen * 2 + 5 > KMODBUS_MAX_TXBUF) {
+		ExceptionResponse(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	bytecount = (unsigned char)(rlen * sizeof(unsigned short));
+	txlen = (int)bytecount + 3;
+
+	txptr = hd->TxBuf;
+	*txptr++ = hd->RxBuf[0];
+	*txptr++ = hd->RxBuf[1];
+	*txptr++ = bytecount;
+	ret = ReadWriteX4(radrs, txptr, rlen, wadrs, &hd->RxBuf[11], wlen);
+	if (ret != KMODBUS_OK) {
+		ExceptionResponse(hd, ret);
+		return ret;
+	}
+	txptr += bytecount;
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, txlen);
+	*txptr++ = (unsigned char)(crc16 & 0x00FF);
+	*txptr = (unsigned char)(crc16 >> 8);
+	txlen += 2;
+
+	hd->MessageCounter++;
+	ret = KModbusPuts(hd, hd->TxBuf, txlen);
+	if (ret == KMODBUS_OK) {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+#endif
+
+/* Handlers of the function codes disabled by the profile are left out */
+#if KMODBUS_USE_FC01
+#define	ENTRY_01	entry_ReadCoilStatus01
+#else
+#define	ENTRY_01	0
+#endif
+#if KMODBUS_USE_FC02
+#define	ENTRY_02	entry_ReadInputStatus02
+#else
+#define	ENTRY_02	0
+#endif
+#if KMODBUS_USE_FC03
+#define	ENTRY_03	entry_ReadHoldingRegister03
+#else
+#define	ENTRY_03	0
+#endif
+#if KMODBUS_USE_FC04
+#define	ENTRY_04	entry_ReadInputRegister04
+#else
+#define	ENTRY_04	0
+#endif
+#if KMODBUS_USE_FC05
+#define	ENTRY_05	entry_ForceSingleCoil05
+#else
+#define	ENTRY_05	0
+#endif
+#if KMODBUS_USE_FC06
+#define	ENTRY_06	entry_PresetSingleRegister06
+#else
+#define	ENTRY_06	0
+#endif
+#if KMODBUS_USE_FC08
+#define	ENTRY_08	entry_Diagnostics08
+#else
+#define	ENTRY_08	0
+#endif
+#if KMODBUS_USE_FC11
+#define	ENTRY_11	entry_FetchCommunicationEventCounter11
+#else
+#define	ENTRY_11	0
+#endif
+#if KMODBUS_USE_FC12
+#define	ENTRY_12	entry_FetchCommunicationEventLog12
+#else
+#define	ENTRY_12	0
+#endif
+#if KMODBUS_USE_FC15
+#define	ENTRY_15	entry_ForceMultipleCoils15
+#else
+#define	ENTRY_15	0
+#endif
+#if KMODBUS_USE_FC16
+#define	ENTRY_16	entry_PresetMultipleRegisters16
+#else
+#define	ENTRY_16	0
+#endif
+#if KMODBUS_USE_FC17
+#define	ENTRY_17	entry_ReportSlaveID17
+#else
+#define	ENTRY_17	0
+#endif
+#if KMODBUS_USE_FC22
+#define	ENTRY_22	entry_MaskWriteRegister22
+#else
+#define	ENTRY_22	0
+#endif
+#if KMODBUS_USE_FC23
+#define	ENTRY_23	entry_ReadWriteMultipleRegisters23
+#else
+#define	ENTRY_23	0
+#endif
+
+const KModbusHandler	KModbusHandler_Tbl[KMODBUS_FUNCTION_TBLSIZE] = {
+	0,
+	ENTRY_01,					/* 01 */
+	ENTRY_02,					/* 02 */
+	ENTRY_03,					/* 03 */
+	ENTRY_04,					/* 04 */
+	ENTRY_05,					/* 05 */
+	ENTRY_06,					/* 06 */
+	0,
+	ENTRY_08,					/* 08 */
+	0,
+	0,
+	ENTRY_11,					/* 11 */
+	ENTRY_12,					/* 12 */
+	0,
+	0,
+	ENTRY_15,					/* 15 */
+	ENTRY_16,					/* 16 */
+	ENTRY_17,					/* 17 */
+	0,
+	0,
+	0,
+	0,
+	ENTRY_22,					/* 22 */
+	ENTRY_23						/* 23 */
+};
+
+/* Function codes served by the application, see KModbus_RegisterFunction */
+typedef struct UserFunction_t {
+	KModbusHandler	Handler;
+	void*			Context;
+	unsigned char	Code;
+	unsigned char	Length;
+	unsigned char	CountPos;
+} UserFunction_t;
+
+static UserFunction_t	UserFunction[KMODBUS_USER_FUNCTIONS];
+
+static KModbusHandler	FindHandler(unsigned char cd, int* qlen, int* countpos)
+{
+	int		i;
+
+	if (cd < KMODBUS_FUNCTION_TBLSIZE && KModbusHandler_Tbl[cd] != 0) {
+		*qlen = QueryLength[cd];
+		*countpos = QueryCountPos[cd];
+		return KModbusHandler_Tbl[cd];
+	}
+	for (i = 0; i < KMODBUS_USER_FUNCTIONS; i++) {
+		if (UserFunction[i].Handler != 0 && UserFunction[i].Code == cd) {
+			*qlen = UserFunction[i].Length;
+			*countpos = UserFunction[i].CountPos;
+			return UserFunction[i].Handler;
+		}
+	}
+	return 0;
+}
+
+KMODBUS_STATUS	KModbus_RegisterFunction(unsigned char cd, KModbusHandler handler, int qlen, int countpos)
+{
+	return KModbus_RegisterFunctionContext(cd, handler, qlen, countpos, 0);
+}
+
+KMODBUS_STATUS	KModbus_RegisterFunctionContext(unsigned char cd, KModbusHandler handler, int qlen, int countpos, void* context)
+{
+	int		i, slot;
+
+	if (cd == 0 || cd >= 0x80 || (cd < KMODBUS_FUNCTION_TBLSIZE && KModbusHandler_Tbl[cd] != 0)) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (qlen < 2 || qlen + 2 > KMODBUS_MAX_RXBUF || countpos < 0 || countpos >= qlen) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	slot = -1;
+	for (i = 0; i < KMODBUS_USER_FUNCTIONS; i++) {
+		if (UserFunction[i].Handler != 0 && UserFunction[i].Code == cd) {
+			break;
+		}
+		if (UserFunction[i].Handler == 0 && slot < 0) {
+			slot = i;
+		}
+	}
+	if (i == KMODBUS_USER_FUNCTIONS) {
+		if (handler == 0) {
+			return KMODBUS_OK;
+		}
+		if (slot < 0) {
+			return KMODBUS_INVALID_PARAM;
+		}
+		i = slot;
+	}
+	UserFunction[i].Code = cd;
+	UserFunction[i].Length = (unsigned char)qlen;
+	UserFunction[i].CountPos = (unsigned char)countpos;
+	UserFunction[i].Context = context;
+	UserFunction[i].Handler = handler;
+	return KMODBUS_OK;
+}
+
+void*	KModbus_FunctionContext(unsigned char cd)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_USER_FUNCTIONS; i++) {
+		if (UserFunction[i].Handler != 0 && UserFunction[i].Code == cd) {
+			return UserFunction[i].Context;
+		}
+	}
+	return 0;
+}
+
+KMODBUS_STATUS	KModbus_Respond(PKModbus_t hd, int len)
+{
+	unsigned short	crc16;
+
+	if (len < 2 || len + 2 > KMODBUS_MAX_TXBUF) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	crc16 = KModbus_CalcCRC16(hd->TxBuf, len);
+	hd->TxBuf[len] = (unsigned char)(crc16 & 0x00FF);
+	hd->TxBuf[len + 1] = (unsigned char)(crc16 >> 8);
+
+	hd->MessageCounter++;
+	return KModbusPuts(hd, hd->TxBuf, len + 2);
+}
+
+void	KModbus_Exception(PKModbus_t hd, KMODBUS_STATUS errcode)
+{
+	ExceptionResponse(hd, errcode);
+}
+
+KMODBUS_STATUS	KMODBUS_Get(unsigned char *c)
+{
+	
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	KMODBUS_Gets(unsigned char *buf, int len)
+{
+	
+	return KMODBUS_NODATA;
+}
+KMODBUS_STATUS	KMODBUS_Put(unsigned char c)
+{
+	
+	return KMODBUS_OK;
+}
+KMODBUS_STATUS	KMODBUS_Puts(unsigned char *buf, int len)
+{
+	
+	return KMODBUS_OK;
+}
+
+#if KMODBUS_CRC_TABLE
+/* CRC16 (polynomial 0xA001) of every byte value */
+static const unsigned short	CRC16Tbl[256] = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+/* Calculate the CRC16 of the buffer data */
+unsigned short	KModbus_CalcCRC16(unsigned char* buf, int len)
+{
+	unsigned short	crc16 = 0xffff;
+
+	while (len) {
+		crc16 = (crc16 >> 8) ^ CRC16Tbl[(crc16 ^ *buf++) & 0x00FF];
+		--len;
+	}
+	return crc16;
+}
+#else
+/* Calculate the CRC16 of the buffer data */
+unsigned short	KModbus_CalcCRC16(unsigned char* buf, int len)
+{
+	int				i, lsb;
+	unsigned short	crc16 = 0xffff;
+	
+	while (len) {
+		crc16 ^= (unsigned short)*buf++;
+		for (i = 0; i < 8; i++) {
+			lsb = crc16 & 0x0001;
+			crc16 >>= 1;
+			if (lsb) {
+				crc16 ^= 0xA001;
+			}
+		}
+		--len;
+	}
+	return crc16;
+}
+#endif
+
+/* Convert 16bit little endian to native order */
+unsigned short	KModbud_L2N(unsigned char* little16)
+{
+	unsigned short	naitive16;
+
+	naitive16 = (*little16);
+	++little16;
+	naitive16 |= ((unsigned short)(*little16)) << 8;
+	return naitive16;
+}
+
+/* Convert 16-bit big endian to native order */
+unsigned short	KModbud_B2N(unsigned char* big16)
+{
+	unsigned short	naitive16;
+
+	naitive16 = ((unsigned short)(*big16)) << 8;
+	++big16;
+	naitive16 |= (*big16);
+	return naitive16;
+}
+
+/* Handle only, the banks are shared by every handle and keep their contents */
+void	KModbus_InitHandle(PKModbus_t hd)
+{
+	hd->ID = KMODBUS_ID;
+	hd->GetTick = KMODBUS_GETTICKCOUNT;
+	hd->Interface.Get = KMODBUS_GETCOM;
+	hd->Interface.Put = KMODBUS_PUTCOM;
+	hd->Interface.Puts = KMODBUS_PUTSCOM;
+	hd->Capture = 0;
+	hd->CaptureContext = 0;
+	hd->Health = 0;
+	hd->Cache = 0;
+	hd->Accept = 0;
+	hd->Dispatch = 0;
+	hd->Transaction = 0;
+
+	hd->ListenOnlyMode = 0;
+	hd->EventCounter = 0;
+	hd->MessageCounter = 0;
+	hd->DiagnosticRegister = 0;
+	hd->CRCErrorCounter = 0;
+	hd->ExceptionErrorCount = 0;
+	hd->NoResponseCount = 0;
+	hd->BroadcastCounter = 0;
+	hd->NoCommunicationTime = 10;
+	hd->TurnaroundDelay = KMODBUS_TURNAROUND_DELAY;
+	hd->RxLen = 0;
+	hd->RxState = RX_IDLE;
+}
+
+/* Clear the banks, once before any handle serves them */
+void	KModbus_InitBanks(void)
+{
+#if KMODBUS_PROCESS_IMAGE
+	memset(Image, 0x00, sizeof(Image));
+	ImageFront = 0;
+	KMODBUS_ATOMIC_STORE(&ImageSeq, ImageSeq + 1);		/* Also voids every response cache */
+	ImageLogLen = 0;
+#else
+#if KMODBUS_X0_SIZE > 0
+	memset((void*)X0DM, 0x00, sizeof(X0DM));
+#endif
+#if KMODBUS_X1_SIZE > 0
+	memset((void*)X1DM, 0x00, sizeof(X1DM));
+#endif
+#if KMODBUS_X3_SIZE > 0
+	memset(X3DM, 0x00, sizeof(X3DM));
+	BumpVersion(X3Version, 0, KMODBUS_X3_SIZE);
+#endif
+#if KMODBUS_X4_SIZE > 0
+	memset(X4DM, 0x00, sizeof(X4DM));
+	BumpVersion(X4Version, 0, KMODBUS_X4_SIZE);
+#endif
+#endif
+}
+
+void	KModbus_Init(PKModbus_t hd)
+{
+	KModbus_InitHandle(hd);
+	KModbus_InitBanks();
+}
+
+/* Length of the query in buf without the CRC (0: more data needed, -1: unsupported) */
+int		KModbus_QueryLength(const unsigned char* buf, int len)
+{
+	int		qlen, countpos;
+
+	if (len < 2) {
+		return 0;
+	}
+	if (FindHandler(buf[1], &qlen, &countpos) == 0) {
+		return -1;
+	}
+	/* ID and code take the place of the CRC */
+	if (countpos != 0) {
+		if (len <= countpos) {
+			return 0;
+		}
+		qlen = countpos + 1 + buf[countpos];
+	}
+	if (qlen + 2 > KMODBUS_MAX_RXBUF) {
+		return -1;
+	}
+	return qlen;
+}
+
+/* Address byte of a query this handle answers */
+static int	AcceptUnit(PKModbus_t hd, unsigned char id)
+{
+	if (id == hd->ID || id == KMODBUS_BROADCAST_ID) {
+		return 1;
+	}
+	return hd->Accept != 0 && (*hd->Accept)(hd, id);
+}
+
+/* Execute the query in hd->RxBuf, the response goes out through hd->Interface */
+KMODBUS_STATUS	KModbus_Dispatch(PKModbus_t hd)
+{
+	KModbusHandler	handler;
+	int				qlen, countpos;
+
+	handler = hd->Dispatch;
+	if (handler == 0) {
+		handler = FindHandler(hd->RxBuf[1], &qlen, &countpos);
+	}
+	if (handler == 0) {
+		return KMODBUS_UNSUPPORT_FUNCTION;
+	}
+	if (hd->RxBuf[0] == KMODBUS_BROADCAST_ID) {
+		/* Broadcast writes are executed but never answered */
+		if (!IsBroadcastFunction(hd->RxBuf[1]) || hd->ListenOnlyMode != 0) {
+			return KMODBUS_NOT_RESPONSE;
+		}
+		hd->BroadcastCounter++;
+		hd->NoResponseCount++;
+		return (*handler)(hd);
+	}
+	if (hd->ListenOnlyMode != 0 && hd->RxBuf[1] != 8) {
+		return KMODBUS_NOT_RESPONSE;
+	}
+	return (*handler)(hd);
+}
+
+/* Execute one complete RTU query (address to CRC) received as a whole */
+KMODBUS_STATUS	KModbus_Execute(PKModbus_t hd, const unsigned char* frame, int len)
+{
+	unsigned short	crc16;
+	int				qlen;
+
+	if (len < 4 || !AcceptUnit(hd, frame[0])) {
+		return KMODBUS_NOT_RESPONSE;
+	}
+	qlen = KModbus_QueryLength(frame, len);
+	if (qlen <= 0) {
+		return KMODBUS_UNSUPPORT_FUNCTION;
+	}
+	if (qlen + 2 != len) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	crc16 = KModbus_CalcCRC16((unsigned char*)frame, qlen);
+	if (frame[qlen] != (crc16 & 0x00FF) || frame[qlen + 1] != (crc16 >> 8)) {
+		KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_RX, frame, len, 0);
+		hd->CRCErrorCounter++;
+		return KMODBUS_INVALID_PARAM;
+	}
+	KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_RX, frame, len, 1);
+	memcpy(hd->RxBuf, frame, len);
+	return KModbus_Dispatch(hd);
+}
+
+/* A complete query was received, check it and execute it now or after the silent interval */
+static void	FrameReceived(PKModbus_t hd)
+{
+	unsigned short	crc16;
+	int				len;
+
+	len = hd->RxLen - 2;
+	crc16 = KModbus_CalcCRC16(&hd->RxBuf[0], len);
+	if (hd->RxBuf[len] != (crc16 & 0x00FF) || hd->RxBuf[len + 1] != (crc16 >> 8)) {
+		KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_RX, hd->RxBuf, hd->RxLen, 0);
+		hd->CRCErrorCounter++;
+		hd->RxState = RX_SKIP;
+		return;
+	}
+	KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_RX, hd->RxBuf, hd->RxLen, 1);
+#ifdef _USE_NO_COMMNICATION_TIME_
+	hd->RxState = RX_PENDING;
+#else
+	hd->RxState = RX_IDLE;
+	KModbus_Dispatch(hd);
+#endif
+}
+
+void	KModbus_Tick(PKModbus_t hd, KMODBUS_TICK now)
+{
+	if (hd->RxState == RX_IDLE || now - GET_LAST_TICK(hd) <= GET_NOCOMMTIME(hd)) {
+		return;
+	}
+	if (hd->RxState == RX_PENDING) {
+		hd->RxState = RX_IDLE;
+		KModbus_Dispatch(hd);
+		return;
+	}
+	/* Partial query timed out, or the foreign frame ended */
+	hd->RxState = RX_IDLE;
+}
+
+void	KModbus_Feed(PKModbus_t hd, const unsigned char* bytes, int n, KMODBUS_TICK now)
+{
+	int		qlen;
+
+	KModbus_Tick(hd, now);
+
+	while (n-- > 0) {
+		SET_LAST_TICK(hd, now);
+
+		switch (hd->RxState) {
+		case RX_IDLE:
+			if (!AcceptUnit(hd, *bytes)) {
+				hd->RxState = RX_SKIP;
+				break;
+			}
+			hd->RxBuf[0] = *bytes;
+			hd->RxLen = 1;
+			hd->RxState = RX_FRAME;
+			break;
+
+		case RX_FRAME:
+			hd->RxBuf[hd->RxLen++] = *bytes;
+			qlen = KModbus_QueryLength(hd->RxBuf, hd->RxLen);
+			if (qlen < 0) {
+				hd->RxState = RX_SKIP;
+			}
+			else if (qlen > 0 && hd->RxLen == qlen + 2) {
+				FrameReceived(hd);
+			}
+			break;
+
+		case RX_PENDING:
+			/* Bytes inside the silent interval only delay the execution */
+		case RX_SKIP:
+		default:
+			break;
+		}
+		++bytes;
+	}
+}
+
+KMODBUS_STATUS	KModbusServer(PKModbus_t hd, int* ResQuit)
+{
+	unsigned char	cd;
+
+	hd->RxLen = 0;
+	hd->RxState = RX_IDLE;
+	SET_LAST_TICK(hd, GET_TICK(hd));
+
+	for(;;){
+		KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+
+		/* Monitor quit requests */
+		if (ResQuit) {
+			if (*ResQuit) {
+				break;
+			}
+		}
+		while (hd->Interface.Get(&cd) == KMODBUS_OK) {
+			KModbus_Feed(hd, &cd, 1, GET_TICK(hd));
+		}
+		KModbus_Tick(hd, GET_TICK(hd));
+	}
+	return KMODBUS_OK;
+}
@@ -1,135 +1,332 @@
-﻿/*
-MIT License
-
-Copyright © 2024 Koji Kobayashi All Rights Reserved.
-
-Permission is hereby granted, free of charge, to any person obtaining a copy of
-this software and associated documentation files (the “Software”), to deal in the
-Software without restriction, including without limitation the rights to use, copy,
-modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
-and to permit persons to whom the Software is furnished to do so, subject to the
-following conditions:
-
-The above copyright notice and this permission notice shall be included in all
-copies or substantial portions of the Software.
-
-THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
-EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
-MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
-NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
-HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
-WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
-OTHER DEALINGS IN THE SOFTWARE.
-
-*/
-#ifndef	__KMODBUS_H__
-#define	__KMODBUS_H__
-
-#ifdef __cplusplus
-	extern "C" {
-#endif
-
-#define	KMODBUS_MAX_RXBUF			(268)
-#define	KMODBUS_MAX_TXBUF			(268)
-
-#define	KMODBUS_NO_RECEIVED_DATA		(1)
-#define	KMODBUS_OK						(0)
-#define	KMODBUS_NODATA					(-1)
-#define	KMODBUS_NOT_RESPONSE			(-2)
-#define	KMODBUS_INVALID_PARAM			(-3)
-#define	KMODBUS_TIMEOUT					(-4)
-#define	KMODBUS_NON_EXISTENT_ADDRESS	(-5)
-#define	KMODBUS_UNSUPPORT_FUNCTION		(-6)
-
-typedef	int					KMODBUS_STATUS;
-typedef	unsigned short		KMODBUS_ADDRESS;
-typedef	unsigned short		KMODBUS_COIL_STATUS;
-typedef	unsigned short		KMODBUS_INPUT_STATUS;
-typedef	unsigned short		KMODBUS_HOLDING_REGISTER;
-typedef	unsigned short		KMODBUS_INPUT_REGISTER;
-typedef	unsigned short		KMODBUS_DIAGNOSTICS;
-typedef	unsigned short		KMODBUS_EVENTCOUNTER;
-
-typedef	unsigned long		KMODBUS_TICK;
-#define	KMODBUS_FOREVER		((KMODBUS_TICK)(-1))
-
-typedef	struct {
-	KMODBUS_EVENTCOUNTER	counter;
-	unsigned short			event_counter;
-	unsigned char			event[2];
-} KMODBUS_EVENTLOG;
-
-typedef	struct {
-	unsigned char			ByteCount;
-	unsigned char			SlaveID;
-	unsigned char			RunIndicators;
-	unsigned char			Additionalinformation[1];
-} REPORTSLAVEID;
-
-typedef struct KModbusIF_t {
-	KMODBUS_STATUS (*Get)(unsigned char* c);
-	KMODBUS_STATUS (*Gets)(unsigned char* buf, int len);
-	KMODBUS_STATUS (*Put)(unsigned char c);
-	KMODBUS_STATUS (*Puts)(unsigned char* buf, int len);
-
-} KModbusIF_t, *PKModbusIF_t;
-
-typedef struct KModbusFunc_t {
-	KMODBUS_STATUS (*ReadCoilStatus)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
-	KMODBUS_STATUS (*ReadInputStatus)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
-	KMODBUS_STATUS (*ReadHoldingRegister)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
-	KMODBUS_STATUS (*ReadInputRegister)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_INPUT_REGISTER* buf);
-
-	KMODBUS_STATUS (*ForceSingleCoil)(void* hd, KMODBUS_ADDRESS ad, KMODBUS_COIL_STATUS dt);
-	KMODBUS_STATUS (*PresetSingleRegister)(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER dt);
-	KMODBUS_STATUS (*Diagnostics)(void* hd, KMODBUS_DIAGNOSTICS no, KMODBUS_HOLDING_REGISTER dt);
-
-	KMODBUS_STATUS (*FetchCommunicationEventCounter)(void* hd, KMODBUS_EVENTCOUNTER* buf);
-	KMODBUS_STATUS (*FetchCommunicationEventLog)(void* hd, KMODBUS_EVENTLOG* buf);
-
-	KMODBUS_STATUS (*ForceMultipleCoils)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
-	KMODBUS_STATUS (*PresetMultipleRegisters)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
-
-} KModbusFunc_t;
-
-typedef struct KModbus_t {
-	KModbusIF_t		Interface;
-	KModbusFunc_t	FuncTable;
-	KMODBUS_TICK	(*GetTick)(void);
-
-	KMODBUS_TICK	LastTick;
-	KMODBUS_TICK	NoCommunicationTime;
-
-	unsigned char	RxBuf[KMODBUS_MAX_RXBUF];
-	unsigned char	TxBuf[KMODBUS_MAX_TXBUF];
-
-	unsigned short	ListenOnlyMode;
-	unsigned short	EventCounter;
-	unsigned short	MessageCounter;
-	unsigned short	DiagnosticRegister;
-	unsigned short	CRCErrorCounter;
-	unsigned short	ExceptionErrorCount;
-	unsigned short	NoResponseCount;
-
-	unsigned char	ID;
-
-} KModbus_t, * PKModbus_t;
-
-#include "KModbusConfig.h"
-
-unsigned short	KModbud_L2N(unsigned char* little16);
-unsigned short	KModbud_B2N(unsigned char* big16);
-unsigned short	KModbus_CalcCRC16(unsigned char* buf, int len);
-
-void			KModbus_Init(PKModbus_t hd);
-KMODBUS_STATUS	KModbusServer(PKModbus_t hd, int* ResQuit);
-
-unsigned short	KModbus_Get(int adrs);
-void			KModbus_Set(int adrs, unsigned short reg);
-
-#ifdef __cplusplus
-	}
-#endif
-
-#endif	/* __KMODBUS_H__ */
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUS_H__
+#define	__KMODBUS_H__
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/* Frames longer than the buffers are refused, set smaller ones from the build */
+#ifndef	KMODBUS_MAX_RXBUF
+#define	KMODBUS_MAX_RXBUF			(268)
+#endif
+#ifndef	KMODBUS_MAX_TXBUF
+#define	KMODBUS_MAX_TXBUF			(268)
+#endif
+
+#define	KMODBUS_PROFILE_FULL		(0)
+#define	KMODBUS_PROFILE_SMALL		(1)
+#define	KMODBUS_PROFILE_TINY		(2)
+
+#define	KMODBUS_FUNCTION_TBLSIZE	(24)
+
+/* Function codes the application can add with KModbus_RegisterFunction */
+#ifndef	KMODBUS_USER_FUNCTIONS
+#define	KMODBUS_USER_FUNCTIONS		(4)
+#endif
+
+#define	KMODBUS_BROADCAST_ID		(0)
+
+#define	KMODBUS_NO_RECEIVED_DATA		(1)
+#define	KMODBUS_OK						(0)
+#define	KMODBUS_NODATA					(-1)
+#define	KMODBUS_NOT_RESPONSE			(-2)
+#define	KMODBUS_INVALID_PARAM			(-3)
+#define	KMODBUS_TIMEOUT					(-4)
+#define	KMODBUS_NON_EXISTENT_ADDRESS	(-5)
+#define	KMODBUS_UNSUPPORT_FUNCTION		(-6)
+#define	KMODBUS_INVALID_RESPONSE		(-7)
+#define	KMODBUS_SLAVE_FAILURE			(-8)
+#define	KMODBUS_CANCELLED				(-9)
+#define	KMODBUS_SLAVE_BUSY				(-10)
+
+typedef	int					KMODBUS_STATUS;
+typedef	unsigned short		KMODBUS_ADDRESS;
+typedef	unsigned short		KMODBUS_COIL_STATUS;
+typedef	unsigned short		KMODBUS_INPUT_STATUS;
+typedef	unsigned short		KMODBUS_HOLDING_REGISTER;
+typedef	unsigned short		KMODBUS_INPUT_REGISTER;
+typedef	unsigned short		KMODBUS_DIAGNOSTICS;
+typedef	unsigned short		KMODBUS_EVENTCOUNTER;
+
+typedef	unsigned long		KMODBUS_TICK;
+#define	KMODBUS_FOREVER		((KMODBUS_TICK)(-1))
+
+typedef	struct {
+	KMODBUS_EVENTCOUNTER	counter;
+	unsigned short			event_counter;
+	unsigned char			event[2];
+} KMODBUS_EVENTLOG;
+
+typedef	struct {
+	unsigned char			ByteCount;
+	unsigned char			SlaveID;
+	unsigned char			RunIndicators;
+	unsigned char			Additionalinformation[1];
+} REPORTSLAVEID;
+
+typedef struct KModbusIF_t {
+	KMODBUS_STATUS (*Get)(unsigned char* c);
+	KMODBUS_STATUS (*Gets)(unsigned char* buf, int len);
+	KMODBUS_STATUS (*Put)(unsigned char c);
+	KMODBUS_STATUS (*Puts)(unsigned char* buf, int len);
+
+} KModbusIF_t, *PKModbusIF_t;
+
+typedef struct KModbusFunc_t {
+	KMODBUS_STATUS (*ReadCoilStatus)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+	KMODBUS_STATUS (*ReadInputStatus)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+	KMODBUS_STATUS (*ReadHoldingRegister)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
+	KMODBUS_STATUS (*ReadInputRegister)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_INPUT_REGISTER* buf);
+
+	KMODBUS_STATUS (*ForceSingleCoil)(void* hd, KMODBUS_ADDRESS ad, KMODBUS_COIL_STATUS dt);
+	KMODBUS_STATUS (*PresetSingleRegister)(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER dt);
+	KMODBUS_STATUS (*Diagnostics)(void* hd, KMODBUS_DIAGNOSTICS no, KMODBUS_HOLDING_REGISTER dt);
+
+	KMODBUS_STATUS (*FetchCommunicationEventCounter)(void* hd, KMODBUS_EVENTCOUNTER* buf);
+	KMODBUS_STATUS (*FetchCommunicationEventLog)(void* hd, KMODBUS_EVENTLOG* buf);
+
+	KMODBUS_STATUS (*ForceMultipleCoils)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+	KMODBUS_STATUS (*PresetMultipleRegisters)(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
+
+	KMODBUS_STATUS (*MaskWriteRegister)(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER and_mask, KMODBUS_HOLDING_REGISTER or_mask);
+	KMODBUS_STATUS (*ReadWriteMultipleRegisters)(void* hd, KMODBUS_ADDRESS rad, int rlen, KMODBUS_HOLDING_REGISTER* rbuf, KMODBUS_ADDRESS wad, int wlen, KMODBUS_HOLDING_REGISTER* wbuf);
+
+} KModbusFunc_t;
+
+#define	KMODBUS_CAPTURE_RX			(0)
+#define	KMODBUS_CAPTURE_TX			(1)
+
+typedef struct KModbus_t {
+	KModbusIF_t		Interface;
+	KModbusFunc_t	FuncTable;
+	KMODBUS_TICK	(*GetTick)(void);
+
+	/* Frame tap, called for every received and transmitted frame when set */
+	void			(*Capture)(struct KModbus_t* hd, int dir, const unsigned char* buf, int len, int crcok);
+	void*			CaptureContext;
+
+	/* Per-slave timeout and retry state of the master, adaptive when set */
+	struct KModbusHealth_t*	Health;
+
+	/* FC03/FC04 response cache of the server, see KModbus_CacheInit */
+	struct KModbusCache_t*	Cache;
+
+	/* Unit filter and query executor of the C++ front end (KModbus.hpp), 0: built-in */
+	int				(*Accept)(struct KModbus_t* hd, unsigned char id);
+	KMODBUS_STATUS	(*Dispatch)(struct KModbus_t* hd);
+
+	/* Runs the requests of KModbusMaster_Transaction in place of the bus, 0: built-in */
+	KMODBUS_STATUS	(*Transaction)(struct KModbus_t* hd, int txlen, unsigned short* buf);
+
+	KMODBUS_TICK	LastTick;
+	KMODBUS_TICK	NoCommunicationTime;
+	KMODBUS_TICK	ResponseTimeout;
+	KMODBUS_TICK	TurnaroundDelay;
+
+	unsigned char	RxBuf[KMODBUS_MAX_RXBUF];
+	unsigned char	TxBuf[KMODBUS_MAX_TXBUF];
+
+	/* Frame parser state of KModbus_Feed */
+	int				RxLen;
+	int				RxState;
+
+	unsigned short	ListenOnlyMode;
+	unsigned short	EventCounter;
+	unsigned short	MessageCounter;
+	unsigned short	DiagnosticRegister;
+	unsigned short	CRCErrorCounter;
+	unsigned short	ExceptionErrorCount;
+	unsigned short	NoResponseCount;
+	unsigned short	BroadcastCounter;
+
+	unsigned char	ID;
+
+} KModbus_t, * PKModbus_t;
+
+#include "KModbusConfig.h"
+#include "KModbusProfile.h"
+
+#ifndef	KMODBUS_CACHE_ENTRIES
+#define	KMODBUS_CACHE_ENTRIES		(8)
+#endif
+#define	KMODBUS_CACHE_FRAME			(5 + 250)	/* FC03/04 response of 125 registers */
+
+typedef struct KModbusCacheEntry_t {
+	unsigned long	Version;		/* Of the registers when the frame was built */
+	unsigned long	Used;			/* Clock of the last use, the oldest entry is replaced */
+	unsigned short	Adrs;
+	unsigned short	Count;
+	unsigned short	Length;
+	unsigned char	Code;			/* 0: empty */
+	unsigned char	Id;
+	unsigned char	Frame[KMODBUS_CACHE_FRAME];
+
+} KModbusCacheEntry_t;
+
+/*
+	Response cache of FC03/FC04. A repeated query is answered with the
+	frame built for it last time, CRC included, as long as none of its
+	registers was written. The register banks keep a version per 64
+	registers that every write bumps; with KMODBUS_PROCESS_IMAGE the
+	commit sequence stands in for it. A cache belongs to one handle.
+*/
+typedef struct KModbusCache_t {
+	KModbusCacheEntry_t	Entry[KMODBUS_CACHE_ENTRIES];
+	unsigned long		Clock;
+	unsigned long		Hits;
+	unsigned long		Misses;
+	unsigned long		Stale;		/* Misses on a cached query whose registers changed */
+
+} KModbusCache_t, *PKModbusCache_t;
+
+/* Readers of the banks may share the lock when the configuration allows it */
+#ifndef	CRITICAL_SECTION_READ_BEGIN
+#define	CRITICAL_SECTION_READ_BEGIN	CRITICAL_SECTION_BEGIN
+#define	CRITICAL_SECTION_READ_END	CRITICAL_SECTION_END
+#endif
+
+#ifndef	KMODBUS_TURNAROUND_DELAY
+#define	KMODBUS_TURNAROUND_DELAY	(100)
+#endif
+
+#define	KMODBUS_CAPTURE(hd, dir, buf, len, crcok)	\
+	do { if ((hd)->Capture) (*(hd)->Capture)((hd), (dir), (buf), (len), (crcok)); } while (0)
+
+typedef KMODBUS_STATUS (*KModbusHandler)(PKModbus_t);
+
+extern const int			QueryLength[KMODBUS_FUNCTION_TBLSIZE];
+extern const int			QueryCountPos[KMODBUS_FUNCTION_TBLSIZE];
+extern const KModbusHandler	KModbusHandler_Tbl[KMODBUS_FUNCTION_TBLSIZE];
+
+KMODBUS_STATUS	entry_ReadCoilStatus01(PKModbus_t hd);
+KMODBUS_STATUS	entry_ReadInputStatus02(PKModbus_t hd);
+KMODBUS_STATUS	entry_ReadHoldingRegister03(PKModbus_t hd);
+KMODBUS_STATUS	entry_ReadInputRegister04(PKModbus_t hd);
+KMODBUS_STATUS	entry_ForceSingleCoil05(PKModbus_t hd);
+KMODBUS_STATUS	entry_PresetSingleRegister06(PKModbus_t hd);
+KMODBUS_STATUS	entry_Diagnostics08(PKModbus_t hd);
+KMODBUS_STATUS	entry_FetchCommunicationEventCounter11(PKModbus_t hd);
+KMODBUS_STATUS	entry_FetchCommunicationEventLog12(PKModbus_t hd);
+KMODBUS_STATUS	entry_ForceMultipleCoils15(PKModbus_t hd);
+KMODBUS_STATUS	entry_PresetMultipleRegisters16(PKModbus_t hd);
+KMODBUS_STATUS	entry_ReportSlaveID17(PKModbus_t hd);
+KMODBUS_STATUS	entry_MaskWriteRegister22(PKModbus_t hd);
+KMODBUS_STATUS	entry_ReadWriteMultipleRegisters23(PKModbus_t hd);
+
+unsigned short	KModbud_L2N(unsigned char* little16);
+unsigned short	KModbud_B2N(unsigned char* big16);
+unsigned short	KModbus_CalcCRC16(unsigned char* buf, int len);
+
+/* KModbus_Init is KModbus_InitHandle and KModbus_InitBanks, further handles on the same banks take KModbus_InitHandle */
+void			KModbus_Init(PKModbus_t hd);
+void			KModbus_InitHandle(PKModbus_t hd);
+void			KModbus_InitBanks(void);
+void			KModbus_CacheInit(PKModbus_t hd, PKModbusCache_t cache);
+KMODBUS_STATUS	KModbusServer(PKModbus_t hd, int* ResQuit);
+
+/* Non-blocking server: push received bytes, call Tick when nothing arrives */
+void			KModbus_Feed(PKModbus_t hd, const unsigned char* bytes, int n, KMODBUS_TICK now);
+void			KModbus_Tick(PKModbus_t hd, KMODBUS_TICK now);
+
+int				KModbus_QueryLength(const unsigned char* buf, int len);
+KMODBUS_STATUS	KModbus_Dispatch(PKModbus_t hd);
+KMODBUS_STATUS	KModbus_Execute(PKModbus_t hd, const unsigned char* frame, int len);
+
+/*
+	Serve a function code from the application (user-defined codes 65-72 and
+	100-110, or a standard code left out by the profile). qlen is the query
+	length without the CRC, or countpos the offset of its byte count when the
+	length varies. A null handler removes the code. Register before the server
+	starts. The handler answers with KModbus_Respond after building the
+	response in hd->TxBuf, or with KModbus_Exception.
+*/
+KMODBUS_STATUS	KModbus_RegisterFunction(unsigned char cd, KModbusHandler handler, int qlen, int countpos);
+/* Same with a context the handler gets back from KModbus_FunctionContext(hd->RxBuf[1]) */
+KMODBUS_STATUS	KModbus_RegisterFunctionContext(unsigned char cd, KModbusHandler handler, int qlen, int countpos, void* context);
+void*			KModbus_FunctionContext(unsigned char cd);
+KMODBUS_STATUS	KModbus_Respond(PKModbus_t hd, int len);
+void			KModbus_Exception(PKModbus_t hd, KMODBUS_STATUS errcode);
+
+/* Bank access, bits packed LSB first, registers big-endian as on the wire */
+KMODBUS_STATUS	GetX0(int adrs, unsigned char* dt, int len);
+KMODBUS_STATUS	GetX1(int adrs, unsigned char* dt, int len);
+KMODBUS_STATUS	GetX3(int adrs, unsigned char* dt, int len);
+KMODBUS_STATUS	GetX4(int adrs, unsigned char* dt, int len);
+
+unsigned short	KModbus_Get(int adrs);
+void			KModbus_Set(int adrs, unsigned short reg);
+
+/*
+	Lock-free bit access for coils 1-9999 and inputs 10001-19999. Each is
+	one atomic operation on the 64-bit word holding the bit and returns its
+	previous state (0/1), or KMODBUS_NON_EXISTENT_ADDRESS. Bus reads and
+	writes see every word whole. Safe from any number of threads, except
+	with KMODBUS_PROCESS_IMAGE: then they work on the back copy as
+	KModbus_Set does, KModbus_Commit copies over it whole, and only the
+	thread calling KModbus_Commit may use them.
+*/
+int				KModbus_BitSet(int adrs);
+int				KModbus_BitClear(int adrs);
+int				KModbus_BitToggle(int adrs);
+int				KModbus_BitTest(int adrs);
+
+/*
+	Application access to bank 0, 1, 3 or 4 by 0-based address, data as
+	GetXn. A multi-register value is read and written in one piece.
+*/
+KMODBUS_STATUS	KModbus_Read(int bank, int adrs, unsigned char* dt, int len);
+KMODBUS_STATUS	KModbus_Write(int bank, int adrs, unsigned char* dt, int len);
+
+/*
+	Write version of a register range of bank 3 or 4: the sum of the
+	versions of its 64-register pages, it grows with every write to them.
+	With KMODBUS_PROCESS_IMAGE the commit count. 0 for the bit banks and
+	out of range, the caller compares the data instead.
+*/
+unsigned long	KModbus_Version(int bank, int adrs, int len);
+
+/*
+	With KMODBUS_PROCESS_IMAGE, KModbus_Get/Set work on a private back copy
+	of the banks and KModbus_Commit publishes it at the end of each scan.
+	Masters always read a complete scan, their writes show from the next
+	commit. Call Get/Set/Commit from one thread. Without the option
+	KModbus_Commit does nothing.
+*/
+void			KModbus_Commit(void);
+
+/*
+	Fault in every page of the banks before a real-time loop starts. touch
+	gets each bank range, 0 writes the pages back in place.
+*/
+void			KModbus_Prefault(void (*touch)(void* p, unsigned long bytes));
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUS_H__ */
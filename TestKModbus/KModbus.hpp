@@ -0,0 +1,246 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUS_HPP__
+#define	__KMODBUS_HPP__
+
+/*
+	Header-only C++17 front end for KModbus.
+
+	The enabled function codes, the addressable bank sizes, the accepted
+	unit IDs and the transport are template parameters. Function codes
+	without a specialization of KModbus::Function, or left out by the
+	footprint profile, are rejected by the compiler, and the dispatch over
+	the enabled codes is generated at compile time. Framing, broadcast and
+	listen-only handling are those of KModbus_Feed/KModbus_Tick, which call
+	the generated dispatch through the handle. The protocol work itself is
+	done by the entry_xxx handlers of KModbus.c; which of them are linked
+	is decided by the KMODBUS_USE_FCxx switches of the profile, not by the
+	Functions<> list. A query of a code outside the list is answered with
+	exception 01.
+
+	struct Com {
+		static KMODBUS_STATUS	Get(unsigned char* c);
+		static KMODBUS_STATUS	Puts(unsigned char* buf, int len);
+		static KMODBUS_TICK		Tick(void);
+	};
+	KModbus::Server< Com, KModbus::Units<1>, KModbus::DefaultBanks,
+		KModbus::Functions<3, 6, 16> >	server(hKModbus);
+	server.Run(&ReqQuit);
+
+	An event loop feeds the handle with KModbus_Feed/KModbus_Tick instead
+	of calling Run.
+*/
+
+#include	"KModbus.h"
+
+namespace KModbus {
+
+enum class Bank { None, X0, X1, X3, X4 };
+
+/* Function code traits (unsupported codes fail here) */
+template<unsigned char Code>
+struct Function {
+	static_assert(Code != Code, "KModbus: unsupported function code");
+};
+
+#define	KMODBUS_FUNCTION(cd, qlen, cpos, bank, multi, second, entry)	\
+template<>															\
+struct Function<cd> {												\
+	static constexpr int	QueryLength = (qlen);					\
+	static constexpr int	CountPos = (cpos);						\
+	static constexpr Bank	Target = Bank::bank;					\
+	static constexpr bool	Multiple = (multi);						\
+	static constexpr int	SecondRange = (second);					\
+	static KMODBUS_STATUS	Entry(PKModbus_t hd) { return entry(hd); }	\
+};
+
+/*
+	qlen:	bytes after the function code up to the byte count (or the CRC)
+	cpos:	offset of the byte count of variable length queries
+	second:	offset of a second address/quantity pair on the same bank
+*/
+/*				 code	qlen	cpos	bank	multi	second	entry								*/
+KMODBUS_FUNCTION( 1,	6,		0,		X0,		true,	0,	entry_ReadCoilStatus01)
+KMODBUS_FUNCTION( 2,	6,		0,		X1,		true,	0,	entry_ReadInputStatus02)
+KMODBUS_FUNCTION( 3,	6,		0,		X4,		true,	0,	entry_ReadHoldingRegister03)
+KMODBUS_FUNCTION( 4,	6,		0,		X3,		true,	0,	entry_ReadInputRegister04)
+KMODBUS_FUNCTION( 5,	6,		0,		X0,		false,	0,	entry_ForceSingleCoil05)
+KMODBUS_FUNCTION( 6,	6,		0,		X4,		false,	0,	entry_PresetSingleRegister06)
+KMODBUS_FUNCTION( 8,	6,		0,		None,	false,	0,	entry_Diagnostics08)
+KMODBUS_FUNCTION(11,	2,		0,		None,	false,	0,	entry_FetchCommunicationEventCounter11)
+KMODBUS_FUNCTION(12,	2,		0,		None,	false,	0,	entry_FetchCommunicationEventLog12)
+KMODBUS_FUNCTION(15,	5,		6,		X0,		true,	0,	entry_ForceMultipleCoils15)
+KMODBUS_FUNCTION(16,	5,		6,		X4,		true,	0,	entry_PresetMultipleRegisters16)
+KMODBUS_FUNCTION(17,	2,		0,		None,	false,	0,	entry_ReportSlaveID17)
+KMODBUS_FUNCTION(22,	8,		0,		X4,		false,	0,	entry_MaskWriteRegister22)
+KMODBUS_FUNCTION(23,	9,		10,		X4,		true,	6,	entry_ReadWriteMultipleRegisters23)
+
+#undef	KMODBUS_FUNCTION
+
+/* Addressable size of each bank, at most the size reserved by KModbusConfig.h */
+template<int X0Size, int X1Size, int X3Size, int X4Size>
+struct Banks {
+	static_assert(X0Size >= 0 && X0Size <= KMODBUS_X0_SIZE, "KModbus: X0 bank exceeds KMODBUS_X0_SIZE");
+	static_assert(X1Size >= 0 && X1Size <= KMODBUS_X1_SIZE, "KModbus: X1 bank exceeds KMODBUS_X1_SIZE");
+	static_assert(X3Size >= 0 && X3Size <= KMODBUS_X3_SIZE, "KModbus: X3 bank exceeds KMODBUS_X3_SIZE");
+	static_assert(X4Size >= 0 && X4Size <= KMODBUS_X4_SIZE, "KModbus: X4 bank exceeds KMODBUS_X4_SIZE");
+
+	static constexpr int	Size(Bank b)
+	{
+		return	(b == Bank::X0) ? X0Size :
+				(b == Bank::X1) ? X1Size :
+				(b == Bank::X3) ? X3Size :
+				(b == Bank::X4) ? X4Size : 0;
+	}
+};
+using DefaultBanks = Banks<KMODBUS_X0_SIZE, KMODBUS_X1_SIZE, KMODBUS_X3_SIZE, KMODBUS_X4_SIZE>;
+
+/* Accepted unit IDs, the first one is reported by FC17 */
+template<unsigned char First, unsigned char... Rest>
+struct Units {
+	static constexpr unsigned char	ID = First;
+
+	static constexpr bool	Accept(unsigned char id)
+	{
+		return id == First || ((id == Rest) || ...);
+	}
+};
+
+/* Function codes compiled into KModbus.c by the footprint profile */
+constexpr bool	Compiled(unsigned char cd)
+{
+	return	(cd == 1) ? KMODBUS_USE_FC01 :
+			(cd == 2) ? KMODBUS_USE_FC02 :
+			(cd == 3) ? KMODBUS_USE_FC03 :
+			(cd == 4) ? KMODBUS_USE_FC04 :
+			(cd == 5) ? KMODBUS_USE_FC05 :
+			(cd == 6) ? KMODBUS_USE_FC06 :
+			(cd == 8) ? KMODBUS_USE_FC08 :
+			(cd == 11) ? KMODBUS_USE_FC11 :
+			(cd == 12) ? KMODBUS_USE_FC12 :
+			(cd == 15) ? KMODBUS_USE_FC15 :
+			(cd == 16) ? KMODBUS_USE_FC16 :
+			(cd == 17) ? KMODBUS_USE_FC17 :
+			(cd == 22) ? KMODBUS_USE_FC22 :
+			(cd == 23) ? KMODBUS_USE_FC23 : false;
+}
+
+/* Enabled function codes */
+template<unsigned char... Codes>
+struct Functions {
+	static_assert(sizeof...(Codes) > 0, "KModbus: no function code enabled");
+	static_assert((Compiled(Codes) && ...), "KModbus: function code disabled by the profile");
+};
+
+template<typename Transport, typename UnitList, typename BankMap, typename FunctionList>
+class Server;
+
+template<typename Transport, typename UnitList, typename BankMap, unsigned char... Codes>
+class Server<Transport, UnitList, BankMap, Functions<Codes...>> {
+public:
+	explicit Server(KModbus_t& handle) : hd(handle)
+	{
+		KModbus_Init(&hd);
+		hd.ID = UnitList::ID;
+		hd.GetTick = &Transport::Tick;
+		hd.Interface.Get = &Transport::Get;
+		hd.Interface.Puts = &Transport::Puts;
+		hd.Accept = &Accept;
+		hd.Dispatch = &Dispatch;
+	}
+
+	KMODBUS_STATUS	Run(int* ResQuit)
+	{
+		return KModbusServer(&hd, ResQuit);
+	}
+
+	/* Query in hd->RxBuf, called by KModbus_Dispatch after the broadcast and listen-only checks */
+	static KMODBUS_STATUS	Dispatch(PKModbus_t hd)
+	{
+		KMODBUS_STATUS	ret = KMODBUS_UNSUPPORT_FUNCTION;
+		unsigned char	cd = hd->RxBuf[1];
+
+		if (((cd == Codes && (ret = Call<Codes>(hd), true)) || ...)) {
+			return ret;
+		}
+		/* Framed by the C tables but not in the list: exception 01, broadcasts stay unanswered */
+		if (hd->RxBuf[0] != KMODBUS_BROADCAST_ID) {
+			KModbus_Exception(hd, KMODBUS_UNSUPPORT_FUNCTION);
+		}
+		return ret;
+	}
+
+private:
+	static_assert(((Function<Codes>::QueryLength + 4 <= KMODBUS_MAX_RXBUF) && ...),
+		"KModbus: query does not fit in KMODBUS_MAX_RXBUF");
+
+	static int	Accept(PKModbus_t, unsigned char id)
+	{
+		return UnitList::Accept(id);
+	}
+
+	template<unsigned char Code>
+	static KMODBUS_STATUS	Call(PKModbus_t hd)
+	{
+		using F = Function<Code>;
+
+		if constexpr (F::Target != Bank::None && BankMap::Size(F::Target) < Size(F::Target)) {
+			int	adrs, len;
+
+			adrs = KModbud_B2N(&hd->RxBuf[2]);
+			len = F::Multiple ? KModbud_B2N(&hd->RxBuf[4]) : 1;
+			if (adrs + len > BankMap::Size(F::Target)) {
+				return Exception(hd);
+			}
+			if constexpr (F::SecondRange != 0) {
+				adrs = KModbud_B2N(&hd->RxBuf[F::SecondRange]);
+				len = KModbud_B2N(&hd->RxBuf[F::SecondRange + 2]);
+				if (adrs + len > BankMap::Size(F::Target)) {
+					return Exception(hd);
+				}
+			}
+		}
+		return F::Entry(hd);
+	}
+
+	static constexpr int	Size(Bank b)
+	{
+		return DefaultBanks::Size(b);
+	}
+
+	/* Outside of the narrowed bank: exception 02 */
+	static KMODBUS_STATUS	Exception(PKModbus_t hd)
+	{
+		KModbus_Exception(hd, KMODBUS_NON_EXISTENT_ADDRESS);
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+
+	KModbus_t&	hd;
+};
+
+}	/* namespace KModbus */
+
+#endif	/* __KMODBUS_HPP__ */
@@ -0,0 +1,90 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSATOMIC_H__
+#define	__KMODBUSATOMIC_H__
+
+/*
+	Minimal atomic operations for the lock-free parts of KModbus.
+	KMODBUS_ATOMIC_LOAD has acquire and KMODBUS_ATOMIC_STORE release
+	semantics; FETCH_ADD and CAS are full barriers. The 64-bit operations
+	hold the bit banks, their read-modify-writes are full barriers too.
+*/
+
+typedef	volatile long	KMODBUS_ATOMIC;
+#if defined(_MSC_VER)
+typedef	volatile __int64			KMODBUS_ATOMIC64;
+#else
+typedef	volatile unsigned long long	KMODBUS_ATOMIC64 __attribute__((aligned(8)));
+#endif
+
+#ifndef	KMODBUS_CACHE_LINE
+#define	KMODBUS_CACHE_LINE		(64)
+#endif
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <intrin.h>
+
+/* volatile accesses are acquire/release under /volatile:ms (x86, x64) */
+#define	KMODBUS_ATOMIC_LOAD(p)				(*(p))
+#define	KMODBUS_ATOMIC_STORE(p, v)			(*(p) = (v))
+#define	KMODBUS_ATOMIC_FETCH_ADD(p, v)		_InterlockedExchangeAdd((p), (v))
+#define	KMODBUS_ATOMIC_CAS(p, expect, v)	(_InterlockedCompareExchange((p), (v), (expect)) == (expect))
+#define	KMODBUS_ATOMIC_FENCE()				MemoryBarrier()
+
+#if defined(_M_X64) || defined(_M_ARM64)
+#define	KMODBUS_ATOMIC64_LOAD(p)			((unsigned __int64)*(p))
+#else
+/* 32-bit targets read the word in one piece with a no-op exchange */
+#define	KMODBUS_ATOMIC64_LOAD(p)			((unsigned __int64)InterlockedCompareExchange64((p), 0, 0))
+#endif
+#define	KMODBUS_ATOMIC64_FETCH_OR(p, v)		((unsigned __int64)InterlockedOr64((p), (__int64)(v)))
+#define	KMODBUS_ATOMIC64_FETCH_AND(p, v)	((unsigned __int64)InterlockedAnd64((p), (__int64)(v)))
+#define	KMODBUS_ATOMIC64_FETCH_XOR(p, v)	((unsigned __int64)InterlockedXor64((p), (__int64)(v)))
+#define	KMODBUS_ATOMIC64_CAS(p, expect, v)	\
+	(InterlockedCompareExchange64((p), (__int64)(v), (__int64)(expect)) == (__int64)(expect))
+
+#elif defined(__GNUC__)
+
+#define	KMODBUS_ATOMIC_LOAD(p)				__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	KMODBUS_ATOMIC_STORE(p, v)			__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	KMODBUS_ATOMIC_FETCH_ADD(p, v)		__atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define	KMODBUS_ATOMIC_CAS(p, expect, v)	__extension__ ({ long _e = (expect); \
+	__atomic_compare_exchange_n((p), &_e, (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+#define	KMODBUS_ATOMIC_FENCE()				__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define	KMODBUS_ATOMIC64_LOAD(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	KMODBUS_ATOMIC64_FETCH_OR(p, v)		__atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define	KMODBUS_ATOMIC64_FETCH_AND(p, v)	__atomic_fetch_and((p), (v), __ATOMIC_SEQ_CST)
+#define	KMODBUS_ATOMIC64_FETCH_XOR(p, v)	__atomic_fetch_xor((p), (v), __ATOMIC_SEQ_CST)
+#define	KMODBUS_ATOMIC64_CAS(p, expect, v)	__extension__ ({ unsigned long long _e = (expect); \
+	__atomic_compare_exchange_n((p), &_e, (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+
+#else
+#error "KModbusAtomic.h: no atomic operations for this compiler"
+#endif
+
+#endif	/* __KMODBUSATOMIC_H__ */
@@ -0,0 +1,376 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifdef	_MSC_VER
+#define	_CRT_SECURE_NO_WARNINGS
+#endif
+#include	"KModbusCapture.h"
+#include	<stdio.h>
+#include	<memory.h>
+
+#define	CAPTURE_MASK		((unsigned long)(KMODBUS_CAPTURE_RECORDS) - 1)
+#define	SEQ_BUSY			(-1L)	/* Record being written */
+
+#define	FILE_MAGIC			"KMBC"
+#define	FILE_VERSION		(1)
+#define	FILE_HEADER_SIZE	(12)
+#define	FILE_RECORD_SIZE	(9)		/* Without the frame data */
+
+static void	Put(PKModbusCapture_t cap, KMODBUS_TICK stamp, int dir, const unsigned char* buf, int len, int crcok)
+{
+	PKModbusCaptureRecord_t	r;
+	unsigned long			no;
+	long					seq;
+
+	if (len > KMODBUS_CAPTURE_MAX_FRAME) {
+		len = KMODBUS_CAPTURE_MAX_FRAME;
+	}
+	no = (unsigned long)KMODBUS_ATOMIC_FETCH_ADD(&cap->Head, 1);
+	r = &cap->Ring[no & CAPTURE_MASK];
+
+	/*
+		A writer a lap ahead or behind may hold the same slot. Only one of
+		them gets it, the other drops its frame rather than wait.
+	*/
+	do {
+		seq = KMODBUS_ATOMIC_LOAD(&r->Seq);
+		if (seq == SEQ_BUSY || (seq != 0 && (long)((unsigned long)seq - (no + 1)) >= 0)) {
+			KMODBUS_ATOMIC_FETCH_ADD(&cap->Dropped, 1);
+			return;
+		}
+	} while (!KMODBUS_ATOMIC_CAS(&r->Seq, seq, SEQ_BUSY));
+	r->Stamp = stamp;
+	r->Dir = (unsigned char)dir;
+	r->Unit = (len > 0) ? buf[0] : 0;
+	r->CrcOk = (unsigned char)(crcok != 0);
+	r->Len = (unsigned short)len;
+	memcpy(r->Data, buf, len);
+	KMODBUS_ATOMIC_STORE(&r->Seq, (long)(no + 1));
+}
+
+static void	CaptureHook(PKModbus_t hd, int dir, const unsigned char* buf, int len, int crcok)
+{
+	KModbusCapture_Frame((PKModbusCapture_t)hd->CaptureContext, dir, buf, len, crcok);
+}
+
+void	KModbusCapture_Init(PKModbusCapture_t cap, KMODBUS_TICK (*gettick)(void), unsigned long ticks_per_second)
+{
+	int		i;
+
+	cap->Head = 0;
+	cap->Dropped = 0;
+	cap->GetTick = gettick;
+	cap->TicksPerSecond = ticks_per_second;
+	for (i = 0; i < KMODBUS_CAPTURE_RECORDS; i++) {
+		cap->Ring[i].Seq = 0;
+	}
+}
+
+void	KModbusCapture_Attach(PKModbusCapture_t cap, PKModbus_t hd)
+{
+	hd->CaptureContext = cap;
+	hd->Capture = CaptureHook;
+}
+
+void	KModbusCapture_Detach(PKModbus_t hd)
+{
+	hd->Capture = 0;
+	hd->CaptureContext = 0;
+}
+
+void	KModbusCapture_Frame(PKModbusCapture_t cap, int dir, const unsigned char* buf, int len, int crcok)
+{
+	Put(cap, (*cap->GetTick)(), dir, buf, len, crcok);
+}
+
+void	KModbusCapture_Range(PKModbusCapture_t cap, unsigned long* first, unsigned long* end)
+{
+	*end = (unsigned long)KMODBUS_ATOMIC_LOAD(&cap->Head);
+	*first = (*end > KMODBUS_CAPTURE_RECORDS) ? *end - KMODBUS_CAPTURE_RECORDS : 0;
+}
+
+/* Copy record no, 0 when it was overwritten or is still being written */
+int		KModbusCapture_Read(PKModbusCapture_t cap, unsigned long no, PKModbusCaptureRecord_t rec)
+{
+	PKModbusCaptureRecord_t	r;
+	unsigned long			seq;
+
+	r = &cap->Ring[no & CAPTURE_MASK];
+	seq = (unsigned long)KMODBUS_ATOMIC_LOAD(&r->Seq);
+	if (seq != no + 1) {
+		return 0;
+	}
+	rec->Stamp = r->Stamp;
+	rec->Dir = r->Dir;
+	rec->Unit = r->Unit;
+	rec->CrcOk = r->CrcOk;
+	rec->Len = r->Len;
+	if (rec->Len > KMODBUS_CAPTURE_MAX_FRAME) {
+		return 0;
+	}
+	memcpy(rec->Data, r->Data, rec->Len);
+	KMODBUS_ATOMIC_FENCE();
+	if ((unsigned long)KMODBUS_ATOMIC_LOAD(&r->Seq) != seq) {
+		return 0;
+	}
+	rec->Seq = (long)seq;
+	return 1;
+}
+
+static unsigned char*	PutLE16(unsigned char* pt, unsigned long u)
+{
+	*pt++ = (unsigned char)(u & 0xFF);
+	*pt++ = (unsigned char)((u >> 8) & 0xFF);
+	return pt;
+}
+
+static unsigned char*	PutLE32(unsigned char* pt, unsigned long u)
+{
+	pt = PutLE16(pt, u & 0xFFFF);
+	return PutLE16(pt, (u >> 16) & 0xFFFF);
+}
+
+static unsigned long	GetLE32(const unsigned char* pt)
+{
+	return (unsigned long)pt[0] | ((unsigned long)pt[1] << 8) | ((unsigned long)pt[2] << 16) | ((unsigned long)pt[3] << 24);
+}
+
+KMODBUS_STATUS	KModbusCapture_Save(PKModbusCapture_t cap, const char* path)
+{
+	KModbusCaptureRecord_t	rec;
+	unsigned char			hdr[FILE_HEADER_SIZE], *pt;
+	unsigned long			first, end, no;
+	FILE*					fp;
+	int						ok;
+
+	fp = fopen(path, "wb");
+	if (fp == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memcpy(hdr, FILE_MAGIC, 4);
+	pt = PutLE16(&hdr[4], FILE_VERSION);
+	pt = PutLE16(pt, 0);
+	PutLE32(pt, cap->TicksPerSecond);
+	ok = fwrite(hdr, FILE_HEADER_SIZE, 1, fp) == 1;
+
+	KModbusCapture_Range(cap, &first, &end);
+	for (no = first; ok && no != end; no++) {
+		if (!KModbusCapture_Read(cap, no, &rec)) {
+			continue;
+		}
+		pt = PutLE32(hdr, rec.Stamp);
+		*pt++ = rec.Dir;
+		*pt++ = rec.CrcOk;
+		*pt++ = rec.Unit;
+		PutLE16(pt, rec.Len);
+		ok = fwrite(hdr, FILE_RECORD_SIZE, 1, fp) == 1
+			&& (rec.Len == 0 || fwrite(rec.Data, rec.Len, 1, fp) == 1);
+	}
+	if (fclose(fp) != 0) {
+		ok = 0;
+	}
+	return ok ? KMODBUS_OK : KMODBUS_INVALID_PARAM;
+}
+
+KMODBUS_STATUS	KModbusCapture_SavePcap(PKModbusCapture_t cap, const char* path)
+{
+	KModbusCaptureRecord_t	rec;
+	unsigned char			hdr[24], *pt;
+	unsigned long			first, end, no, tps;
+	FILE*					fp;
+	int						ok;
+
+	fp = fopen(path, "wb");
+	if (fp == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	tps = cap->TicksPerSecond ? cap->TicksPerSecond : 1000;
+
+	pt = PutLE32(hdr, 0xA1B2C3D4UL);
+	pt = PutLE16(pt, 2);
+	pt = PutLE16(pt, 4);
+	pt = PutLE32(pt, 0);			/* thiszone */
+	pt = PutLE32(pt, 0);			/* sigfigs */
+	pt = PutLE32(pt, 65535);		/* snaplen */
+	PutLE32(pt, KMODBUS_CAPTURE_LINKTYPE);
+	ok = fwrite(hdr, 24, 1, fp) == 1;
+
+	KModbusCapture_Range(cap, &first, &end);
+	for (no = first; ok && no != end; no++) {
+		if (!KModbusCapture_Read(cap, no, &rec)) {
+			continue;
+		}
+		pt = PutLE32(hdr, rec.Stamp / tps);
+		pt = PutLE32(pt, (unsigned long)((double)(rec.Stamp % tps) * 1000000.0 / tps));
+		pt = PutLE32(pt, rec.Len + 2UL);
+		pt = PutLE32(pt, rec.Len + 2UL);
+		*pt++ = rec.Dir;
+		*pt++ = rec.CrcOk;
+		ok = fwrite(hdr, 18, 1, fp) == 1
+			&& (rec.Len == 0 || fwrite(rec.Data, rec.Len, 1, fp) == 1);
+	}
+	if (fclose(fp) != 0) {
+		ok = 0;
+	}
+	return ok ? KMODBUS_OK : KMODBUS_INVALID_PARAM;
+}
+
+/* Append the records of a file written by KModbusCapture_Save */
+KMODBUS_STATUS	KModbusCapture_Load(PKModbusCapture_t cap, const char* path)
+{
+	unsigned char	hdr[FILE_HEADER_SIZE];
+	unsigned char	data[KMODBUS_CAPTURE_MAX_FRAME];
+	int				len;
+	FILE*			fp;
+	KMODBUS_STATUS	ret;
+
+	fp = fopen(path, "rb");
+	if (fp == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (fread(hdr, FILE_HEADER_SIZE, 1, fp) != 1 || memcmp(hdr, FILE_MAGIC, 4) != 0
+		|| hdr[4] != FILE_VERSION || hdr[5] != 0) {
+		fclose(fp);
+		return KMODBUS_INVALID_PARAM;
+	}
+	cap->TicksPerSecond = GetLE32(&hdr[8]);
+
+	ret = KMODBUS_OK;
+	while (fread(hdr, FILE_RECORD_SIZE, 1, fp) == 1) {
+		len = hdr[7] | (hdr[8] << 8);
+		if (len > KMODBUS_CAPTURE_MAX_FRAME || (len != 0 && fread(data, len, 1, fp) != 1)) {
+			ret = KMODBUS_INVALID_PARAM;
+			break;
+		}
+		Put(cap, GetLE32(hdr), hdr[4], data, len, hdr[5]);
+	}
+	fclose(fp);
+	return ret;
+}
+
+/*
+	Replay context, installed as the capture context of hd while the
+	replay runs. Responses are counted from the capture hook, which gets
+	hd, so concurrent replays on different handles do not share counters.
+*/
+typedef struct ReplayContext_t {
+	KModbusReplayStats_t*	Stats;
+	PKModbusCapture_t		Source;
+	void					(*Capture)(struct KModbus_t*, int, const unsigned char*, int, int);
+	void*					CaptureContext;
+
+} ReplayContext_t;
+
+static void	ReplayHook(PKModbus_t hd, int dir, const unsigned char* buf, int len, int crcok)
+{
+	ReplayContext_t*	rc = (ReplayContext_t*)hd->CaptureContext;
+
+	if (dir == KMODBUS_CAPTURE_TX) {
+		rc->Stats->Responses++;
+		rc->Stats->ResponseBytes += len;
+	}
+	/* Keep recording into another capture, never into the replayed one */
+	if (rc->Capture && rc->CaptureContext != rc->Source) {
+		hd->CaptureContext = rc->CaptureContext;
+		(*rc->Capture)(hd, dir, buf, len, crcok);
+		hd->CaptureContext = rc;
+	}
+}
+
+/* In-memory interface of the replay, responses go nowhere */
+static KMODBUS_STATUS	ReplayGet(unsigned char* c)
+{
+	return KMODBUS_NODATA;
+}
+static KMODBUS_STATUS	ReplayGets(unsigned char* buf, int len)
+{
+	return KMODBUS_NODATA;
+}
+static KMODBUS_STATUS	ReplayPut(unsigned char c)
+{
+	return KMODBUS_OK;
+}
+static KMODBUS_STATUS	ReplayPuts(unsigned char* buf, int len)
+{
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusCapture_Replay(PKModbusCapture_t cap, PKModbus_t hd, int realtime, KModbusReplayStats_t* st)
+{
+	KModbusCaptureRecord_t	rec;
+	KModbusIF_t				saved;
+	ReplayContext_t			rc;
+	unsigned long			first, end, no, tps, delta;
+	KMODBUS_TICK			start, base, offset;
+	int						started;
+
+	memset(st, 0x00, sizeof(*st));
+	tps = cap->TicksPerSecond ? cap->TicksPerSecond : 1000;
+
+	saved = hd->Interface;
+	rc.Stats = st;
+	rc.Source = cap;
+	rc.Capture = hd->Capture;
+	rc.CaptureContext = hd->CaptureContext;
+	hd->Capture = ReplayHook;
+	hd->CaptureContext = &rc;
+	hd->Interface.Get = ReplayGet;
+	hd->Interface.Gets = ReplayGets;
+	hd->Interface.Put = ReplayPut;
+	hd->Interface.Puts = ReplayPuts;
+
+	started = 0;
+	base = 0;
+	start = (*hd->GetTick)();
+	KModbusCapture_Range(cap, &first, &end);
+	for (no = first; no != end; no++) {
+		if (!KModbusCapture_Read(cap, no, &rec)) {
+			st->Skipped++;
+			continue;
+		}
+		if (rec.Dir != KMODBUS_CAPTURE_RX) {
+			continue;
+		}
+		if (realtime) {
+			if (!started) {
+				base = rec.Stamp;
+				started = 1;
+			}
+			delta = rec.Stamp - base;
+			offset = (delta / tps) * 1000 + (delta % tps) * 1000 / tps;
+			while ((*hd->GetTick)() - start < offset) {
+				KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+			}
+		}
+		KModbus_Execute(hd, rec.Data, rec.Len);
+		st->Frames++;
+	}
+	st->Elapsed = (*hd->GetTick)() - start;
+
+	hd->Interface = saved;
+	hd->Capture = rc.Capture;
+	hd->CaptureContext = rc.CaptureContext;
+	return KMODBUS_OK;
+}
@@ -0,0 +1,101 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSCAPTURE_H__
+#define	__KMODBUSCAPTURE_H__
+
+#include "KModbus.h"
+#include "KModbusAtomic.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_CAPTURE_RECORDS
+#define	KMODBUS_CAPTURE_RECORDS		(256)	/* Power of two */
+#endif
+#define	KMODBUS_CAPTURE_MAX_FRAME	(KMODBUS_MAX_RXBUF)
+
+/* pcap link type of the dump, each packet starts with the direction and CRC status bytes */
+#define	KMODBUS_CAPTURE_LINKTYPE	(147)	/* LINKTYPE_USER0 */
+
+typedef struct KModbusCaptureRecord_t {
+	KMODBUS_ATOMIC	Seq;		/* Record number + 1 when complete, 0 when empty, -1 while written */
+	KMODBUS_TICK	Stamp;
+	unsigned char	Dir;		/* KMODBUS_CAPTURE_RX / KMODBUS_CAPTURE_TX */
+	unsigned char	Unit;
+	unsigned char	CrcOk;
+	unsigned short	Len;
+	unsigned char	Data[KMODBUS_CAPTURE_MAX_FRAME];
+
+} KModbusCaptureRecord_t, *PKModbusCaptureRecord_t;
+
+/*
+	Always-on frame capture. Writers claim a record number with one atomic
+	add and never wait, the oldest records are overwritten. When two
+	writers a lap apart meet on one slot, the one that comes second drops
+	its frame (Dropped). Readers copy a slot and drop it when its sequence
+	number changed under them.
+*/
+typedef struct KModbusCapture_t {
+	KMODBUS_ATOMIC			Head;
+	KMODBUS_ATOMIC			Dropped;
+	KMODBUS_TICK			(*GetTick)(void);
+	unsigned long			TicksPerSecond;
+
+	KModbusCaptureRecord_t	Ring[KMODBUS_CAPTURE_RECORDS];
+
+} KModbusCapture_t, *PKModbusCapture_t;
+
+typedef struct KModbusReplayStats_t {
+	unsigned long	Frames;
+	unsigned long	Responses;
+	unsigned long	ResponseBytes;
+	unsigned long	Skipped;
+	KMODBUS_TICK	Elapsed;
+
+} KModbusReplayStats_t;
+
+void			KModbusCapture_Init(PKModbusCapture_t cap, KMODBUS_TICK (*gettick)(void), unsigned long ticks_per_second);
+void			KModbusCapture_Attach(PKModbusCapture_t cap, PKModbus_t hd);
+void			KModbusCapture_Detach(PKModbus_t hd);
+void			KModbusCapture_Frame(PKModbusCapture_t cap, int dir, const unsigned char* buf, int len, int crcok);
+
+/* Records currently held are numbered first to end - 1 */
+void			KModbusCapture_Range(PKModbusCapture_t cap, unsigned long* first, unsigned long* end);
+int				KModbusCapture_Read(PKModbusCapture_t cap, unsigned long no, PKModbusCaptureRecord_t rec);
+
+KMODBUS_STATUS	KModbusCapture_Save(PKModbusCapture_t cap, const char* path);
+KMODBUS_STATUS	KModbusCapture_SavePcap(PKModbusCapture_t cap, const char* path);
+KMODBUS_STATUS	KModbusCapture_Load(PKModbusCapture_t cap, const char* path);
+
+/* Feed the captured queries to hd, realtime != 0 keeps the original spacing */
+KMODBUS_STATUS	KModbusCapture_Replay(PKModbusCapture_t cap, PKModbus_t hd, int realtime, KModbusReplayStats_t* st);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSCAPTURE_H__ */
@@ -0,0 +1,608 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSCLIENT_HPP__
+#define	__KMODBUSCLIENT_HPP__
+
+/*
+	C++20 coroutine client for KModbus masters.
+
+	Each Link drives one master handle (a serial line or a TCP slave) and
+	runs one transaction at a time on it. All links are polled by one
+	Executor on the calling thread, so requests to different links are in
+	flight at the same time without a thread per device.
+
+	KModbus::Executor	ex;
+	KModbus::Link		line1(ex, &hMaster1), line2(ex, &hMaster2);
+	KModbus::Client		c1(line1), c2(line2);
+
+	ex.Spawn([&]() -> KModbus::Task<> {
+		KModbus::Reply	r = co_await c1.ReadHoldingRegister(1, 0, 10);
+		...
+	}());
+	ex.Run();
+
+	Timeouts default to hd->ResponseTimeout and can be given per request.
+	A request whose Cancellation is raised completes with KMODBUS_CANCELLED;
+	if its frame is already on the wire the link still waits for the
+	response (or the timeout) before sending the next one.
+*/
+
+#include	"KModbusMaster.h"
+#include	<coroutine>
+#include	<cstring>
+#include	<deque>
+#include	<exception>
+#include	<utility>
+#include	<vector>
+
+namespace KModbus {
+
+class Executor;
+class Link;
+
+/* Lazily started coroutine returning T */
+template<typename T = void>
+class Task;
+
+namespace Detail {
+
+template<typename T>
+struct PromiseBase {
+	std::coroutine_handle<>		continuation;
+	std::exception_ptr			error;
+
+	std::suspend_always	initial_suspend() noexcept { return {}; }
+
+	struct FinalAwaiter {
+		bool	await_ready() noexcept { return false; }
+		template<typename P>
+		std::coroutine_handle<>	await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			if (h.promise().continuation) {
+				return h.promise().continuation;
+			}
+			return std::noop_coroutine();
+		}
+		void	await_resume() noexcept {}
+	};
+	FinalAwaiter	final_suspend() noexcept { return {}; }
+
+	void	unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct Promise : PromiseBase<T> {
+	T		value{};
+
+	Task<T>	get_return_object();
+	void	return_value(T v) { value = std::move(v); }
+	T		result()
+	{
+		if (this->error) {
+			std::rethrow_exception(this->error);
+		}
+		return std::move(value);
+	}
+};
+
+template<>
+struct Promise<void> : PromiseBase<void> {
+	Task<void>	get_return_object();
+	void		return_void() {}
+	void		result()
+	{
+		if (this->error) {
+			std::rethrow_exception(this->error);
+		}
+	}
+};
+
+/* Fire-and-forget frame used by Executor::Spawn */
+struct Detached {
+	struct promise_type {
+		Detached			get_return_object() { return {}; }
+		std::suspend_never	initial_suspend() noexcept { return {}; }
+		std::suspend_never	final_suspend() noexcept { return {}; }
+		void				return_void() {}
+		void				unhandled_exception() { std::terminate(); }
+	};
+};
+
+}	/* namespace Detail */
+
+template<typename T>
+class Task {
+public:
+	using promise_type = Detail::Promise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(handle_type h) : handle(h) {}
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task&	operator=(Task&& other) noexcept
+	{
+		if (this != &other) {
+			if (handle) {
+				handle.destroy();
+			}
+			handle = std::exchange(other.handle, nullptr);
+		}
+		return *this;
+	}
+	Task(const Task&) = delete;
+	Task&	operator=(const Task&) = delete;
+	~Task()
+	{
+		if (handle) {
+			handle.destroy();
+		}
+	}
+
+	bool	await_ready() const noexcept { return !handle || handle.done(); }
+	std::coroutine_handle<>	await_suspend(std::coroutine_handle<> caller) noexcept
+	{
+		handle.promise().continuation = caller;
+		return handle;
+	}
+	T		await_resume() { return handle.promise().result(); }
+
+private:
+	handle_type		handle;
+};
+
+namespace Detail {
+
+template<typename T>
+inline Task<T>	Promise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void>	Promise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}	/* namespace Detail */
+
+/* Result of a request, values are filled for reads */
+struct Reply {
+	KMODBUS_STATUS					status = KMODBUS_OK;
+	std::vector<unsigned short>		values;
+
+	explicit operator bool() const { return status == KMODBUS_OK; }
+};
+
+/* Raised by the application to abandon requests that refer to it */
+class Cancellation {
+public:
+	void	Cancel() { cancelled = true; }
+	void	Reset() { cancelled = false; }
+	bool	IsCancelled() const { return cancelled; }
+
+private:
+	bool	cancelled = false;
+};
+
+struct Options {
+	KMODBUS_TICK		timeout = 0;		/* 0: hd->ResponseTimeout */
+	const Cancellation*	cancel = nullptr;
+};
+
+/* Awaitable request, lives in the frame of the awaiting coroutine */
+class Transaction {
+public:
+	/* build(req) encodes the request frame and returns its length */
+	template<typename Build>
+	Transaction(Link& l, int cnt, const Options& opt, Build build) : link(l), count(cnt), options(opt)
+	{
+		reqlen = build(req);
+		if (reqlen <= 0) {
+			reply.status = KMODBUS_INVALID_PARAM;
+		}
+	}
+	Transaction(const Transaction&) = delete;
+	Transaction&	operator=(const Transaction&) = delete;
+
+	bool	await_ready() const noexcept { return reqlen <= 0; }
+	void	await_suspend(std::coroutine_handle<> h);
+	Reply	await_resume() { return std::move(reply); }
+
+private:
+	friend class Link;
+
+	Link&					link;
+	unsigned char			req[KMODBUS_MAX_TXBUF];
+	int						reqlen;
+	int						count;
+	Options					options;
+	Transaction*			next = nullptr;
+	std::coroutine_handle<>	waiter;
+	Reply					reply;
+};
+
+class Executor {
+public:
+	explicit Executor(KMODBUS_TICK (*tick)(void) = KMODBUS_GETTICKCOUNT) : GetTick(tick) {}
+	Executor(const Executor&) = delete;
+	Executor&	operator=(const Executor&) = delete;
+
+	KMODBUS_TICK	Now() const { return (*GetTick)(); }
+
+	/* Start a top-level task, Run() returns when all of them finished */
+	void	Spawn(Task<void> task)
+	{
+		++running;
+		Start(this, std::move(task));
+	}
+
+	void	Post(std::coroutine_handle<> h) { ready.push_back(h); }
+
+	/* Awaitable delay on the executor clock */
+	struct Delay {
+		Executor&		ex;
+		KMODBUS_TICK	until;
+
+		bool	await_ready() const noexcept { return false; }
+		void	await_suspend(std::coroutine_handle<> h) { ex.timers.push_back({ until, h }); }
+		void	await_resume() const noexcept {}
+	};
+	Delay	Sleep(KMODBUS_TICK ms) { return Delay{ *this, Now() + ms }; }
+
+	/* One round of link polling, timers and resumption; false when idle */
+	bool	RunOnce();
+
+	void	Run()
+	{
+		while (running > 0) {
+			if (!RunOnce()) {
+				KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+			}
+		}
+	}
+
+private:
+	friend class Link;
+
+	struct Timer {
+		KMODBUS_TICK			until;
+		std::coroutine_handle<>	waiter;
+	};
+
+	static Detail::Detached	Start(Executor* ex, Task<void> task)
+	{
+		co_await task;
+		--ex->running;
+	}
+
+	KMODBUS_TICK						(*GetTick)(void);
+	std::vector<Link*>					links;
+	std::deque<std::coroutine_handle<>>	ready;
+	std::vector<Timer>					timers;
+	int									running = 0;
+};
+
+class Link {
+public:
+	Link(Executor& executor, PKModbus_t handle) : ex(executor), hd(handle)
+	{
+		ex.links.push_back(this);
+	}
+	Link(const Link&) = delete;
+	Link&	operator=(const Link&) = delete;
+	~Link()
+	{
+		for (auto it = ex.links.begin(); it != ex.links.end(); ++it) {
+			if (*it == this) {
+				ex.links.erase(it);
+				break;
+			}
+		}
+	}
+
+	PKModbus_t	Handle() const { return hd; }
+
+	void	Submit(Transaction* t)
+	{
+		t->next = nullptr;
+		if (tail) {
+			tail->next = t;
+		}
+		else {
+			head = t;
+		}
+		tail = t;
+	}
+
+	/* Advance the transaction on the wire, false when nothing happened */
+	bool	Poll(KMODBUS_TICK now)
+	{
+		bool	progress = DropCancelled();
+
+		if (onwire) {
+			progress |= Receive(now);
+		}
+		if (turnaround && (long)(now - idleUntil) >= 0) {
+			turnaround = false;
+		}
+		if (!onwire && !turnaround && head) {
+			Send(now);
+			progress = true;
+		}
+		return progress;
+	}
+
+private:
+	void	Complete(Transaction* t, KMODBUS_STATUS status)
+	{
+		t->reply.status = status;
+		ex.Post(t->waiter);
+	}
+
+	bool	DropCancelled()
+	{
+		Transaction		**pp = &head, *t;
+		bool			dropped = false;
+
+		tail = nullptr;
+		while ((t = *pp) != nullptr) {
+			if (t->options.cancel && t->options.cancel->IsCancelled()) {
+				*pp = t->next;
+				Complete(t, KMODBUS_CANCELLED);
+				dropped = true;
+				continue;
+			}
+			tail = t;
+			pp = &t->next;
+		}
+		if (active && active->options.cancel && active->options.cancel->IsCancelled()) {
+			/* Keep waiting on the wire, but release the caller now */
+			Complete(active, KMODBUS_CANCELLED);
+			active = nullptr;
+			dropped = true;
+		}
+		return dropped;
+	}
+
+	void	Send(KMODBUS_TICK now)
+	{
+		KMODBUS_STATUS	ret;
+		unsigned char	c;
+		int				n;
+
+		active = head;
+		head = head->next;
+		if (!head) {
+			tail = nullptr;
+		}
+
+		/* Discard the rest of a previous response, at most one frame of a noisy line */
+		for (n = 0; n < KMODBUS_MAX_RXBUF && hd->Interface.Get(&c) == KMODBUS_OK; n++) {
+		}
+		memcpy(hd->TxBuf, active->req, active->reqlen);
+		hd->MessageCounter++;
+		ret = hd->Interface.Puts(hd->TxBuf, active->reqlen);
+		if (ret != KMODBUS_OK || hd->TxBuf[0] == KMODBUS_BROADCAST_ID) {
+			/* Transport failure or broadcast without response */
+			if (ret == KMODBUS_OK) {
+				/* Hold the line for the turnaround delay */
+				hd->BroadcastCounter++;
+				idleUntil = now + hd->TurnaroundDelay;
+				turnaround = true;
+			}
+			Complete(active, ret);
+			active = nullptr;
+			return;
+		}
+		timeout = active->options.timeout ? active->options.timeout : hd->ResponseTimeout;
+		start = now;
+		rxlen = 0;
+		onwire = true;
+	}
+
+	bool	Receive(KMODBUS_TICK now)
+	{
+		KMODBUS_STATUS	ret;
+		bool			progress = false;
+		int				need;
+
+		while (hd->Interface.Get(&hd->RxBuf[rxlen]) == KMODBUS_OK) {
+			progress = true;
+			++rxlen;
+			need = KModbusMaster_ResponseLength(hd->RxBuf, rxlen);
+			if (need < 0) {
+				hd->ExceptionErrorCount++;
+				Finish(KMODBUS_INVALID_RESPONSE);
+				return true;
+			}
+			if (need > 0 && rxlen >= need) {
+				if (active) {
+					if (active->count > 0) {
+						active->reply.values.resize(active->count);
+					}
+					ret = KModbusMaster_Decode(hd->TxBuf, hd->RxBuf, rxlen,
+						active->reply.values.empty() ? nullptr : active->reply.values.data());
+				}
+				else {
+					ret = KModbusMaster_Decode(hd->TxBuf, hd->RxBuf, rxlen, nullptr);
+				}
+				if (ret == KMODBUS_INVALID_RESPONSE) {
+					hd->CRCErrorCounter++;
+				}
+				else if (ret != KMODBUS_OK) {
+					hd->ExceptionErrorCount++;
+				}
+				else {
+					hd->EventCounter++;
+				}
+				Finish(ret);
+				return true;
+			}
+		}
+		if (now - start >= timeout) {
+			hd->NoResponseCount++;
+			Finish(KMODBUS_TIMEOUT);
+			return true;
+		}
+		return progress;
+	}
+
+	void	Finish(KMODBUS_STATUS status)
+	{
+		if (active) {
+			if (status != KMODBUS_OK) {
+				active->reply.values.clear();
+			}
+			Complete(active, status);
+			active = nullptr;
+		}
+		onwire = false;
+	}
+
+	Executor&		ex;
+	PKModbus_t		hd;
+	Transaction*	head = nullptr;
+	Transaction*	tail = nullptr;
+	Transaction*	active = nullptr;
+	bool			onwire = false;
+	bool			turnaround = false;
+	int				rxlen = 0;
+	KMODBUS_TICK	start = 0;
+	KMODBUS_TICK	timeout = 0;
+	KMODBUS_TICK	idleUntil = 0;
+};
+
+inline void	Transaction::await_suspend(std::coroutine_handle<> h)
+{
+	waiter = h;
+	link.Submit(this);
+}
+
+inline bool	Executor::RunOnce()
+{
+	KMODBUS_TICK	now = Now();
+	bool			progress = false;
+	size_t			i;
+
+	for (Link* l : links) {
+		progress |= l->Poll(now);
+	}
+	for (i = 0; i < timers.size(); ) {
+		if ((long)(now - timers[i].until) >= 0) {
+			ready.push_back(timers[i].waiter);
+			timers[i] = timers.back();
+			timers.pop_back();
+			continue;
+		}
+		++i;
+	}
+	while (!ready.empty()) {
+		std::coroutine_handle<>	h = ready.front();
+
+		ready.pop_front();
+		h.resume();
+		progress = true;
+	}
+	return progress;
+}
+
+/* Request front end of a Link, unit is the slave address of each request */
+class Client {
+public:
+	explicit Client(Link& l) : link(l) {}
+
+	Transaction	ReadCoilStatus(unsigned char unit, KMODBUS_ADDRESS ad, int len, const Options& opt = {})
+	{
+		return Read(unit, 1, ad, len, opt);
+	}
+	Transaction	ReadInputStatus(unsigned char unit, KMODBUS_ADDRESS ad, int len, const Options& opt = {})
+	{
+		return Read(unit, 2, ad, len, opt);
+	}
+	Transaction	ReadHoldingRegister(unsigned char unit, KMODBUS_ADDRESS ad, int len, const Options& opt = {})
+	{
+		return Read(unit, 3, ad, len, opt);
+	}
+	Transaction	ReadInputRegister(unsigned char unit, KMODBUS_ADDRESS ad, int len, const Options& opt = {})
+	{
+		return Read(unit, 4, ad, len, opt);
+	}
+	Transaction	ForceSingleCoil(unsigned char unit, KMODBUS_ADDRESS ad, KMODBUS_COIL_STATUS dt, const Options& opt = {})
+	{
+		return Transaction(link, 0, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildWriteSingle(buf, unit, 5, ad, dt);
+		});
+	}
+	Transaction	PresetSingleRegister(unsigned char unit, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER dt, const Options& opt = {})
+	{
+		return Transaction(link, 0, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildWriteSingle(buf, unit, 6, ad, dt);
+		});
+	}
+	Transaction	ForceMultipleCoils(unsigned char unit, KMODBUS_ADDRESS ad, const std::vector<KMODBUS_COIL_STATUS>& dt, const Options& opt = {})
+	{
+		return Transaction(link, 0, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildWriteMultiple(buf, unit, 15, ad, (int)dt.size(), dt.data());
+		});
+	}
+	Transaction	PresetMultipleRegisters(unsigned char unit, KMODBUS_ADDRESS ad, const std::vector<KMODBUS_HOLDING_REGISTER>& dt, const Options& opt = {})
+	{
+		return Transaction(link, 0, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildWriteMultiple(buf, unit, 16, ad, (int)dt.size(), dt.data());
+		});
+	}
+	Transaction	MaskWriteRegister(unsigned char unit, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER and_mask, KMODBUS_HOLDING_REGISTER or_mask, const Options& opt = {})
+	{
+		return Transaction(link, 0, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildMaskWrite(buf, unit, ad, and_mask, or_mask);
+		});
+	}
+	Transaction	ReadWriteMultipleRegisters(unsigned char unit, KMODBUS_ADDRESS rad, int rlen, KMODBUS_ADDRESS wad, const std::vector<KMODBUS_HOLDING_REGISTER>& wdt, const Options& opt = {})
+	{
+		return Transaction(link, rlen, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildReadWrite(buf, unit, rad, rlen, wad, (int)wdt.size(), wdt.data());
+		});
+	}
+	Transaction	Diagnostics(unsigned char unit, KMODBUS_DIAGNOSTICS no, KMODBUS_HOLDING_REGISTER dt, const Options& opt = {})
+	{
+		return Transaction(link, 1, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildDiagnostics(buf, unit, no, dt);
+		});
+	}
+
+private:
+	Transaction	Read(unsigned char unit, unsigned char fc, KMODBUS_ADDRESS ad, int len, const Options& opt)
+	{
+		return Transaction(link, len, opt, [&](unsigned char* buf) {
+			return KModbusMaster_BuildRead(buf, unit, fc, ad, len);
+		});
+	}
+
+	Link&	link;
+};
+
+}	/* namespace KModbus */
+
+#endif	/* __KMODBUSCLIENT_HPP__ */
@@ -0,0 +1,417 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifdef	_MSC_VER
+#define	_CRT_SECURE_NO_WARNINGS
+#endif
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define	_POSIX_C_SOURCE			200809L		/* ftruncate */
+#endif
+#include	"KModbusFile.h"
+#include	"KModbusMaster.h"
+#include	"KModbusLock.h"
+#include	<memory.h>
+
+#ifdef _WIN32
+#include	<windows.h>
+#else
+#include	<fcntl.h>
+#include	<sys/mman.h>
+#include	<sys/stat.h>
+#include	<unistd.h>
+#endif
+
+#define	REFERENCE_TYPE		(6)
+#define	SUB_REQUEST			(7)		/* Reference type, file (2), record (2), length (2) */
+#define	FILE_QUERY_LEN		(3)		/* ID, code, byte count */
+#define	FILE_COUNT_POS		(2)
+
+typedef struct FileRegion_t {
+	unsigned char*	Data;
+	unsigned long	Bytes;
+	unsigned short	First;
+	unsigned short	Files;
+	int				Writable;
+	int				Mapped;
+#ifdef _WIN32
+	HANDLE			File;
+	HANDLE			Mapping;
+#endif
+} FileRegion_t;
+
+static FileRegion_t	s_Region[KMODBUS_FILES];
+static KMODBUS_LOCK	s_Lock = KMODBUS_LOCK_INIT;
+
+static FileRegion_t*	FindRegion(unsigned short first)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_FILES; i++) {
+		if (s_Region[i].Data != 0 && s_Region[i].First == first) {
+			return &s_Region[i];
+		}
+	}
+	return 0;
+}
+
+/* Data of one sub-request, 0 when it is outside every region */
+static unsigned char*	Locate(const unsigned char* q, int write)
+{
+	FileRegion_t*	r;
+	unsigned long	ofs;
+	unsigned int	file, record, len;
+	int				i;
+
+	file = KModbud_B2N((unsigned char*)&q[1]);
+	record = KModbud_B2N((unsigned char*)&q[3]);
+	len = KModbud_B2N((unsigned char*)&q[5]);
+	if (q[0] != REFERENCE_TYPE || len < 1 || record + len > KMODBUS_FILE_RECORDS) {
+		return 0;
+	}
+	for (i = 0; i < KMODBUS_FILES; i++) {
+		r = &s_Region[i];
+		if (r->Data == 0 || file < r->First || file - r->First >= r->Files) {
+			continue;
+		}
+		if (write && !r->Writable) {
+			return 0;
+		}
+		ofs = ((unsigned long)(file - r->First) * KMODBUS_FILE_RECORDS + record) * 2;
+		if (ofs + len * 2 > r->Bytes) {
+			return 0;
+		}
+		return &r->Data[ofs];
+	}
+	return 0;
+}
+
+static KMODBUS_STATUS	AddRegion(unsigned short first, unsigned char* data, unsigned long bytes, int writable, int mapped)
+{
+	FileRegion_t*	r;
+	unsigned long	files;
+	int				i, slot;
+
+	files = (bytes + KMODBUS_FILE_BYTES - 1) / KMODBUS_FILE_BYTES;
+	if (first == 0 || data == 0 || bytes < 2 || files > 0x10000UL - first) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	slot = -1;
+	for (i = 0; i < KMODBUS_FILES; i++) {
+		r = &s_Region[i];
+		if (r->Data == 0) {
+			if (slot < 0) {
+				slot = i;
+			}
+		}
+		else if (first < r->First + r->Files && r->First < first + files) {
+			return KMODBUS_INVALID_PARAM;		/* Overlaps */
+		}
+	}
+	if (slot < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	r = &s_Region[slot];
+	KModbusLock_Begin(&s_Lock);
+	r->First = first;
+	r->Files = (unsigned short)files;
+	r->Bytes = bytes & ~1UL;
+	r->Writable = writable;
+	r->Mapped = mapped;
+	r->Data = data;
+	KModbusLock_End(&s_Lock);
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusFile_Attach(unsigned short first, void* data, unsigned long bytes, int writable)
+{
+	return AddRegion(first, (unsigned char*)data, bytes, writable, 0);
+}
+
+#ifdef _WIN32
+KMODBUS_STATUS	KModbusFile_Map(unsigned short first, const char* path, unsigned long bytes, int writable)
+{
+	HANDLE			file, mapping;
+	LARGE_INTEGER	size;
+	FileRegion_t*	r;
+	void*			view;
+	KMODBUS_STATUS	ret;
+
+	file = CreateFileA(path, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (bytes == 0) {
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || size.QuadPart > 0xFFFFFFFFLL) {
+			CloseHandle(file);
+			return KMODBUS_INVALID_PARAM;
+		}
+		bytes = (unsigned long)size.QuadPart;
+	}
+	/* A writable mapping larger than the file extends it */
+	mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, bytes, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return KMODBUS_INVALID_PARAM;
+	}
+	view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, bytes);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return KMODBUS_INVALID_PARAM;
+	}
+	ret = AddRegion(first, (unsigned char*)view, bytes, writable, 1);
+	if (ret != KMODBUS_OK) {
+		UnmapViewOfFile(view);
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return ret;
+	}
+	r = FindRegion(first);
+	r->File = file;
+	r->Mapping = mapping;
+	return KMODBUS_OK;
+}
+
+static void	Unmap(FileRegion_t* r)
+{
+	UnmapViewOfFile(r->Data);
+	CloseHandle(r->Mapping);
+	CloseHandle(r->File);
+}
+
+static int	SyncRegion(FileRegion_t* r)
+{
+	return FlushViewOfFile(r->Data, r->Bytes) && FlushFileBuffers(r->File);
+}
+#else
+KMODBUS_STATUS	KModbusFile_Map(unsigned short first, const char* path, unsigned long bytes, int writable)
+{
+	struct stat		st;
+	void*			view;
+	KMODBUS_STATUS	ret;
+	int				fd;
+
+	fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (fd < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (bytes == 0) {
+		bytes = (unsigned long)st.st_size;
+	}
+	if (bytes == 0 || (bytes > (unsigned long)st.st_size && (!writable || ftruncate(fd, (off_t)bytes) != 0))) {
+		close(fd);
+		return KMODBUS_INVALID_PARAM;
+	}
+	view = mmap(0, bytes, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);		/* The mapping keeps the file */
+	if (view == MAP_FAILED) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	ret = AddRegion(first, (unsigned char*)view, bytes, writable, 1);
+	if (ret != KMODBUS_OK) {
+		munmap(view, bytes);
+	}
+	return ret;
+}
+
+static void	Unmap(FileRegion_t* r)
+{
+	munmap(r->Data, r->Bytes);
+}
+
+static int	SyncRegion(FileRegion_t* r)
+{
+	return msync(r->Data, r->Bytes, MS_SYNC) == 0;
+}
+#endif
+
+void*	KModbusFile_Data(unsigned short first, unsigned long* bytes)
+{
+	FileRegion_t*	r;
+
+	r = FindRegion(first);
+	if (r == 0) {
+		return 0;
+	}
+	if (bytes) {
+		*bytes = r->Bytes;
+	}
+	return r->Data;
+}
+
+KMODBUS_STATUS	KModbusFile_Sync(unsigned short first)
+{
+	FileRegion_t*	r;
+
+	r = FindRegion(first);
+	if (r == 0 || !r->Mapped) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	return SyncRegion(r) ? KMODBUS_OK : KMODBUS_SLAVE_FAILURE;
+}
+
+void	KModbusFile_Detach(unsigned short first)
+{
+	FileRegion_t*	r;
+	FileRegion_t	old;
+
+	r = FindRegion(first);
+	if (r == 0) {
+		return;
+	}
+	/* No handler is inside the region once the lock is released */
+	KModbusLock_Begin(&s_Lock);
+	old = *r;
+	memset(r, 0x00, sizeof(*r));
+	KModbusLock_End(&s_Lock);
+	if (old.Mapped) {
+		Unmap(&old);
+	}
+}
+
+static KMODBUS_STATUS	entry_ReadFileRecord20(PKModbus_t hd)
+{
+	unsigned char*	q;
+	unsigned char*	tx;
+	unsigned char*	dt;
+	KMODBUS_STATUS	ret;
+	int				n, i, len, total;
+
+	n = hd->RxBuf[2];
+	if (n < SUB_REQUEST || n > KMODBUS_MAX_FILE_BYTES || n % SUB_REQUEST != 0) {
+		KModbus_Exception(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	total = 0;
+	for (i = 0; i < n; i += SUB_REQUEST) {
+		total += 2 + KModbud_B2N(&hd->RxBuf[3 + i + 5]) * 2;
+	}
+	if (total > KMODBUS_MAX_FILE_BYTES || total + 5 > KMODBUS_MAX_TXBUF) {
+		KModbus_Exception(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+
+	ret = KMODBUS_OK;
+	KModbusLock_ReadBegin(&s_Lock);
+	for (i = 0; i < n && ret == KMODBUS_OK; i += SUB_REQUEST) {
+		if (Locate(&hd->RxBuf[3 + i], 0) == 0) {
+			ret = KMODBUS_NON_EXISTENT_ADDRESS;
+		}
+	}
+	tx = &hd->TxBuf[3];
+	for (i = 0; i < n && ret == KMODBUS_OK; i += SUB_REQUEST) {
+		q = &hd->RxBuf[3 + i];
+		dt = Locate(q, 0);
+		len = KModbud_B2N(&q[5]) * 2;
+		*tx++ = (unsigned char)(len + 1);
+		*tx++ = REFERENCE_TYPE;
+		memcpy(tx, dt, len);
+		tx += len;
+	}
+	KModbusLock_ReadEnd(&s_Lock);
+	if (ret != KMODBUS_OK) {
+		KModbus_Exception(hd, ret);
+		return ret;
+	}
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1];
+	hd->TxBuf[2] = (unsigned char)total;
+	return KModbus_Respond(hd, total + 3);
+}
+
+static KMODBUS_STATUS	entry_WriteFileRecord21(PKModbus_t hd)
+{
+	unsigned char*	q;
+	KMODBUS_STATUS	ret;
+	int				n, i, len;
+
+	n = hd->RxBuf[2];
+	if (n < SUB_REQUEST + 2 || n > KMODBUS_MAX_FILE_BYTES) {
+		KModbus_Exception(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+	/* The sub-requests must fill the byte count exactly */
+	for (i = 0; i < n; i += SUB_REQUEST + len) {
+		if (i + SUB_REQUEST > n) {
+			break;
+		}
+		len = KModbud_B2N(&hd->RxBuf[3 + i + 5]) * 2;
+	}
+	if (i != n) {
+		KModbus_Exception(hd, KMODBUS_INVALID_PARAM);
+		return KMODBUS_INVALID_PARAM;
+	}
+
+	ret = KMODBUS_OK;
+	KModbusLock_Begin(&s_Lock);
+	for (i = 0; i < n && ret == KMODBUS_OK; i += SUB_REQUEST + len) {
+		q = &hd->RxBuf[3 + i];
+		len = KModbud_B2N(&q[5]) * 2;
+		if (Locate(q, 1) == 0) {
+			ret = KMODBUS_NON_EXISTENT_ADDRESS;
+		}
+	}
+	for (i = 0; i < n && ret == KMODBUS_OK; i += SUB_REQUEST + len) {
+		q = &hd->RxBuf[3 + i];
+		len = KModbud_B2N(&q[5]) * 2;
+		memcpy(Locate(q, 1), &q[SUB_REQUEST], len);
+	}
+	KModbusLock_End(&s_Lock);
+	if (ret != KMODBUS_OK) {
+		KModbus_Exception(hd, ret);
+		return ret;
+	}
+
+	/* The response echoes the query */
+	memcpy(hd->TxBuf, hd->RxBuf, n + 3);
+	return KModbus_Respond(hd, n + 3);
+}
+
+void	KModbusFile_Begin(void)
+{
+	KModbusLock_Begin(&s_Lock);
+}
+
+void	KModbusFile_End(void)
+{
+	KModbusLock_End(&s_Lock);
+}
+
+KMODBUS_STATUS	KModbusFile_Serve(int on)
+{
+	KMODBUS_STATUS	ret;
+
+	ret = KModbus_RegisterFunction(20, on ? entry_ReadFileRecord20 : 0, FILE_QUERY_LEN, FILE_COUNT_POS);
+	if (ret == KMODBUS_OK) {
+		ret = KModbus_RegisterFunction(21, on ? entry_WriteFileRecord21 : 0, FILE_QUERY_LEN, FILE_COUNT_POS);
+	}
+	return ret;
+}
@@ -0,0 +1,79 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSFILE_H__
+#define	__KMODBUSFILE_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/*
+	File records (FC20/FC21) served from application buffers or memory
+	mapped files. A region holds registers big-endian, as on the wire, and
+	is split into file numbers of 10000 records starting at its first file
+	number. Reads copy straight from the region into the response frame,
+	every sub-request of a frame is checked before any data moves. The
+	handlers hold the lock of the regions, not the bank lock; the
+	application takes it with KModbusFile_Begin/End when it needs a
+	consistent view of a region.
+*/
+
+#ifndef	KMODBUS_FILES
+#define	KMODBUS_FILES				(8)		/* Regions */
+#endif
+
+#define	KMODBUS_FILE_RECORDS		(10000)	/* Records of one file number */
+#define	KMODBUS_FILE_BYTES			(KMODBUS_FILE_RECORDS * 2)
+
+/* Expose bytes of data as files first, first + 1, ... */
+KMODBUS_STATUS	KModbusFile_Attach(unsigned short first, void* data, unsigned long bytes, int writable);
+
+/* Map path, created or extended to bytes when writable (0: the size of the file) */
+KMODBUS_STATUS	KModbusFile_Map(unsigned short first, const char* path, unsigned long bytes, int writable);
+
+/* Start of the region of file first and its size, 0 when there is none */
+void*			KModbusFile_Data(unsigned short first, unsigned long* bytes);
+
+/* Write the dirty pages of a mapped region back to its file */
+KMODBUS_STATUS	KModbusFile_Sync(unsigned short first);
+
+/* Stop serving the region, a mapped file is unmapped */
+void			KModbusFile_Detach(unsigned short first);
+
+/* Hold off the FC20/FC21 handlers, no bank access inside */
+void			KModbusFile_Begin(void);
+void			KModbusFile_End(void);
+
+/* Register (on != 0) or remove the FC20/FC21 handlers */
+KMODBUS_STATUS	KModbusFile_Serve(int on);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSFILE_H__ */
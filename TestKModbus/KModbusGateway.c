@@ -0,0 +1,771 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusGateway.h"
+#include	<memory.h>
+
+#define	GET_TICK(fd)			(*((fd)->GetTick))()
+
+#define	IS_READ(fc)				((fc) >= 1 && (fc) <= 4)
+
+/* Modbus exception codes sent by the gateway itself */
+#define	EX_ILLEGAL_FUNCTION		(0x01)
+#define	EX_ILLEGAL_DATA_VALUE	(0x03)
+#define	EX_SERVER_BUSY			(0x06)
+#define	EX_GATEWAY_NO_RESPONSE	(0x0B)
+
+static void	CloseClient(PKModbusGateway_t gw, int ci);
+
+static PKModbusGwRequest_t	AllocRequest(PKModbusGateway_t gw)
+{
+	PKModbusGwRequest_t	rq;
+
+	rq = gw->Free;
+	if (rq) {
+		gw->Free = rq->Next;
+		rq->Next = 0;
+		rq->Waiters = 0;
+	}
+	return rq;
+}
+
+static void	FreeRequest(PKModbusGateway_t gw, PKModbusGwRequest_t rq)
+{
+	rq->Next = gw->Free;
+	gw->Free = rq;
+}
+
+/* Send an MBAP framed PDU back to the client that asked for it */
+static void	Reply(PKModbusGateway_t gw, PKModbusGwRequest_t rq, const unsigned char* pdu, int len)
+{
+	KModbusGwClient_t*	cl;
+	unsigned char		adu[KMODBUS_GW_MAX_ADU];
+
+	cl = &gw->Clients[rq->Client];
+	if (cl->Socket == KMODBUS_INVALID_SOCKET || cl->Generation != rq->Generation) {
+		return;		/* Client went away meanwhile */
+	}
+	adu[0] = (unsigned char)(rq->Tid >> 8);
+	adu[1] = (unsigned char)(rq->Tid & 0x00FF);
+	adu[2] = 0;
+	adu[3] = 0;
+	adu[4] = (unsigned char)((len + 1) >> 8);
+	adu[5] = (unsigned char)((len + 1) & 0x00FF);
+	adu[6] = rq->Unit;
+	memcpy(&adu[7], pdu, len);
+	if (send(cl->Socket, (const char*)adu, len + 7, 0) != len + 7) {
+		CloseClient(gw, rq->Client);
+	}
+}
+
+static void	ReplyException(PKModbusGateway_t gw, PKModbusGwRequest_t rq, unsigned char code)
+{
+	unsigned char	pdu[2];
+
+	pdu[0] = rq->Pdu[0] | 0x80;
+	pdu[1] = code;
+	Reply(gw, rq, pdu, 2);
+}
+
+/* Build the read response for ad/cnt out of the data of a larger read at srcad */
+static int	SliceRead(unsigned char fc, unsigned short srcad, const unsigned char* src, unsigned short ad, int cnt, unsigned char* pdu)
+{
+	int		i, bit;
+
+	pdu[0] = fc;
+	if (fc >= 3) {
+		pdu[1] = (unsigned char)(cnt * 2);
+		memcpy(&pdu[2], &src[(ad - srcad) * 2], cnt * 2);
+		return cnt * 2 + 2;
+	}
+	pdu[1] = (unsigned char)((cnt + 7) / 8);
+	memset(&pdu[2], 0x00, pdu[1]);
+	for (i = 0; i < cnt; i++) {
+		bit = ad - srcad + i;
+		if (src[bit / 8] & (1 << (bit % 8))) {
+			pdu[2 + i / 8] |= (unsigned char)(1 << (i % 8));
+		}
+	}
+	return pdu[1] + 2;
+}
+
+static unsigned short	ReadAddr(PKModbusGwRequest_t rq)
+{
+	return KModbud_B2N(&rq->Pdu[1]);
+}
+
+static unsigned short	ReadCount(PKModbusGwRequest_t rq)
+{
+	return KModbud_B2N(&rq->Pdu[3]);
+}
+
+/* Does read a cover the whole range of read b */
+static int	Covers(unsigned char unit, unsigned char fc, unsigned short ad, unsigned short cnt, PKModbusGwRequest_t b)
+{
+	return unit == b->Unit && fc == b->Pdu[0]
+		&& ReadAddr(b) >= ad && (long)ReadAddr(b) + ReadCount(b) <= (long)ad + cnt;
+}
+
+void	KModbusGateway_InvalidateCache(PKModbusGateway_t gw)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_GW_CACHE_SIZE; i++) {
+		gw->Cache[i].Valid = 0;
+	}
+}
+
+/* Function codes a slave executes from a broadcast (writes only), as the core accepts them */
+static int	IsBroadcastFunction(unsigned char fc)
+{
+	switch (fc) {
+	case 5:
+	case 6:
+	case 15:
+	case 16:
+	case 22:
+		return 1;
+	}
+	return 0;
+}
+
+/* Is the PDU as long as its function code and byte count say, and a read's quantity in range */
+static int	PduLengthValid(const unsigned char* pdu, int len)
+{
+	unsigned short	cnt;
+
+	switch (pdu[0]) {
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+		if (len != 5) {
+			return 0;
+		}
+		cnt = KModbud_B2N((unsigned char*)&pdu[3]);
+		return cnt >= 1 && cnt <= ((pdu[0] <= 2) ? KMODBUS_MAX_READ_BITS : KMODBUS_MAX_READ_REGS);
+	case 5:
+	case 6:
+		return len == 5;
+	case 15:
+	case 16:
+		return len >= 6 && len == 6 + pdu[5];
+	case 22:
+		return len == 7;
+	case 23:
+		return len >= 10 && len == 10 + pdu[9];
+	default:
+		/* Passed through as is, the slave judges it */
+		return 1;
+	}
+}
+
+/* Drop cached reads of the table a write request modifies */
+static void	InvalidateFor(PKModbusGateway_t gw, PKModbusGwRequest_t rq)
+{
+	KModbusGwCache_t*	ce;
+	unsigned char		table;
+	long				ad, cnt;
+	int					i;
+
+	switch (rq->Pdu[0]) {
+	case 5:
+		table = 1;
+		ad = KModbud_B2N(&rq->Pdu[1]);
+		cnt = 1;
+		break;
+	case 15:
+		table = 1;
+		ad = KModbud_B2N(&rq->Pdu[1]);
+		cnt = KModbud_B2N(&rq->Pdu[3]);
+		break;
+	case 6:
+	case 22:
+		table = 3;
+		ad = KModbud_B2N(&rq->Pdu[1]);
+		cnt = 1;
+		break;
+	case 16:
+		table = 3;
+		ad = KModbud_B2N(&rq->Pdu[1]);
+		cnt = KModbud_B2N(&rq->Pdu[3]);
+		break;
+	case 23:
+		table = 3;
+		ad = KModbud_B2N(&rq->Pdu[5]);
+		cnt = KModbud_B2N(&rq->Pdu[7]);
+		break;
+	default:
+		if (IS_READ(rq->Pdu[0])) {
+			return;
+		}
+		/* Unknown side effects, forget everything of that unit */
+		for (i = 0; i < KMODBUS_GW_CACHE_SIZE; i++) {
+			if (gw->Cache[i].Unit == rq->Unit) {
+				gw->Cache[i].Valid = 0;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < KMODBUS_GW_CACHE_SIZE; i++) {
+		ce = &gw->Cache[i];
+		if (ce->Valid && (ce->Unit == rq->Unit || rq->Unit == KMODBUS_BROADCAST_ID) && ce->Fc == table
+			&& ad < (long)ce->Addr + ce->Count && (long)ce->Addr < ad + cnt) {
+			ce->Valid = 0;
+		}
+	}
+}
+
+static int	CacheLookup(PKModbusGateway_t gw, PKModbusGwRequest_t rq, KMODBUS_TICK now, unsigned char* pdu)
+{
+	KModbusGwCache_t*	ce;
+	int					i;
+
+	if (gw->CacheTTL == 0) {
+		return 0;
+	}
+	for (i = 0; i < KMODBUS_GW_CACHE_SIZE; i++) {
+		ce = &gw->Cache[i];
+		if (!ce->Valid) {
+			continue;
+		}
+		if (now - ce->Stamp >= gw->CacheTTL) {
+			ce->Valid = 0;
+			continue;
+		}
+		if (Covers(ce->Unit, ce->Fc, ce->Addr, ce->Count, rq)) {
+			return SliceRead(rq->Pdu[0], ce->Addr, ce->Data, ReadAddr(rq), ReadCount(rq), pdu);
+		}
+	}
+	return 0;
+}
+
+static void	CacheStore(PKModbusGateway_t gw, PKModbusGwRequest_t rq, const unsigned char* data, int len, KMODBUS_TICK now)
+{
+	KModbusGwCache_t	*ce, *victim;
+	int					i;
+
+	if (gw->CacheTTL == 0) {
+		return;
+	}
+	victim = &gw->Cache[0];
+	for (i = 0; i < KMODBUS_GW_CACHE_SIZE; i++) {
+		ce = &gw->Cache[i];
+		if (!ce->Valid) {
+			victim = ce;
+			break;
+		}
+		if ((long)(ce->Stamp - victim->Stamp) < 0) {
+			victim = ce;
+		}
+	}
+	victim->Valid = 1;
+	victim->Unit = rq->Unit;
+	victim->Fc = rq->Pdu[0];
+	victim->Addr = ReadAddr(rq);
+	victim->Count = ReadCount(rq);
+	victim->Stamp = now;
+	memcpy(victim->Data, data, len);
+}
+
+/* Does the client still wait for a request that may modify the slave */
+static int	WritePending(KModbusGwClient_t* cl)
+{
+	PKModbusGwRequest_t	rq;
+
+	for (rq = cl->Head; rq; rq = rq->Next) {
+		if (!IS_READ(rq->Pdu[0])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+	Attach a read to an identical or larger read that is on the bus or
+	queued. A read behind a write of the same client must see that write,
+	so it keeps its place in the client's queue.
+*/
+static int	Merge(PKModbusGateway_t gw, PKModbusGwRequest_t rq)
+{
+	PKModbusGwRequest_t	host;
+	int					i;
+
+	if (WritePending(&gw->Clients[rq->Client])) {
+		return 0;
+	}
+	host = gw->Active;
+	if (!(host && IS_READ(host->Pdu[0]) && Covers(host->Unit, host->Pdu[0], ReadAddr(host), ReadCount(host), rq))) {
+		host = 0;
+		for (i = 0; i < KMODBUS_GW_MAX_CLIENTS && host == 0; i++) {
+			for (host = gw->Clients[i].Head; host; host = host->Next) {
+				if (IS_READ(host->Pdu[0]) && Covers(host->Unit, host->Pdu[0], ReadAddr(host), ReadCount(host), rq)) {
+					break;
+				}
+			}
+		}
+	}
+	if (host == 0) {
+		return 0;
+	}
+	rq->Next = host->Waiters;
+	host->Waiters = rq;
+	return 1;
+}
+
+static void	Enqueue(PKModbusGateway_t gw, int ci, const unsigned char* adu, int len)
+{
+	KModbusGwClient_t*	cl = &gw->Clients[ci];
+	KModbusGwRequest_t	tmp, *rq;
+	unsigned char		pdu[KMODBUS_GW_MAX_PDU];
+	KMODBUS_TICK		now;
+	int					plen;
+
+	gw->Requests++;
+	now = GET_TICK(gw->Bus);
+
+	tmp.Client = ci;
+	tmp.Generation = cl->Generation;
+	tmp.Tid = KModbud_B2N((unsigned char*)&adu[0]);
+	tmp.Unit = adu[6];
+	tmp.PduLen = len - 7;
+	memcpy(tmp.Pdu, &adu[7], tmp.PduLen);
+
+	if (!PduLengthValid(tmp.Pdu, tmp.PduLen)) {
+		ReplyException(gw, &tmp, EX_ILLEGAL_DATA_VALUE);
+		return;
+	}
+	/* Nothing answers a read sent to every slave */
+	if (tmp.Unit == KMODBUS_BROADCAST_ID && !IsBroadcastFunction(tmp.Pdu[0])) {
+		ReplyException(gw, &tmp, EX_ILLEGAL_FUNCTION);
+		return;
+	}
+	if (IS_READ(tmp.Pdu[0])) {
+		/* Behind a pending write of this client the cache may be stale */
+		plen = WritePending(cl) ? 0 : CacheLookup(gw, &tmp, now, pdu);
+		if (plen > 0) {
+			gw->CacheHits++;
+			Reply(gw, &tmp, pdu, plen);
+			return;
+		}
+	}
+	else {
+		InvalidateFor(gw, &tmp);
+	}
+
+	rq = AllocRequest(gw);
+	if (rq == 0) {
+		gw->Rejected++;
+		ReplyException(gw, &tmp, EX_SERVER_BUSY);
+		return;
+	}
+	rq->Client = tmp.Client;
+	rq->Generation = tmp.Generation;
+	rq->Tid = tmp.Tid;
+	rq->Unit = tmp.Unit;
+	rq->PduLen = tmp.PduLen;
+	memcpy(rq->Pdu, tmp.Pdu, tmp.PduLen);
+	rq->Queued = now;
+
+	if (IS_READ(rq->Pdu[0]) && Merge(gw, rq)) {
+		gw->Merged++;
+		return;
+	}
+	if (cl->Tail) {
+		cl->Tail->Next = rq;
+	}
+	else {
+		cl->Head = rq;
+	}
+	cl->Tail = rq;
+}
+
+/* Answer the bus request and every read merged into it */
+static void	Complete(PKModbusGateway_t gw, const unsigned char* pdu, int len, unsigned char exception)
+{
+	PKModbusGwRequest_t	rq, w, next;
+	unsigned char		slice[KMODBUS_GW_MAX_PDU];
+	int					slen;
+
+	rq = gw->Active;
+	gw->Active = 0;
+
+	if (exception) {
+		ReplyException(gw, rq, exception);
+	}
+	else {
+		Reply(gw, rq, pdu, len);
+		if (IS_READ(rq->Pdu[0]) && !(pdu[0] & 0x80)) {
+			CacheStore(gw, rq, &pdu[2], pdu[1], GET_TICK(gw->Bus));
+		}
+		if (!IS_READ(rq->Pdu[0])) {
+			InvalidateFor(gw, rq);
+		}
+	}
+	for (w = rq->Waiters; w; w = next) {
+		next = w->Next;
+		if (exception) {
+			ReplyException(gw, w, exception);
+		}
+		else if (pdu[0] & 0x80) {
+			Reply(gw, w, pdu, len);
+		}
+		else {
+			slen = SliceRead(w->Pdu[0], ReadAddr(rq), &pdu[2], ReadAddr(w), ReadCount(w), slice);
+			Reply(gw, w, slice, slen);
+		}
+		FreeRequest(gw, w);
+	}
+	FreeRequest(gw, rq);
+}
+
+/* Put the next request on the bus, clients are served round robin */
+static void	StartNext(PKModbusGateway_t gw)
+{
+	PKModbus_t			bus = gw->Bus;
+	KModbusGwClient_t*	cl;
+	PKModbusGwRequest_t	rq, w;
+	unsigned char		c;
+	unsigned short		crc16;
+	int					i, ci, len;
+
+	/* Slaves are still executing the last broadcast */
+	if (gw->Turnaround) {
+		if (GET_TICK(bus) - gw->ActiveStart < bus->TurnaroundDelay) {
+			return;
+		}
+		gw->Turnaround = 0;
+	}
+	for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+		ci = (gw->NextClient + i) % KMODBUS_GW_MAX_CLIENTS;
+		cl = &gw->Clients[ci];
+		if (cl->Head) {
+			break;
+		}
+	}
+	if (i == KMODBUS_GW_MAX_CLIENTS) {
+		return;
+	}
+	gw->NextClient = (ci + 1) % KMODBUS_GW_MAX_CLIENTS;
+
+	rq = cl->Head;
+	cl->Head = rq->Next;
+	if (cl->Head == 0) {
+		cl->Tail = 0;
+	}
+	rq->Next = 0;
+	gw->Active = rq;
+
+	bus->TxBuf[0] = rq->Unit;
+	memcpy(&bus->TxBuf[1], rq->Pdu, rq->PduLen);
+	len = rq->PduLen + 1;
+	crc16 = KModbus_CalcCRC16(bus->TxBuf, len);
+	bus->TxBuf[len++] = (unsigned char)(crc16 & 0x00FF);
+	bus->TxBuf[len++] = (unsigned char)(crc16 >> 8);
+
+	/* Discard the rest of a previous response */
+	while (bus->Interface.Get(&c) == KMODBUS_OK) {
+	}
+	gw->BusTransactions++;
+	gw->ActiveStart = GET_TICK(bus);
+	gw->RxLen = 0;
+	KMODBUS_CAPTURE(bus, KMODBUS_CAPTURE_TX, bus->TxBuf, len, 1);
+	if (bus->Interface.Puts(bus->TxBuf, len) != KMODBUS_OK) {
+		Complete(gw, 0, 0, EX_GATEWAY_NO_RESPONSE);
+		return;
+	}
+	if (rq->Unit == KMODBUS_BROADCAST_ID) {
+		/* Nothing comes back, nothing goes back */
+		InvalidateFor(gw, rq);
+		gw->Active = 0;
+		gw->Turnaround = 1;
+		bus->BroadcastCounter++;
+		while ((w = rq->Waiters) != 0) {
+			rq->Waiters = w->Next;
+			ReplyException(gw, w, EX_GATEWAY_NO_RESPONSE);
+			FreeRequest(gw, w);
+		}
+		FreeRequest(gw, rq);
+	}
+}
+
+static void	PollBus(PKModbusGateway_t gw)
+{
+	PKModbus_t		bus = gw->Bus;
+	KMODBUS_STATUS	ret;
+	KMODBUS_TICK	now;
+	int				need;
+
+	if (gw->Active == 0) {
+		StartNext(gw);
+		if (gw->Active == 0) {
+			return;
+		}
+	}
+	while (bus->Interface.Get(&bus->RxBuf[gw->RxLen]) == KMODBUS_OK) {
+		if (++gw->RxLen >= KMODBUS_MAX_RXBUF) {
+			break;
+		}
+		need = KModbusMaster_ResponseLength(bus->RxBuf, gw->RxLen);
+		if (need < 0 || (need > 0 && gw->RxLen >= need)) {
+			gw->BusTime += GET_TICK(bus) - gw->ActiveStart;
+			ret = KModbusMaster_Decode(bus->TxBuf, bus->RxBuf, gw->RxLen, 0);
+			KMODBUS_CAPTURE(bus, KMODBUS_CAPTURE_RX, bus->RxBuf, gw->RxLen, need > 0 && ret != KMODBUS_INVALID_RESPONSE);
+			if (need < 0 || ret == KMODBUS_INVALID_RESPONSE) {
+				bus->CRCErrorCounter++;
+				Complete(gw, 0, 0, EX_GATEWAY_NO_RESPONSE);
+			}
+			else {
+				Complete(gw, &bus->RxBuf[1], gw->RxLen - 3, 0);
+			}
+			StartNext(gw);
+			return;
+		}
+	}
+	now = GET_TICK(bus);
+	if (now - gw->ActiveStart >= bus->ResponseTimeout) {
+		gw->BusTime += now - gw->ActiveStart;
+		gw->BusTimeouts++;
+		bus->NoResponseCount++;
+		Complete(gw, 0, 0, EX_GATEWAY_NO_RESPONSE);
+		StartNext(gw);
+	}
+}
+
+static void	CloseClient(PKModbusGateway_t gw, int ci)
+{
+	KModbusGwClient_t*	cl = &gw->Clients[ci];
+	PKModbusGwRequest_t	rq, next;
+
+	if (cl->Socket != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(cl->Socket);
+		cl->Socket = KMODBUS_INVALID_SOCKET;
+	}
+	for (rq = cl->Head; rq; rq = next) {
+		next = rq->Next;
+		/* Reads merged into a dropped request get it re-queued on their own */
+		while (rq->Waiters) {
+			PKModbusGwRequest_t	w = rq->Waiters;
+
+			rq->Waiters = w->Next;
+			w->Next = 0;
+			if (w->Client == ci) {
+				FreeRequest(gw, w);
+				continue;
+			}
+			if (gw->Clients[w->Client].Tail) {
+				gw->Clients[w->Client].Tail->Next = w;
+			}
+			else {
+				gw->Clients[w->Client].Head = w;
+			}
+			gw->Clients[w->Client].Tail = w;
+		}
+		FreeRequest(gw, rq);
+	}
+	cl->Head = 0;
+	cl->Tail = 0;
+	cl->RxLen = 0;
+	cl->Generation++;
+}
+
+static void	Accept(PKModbusGateway_t gw)
+{
+	KMODBUS_SOCKET	s;
+	int				i;
+
+	s = accept(gw->Listen, NULL, NULL);
+	if (s == KMODBUS_INVALID_SOCKET) {
+		return;
+	}
+	for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+		if (gw->Clients[i].Socket == KMODBUS_INVALID_SOCKET) {
+			KModbusSocket_NonBlocking(s);
+			gw->Clients[i].Socket = s;
+			gw->Clients[i].RxLen = 0;
+			return;
+		}
+	}
+	KMODBUS_CLOSESOCKET(s);
+}
+
+/* Split the received stream into MBAP frames */
+static void	ReadClient(PKModbusGateway_t gw, int ci)
+{
+	KModbusGwClient_t*	cl = &gw->Clients[ci];
+	int					n, flen;
+
+	n = recv(cl->Socket, (char*)&cl->RxBuf[cl->RxLen], KMODBUS_GW_MAX_ADU - cl->RxLen, 0);
+	if (n <= 0) {
+		CloseClient(gw, ci);
+		return;
+	}
+	cl->RxLen += n;
+	while (cl->RxLen >= 7) {
+		flen = KModbud_B2N(&cl->RxBuf[4]) + 6;
+		if (cl->RxBuf[2] != 0 || cl->RxBuf[3] != 0 || flen < 8 || flen > KMODBUS_GW_MAX_ADU) {
+			CloseClient(gw, ci);
+			return;
+		}
+		if (cl->RxLen < flen) {
+			break;
+		}
+		Enqueue(gw, ci, cl->RxBuf, flen);
+		if (cl->Socket == KMODBUS_INVALID_SOCKET) {
+			return;
+		}
+		cl->RxLen -= flen;
+		memmove(cl->RxBuf, &cl->RxBuf[flen], cl->RxLen);
+	}
+}
+
+KMODBUS_STATUS	KModbusGateway_Open(PKModbusGateway_t gw, PKModbus_t bus, unsigned short port, KMODBUS_TICK ttl)
+{
+	struct sockaddr_in	sa;
+	int					i, on = 1;
+
+	memset(gw, 0x00, sizeof(*gw));
+	gw->Bus = bus;
+	gw->CacheTTL = ttl;
+	for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+		gw->Clients[i].Socket = KMODBUS_INVALID_SOCKET;
+	}
+	for (i = 0; i < KMODBUS_GW_MAX_REQUESTS; i++) {
+		FreeRequest(gw, &gw->Pool[i]);
+	}
+
+	if (KModbusSocket_Startup() != 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	gw->Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (gw->Listen == KMODBUS_INVALID_SOCKET) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	setsockopt(gw->Listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if (bind(gw->Listen, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(gw->Listen, 8) != 0) {
+		KMODBUS_CLOSESOCKET(gw->Listen);
+		gw->Listen = KMODBUS_INVALID_SOCKET;
+		return KMODBUS_INVALID_PARAM;
+	}
+	KModbusSocket_NonBlocking(gw->Listen);
+	return KMODBUS_OK;
+}
+
+void	KModbusGateway_Close(PKModbusGateway_t gw)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+		CloseClient(gw, i);
+	}
+	if (gw->Listen != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(gw->Listen);
+		gw->Listen = KMODBUS_INVALID_SOCKET;
+	}
+}
+
+KMODBUS_STATUS	KModbusGateway_Poll(PKModbusGateway_t gw, int timeout_ms)
+{
+	fd_set			rfds;
+	struct timeval	tv;
+	KMODBUS_SOCKET	maxfd;
+	int				i, ret;
+
+	FD_ZERO(&rfds);
+	FD_SET(gw->Listen, &rfds);
+	maxfd = gw->Listen;
+	for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+		if (gw->Clients[i].Socket != KMODBUS_INVALID_SOCKET) {
+			FD_SET(gw->Clients[i].Socket, &rfds);
+			if (gw->Clients[i].Socket > maxfd) {
+				maxfd = gw->Clients[i].Socket;
+			}
+		}
+	}
+	/* The serial line has no descriptor, keep polling it while it is busy */
+	if (gw->Active || gw->Turnaround) {
+		timeout_ms = 0;
+	}
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	ret = select((int)maxfd + 1, &rfds, NULL, NULL, &tv);
+	if (ret < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (ret > 0) {
+		if (FD_ISSET(gw->Listen, &rfds)) {
+			Accept(gw);
+		}
+		for (i = 0; i < KMODBUS_GW_MAX_CLIENTS; i++) {
+			if (gw->Clients[i].Socket != KMODBUS_INVALID_SOCKET && FD_ISSET(gw->Clients[i].Socket, &rfds)) {
+				ReadClient(gw, i);
+			}
+		}
+	}
+	PollBus(gw);
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusGateway(PKModbusGateway_t gw, int* ResQuit)
+{
+	KMODBUS_STATUS	ret;
+
+	for (;;) {
+		/* Monitor quit requests */
+		if (ResQuit) {
+			if (*ResQuit) {
+				break;
+			}
+		}
+		ret = KModbusGateway_Poll(gw, 10);
+		if (ret != KMODBUS_OK) {
+			return ret;
+		}
+		if (gw->Active) {
+			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+		}
+	}
+	return KMODBUS_OK;
+}
+
+unsigned long	KModbusGateway_HitRate(PKModbusGateway_t gw)
+{
+	if (gw->Requests == 0) {
+		return 0;
+	}
+	return gw->CacheHits * 100 / gw->Requests;
+}
+
+unsigned long	KModbusGateway_BusTimeSaved(PKModbusGateway_t gw)
+{
+	if (gw->BusTransactions == 0) {
+		return 0;
+	}
+	return (gw->CacheHits + gw->Merged) * (gw->BusTime / gw->BusTransactions);
+}
@@ -0,0 +1,131 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSGATEWAY_H__
+#define	__KMODBUSGATEWAY_H__
+
+#include "KModbusSocket.h"
+#include "KModbusMaster.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_GW_MAX_CLIENTS
+#define	KMODBUS_GW_MAX_CLIENTS		(16)
+#endif
+#ifndef	KMODBUS_GW_MAX_REQUESTS
+#define	KMODBUS_GW_MAX_REQUESTS		(64)
+#endif
+#ifndef	KMODBUS_GW_CACHE_SIZE
+#define	KMODBUS_GW_CACHE_SIZE		(32)
+#endif
+
+#define	KMODBUS_GW_MAX_PDU			(253)
+#define	KMODBUS_GW_MAX_ADU			(KMODBUS_GW_MAX_PDU + 7)
+
+/* A Modbus TCP request waiting for (or riding on) a bus transaction */
+typedef struct KModbusGwRequest_t {
+	struct KModbusGwRequest_t*	Next;
+	struct KModbusGwRequest_t*	Waiters;	/* Merged reads answered by this one */
+	int							Client;
+	unsigned long				Generation;
+	unsigned short				Tid;
+	unsigned char				Unit;
+	unsigned char				Pdu[KMODBUS_GW_MAX_PDU];
+	int							PduLen;
+	KMODBUS_TICK				Queued;
+
+} KModbusGwRequest_t, *PKModbusGwRequest_t;
+
+typedef struct KModbusGwClient_t {
+	KMODBUS_SOCKET			Socket;
+	unsigned long			Generation;
+	unsigned char			RxBuf[KMODBUS_GW_MAX_ADU];
+	int						RxLen;
+	PKModbusGwRequest_t		Head;
+	PKModbusGwRequest_t		Tail;
+
+} KModbusGwClient_t;
+
+/* Read response kept for the cache TTL */
+typedef struct KModbusGwCache_t {
+	int						Valid;
+	unsigned char			Unit;
+	unsigned char			Fc;
+	unsigned short			Addr;
+	unsigned short			Count;
+	KMODBUS_TICK			Stamp;
+	unsigned char			Data[KMODBUS_GW_MAX_PDU];
+
+} KModbusGwCache_t;
+
+typedef struct KModbusGateway_t {
+	PKModbus_t				Bus;			/* RTU master handle (KModbusMaster_Init) */
+	KMODBUS_SOCKET			Listen;
+	KMODBUS_TICK			CacheTTL;		/* 0 disables the cache */
+
+	KModbusGwClient_t		Clients[KMODBUS_GW_MAX_CLIENTS];
+	int						NextClient;		/* Round robin position */
+
+	KModbusGwRequest_t		Pool[KMODBUS_GW_MAX_REQUESTS];
+	PKModbusGwRequest_t		Free;
+	PKModbusGwRequest_t		Active;			/* Request on the bus */
+	KMODBUS_TICK			ActiveStart;
+	int						RxLen;
+	int						Turnaround;		/* Waiting after a broadcast */
+
+	KModbusGwCache_t		Cache[KMODBUS_GW_CACHE_SIZE];
+
+	/* Statistics */
+	unsigned long			Requests;
+	unsigned long			CacheHits;
+	unsigned long			Merged;
+	unsigned long			BusTransactions;
+	unsigned long			BusTimeouts;
+	unsigned long			Rejected;
+	unsigned long			BusTime;		/* Ticks the bus was busy */
+
+} KModbusGateway_t, *PKModbusGateway_t;
+
+KMODBUS_STATUS	KModbusGateway_Open(PKModbusGateway_t gw, PKModbus_t bus, unsigned short port, KMODBUS_TICK ttl);
+void			KModbusGateway_Close(PKModbusGateway_t gw);
+
+/* Serve the clients and the bus for up to timeout_ms */
+KMODBUS_STATUS	KModbusGateway_Poll(PKModbusGateway_t gw, int timeout_ms);
+KMODBUS_STATUS	KModbusGateway(PKModbusGateway_t gw, int* ResQuit);
+
+/* Answered from the cache, in percent of all requests (merged reads still waited for the bus) */
+unsigned long	KModbusGateway_HitRate(PKModbusGateway_t gw);
+/* Bus time saved by the cache and by merged reads (average transaction time each) */
+unsigned long	KModbusGateway_BusTimeSaved(PKModbusGateway_t gw);
+
+void			KModbusGateway_InvalidateCache(PKModbusGateway_t gw);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSGATEWAY_H__ */
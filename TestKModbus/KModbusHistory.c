@@ -0,0 +1,504 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define	_POSIX_C_SOURCE			200809L		/* pthread_rwlock_t */
+#endif
+#include	"KModbusHistory.h"
+#include	<memory.h>
+
+#define	STREAM_HEADER		(8)		/* Mode, count, stamp (4), value (2) */
+#define	STREAM_MAX_COUNT	(255)
+#define	HISTORY_QUERY_LEN	(10)	/* ID, code, bank, address (2), from (4), max */
+
+#define	TICK_BEFORE(a, b)	((long)((a) - (b)) < 0)
+
+/* Bank entries read per access, 250 bytes either way */
+#define	READ_CHUNK_BITS		(2000)
+#define	READ_CHUNK_REGS		(125)
+
+static int	PutVarint(unsigned char* p, unsigned long v)
+{
+	int		n;
+
+	n = 0;
+	while (v >= 0x80) {
+		p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char)v;
+	return n;
+}
+
+/* Varint at *pos of a ring of size bytes, *pos moves past it */
+static unsigned long	RingVarint(const unsigned char* ring, int size, int* pos)
+{
+	unsigned long	v;
+	unsigned char	c;
+	int				shift;
+
+	v = 0;
+	shift = 0;
+	do {
+		c = ring[*pos];
+		if (++*pos == size) {
+			*pos = 0;
+		}
+		v |= (unsigned long)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return v;
+}
+
+static unsigned long	Code(int mode, unsigned short value, unsigned short prev)
+{
+	short	d;
+
+	if (mode == KMODBUS_HISTORY_XOR) {
+		return (unsigned long)(value ^ prev);
+	}
+	d = (short)(value - prev);
+	return (unsigned long)(unsigned short)((d << 1) ^ (d >> 15));		/* Zigzag */
+}
+
+static unsigned short	Apply(int mode, unsigned long code, unsigned short prev)
+{
+	if (mode == KMODBUS_HISTORY_XOR) {
+		return (unsigned short)(prev ^ code);
+	}
+	return (unsigned short)(prev + (unsigned short)((code >> 1) ^ (0 - (code & 1))));
+}
+
+static int	Record(unsigned char* p, int mode, KMODBUS_TICK dt, unsigned short value, unsigned short prev)
+{
+	int		n;
+
+	n = PutVarint(p, (unsigned long)dt);
+	n += PutVarint(p + n, Code(mode, value, prev));
+	return n;
+}
+
+/* Drop the oldest sample, the first record becomes First */
+static void	Drop(KModbusHistoryChannel_t* ch, PKModbusHistoryReg_t r, const unsigned char* ring)
+{
+	int				pos, start;
+	unsigned long	dt, code;
+
+	start = (r->Head + ch->RingBytes - r->Used) % ch->RingBytes;
+	pos = start;
+	dt = RingVarint(ring, ch->RingBytes, &pos);
+	code = RingVarint(ring, ch->RingBytes, &pos);
+	r->First += (KMODBUS_TICK)dt;
+	r->FirstValue = Apply(ch->Mode, code, r->FirstValue);
+	r->Used -= (unsigned short)((pos + ch->RingBytes - start) % ch->RingBytes);
+	r->Samples--;
+}
+
+static void	Append(PKModbusHistory_t h, KModbusHistoryChannel_t* ch, int idx, KMODBUS_TICK now, unsigned short value)
+{
+	PKModbusHistoryReg_t	r;
+	unsigned char*			ring;
+	unsigned char			rec[KMODBUS_HISTORY_MAX_SAMPLE];
+	int						n, i;
+
+	r = &ch->Reg[idx];
+	ring = ch->Data + (long)idx * ch->RingBytes;
+	if (r->Samples == 0) {
+		r->First = r->Last = now;
+		r->FirstValue = r->LastValue = value;
+		r->Samples = 1;
+		h->Appended++;
+		return;
+	}
+	n = Record(rec, ch->Mode, now - r->Last, value, r->LastValue);
+	while (r->Used + n > ch->RingBytes) {
+		Drop(ch, r, ring);
+		h->Dropped++;
+	}
+	for (i = 0; i < n; i++) {
+		ring[r->Head] = rec[i];
+		if (++r->Head == ch->RingBytes) {
+			r->Head = 0;
+		}
+	}
+	r->Used += (unsigned short)n;
+	r->Samples++;
+	r->Last = now;
+	r->LastValue = value;
+	h->Appended++;
+}
+
+static KMODBUS_STATUS	ReadBank(int bank, int adrs, unsigned char* dt, int len)
+{
+	switch (bank) {
+	case KMODBUS_HISTORY_X0:	return GetX0(adrs, dt, len);
+	case KMODBUS_HISTORY_X1:	return GetX1(adrs, dt, len);
+	case KMODBUS_HISTORY_X3:	return GetX3(adrs, dt, len);
+	case KMODBUS_HISTORY_X4:	return GetX4(adrs, dt, len);
+	}
+	return KMODBUS_INVALID_PARAM;
+}
+
+static int	IsBitBank(int bank)
+{
+	return bank == KMODBUS_HISTORY_X0 || bank == KMODBUS_HISTORY_X1;
+}
+
+static KModbusHistoryChannel_t*	FindChannel(PKModbusHistory_t h, int bank, int adrs)
+{
+	int		i;
+
+	for (i = 0; i < h->Channels; i++) {
+		if (h->Channel[i].Bank == bank && adrs >= h->Channel[i].Adrs && adrs < h->Channel[i].Adrs + h->Channel[i].Count) {
+			return &h->Channel[i];
+		}
+	}
+	return 0;
+}
+
+void	KModbusHistory_Init(PKModbusHistory_t h)
+{
+	memset(h, 0x00, sizeof(*h));
+	KModbusLock_Init(&h->Lock);
+}
+
+KMODBUS_STATUS	KModbusHistory_Add(PKModbusHistory_t h, int bank, int adrs, int count, int mode, KMODBUS_TICK period,
+					PKModbusHistoryReg_t reg, unsigned char* data, int ring)
+{
+	KModbusHistoryChannel_t*	ch;
+	unsigned char				probe[2];
+	int							i;
+
+	if (h->Channels >= KMODBUS_HISTORY_CHANNELS || count < 1 || adrs < 0 || reg == 0 || data == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (ring < KMODBUS_HISTORY_MIN_RING || ring > 0xFFFF) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (mode != KMODBUS_HISTORY_DELTA && mode != KMODBUS_HISTORY_XOR) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (ReadBank(bank, adrs + count - 1, probe, 1) != KMODBUS_OK) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	for (i = 0; i < h->Channels; i++) {
+		ch = &h->Channel[i];
+		if (ch->Bank == bank && adrs < ch->Adrs + ch->Count && ch->Adrs < adrs + count) {
+			return KMODBUS_INVALID_PARAM;
+		}
+	}
+	ch = &h->Channel[h->Channels];
+	ch->Bank = bank;
+	ch->Adrs = adrs;
+	ch->Count = count;
+	ch->Mode = mode;
+	ch->Period = period;
+	ch->NextSample = 0;
+	ch->RingBytes = ring;
+	ch->Reg = reg;
+	ch->Data = data;
+	memset(reg, 0x00, sizeof(KModbusHistoryReg_t) * count);
+
+	KModbusLock_Begin(&h->Lock);
+	h->Channels++;
+	KModbusLock_End(&h->Lock);
+	return KMODBUS_OK;
+}
+
+void	KModbusHistory_Sample(PKModbusHistory_t h, KMODBUS_TICK now)
+{
+	KModbusHistoryChannel_t*	ch;
+	unsigned char				buf[READ_CHUNK_REGS * 2];
+	unsigned short				value;
+	int							c, i, n, base, chunk, onchange;
+
+	for (c = 0; c < h->Channels; c++) {
+		ch = &h->Channel[c];
+		onchange = (ch->Period == 0);
+		if (!onchange) {
+			if (ch->Reg[0].Samples != 0 && TICK_BEFORE(now, ch->NextSample)) {
+				continue;
+			}
+			/* Keep the period grid unless this is the first sample or it fell behind */
+			if (ch->Reg[0].Samples != 0 && TICK_BEFORE(now, ch->NextSample + ch->Period)) {
+				ch->NextSample += ch->Period;
+			}
+			else {
+				ch->NextSample = now + ch->Period;
+			}
+		}
+		chunk = IsBitBank(ch->Bank) ? READ_CHUNK_BITS : READ_CHUNK_REGS;
+		for (base = 0; base < ch->Count; base += n) {
+			n = (ch->Count - base < chunk) ? ch->Count - base : chunk;
+			if (ReadBank(ch->Bank, ch->Adrs + base, buf, n) != KMODBUS_OK) {
+				break;
+			}
+			/* The bank lock is released, the rings have their own */
+			KModbusLock_Begin(&h->Lock);
+			for (i = 0; i < n; i++) {
+				if (IsBitBank(ch->Bank)) {
+					value = (buf[i / 8] >> (i % 8)) & 0x01;
+				}
+				else {
+					value = KModbud_B2N(&buf[i * 2]);
+				}
+				if (onchange && ch->Reg[base + i].Samples != 0 && ch->Reg[base + i].LastValue == value) {
+					continue;
+				}
+				Append(h, ch, base + i, now, value);
+			}
+			KModbusLock_End(&h->Lock);
+		}
+	}
+}
+
+int		KModbusHistory_Export(PKModbusHistory_t h, int bank, int adrs, KMODBUS_TICK from, KMODBUS_TICK to,
+			KMODBUS_TICK* stamps, unsigned short* values, int max)
+{
+	KModbusHistoryChannel_t*	ch;
+	PKModbusHistoryReg_t		r;
+	const unsigned char*		ring;
+	KMODBUS_TICK				t;
+	unsigned short				v;
+	int							pos, left, cnt;
+
+	ch = FindChannel(h, bank, adrs);
+	if (ch == 0 || max < 1) {
+		return 0;
+	}
+	cnt = 0;
+	KModbusLock_ReadBegin(&h->Lock);
+	r = &ch->Reg[adrs - ch->Adrs];
+	ring = ch->Data + (long)(adrs - ch->Adrs) * ch->RingBytes;
+	pos = (r->Head + ch->RingBytes - r->Used) % ch->RingBytes;
+	t = r->First;
+	v = r->FirstValue;
+	for (left = r->Samples; left > 0; left--) {
+		if (TICK_BEFORE(to, t)) {
+			break;
+		}
+		if (!TICK_BEFORE(t, from)) {
+			stamps[cnt] = t;
+			values[cnt] = v;
+			if (++cnt == max) {
+				break;
+			}
+		}
+		if (left > 1) {
+			t += (KMODBUS_TICK)RingVarint(ring, ch->RingBytes, &pos);
+			v = Apply(ch->Mode, RingVarint(ring, ch->RingBytes, &pos), v);
+		}
+	}
+	KModbusLock_ReadEnd(&h->Lock);
+	return cnt;
+}
+
+/* Caller holds the lock */
+static int	Encode(KModbusHistoryChannel_t* ch, int adrs, KMODBUS_TICK from, unsigned char* buf, int size, int maxcount, int* count)
+{
+	PKModbusHistoryReg_t	r;
+	const unsigned char*	ring;
+	KMODBUS_TICK			t, pt;
+	unsigned short			v, pv;
+	unsigned char			rec[KMODBUS_HISTORY_MAX_SAMPLE];
+	int						pos, left, cnt, len, n;
+
+	r = &ch->Reg[adrs - ch->Adrs];
+	ring = ch->Data + (long)(adrs - ch->Adrs) * ch->RingBytes;
+	pos = (r->Head + ch->RingBytes - r->Used) % ch->RingBytes;
+	t = r->First;
+	v = r->FirstValue;
+	pt = 0;
+	pv = 0;
+	cnt = 0;
+	len = STREAM_HEADER;
+	memset(buf, 0x00, STREAM_HEADER);
+	buf[0] = (unsigned char)ch->Mode;
+
+	if (maxcount > STREAM_MAX_COUNT) {
+		maxcount = STREAM_MAX_COUNT;
+	}
+	for (left = r->Samples; left > 0 && cnt < maxcount; left--) {
+		if (!TICK_BEFORE(t, from)) {
+			if (cnt == 0) {
+				buf[2] = (unsigned char)((unsigned long)t >> 24);
+				buf[3] = (unsigned char)((unsigned long)t >> 16);
+				buf[4] = (unsigned char)((unsigned long)t >> 8);
+				buf[5] = (unsigned char)t;
+				buf[6] = (unsigned char)(v >> 8);
+				buf[7] = (unsigned char)v;
+			}
+			else {
+				n = Record(rec, ch->Mode, t - pt, v, pv);
+				if (len + n > size) {
+					break;
+				}
+				memcpy(&buf[len], rec, n);
+				len += n;
+			}
+			pt = t;
+			pv = v;
+			cnt++;
+		}
+		if (left > 1) {
+			t += (KMODBUS_TICK)RingVarint(ring, ch->RingBytes, &pos);
+			v = Apply(ch->Mode, RingVarint(ring, ch->RingBytes, &pos), v);
+		}
+	}
+	buf[1] = (unsigned char)cnt;
+	*count = cnt;
+	return len;
+}
+
+int		KModbusHistory_Encode(PKModbusHistory_t h, int bank, int adrs, KMODBUS_TICK from,
+			unsigned char* buf, int size, int maxcount, int* count)
+{
+	KModbusHistoryChannel_t*	ch;
+	int							len;
+
+	*count = 0;
+	ch = FindChannel(h, bank, adrs);
+	if (ch == 0 || size < STREAM_HEADER) {
+		return 0;
+	}
+	KModbusLock_ReadBegin(&h->Lock);
+	len = Encode(ch, adrs, from, buf, size, maxcount, count);
+	KModbusLock_ReadEnd(&h->Lock);
+	return len;
+}
+
+int		KModbusHistory_Decode(const unsigned char* buf, int len, KMODBUS_TICK* stamps, unsigned short* values, int max)
+{
+	KMODBUS_TICK	t;
+	unsigned short	v;
+	unsigned long	dt, code;
+	int				mode, cnt, i, pos, shift;
+
+	dt = 0;
+	if (len < STREAM_HEADER || buf[1] == 0 || max < 1) {
+		return 0;
+	}
+	mode = buf[0];
+	t = (KMODBUS_TICK)(((unsigned long)buf[2] << 24) | ((unsigned long)buf[3] << 16) | ((unsigned long)buf[4] << 8) | buf[5]);
+	v = (unsigned short)((buf[6] << 8) | buf[7]);
+	pos = STREAM_HEADER;
+	for (cnt = 0; ; ) {
+		stamps[cnt] = t;
+		values[cnt] = v;
+		if (++cnt == buf[1] || cnt == max) {
+			break;
+		}
+		for (i = 0; i < 2; i++) {
+			code = 0;
+			shift = 0;
+			do {
+				if (pos >= len) {
+					return cnt;		/* Truncated */
+				}
+				code |= (unsigned long)(buf[pos] & 0x7F) << shift;
+				shift += 7;
+			} while (buf[pos++] & 0x80);
+			if (i == 0) {
+				dt = code;
+			}
+		}
+		t += (KMODBUS_TICK)dt;
+		v = Apply(mode, code, v);
+	}
+	return cnt;
+}
+
+void	KModbusHistory_Usage(PKModbusHistory_t h, KModbusHistoryUsage_t* u)
+{
+	KModbusHistoryChannel_t*	ch;
+	unsigned long				records;
+	int							c, i;
+
+	memset(u, 0x00, sizeof(*u));
+	records = 0;
+	KModbusLock_ReadBegin(&h->Lock);
+	for (c = 0; c < h->Channels; c++) {
+		ch = &h->Channel[c];
+		u->Registers += (unsigned long)ch->Count;
+		u->Bytes += (unsigned long)ch->Count * (unsigned long)KMODBUS_HISTORY_REG_BYTES(ch->RingBytes);
+		for (i = 0; i < ch->Count; i++) {
+			u->Samples += ch->Reg[i].Samples;
+			u->RecordBytes += ch->Reg[i].Used;
+			if (ch->Reg[i].Samples > 1) {
+				records += ch->Reg[i].Samples - 1;
+			}
+		}
+	}
+	KModbusLock_ReadEnd(&h->Lock);
+	if (u->Registers != 0) {
+		u->BytesPerRegister = u->Bytes / u->Registers;
+	}
+	if (records != 0) {
+		u->BytesPerSample = (double)u->RecordBytes / (double)records;
+	}
+}
+
+static KMODBUS_STATUS	entry_History(PKModbus_t hd)
+{
+	PKModbusHistory_t			h;
+	KModbusHistoryChannel_t*	ch;
+	PKModbusHistoryReg_t		r;
+	KMODBUS_TICK				from;
+	unsigned long				from32, back;
+	int							bank, adrs, max, len, size, count;
+
+	bank = hd->RxBuf[2];
+	adrs = KModbud_B2N(&hd->RxBuf[3]);
+	from32 = ((unsigned long)hd->RxBuf[5] << 24) | ((unsigned long)hd->RxBuf[6] << 16) | ((unsigned long)hd->RxBuf[7] << 8) | hd->RxBuf[8];
+	max = (hd->RxBuf[9] == 0) ? STREAM_MAX_COUNT : hd->RxBuf[9];
+
+	size = KMODBUS_MAX_TXBUF - 5;
+	if (size > 255) {
+		size = 255;
+	}
+	h = (PKModbusHistory_t)KModbus_FunctionContext(hd->RxBuf[1]);
+	ch = (h != 0) ? FindChannel(h, bank, adrs) : 0;
+	if (ch == 0) {
+		KModbus_Exception(hd, KMODBUS_NON_EXISTENT_ADDRESS);
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	KModbusLock_ReadBegin(&h->Lock);
+	/* The query carries the low 32 bits of the tick, place them before the newest sample */
+	r = &ch->Reg[adrs - ch->Adrs];
+	back = ((unsigned long)r->Last - from32) & 0xFFFFFFFFUL;
+	from = r->Last - (KMODBUS_TICK)back;
+	len = Encode(ch, adrs, from, &hd->TxBuf[3], size, max, &count);
+	KModbusLock_ReadEnd(&h->Lock);
+
+	hd->TxBuf[0] = hd->RxBuf[0];
+	hd->TxBuf[1] = hd->RxBuf[1];
+	hd->TxBuf[2] = (unsigned char)len;
+	return KModbus_Respond(hd, len + 3);
+}
+
+KMODBUS_STATUS	KModbusHistory_Serve(PKModbusHistory_t h, unsigned char cd)
+{
+	return KModbus_RegisterFunctionContext(cd, (h != 0) ? entry_History : 0, HISTORY_QUERY_LEN, 0, h);
+}
@@ -0,0 +1,155 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSHISTORY_H__
+#define	__KMODBUSHISTORY_H__
+
+#include "KModbus.h"
+#include "KModbusLock.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_HISTORY_CHANNELS
+#define	KMODBUS_HISTORY_CHANNELS	(8)
+#endif
+
+/* Vendor function code of KModbusHistory_Serve (user-defined range 65-72) */
+#ifndef	KMODBUS_HISTORY_FC
+#define	KMODBUS_HISTORY_FC			(65)
+#endif
+
+/* Banks */
+#define	KMODBUS_HISTORY_X0			(0)		/* Coils */
+#define	KMODBUS_HISTORY_X1			(1)		/* Input status */
+#define	KMODBUS_HISTORY_X3			(3)		/* Input registers */
+#define	KMODBUS_HISTORY_X4			(4)		/* Holding registers */
+
+/* Compression of the values, time stamps are always delta coded */
+#define	KMODBUS_HISTORY_DELTA		(0)		/* Signed difference, for analog values */
+#define	KMODBUS_HISTORY_XOR			(1)		/* Changed bits, for status words and coils */
+
+/* Largest encoded sample: 10 byte time delta (64-bit tick) and 3 byte value */
+#define	KMODBUS_HISTORY_MAX_SAMPLE	(13)
+#define	KMODBUS_HISTORY_MIN_RING	(16)
+
+/* Memory of one register with a ring of ring bytes */
+#define	KMODBUS_HISTORY_REG_BYTES(ring)	(sizeof(KModbusHistoryReg_t) + (ring))
+
+/*
+	Samples of one register. The oldest sample is kept in First/FirstValue,
+	every later one is a record of the ring coded against its predecessor:
+	the time delta and the value code as varints of 7 bits per byte. A
+	sample takes 2 bytes while the delta stays below 128 ticks and the
+	value moves by less than 64 (DELTA) or changes only the low 7 bits
+	(XOR), 3 bytes for a 1 s period on a 1 ms tick. Dropping the oldest
+	sample decodes one record into First/FirstValue.
+*/
+typedef struct KModbusHistoryReg_t {
+	KMODBUS_TICK	First;
+	KMODBUS_TICK	Last;
+	unsigned short	FirstValue;
+	unsigned short	LastValue;
+	unsigned short	Head;			/* Write offset in the ring */
+	unsigned short	Used;			/* Bytes of the records */
+	unsigned short	Samples;		/* Including First */
+
+} KModbusHistoryReg_t, *PKModbusHistoryReg_t;
+
+typedef struct KModbusHistoryChannel_t {
+	int						Bank;
+	int						Adrs;		/* 0-based, as the bank accessors */
+	int						Count;
+	int						Mode;
+	KMODBUS_TICK			Period;		/* 0: sample on change */
+	KMODBUS_TICK			NextSample;
+	int						RingBytes;
+	PKModbusHistoryReg_t	Reg;
+	unsigned char*			Data;		/* Count rings of RingBytes */
+
+} KModbusHistoryChannel_t;
+
+typedef struct KModbusHistory_t {
+	KMODBUS_LOCK			Lock;		/* Rings and channels, not the banks */
+	int						Channels;
+	KModbusHistoryChannel_t	Channel[KMODBUS_HISTORY_CHANNELS];
+
+	unsigned long			Appended;
+	unsigned long			Dropped;
+
+} KModbusHistory_t, *PKModbusHistory_t;
+
+typedef struct KModbusHistoryUsage_t {
+	unsigned long	Registers;
+	unsigned long	Bytes;				/* Headers and rings */
+	unsigned long	BytesPerRegister;	/* Average over the channels */
+	unsigned long	Samples;			/* Held now */
+	unsigned long	RecordBytes;		/* Ring bytes holding them */
+	double			BytesPerSample;		/* RecordBytes / Samples, the sample in First is free */
+
+} KModbusHistoryUsage_t;
+
+void			KModbusHistory_Init(PKModbusHistory_t h);
+
+/*
+	Keep the history of count entries of a bank from adrs. reg holds count
+	headers and data count * ring bytes, both owned by the caller so the
+	budget shows in the map file. Channels of one history must not overlap.
+*/
+KMODBUS_STATUS	KModbusHistory_Add(PKModbusHistory_t h, int bank, int adrs, int count, int mode, KMODBUS_TICK period,
+					PKModbusHistoryReg_t reg, unsigned char* data, int ring);
+
+/* Read the banks and record the due samples, call from the application loop */
+void			KModbusHistory_Sample(PKModbusHistory_t h, KMODBUS_TICK now);
+
+/* Samples of one entry stamped from..to (inclusive), oldest first, returns the count */
+int				KModbusHistory_Export(PKModbusHistory_t h, int bank, int adrs, KMODBUS_TICK from, KMODBUS_TICK to,
+					KMODBUS_TICK* stamps, unsigned short* values, int max);
+
+/*
+	Compressed stream of the samples of one entry from a time, as sent by the
+	vendor function: mode, count, 32-bit stamp and value of the first sample,
+	then the records. Returns the bytes written, *count the samples.
+*/
+int				KModbusHistory_Encode(PKModbusHistory_t h, int bank, int adrs, KMODBUS_TICK from,
+					unsigned char* buf, int size, int maxcount, int* count);
+int				KModbusHistory_Decode(const unsigned char* buf, int len, KMODBUS_TICK* stamps, unsigned short* values, int max);
+
+void			KModbusHistory_Usage(PKModbusHistory_t h, KModbusHistoryUsage_t* u);
+
+/*
+	Serve the history with a vendor function code, each code its own
+	history (h is kept with the registration, 0 removes the code):
+	query	ID, code, bank, address (2), from (4), max samples
+	answer	ID, code, byte count, KModbusHistory_Encode stream
+*/
+KMODBUS_STATUS	KModbusHistory_Serve(PKModbusHistory_t h, unsigned char cd);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSHISTORY_H__ */
@@ -0,0 +1,181 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusLite.h"
+#include	<memory.h>
+
+static void	Load(PKModbus_t engine, const KModbusLite_t* h)
+{
+	engine->ID = h->ID;
+	engine->ListenOnlyMode = h->ListenOnlyMode;
+	engine->EventCounter = h->EventCounter;
+	engine->MessageCounter = h->MessageCounter;
+	engine->DiagnosticRegister = h->DiagnosticRegister;
+	engine->CRCErrorCounter = h->CRCErrorCounter;
+	engine->ExceptionErrorCount = h->ExceptionErrorCount;
+	engine->NoResponseCount = h->NoResponseCount;
+	engine->BroadcastCounter = h->BroadcastCounter;
+}
+
+static void	Store(const KModbus_t* engine, PKModbusLite_t h)
+{
+	h->ListenOnlyMode = engine->ListenOnlyMode;
+	h->EventCounter = engine->EventCounter;
+	h->MessageCounter = engine->MessageCounter;
+	h->DiagnosticRegister = engine->DiagnosticRegister;
+	h->CRCErrorCounter = engine->CRCErrorCounter;
+	h->ExceptionErrorCount = engine->ExceptionErrorCount;
+	h->NoResponseCount = engine->NoResponseCount;
+	h->BroadcastCounter = engine->BroadcastCounter;
+}
+
+static unsigned char*	Borrow(PKModbusSlab_t s, PKModbusLite_t h)
+{
+	int		used;
+
+	if (s->Top == 0) {
+		s->Exhausted++;
+		return 0;
+	}
+	h->Buf = (unsigned short)(s->Free[--s->Top] + 1);
+	used = s->Count - s->Top;
+	if (used > s->Peak) {
+		s->Peak = used;
+	}
+	return s->Buf[h->Buf - 1];
+}
+
+static void	Release(PKModbusSlab_t s, PKModbusLite_t h)
+{
+	if (h->Buf != 0) {
+		s->Free[s->Top++] = (unsigned short)(h->Buf - 1);
+		h->Buf = 0;
+	}
+	h->RxLen = 0;
+}
+
+void	KModbusSlab_Init(PKModbusSlab_t s, unsigned char (*buf)[KMODBUS_MAX_RXBUF], unsigned short* free, int count)
+{
+	int		i;
+
+	memset(s, 0x00, sizeof(*s));
+	s->Buf = buf;
+	s->Free = free;
+	s->Count = (count > 65535) ? 65535 : count;
+	for (i = 0; i < s->Count; i++) {
+		s->Free[i] = (unsigned short)(s->Count - 1 - i);
+	}
+	s->Top = s->Count;
+}
+
+void	KModbusLite_Init(PKModbusLite_t h, unsigned char id)
+{
+	memset(h, 0x00, sizeof(*h));
+	h->ID = id;
+	h->RxState = KMODBUS_LITE_IDLE;
+}
+
+KMODBUS_STATUS	KModbusLite_Execute(PKModbus_t engine, PKModbusLite_t h, const unsigned char* frame, int len)
+{
+	KMODBUS_STATUS	ret;
+
+	/* Queries for other units do not touch the engine */
+	if (len < 4 || (frame[0] != h->ID && frame[0] != KMODBUS_BROADCAST_ID)) {
+		return KMODBUS_NOT_RESPONSE;
+	}
+	Load(engine, h);
+	ret = KModbus_Execute(engine, frame, len);
+	Store(engine, h);
+	return ret;
+}
+
+void	KModbusLite_Tick(PKModbus_t engine, PKModbusSlab_t slab, PKModbusLite_t h, KMODBUS_TICK now)
+{
+	if (h->RxState == KMODBUS_LITE_IDLE || now - h->LastTick <= engine->NoCommunicationTime) {
+		return;
+	}
+	if (h->RxState == KMODBUS_LITE_PENDING) {
+		KModbusLite_Execute(engine, h, slab->Buf[h->Buf - 1], h->RxLen);
+	}
+	/* Executed, or the partial query timed out, or the foreign frame ended */
+	Release(slab, h);
+	h->RxState = KMODBUS_LITE_IDLE;
+}
+
+void	KModbusLite_Feed(PKModbus_t engine, PKModbusSlab_t slab, PKModbusLite_t h,
+			const unsigned char* bytes, int n, KMODBUS_TICK now)
+{
+	unsigned char*	buf;
+	int				qlen;
+
+	KModbusLite_Tick(engine, slab, h, now);
+
+	buf = h->Buf ? slab->Buf[h->Buf - 1] : 0;
+	while (n-- > 0) {
+		h->LastTick = now;
+
+		switch (h->RxState) {
+		case KMODBUS_LITE_IDLE:
+			if (*bytes != h->ID && *bytes != KMODBUS_BROADCAST_ID) {
+				h->RxState = KMODBUS_LITE_SKIP;
+				break;
+			}
+			buf = Borrow(slab, h);
+			if (buf == 0) {
+				h->RxState = KMODBUS_LITE_SKIP;
+				break;
+			}
+			buf[0] = *bytes;
+			h->RxLen = 1;
+			h->RxState = KMODBUS_LITE_FRAME;
+			break;
+
+		case KMODBUS_LITE_FRAME:
+			buf[h->RxLen++] = *bytes;
+			qlen = KModbus_QueryLength(buf, h->RxLen);
+			if (qlen < 0) {
+				Release(slab, h);
+				h->RxState = KMODBUS_LITE_SKIP;
+			}
+			else if (qlen > 0 && h->RxLen == qlen + 2) {
+#ifdef _USE_NO_COMMNICATION_TIME_
+				h->RxState = KMODBUS_LITE_PENDING;
+#else
+				KModbusLite_Execute(engine, h, buf, h->RxLen);
+				Release(slab, h);
+				h->RxState = KMODBUS_LITE_IDLE;
+#endif
+			}
+			break;
+
+		case KMODBUS_LITE_PENDING:
+			/* Bytes inside the silent interval only delay the execution */
+		case KMODBUS_LITE_SKIP:
+		default:
+			break;
+		}
+		++bytes;
+	}
+}
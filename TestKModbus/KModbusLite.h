@@ -0,0 +1,102 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSLITE_H__
+#define	__KMODBUSLITE_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#define	KMODBUS_LITE_IDLE			(0)
+#define	KMODBUS_LITE_FRAME			(1)
+#define	KMODBUS_LITE_SKIP			(2)
+#define	KMODBUS_LITE_PENDING		(3)
+
+/*
+	Receive buffers lent to compact handles while they hold part of a
+	query. Storage is the caller's, count buffers and count free slots.
+	A slab belongs to one thread.
+*/
+typedef struct KModbusSlab_t {
+	unsigned char	(*Buf)[KMODBUS_MAX_RXBUF];
+	unsigned short*	Free;
+	int				Count;
+	int				Top;			/* Free buffers */
+
+	int				Peak;			/* Most buffers lent at once */
+	unsigned long	Exhausted;		/* Queries dropped, no buffer left */
+
+} KModbusSlab_t, *PKModbusSlab_t;
+
+/*
+	Server endpoint without buffers, for tens of thousands of emulated
+	slaves or sessions. Everything a query touches fits one cache line.
+	A full KModbus_t per thread (the engine) brings the interface, the
+	function table and the transmit and receive buffers; the endpoint is
+	loaded into it for the query and its counters stored back after.
+	The engine's Interface.Puts sends the answer of the endpoint being
+	executed.
+*/
+typedef struct KModbusLite_t {
+	unsigned short	MessageCounter;
+	unsigned short	EventCounter;
+	unsigned short	CRCErrorCounter;
+	unsigned short	ExceptionErrorCount;
+	unsigned short	NoResponseCount;
+	unsigned short	BroadcastCounter;
+	unsigned short	DiagnosticRegister;
+	unsigned short	ListenOnlyMode;
+	KMODBUS_TICK	LastTick;
+	unsigned short	RxLen;
+	unsigned short	Buf;			/* Slab buffer + 1 while a query is partial, 0 none */
+	unsigned char	RxState;
+	unsigned char	ID;
+
+} KModbusLite_t, *PKModbusLite_t;
+
+void			KModbusSlab_Init(PKModbusSlab_t s, unsigned char (*buf)[KMODBUS_MAX_RXBUF], unsigned short* free, int count);
+
+void			KModbusLite_Init(PKModbusLite_t h, unsigned char id);
+
+/* Execute a complete RTU query (CRC included) for h on engine */
+KMODBUS_STATUS	KModbusLite_Execute(PKModbus_t engine, PKModbusLite_t h, const unsigned char* frame, int len);
+
+/*
+	Byte stream of h, as KModbus_Feed. A buffer is taken from slab at the
+	address byte and given back when the query was executed or dropped.
+	Call Tick for the handles whose RxState is not idle.
+*/
+void			KModbusLite_Feed(PKModbus_t engine, PKModbusSlab_t slab, PKModbusLite_t h,
+					const unsigned char* bytes, int n, KMODBUS_TICK now);
+void			KModbusLite_Tick(PKModbus_t engine, PKModbusSlab_t slab, PKModbusLite_t h, KMODBUS_TICK now);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSLITE_H__ */
@@ -0,0 +1,91 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSLOCK_H__
+#define	__KMODBUSLOCK_H__
+
+/*
+	Reader/writer lock of the optional modules, so their own state does not
+	wait on the bank lock (CRITICAL_SECTION_BEGIN) of the application.
+	Never take the bank lock while holding one of these.
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef	SRWLOCK				KMODBUS_LOCK;
+#define	KMODBUS_LOCK_INIT	SRWLOCK_INIT		/* Static initializer */
+
+static __inline void	KModbusLock_Init(KMODBUS_LOCK* l)
+{
+	InitializeSRWLock(l);
+}
+static __inline void	KModbusLock_Begin(KMODBUS_LOCK* l)
+{
+	AcquireSRWLockExclusive(l);
+}
+static __inline void	KModbusLock_End(KMODBUS_LOCK* l)
+{
+	ReleaseSRWLockExclusive(l);
+}
+static __inline void	KModbusLock_ReadBegin(KMODBUS_LOCK* l)
+{
+	AcquireSRWLockShared(l);
+}
+static __inline void	KModbusLock_ReadEnd(KMODBUS_LOCK* l)
+{
+	ReleaseSRWLockShared(l);
+}
+
+#else
+#include <pthread.h>
+
+typedef	pthread_rwlock_t	KMODBUS_LOCK;
+#define	KMODBUS_LOCK_INIT	PTHREAD_RWLOCK_INITIALIZER
+
+static __inline void	KModbusLock_Init(KMODBUS_LOCK* l)
+{
+	pthread_rwlock_init(l, NULL);
+}
+static __inline void	KModbusLock_Begin(KMODBUS_LOCK* l)
+{
+	pthread_rwlock_wrlock(l);
+}
+static __inline void	KModbusLock_End(KMODBUS_LOCK* l)
+{
+	pthread_rwlock_unlock(l);
+}
+static __inline void	KModbusLock_ReadBegin(KMODBUS_LOCK* l)
+{
+	pthread_rwlock_rdlock(l);
+}
+static __inline void	KModbusLock_ReadEnd(KMODBUS_LOCK* l)
+{
+	pthread_rwlock_unlock(l);
+}
+
+#endif
+
+#endif	/* __KMODBUSLOCK_H__ */
@@ -0,0 +1,812 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusMaster.h"
+#include	<memory.h>
+
+#define	GET_TICK(fd)			(*((fd)->GetTick))()
+
+static int	PutCRC16(unsigned char* buf, int len)
+{
+	unsigned short	crc16;
+
+	crc16 = KModbus_CalcCRC16(buf, len);
+	buf[len++] = (unsigned char)(crc16 & 0x00FF);
+	buf[len++] = (unsigned char)(crc16 >> 8);
+	return len;
+}
+
+static unsigned char*	PutU16(unsigned char* pt, unsigned short u16)
+{
+	*pt++ = (unsigned char)(u16 >> 8);
+	*pt++ = (unsigned char)(u16 & 0x00FF);
+	return pt;
+}
+
+int		KModbusMaster_BuildRead(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, int len)
+{
+	unsigned char*	pt;
+
+	if (fc < 1 || fc > 4 || len < 1) {
+		return 0;
+	}
+	if (len > ((fc <= 2) ? KMODBUS_MAX_READ_BITS : KMODBUS_MAX_READ_REGS)) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = fc;
+	pt = PutU16(pt, ad);
+	pt = PutU16(pt, (unsigned short)len);
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildWriteSingle(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, unsigned short dt)
+{
+	unsigned char*	pt;
+
+	if (fc == 5) {
+		dt = (dt != 0) ? 0xFF00 : 0x0000;
+	}
+	else if (fc != 6) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = fc;
+	pt = PutU16(pt, ad);
+	pt = PutU16(pt, dt);
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildWriteMultiple(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, int len, const unsigned short* dt)
+{
+	unsigned char	*pt, d;
+	int				i, bit;
+
+	if (len < 1) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = fc;
+	pt = PutU16(pt, ad);
+	pt = PutU16(pt, (unsigned short)len);
+	if (fc == 15) {
+		if (len > KMODBUS_MAX_WRITE_BITS) {
+			return 0;
+		}
+		*pt++ = (unsigned char)((len + 7) / 8);
+		d = 0;
+		bit = 0;
+		for (i = 0; i < len; i++) {
+			if (dt[i]) {
+				d |= (1 << bit);
+			}
+			if (++bit == 8) {
+				*pt++ = d;
+				d = 0;
+				bit = 0;
+			}
+		}
+		if (bit != 0) {
+			*pt++ = d;
+		}
+	}
+	else if (fc == 16) {
+		if (len > KMODBUS_MAX_WRITE_REGS) {
+			return 0;
+		}
+		*pt++ = (unsigned char)(len * 2);
+		for (i = 0; i < len; i++) {
+			pt = PutU16(pt, dt[i]);
+		}
+	}
+	else {
+		return 0;
+	}
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildDiagnostics(unsigned char* buf, unsigned char id, KMODBUS_DIAGNOSTICS no, unsigned short dt)
+{
+	unsigned char*	pt;
+
+	pt = buf;
+	*pt++ = id;
+	*pt++ = 8;
+	pt = PutU16(pt, no);
+	pt = PutU16(pt, dt);
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildSimple(unsigned char* buf, unsigned char id, unsigned char fc)
+{
+	if (fc != 11 && fc != 12 && fc != 17) {
+		return 0;
+	}
+	buf[0] = id;
+	buf[1] = fc;
+	return PutCRC16(buf, 2);
+}
+
+int		KModbusMaster_BuildMaskWrite(unsigned char* buf, unsigned char id, KMODBUS_ADDRESS ad, unsigned short and_mask, unsigned short or_mask)
+{
+	unsigned char*	pt;
+
+	pt = buf;
+	*pt++ = id;
+	*pt++ = 22;
+	pt = PutU16(pt, ad);
+	pt = PutU16(pt, and_mask);
+	pt = PutU16(pt, or_mask);
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildReadWrite(unsigned char* buf, unsigned char id, KMODBUS_ADDRESS rad, int rlen, KMODBUS_ADDRESS wad, int wlen, const unsigned short* wdt)
+{
+	unsigned char*	pt;
+	int				i;
+
+	if (rlen < 1 || rlen > KMODBUS_MAX_READ_REGS || wlen < 1 || wlen > KMODBUS_MAX_RW_WRITE_REGS) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = 23;
+	pt = PutU16(pt, rad);
+	pt = PutU16(pt, (unsigned short)rlen);
+	pt = PutU16(pt, wad);
+	pt = PutU16(pt, (unsigned short)wlen);
+	*pt++ = (unsigned char)(wlen * 2);
+	for (i = 0; i < wlen; i++) {
+		pt = PutU16(pt, wdt[i]);
+	}
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildReadFile(unsigned char* buf, unsigned char id, const KModbusFileRecord_t* rec, int n)
+{
+	unsigned char*	pt;
+	int				i, rsp;
+
+	rsp = 0;
+	for (i = 0; i < n; i++) {
+		if (rec[i].Length < 1 || rec[i].Record > 9999) {
+			return 0;
+		}
+		rsp += 2 + rec[i].Length * 2;
+	}
+	if (n < 1 || n * 7 > KMODBUS_MAX_FILE_BYTES || rsp > KMODBUS_MAX_FILE_BYTES) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = 20;
+	*pt++ = (unsigned char)(n * 7);
+	for (i = 0; i < n; i++) {
+		*pt++ = 6;
+		pt = PutU16(pt, rec[i].File);
+		pt = PutU16(pt, rec[i].Record);
+		pt = PutU16(pt, rec[i].Length);
+	}
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_BuildWriteFile(unsigned char* buf, unsigned char id, const KModbusFileRecord_t* rec, int n)
+{
+	unsigned char*	pt;
+	int				i, j, req;
+
+	req = 0;
+	for (i = 0; i < n; i++) {
+		if (rec[i].Length < 1 || rec[i].Record > 9999) {
+			return 0;
+		}
+		req += 7 + rec[i].Length * 2;
+	}
+	if (n < 1 || req > KMODBUS_MAX_FILE_BYTES) {
+		return 0;
+	}
+	pt = buf;
+	*pt++ = id;
+	*pt++ = 21;
+	*pt++ = (unsigned char)req;
+	for (i = 0; i < n; i++) {
+		*pt++ = 6;
+		pt = PutU16(pt, rec[i].File);
+		pt = PutU16(pt, rec[i].Record);
+		pt = PutU16(pt, rec[i].Length);
+		for (j = 0; j < rec[i].Length; j++) {
+			pt = PutU16(pt, rec[i].Data[j]);
+		}
+	}
+	return PutCRC16(buf, (int)(pt - buf));
+}
+
+int		KModbusMaster_ResponseLength(const unsigned char* buf, int len)
+{
+	if (len < 2) {
+		return 0;
+	}
+	if (buf[1] & 0x80) {
+		return 5;
+	}
+	switch (buf[1]) {
+	case 5:
+	case 6:
+	case 8:
+	case 11:
+	case 15:
+	case 16:
+		return 8;
+
+	case 22:
+		return 10;
+
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+	case 12:
+	case 17:
+	case 20:
+	case 21:
+	case 23:
+		if (len < 3) {
+			return 0;
+		}
+		if (buf[2] + 5 > KMODBUS_MAX_RXBUF) {
+			return -1;
+		}
+		return buf[2] + 5;
+	}
+	return -1;
+}
+
+static KMODBUS_STATUS	ExceptionStatus(unsigned char code)
+{
+	switch (code) {
+	case 0x01:
+		return KMODBUS_UNSUPPORT_FUNCTION;
+	case 0x02:
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	case 0x03:
+		return KMODBUS_INVALID_PARAM;
+	case 0x06:
+		return KMODBUS_SLAVE_BUSY;
+	}
+	return KMODBUS_SLAVE_FAILURE;
+}
+
+KMODBUS_STATUS	KModbusMaster_Decode(const unsigned char* req, const unsigned char* rsp, int len, unsigned short* buf)
+{
+	unsigned short	crc16;
+	int				cnt, i, pos;
+
+	if (len < 5 || len != KModbusMaster_ResponseLength(rsp, len)) {
+		return KMODBUS_INVALID_RESPONSE;
+	}
+	crc16 = KModbus_CalcCRC16((unsigned char*)rsp, len - 2);
+	if (rsp[len - 2] != (crc16 & 0x00FF) || rsp[len - 1] != (crc16 >> 8)) {
+		return KMODBUS_INVALID_RESPONSE;
+	}
+	if (rsp[0] != req[0] || (rsp[1] & 0x7F) != req[1]) {
+		return KMODBUS_INVALID_RESPONSE;
+	}
+	if (rsp[1] & 0x80) {
+		return ExceptionStatus(rsp[2]);
+	}
+
+	switch (rsp[1]) {
+	case 1:
+	case 2:
+		cnt = KModbud_B2N((unsigned char*)&req[4]);
+		if (rsp[2] != (cnt + 7) / 8) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		if (buf) {
+			for (i = 0; i < cnt; i++) {
+				buf[i] = (rsp[3 + i / 8] & (1 << (i % 8))) ? 0xFF00 : 0x0000;
+			}
+		}
+		return KMODBUS_OK;
+
+	case 3:
+	case 4:
+	case 23:
+		cnt = KModbud_B2N((unsigned char*)&req[4]);
+		if (rsp[2] != cnt * 2) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		if (buf) {
+			for (i = 0; i < cnt; i++) {
+				buf[i] = KModbud_B2N((unsigned char*)&rsp[3 + i * 2]);
+			}
+		}
+		return KMODBUS_OK;
+
+	case 5:
+	case 6:
+	case 15:
+	case 16:
+		if (memcmp(rsp, req, 6) != 0) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		return KMODBUS_OK;
+
+	case 22:
+		if (memcmp(rsp, req, 8) != 0) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		return KMODBUS_OK;
+
+	case 20:
+		/* One sub-response per sub-request: length, reference type, data */
+		pos = 3;
+		for (i = 0; i < req[2]; i += 7) {
+			cnt = KModbud_B2N((unsigned char*)&req[3 + i + 5]);
+			if (pos + 2 + cnt * 2 > 3 + rsp[2] || rsp[pos] != cnt * 2 + 1 || rsp[pos + 1] != 6) {
+				return KMODBUS_INVALID_RESPONSE;
+			}
+			pos += 2;
+			while (cnt--) {
+				if (buf) {
+					*buf++ = KModbud_B2N((unsigned char*)&rsp[pos]);
+				}
+				pos += 2;
+			}
+		}
+		if (pos != 3 + rsp[2]) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		return KMODBUS_OK;
+
+	case 21:
+		if (memcmp(rsp, req, len - 2) != 0) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		return KMODBUS_OK;
+
+	case 8:
+		if (memcmp(rsp, req, 4) != 0) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		if (buf) {
+			buf[0] = KModbud_B2N((unsigned char*)&rsp[4]);
+		}
+		return KMODBUS_OK;
+
+	case 11:
+		if (buf) {
+			buf[0] = KModbud_B2N((unsigned char*)&rsp[2]);
+			buf[1] = KModbud_B2N((unsigned char*)&rsp[4]);
+		}
+		return KMODBUS_OK;
+
+	case 12:
+		if (rsp[2] < 6) {
+			return KMODBUS_INVALID_RESPONSE;
+		}
+		if (buf) {
+			buf[0] = KModbud_B2N((unsigned char*)&rsp[3]);
+			buf[1] = KModbud_B2N((unsigned char*)&rsp[5]);
+			buf[2] = KModbud_B2N((unsigned char*)&rsp[7]);
+			buf[3] = (rsp[2] > 6) ? rsp[9] : 0;
+			buf[4] = (rsp[2] > 7) ? rsp[10] : 0;
+		}
+		return KMODBUS_OK;
+
+	case 17:
+		if (buf) {
+			for (i = 0; i < rsp[2]; i++) {
+				buf[i] = rsp[3 + i];
+			}
+		}
+		return KMODBUS_OK;
+	}
+	return KMODBUS_INVALID_RESPONSE;
+}
+
+/* Send the request in TxBuf and wait up to timeout for the response */
+static KMODBUS_STATUS	Exchange(PKModbus_t hd, int txlen, unsigned short* buf, KMODBUS_TICK timeout)
+{
+	KMODBUS_STATUS	ret;
+	KMODBUS_TICK	st;
+	unsigned char	c;
+	int				rxlen, need;
+
+	/* Discard the rest of a previous response, at most one frame of a noisy line */
+	for (rxlen = 0; rxlen < KMODBUS_MAX_RXBUF && hd->Interface.Get(&c) == KMODBUS_OK; rxlen++) {
+	}
+
+	hd->MessageCounter++;
+	KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_TX, hd->TxBuf, txlen, 1);
+	ret = hd->Interface.Puts(hd->TxBuf, txlen);
+	if (ret != KMODBUS_OK) {
+		return ret;
+	}
+	/* No response to broadcasts, give the slaves the turnaround delay to execute it */
+	if (hd->TxBuf[0] == KMODBUS_BROADCAST_ID) {
+		hd->BroadcastCounter++;
+		st = GET_TICK(hd);
+		while (GET_TICK(hd) - st < hd->TurnaroundDelay) {
+			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+		}
+		return KMODBUS_OK;
+	}
+
+	rxlen = 0;
+	need = 0;
+	st = GET_TICK(hd);
+	for (;;) {
+		ret = hd->Interface.Get(&hd->RxBuf[rxlen]);
+		if (ret == KMODBUS_OK) {
+			++rxlen;
+			need = KModbusMaster_ResponseLength(hd->RxBuf, rxlen);
+			if (need < 0) {
+				hd->ExceptionErrorCount++;
+				return KMODBUS_INVALID_RESPONSE;
+			}
+			if (need > 0 && rxlen >= need) {
+				break;
+			}
+		}
+		/* Also while bytes arrive, a line trickling noise must time out */
+		if (GET_TICK(hd) - st >= timeout) {
+			hd->NoResponseCount++;
+			return KMODBUS_TIMEOUT;
+		}
+		if (ret != KMODBUS_OK) {
+			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+		}
+	}
+
+	ret = KModbusMaster_Decode(hd->TxBuf, hd->RxBuf, rxlen, buf);
+	KMODBUS_CAPTURE(hd, KMODBUS_CAPTURE_RX, hd->RxBuf, rxlen, ret != KMODBUS_INVALID_RESPONSE);
+	if (ret == KMODBUS_INVALID_RESPONSE) {
+		hd->CRCErrorCounter++;
+	}
+	else if (ret != KMODBUS_OK) {
+		hd->ExceptionErrorCount++;
+	}
+	else {
+		hd->EventCounter++;
+	}
+	return ret;
+}
+
+static unsigned long	HealthRandom(PKModbusHealth_t h)
+{
+	unsigned long	x = h->Random & 0xFFFFFFFFUL;
+
+	x ^= (x << 13) & 0xFFFFFFFFUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xFFFFFFFFUL;
+	h->Random = x;
+	return x;
+}
+
+/* RFC 6298 estimator in integer arithmetic, Srtt is kept x8 and Rttvar x4 */
+static void	UpdateRto(PKModbusHealth_t h, KModbusSlaveHealth_t* sh, KMODBUS_TICK rtt)
+{
+	long	err;
+
+	sh->LastRtt = rtt;
+	if (sh->Srtt == 0) {
+		sh->Srtt = rtt << 3;
+		sh->Rttvar = rtt << 1;
+	}
+	else {
+		err = (long)rtt - (long)(sh->Srtt >> 3);
+		sh->Srtt += err;
+		if (err < 0) {
+			err = -err;
+		}
+		sh->Rttvar += err - (long)(sh->Rttvar >> 2);
+	}
+	sh->Rto = (sh->Srtt >> 3) + sh->Rttvar;
+	if (sh->Rto < h->RtoMin) {
+		sh->Rto = h->RtoMin;
+	}
+	if (sh->Rto > h->RtoMax) {
+		sh->Rto = h->RtoMax;
+	}
+}
+
+static KMODBUS_STATUS	AdaptiveTransaction(PKModbus_t hd, int txlen, unsigned short* buf)
+{
+	PKModbusHealth_t		h = hd->Health;
+	KModbusSlaveHealth_t*	sh = &h->Slave[hd->TxBuf[0]];
+	KMODBUS_STATUS			ret;
+	KMODBUS_TICK			st, timeout, jitter;
+	int						attempt, retries;
+
+	st = GET_TICK(hd);
+	if (sh->Offline) {
+		if ((long)(sh->NextProbe - st) > 0) {
+			sh->Skipped++;
+			return KMODBUS_NOT_RESPONSE;
+		}
+		retries = 0;		/* A probe is a single try */
+	}
+	else {
+		retries = h->MaxRetries;
+	}
+	sh->Transactions++;
+
+	timeout = sh->Rto;
+	for (attempt = 0;; attempt++) {
+		st = GET_TICK(hd);
+		ret = Exchange(hd, txlen, buf, timeout);
+		if (ret == KMODBUS_OK || ret == KMODBUS_NON_EXISTENT_ADDRESS || ret == KMODBUS_UNSUPPORT_FUNCTION
+			|| ret == KMODBUS_INVALID_PARAM || ret == KMODBUS_SLAVE_FAILURE || ret == KMODBUS_SLAVE_BUSY) {
+			break;
+		}
+		if (ret == KMODBUS_TIMEOUT) {
+			sh->Timeouts++;
+		}
+		else {
+			sh->Errors++;
+		}
+		if (attempt >= retries) {
+			/* Give up, repeated failures move the slave to the probe schedule */
+			if (++sh->Failures >= h->OfflineAfter) {
+				if (sh->Offline) {
+					sh->ProbeInterval = (sh->ProbeInterval * 2 < h->ProbeMax) ? sh->ProbeInterval * 2 : h->ProbeMax;
+				}
+				sh->Offline = 1;
+				sh->NextProbe = GET_TICK(hd) + sh->ProbeInterval;
+			}
+			return ret;
+		}
+		/* Back off the timeout and spread the retries of several masters */
+		sh->Retries++;
+		timeout = (timeout * 2 < h->RtoMax) ? timeout * 2 : h->RtoMax;
+		jitter = h->RtoMin ? HealthRandom(h) % h->RtoMin : 0;
+		st = GET_TICK(hd);
+		while (GET_TICK(hd) - st < jitter) {
+			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+		}
+	}
+
+	/* The slave answered, Karn's rule: only first tries give an RTT sample */
+	if (attempt == 0) {
+		UpdateRto(h, sh, GET_TICK(hd) - st);
+	}
+	if (ret == KMODBUS_OK) {
+		sh->Ok++;
+	}
+	else {
+		sh->Exceptions++;
+	}
+	sh->Failures = 0;
+	sh->Offline = 0;
+	sh->ProbeInterval = h->ProbeMin;
+	return ret;
+}
+
+KMODBUS_STATUS	KModbusMaster_Transaction(PKModbus_t hd, int txlen, unsigned short* buf)
+{
+	if (txlen <= 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (hd->Transaction) {
+		return (*hd->Transaction)(hd, txlen, buf);
+	}
+	if (hd->Health && hd->TxBuf[0] != KMODBUS_BROADCAST_ID) {
+		return AdaptiveTransaction(hd, txlen, buf);
+	}
+	return Exchange(hd, txlen, buf, hd->ResponseTimeout);
+}
+
+void	KModbusMaster_HealthInit(PKModbus_t hd, PKModbusHealth_t h)
+{
+	int		i;
+
+	memset(h, 0x00, sizeof(*h));
+	h->MaxRetries = KMODBUS_MAX_RETRIES;
+	h->OfflineAfter = KMODBUS_OFFLINE_AFTER;
+	h->RtoMin = KMODBUS_RTO_MIN;
+	h->RtoMax = hd->ResponseTimeout;
+	h->ProbeMin = KMODBUS_PROBE_MIN;
+	h->ProbeMax = KMODBUS_PROBE_MAX;
+	h->Random = 0x2545F491UL;
+	for (i = 0; i < 256; i++) {
+		h->Slave[i].Rto = hd->ResponseTimeout;
+		h->Slave[i].ProbeInterval = h->ProbeMin;
+	}
+	hd->Health = h;
+}
+
+const KModbusSlaveHealth_t*	KModbusMaster_SlaveHealth(PKModbus_t hd, unsigned char id)
+{
+	if (hd->Health == 0) {
+		return 0;
+	}
+	return &hd->Health->Slave[id];
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadCoilStatus(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildRead(p->TxBuf, p->ID, 1, ad, len), buf);
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadInputStatus(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildRead(p->TxBuf, p->ID, 2, ad, len), buf);
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadHoldingRegister(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildRead(p->TxBuf, p->ID, 3, ad, len), buf);
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadInputRegister(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_INPUT_REGISTER* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildRead(p->TxBuf, p->ID, 4, ad, len), buf);
+}
+
+KMODBUS_STATUS	KModbusMaster_ForceSingleCoil(void* hd, KMODBUS_ADDRESS ad, KMODBUS_COIL_STATUS dt)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildWriteSingle(p->TxBuf, p->ID, 5, ad, dt), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_PresetSingleRegister(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER dt)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildWriteSingle(p->TxBuf, p->ID, 6, ad, dt), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_Diagnostics(void* hd, KMODBUS_DIAGNOSTICS no, KMODBUS_HOLDING_REGISTER dt)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildDiagnostics(p->TxBuf, p->ID, no, dt), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_FetchCommunicationEventCounter(void* hd, KMODBUS_EVENTCOUNTER* buf)
+{
+	PKModbus_t		p = (PKModbus_t)hd;
+	KMODBUS_STATUS	ret;
+	unsigned short	rsp[2];
+
+	ret = KModbusMaster_Transaction(p, KModbusMaster_BuildSimple(p->TxBuf, p->ID, 11), rsp);
+	if (ret == KMODBUS_OK) {
+		*buf = rsp[1];
+	}
+	return ret;
+}
+
+KMODBUS_STATUS	KModbusMaster_FetchCommunicationEventLog(void* hd, KMODBUS_EVENTLOG* buf)
+{
+	PKModbus_t		p = (PKModbus_t)hd;
+	KMODBUS_STATUS	ret;
+	unsigned short	rsp[5];
+
+	ret = KModbusMaster_Transaction(p, KModbusMaster_BuildSimple(p->TxBuf, p->ID, 12), rsp);
+	if (ret == KMODBUS_OK) {
+		buf->counter = rsp[1];
+		buf->event_counter = rsp[2];
+		buf->event[0] = (unsigned char)rsp[3];
+		buf->event[1] = (unsigned char)rsp[4];
+	}
+	return ret;
+}
+
+KMODBUS_STATUS	KModbusMaster_ForceMultipleCoils(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildWriteMultiple(p->TxBuf, p->ID, 15, ad, len, buf), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_PresetMultipleRegisters(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildWriteMultiple(p->TxBuf, p->ID, 16, ad, len, buf), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_MaskWriteRegister(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER and_mask, KMODBUS_HOLDING_REGISTER or_mask)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildMaskWrite(p->TxBuf, p->ID, ad, and_mask, or_mask), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadFileRecord(void* hd, const KModbusFileRecord_t* rec, int n, unsigned short* buf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildReadFile(p->TxBuf, p->ID, rec, n), buf);
+}
+
+KMODBUS_STATUS	KModbusMaster_WriteFileRecord(void* hd, const KModbusFileRecord_t* rec, int n)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildWriteFile(p->TxBuf, p->ID, rec, n), 0);
+}
+
+KMODBUS_STATUS	KModbusMaster_ReadWriteMultipleRegisters(void* hd, KMODBUS_ADDRESS rad, int rlen, KMODBUS_HOLDING_REGISTER* rbuf, KMODBUS_ADDRESS wad, int wlen, KMODBUS_HOLDING_REGISTER* wbuf)
+{
+	PKModbus_t	p = (PKModbus_t)hd;
+
+	return KModbusMaster_Transaction(p, KModbusMaster_BuildReadWrite(p->TxBuf, p->ID, rad, rlen, wad, wlen, wbuf), rbuf);
+}
+
+void	KModbusMaster_Init(PKModbus_t hd)
+{
+	hd->ID = KMODBUS_ID;
+	hd->GetTick = KMODBUS_GETTICKCOUNT;
+	hd->Interface.Get = KMODBUS_GETCOM;
+	hd->Interface.Put = KMODBUS_PUTCOM;
+	hd->Interface.Puts = KMODBUS_PUTSCOM;
+	hd->Capture = 0;
+	hd->CaptureContext = 0;
+	hd->Health = 0;
+	hd->Cache = 0;
+	hd->Accept = 0;
+	hd->Dispatch = 0;
+	hd->Transaction = 0;
+
+	hd->FuncTable.ReadCoilStatus = KModbusMaster_ReadCoilStatus;
+	hd->FuncTable.ReadInputStatus = KModbusMaster_ReadInputStatus;
+	hd->FuncTable.ReadHoldingRegister = KModbusMaster_ReadHoldingRegister;
+	hd->FuncTable.ReadInputRegister = KModbusMaster_ReadInputRegister;
+	hd->FuncTable.ForceSingleCoil = KModbusMaster_ForceSingleCoil;
+	hd->FuncTable.PresetSingleRegister = KModbusMaster_PresetSingleRegister;
+	hd->FuncTable.Diagnostics = KModbusMaster_Diagnostics;
+	hd->FuncTable.FetchCommunicationEventCounter = KModbusMaster_FetchCommunicationEventCounter;
+	hd->FuncTable.FetchCommunicationEventLog = KModbusMaster_FetchCommunicationEventLog;
+	hd->FuncTable.ForceMultipleCoils = KModbusMaster_ForceMultipleCoils;
+	hd->FuncTable.PresetMultipleRegisters = KModbusMaster_PresetMultipleRegisters;
+	hd->FuncTable.MaskWriteRegister = KModbusMaster_MaskWriteRegister;
+	hd->FuncTable.ReadWriteMultipleRegisters = KModbusMaster_ReadWriteMultipleRegisters;
+
+	hd->ListenOnlyMode = 0;
+	hd->EventCounter = 0;
+	hd->MessageCounter = 0;
+	hd->DiagnosticRegister = 0;
+	hd->CRCErrorCounter = 0;
+	hd->ExceptionErrorCount = 0;
+	hd->NoResponseCount = 0;
+	hd->BroadcastCounter = 0;
+	hd->NoCommunicationTime = 10;
+	hd->ResponseTimeout = KMODBUS_RESPONSE_TIMEOUT;
+	hd->TurnaroundDelay = KMODBUS_TURNAROUND_DELAY;
+}
@@ -0,0 +1,161 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSMASTER_H__
+#define	__KMODBUSMASTER_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_RESPONSE_TIMEOUT
+#define	KMODBUS_RESPONSE_TIMEOUT	(1000)
+#endif
+
+#define	KMODBUS_MAX_READ_BITS		(2000)
+#define	KMODBUS_MAX_READ_REGS		(125)
+#define	KMODBUS_MAX_WRITE_BITS		(1968)
+#define	KMODBUS_MAX_WRITE_REGS		(123)
+#define	KMODBUS_MAX_RW_WRITE_REGS	(121)
+#define	KMODBUS_MAX_FILE_BYTES		(245)		/* Sub-requests of FC20/21 in one frame */
+
+/* Defaults of the adaptive timeout and retry policy (ticks) */
+#ifndef	KMODBUS_RTO_MIN
+#define	KMODBUS_RTO_MIN				(20)
+#endif
+#ifndef	KMODBUS_MAX_RETRIES
+#define	KMODBUS_MAX_RETRIES			(2)
+#endif
+#ifndef	KMODBUS_OFFLINE_AFTER
+#define	KMODBUS_OFFLINE_AFTER		(3)		/* Failed transactions in a row */
+#endif
+#ifndef	KMODBUS_PROBE_MIN
+#define	KMODBUS_PROBE_MIN			(1000)
+#endif
+#ifndef	KMODBUS_PROBE_MAX
+#define	KMODBUS_PROBE_MAX			(60000)
+#endif
+
+typedef struct KModbusSlaveHealth_t {
+	KMODBUS_TICK	Srtt;			/* Smoothed RTT x 8 */
+	KMODBUS_TICK	Rttvar;			/* RTT variance x 4 */
+	KMODBUS_TICK	Rto;			/* Response timeout used for this slave */
+	KMODBUS_TICK	LastRtt;
+
+	int				Offline;		/* Polled only at NextProbe */
+	KMODBUS_TICK	NextProbe;
+	KMODBUS_TICK	ProbeInterval;
+	unsigned short	Failures;		/* Failed transactions in a row */
+
+	unsigned long	Transactions;
+	unsigned long	Ok;
+	unsigned long	Exceptions;
+	unsigned long	Timeouts;
+	unsigned long	Errors;			/* Corrupt responses */
+	unsigned long	Retries;
+	unsigned long	Skipped;		/* Requests refused while offline */
+
+} KModbusSlaveHealth_t;
+
+typedef struct KModbusHealth_t {
+	KModbusSlaveHealth_t	Slave[256];		/* Indexed by unit ID */
+
+	int						MaxRetries;
+	int						OfflineAfter;
+	KMODBUS_TICK			RtoMin;
+	KMODBUS_TICK			RtoMax;
+	KMODBUS_TICK			ProbeMin;
+	KMODBUS_TICK			ProbeMax;
+	unsigned long			Random;
+
+} KModbusHealth_t, *PKModbusHealth_t;
+
+/* One sub-request of FC20/21, Data (Length registers) is written by FC21 only */
+typedef struct KModbusFileRecord_t {
+	unsigned short			File;			/* 1 to 65535 */
+	unsigned short			Record;			/* 0 to 9999 */
+	unsigned short			Length;			/* Registers */
+	const unsigned short*	Data;
+
+} KModbusFileRecord_t;
+
+/* Request builders, return the frame length including the CRC (0 on invalid parameter) */
+int				KModbusMaster_BuildRead(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, int len);
+int				KModbusMaster_BuildWriteSingle(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, unsigned short dt);
+int				KModbusMaster_BuildWriteMultiple(unsigned char* buf, unsigned char id, unsigned char fc, KMODBUS_ADDRESS ad, int len, const unsigned short* dt);
+int				KModbusMaster_BuildDiagnostics(unsigned char* buf, unsigned char id, KMODBUS_DIAGNOSTICS no, unsigned short dt);
+int				KModbusMaster_BuildSimple(unsigned char* buf, unsigned char id, unsigned char fc);
+int				KModbusMaster_BuildMaskWrite(unsigned char* buf, unsigned char id, KMODBUS_ADDRESS ad, unsigned short and_mask, unsigned short or_mask);
+int				KModbusMaster_BuildReadWrite(unsigned char* buf, unsigned char id, KMODBUS_ADDRESS rad, int rlen, KMODBUS_ADDRESS wad, int wlen, const unsigned short* wdt);
+int				KModbusMaster_BuildReadFile(unsigned char* buf, unsigned char id, const KModbusFileRecord_t* rec, int n);
+int				KModbusMaster_BuildWriteFile(unsigned char* buf, unsigned char id, const KModbusFileRecord_t* rec, int n);
+
+/* Length of the response frame started in buf (0: more data needed, -1: invalid) */
+int				KModbusMaster_ResponseLength(const unsigned char* buf, int len);
+
+/* Check the response against its request and unpack the data into buf (may be NULL) */
+KMODBUS_STATUS	KModbusMaster_Decode(const unsigned char* req, const unsigned char* rsp, int len, unsigned short* buf);
+
+/*
+	Blocking master on hd->Interface, the slave addressed is hd->ID. The
+	request is in hd->TxBuf; with hd->Transaction set it goes there
+	instead, as for the clients of KModbusSched.h.
+*/
+void			KModbusMaster_Init(PKModbus_t hd);
+KMODBUS_STATUS	KModbusMaster_Transaction(PKModbus_t hd, int txlen, unsigned short* buf);
+
+/*
+	Adaptive policy: each slave gets its timeout from its measured RTT
+	(SRTT + 4 RTTVAR as for TCP), failed requests are retried with jitter,
+	and slaves failing repeatedly are only probed on an exponential backoff.
+	Requests to such a slave return KMODBUS_NOT_RESPONSE without bus time.
+*/
+void			KModbusMaster_HealthInit(PKModbus_t hd, PKModbusHealth_t h);
+const KModbusSlaveHealth_t*	KModbusMaster_SlaveHealth(PKModbus_t hd, unsigned char id);
+
+KMODBUS_STATUS	KModbusMaster_ReadCoilStatus(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+KMODBUS_STATUS	KModbusMaster_ReadInputStatus(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+KMODBUS_STATUS	KModbusMaster_ReadHoldingRegister(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
+KMODBUS_STATUS	KModbusMaster_ReadInputRegister(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_INPUT_REGISTER* buf);
+KMODBUS_STATUS	KModbusMaster_ForceSingleCoil(void* hd, KMODBUS_ADDRESS ad, KMODBUS_COIL_STATUS dt);
+KMODBUS_STATUS	KModbusMaster_PresetSingleRegister(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER dt);
+KMODBUS_STATUS	KModbusMaster_Diagnostics(void* hd, KMODBUS_DIAGNOSTICS no, KMODBUS_HOLDING_REGISTER dt);
+KMODBUS_STATUS	KModbusMaster_FetchCommunicationEventCounter(void* hd, KMODBUS_EVENTCOUNTER* buf);
+KMODBUS_STATUS	KModbusMaster_FetchCommunicationEventLog(void* hd, KMODBUS_EVENTLOG* buf);
+KMODBUS_STATUS	KModbusMaster_ForceMultipleCoils(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_COIL_STATUS* buf);
+KMODBUS_STATUS	KModbusMaster_PresetMultipleRegisters(void* hd, KMODBUS_ADDRESS ad, int len, KMODBUS_HOLDING_REGISTER* buf);
+KMODBUS_STATUS	KModbusMaster_MaskWriteRegister(void* hd, KMODBUS_ADDRESS ad, KMODBUS_HOLDING_REGISTER and_mask, KMODBUS_HOLDING_REGISTER or_mask);
+/* All n sub-requests go in one frame, FC20 returns the records one after another in buf */
+KMODBUS_STATUS	KModbusMaster_ReadFileRecord(void* hd, const KModbusFileRecord_t* rec, int n, unsigned short* buf);
+KMODBUS_STATUS	KModbusMaster_WriteFileRecord(void* hd, const KModbusFileRecord_t* rec, int n);
+KMODBUS_STATUS	KModbusMaster_ReadWriteMultipleRegisters(void* hd, KMODBUS_ADDRESS rad, int rlen, KMODBUS_HOLDING_REGISTER* rbuf, KMODBUS_ADDRESS wad, int wlen, KMODBUS_HOLDING_REGISTER* wbuf);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSMASTER_H__ */
@@ -0,0 +1,120 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusMbap.h"
+#include	"KModbusSocket.h"
+#include	<memory.h>
+
+/* Response buffer of the query being executed on this thread */
+static KMODBUS_THREAD_LOCAL unsigned char*	s_TxPtr;
+static KMODBUS_THREAD_LOCAL int*			s_TxLen;
+static KMODBUS_THREAD_LOCAL int				s_TxMax;
+
+static KMODBUS_STATUS	MbapPuts(unsigned char* buf, int len)
+{
+	if (s_TxPtr == 0 || *s_TxLen + len > s_TxMax) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memcpy(s_TxPtr + *s_TxLen, buf, len);
+	*s_TxLen += len;
+	return KMODBUS_OK;
+}
+
+static KMODBUS_STATUS	MbapPut(unsigned char c)
+{
+	return MbapPuts(&c, 1);
+}
+
+static KMODBUS_STATUS	MbapGet(unsigned char* c)
+{
+	return KMODBUS_NODATA;
+}
+
+void	KModbusMbap_Attach(PKModbus_t hd)
+{
+	hd->Interface.Get = MbapGet;
+	hd->Interface.Gets = 0;
+	hd->Interface.Put = MbapPut;
+	hd->Interface.Puts = MbapPuts;
+}
+
+void	KModbusMbap_Sink(unsigned char* buf, int* len, int max)
+{
+	s_TxPtr = buf;
+	s_TxLen = len;
+	s_TxMax = max;
+}
+
+/* MBAP header of a response of txlen bytes from the unit on, its total length */
+static int	Header(const unsigned char* rx, unsigned char* tx, int txlen)
+{
+	tx[0] = rx[0];
+	tx[1] = rx[1];
+	tx[2] = 0;
+	tx[3] = 0;
+	tx[4] = (unsigned char)(txlen >> 8);
+	tx[5] = (unsigned char)(txlen & 0x00FF);
+	tx[6] = rx[6];
+	return txlen + KMODBUS_MBAP_HEADER;
+}
+
+int		KModbusMbap_Execute(PKModbus_t hd, const unsigned char* rx, int len, unsigned char* tx, int txmax)
+{
+	int		pdulen, txlen;
+
+	if (len < 8 || rx[2] != 0 || rx[3] != 0 || KModbud_B2N((unsigned char*)&rx[4]) + KMODBUS_MBAP_HEADER != len) {
+		return -1;
+	}
+	/* Unit 0 and 255 address this device over IP */
+	if (rx[6] != hd->ID && rx[6] != 0x00 && rx[6] != 0xFF) {
+		return -1;
+	}
+	pdulen = len - 7;
+	if (pdulen + 1 > KMODBUS_MAX_RXBUF) {
+		/* Longer than the receive buffer of this build, illegal data value */
+		if (txmax < KMODBUS_MBAP_HEADER + 3) {
+			return 0;
+		}
+		tx[7] = rx[7] | 0x80;
+		tx[8] = 0x03;
+		hd->MessageCounter++;
+		return Header(rx, tx, 3);
+	}
+	hd->RxBuf[0] = hd->ID;
+	memcpy(&hd->RxBuf[1], &rx[7], pdulen);
+	if (KModbus_QueryLength(hd->RxBuf, pdulen + 1) != pdulen + 1) {
+		return -1;
+	}
+
+	/* The RTU response lands after the MBAP header, its CRC is dropped */
+	txlen = 0;
+	KModbusMbap_Sink(&tx[KMODBUS_MBAP_HEADER], &txlen, txmax - KMODBUS_MBAP_HEADER);
+	KModbus_Dispatch(hd);
+	KModbusMbap_Sink(0, 0, 0);
+	if (txlen < 4) {
+		return 0;
+	}
+	return Header(rx, tx, txlen - 2);
+}
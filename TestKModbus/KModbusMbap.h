@@ -0,0 +1,58 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSMBAP_H__
+#define	__KMODBUSMBAP_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#define	KMODBUS_MBAP_HEADER			(6)		/* Transaction, protocol and length, the unit is counted in the PDU */
+
+/*
+	Response sink of the network transports. KModbusMbap_Attach points the
+	interface of hd at a thread local buffer, so each thread executing
+	queries through its own hd collects the responses set with
+	KModbusMbap_Sink instead of writing to a serial port.
+*/
+void	KModbusMbap_Attach(PKModbus_t hd);
+void	KModbusMbap_Sink(unsigned char* buf, int* len, int max);
+
+/*
+	Execute one MBAP frame of len bytes and write the MBAP framed response
+	to tx. Returns the response length, 0 when nothing is answered and -1
+	when the frame or its unit is not for this device. A PDU longer than
+	KMODBUS_MAX_RXBUF allows is answered with exception 03.
+*/
+int		KModbusMbap_Execute(PKModbus_t hd, const unsigned char* rx, int len, unsigned char* tx, int txmax);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSMBAP_H__ */
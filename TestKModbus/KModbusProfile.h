@@ -0,0 +1,165 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSPROFILE_H__
+#define	__KMODBUSPROFILE_H__
+
+/*
+	Footprint profiles. KModbusConfig.h selects one with KMODBUS_PROFILE,
+	anything it defines itself (bank sizes, KMODBUS_USE_FCxx,
+	KMODBUS_CRC_TABLE) overrides the profile. A bank size of 0 removes
+	the bank and the function codes working on it.
+
+	FULL:	10000 entries per bank, every function code, table CRC
+	SMALL:	256 bits / 128 registers, FC01-06, FC15, FC16, table CRC
+	TINY:	no bit banks, 16 input / 32 holding registers,
+			FC03, FC04, FC06, FC16, bitwise CRC
+*/
+
+#ifndef	KMODBUS_PROFILE
+#define	KMODBUS_PROFILE		KMODBUS_PROFILE_FULL
+#endif
+
+#if		KMODBUS_PROFILE == KMODBUS_PROFILE_FULL
+#define	KMODBUS_PROFILE_NAME		"full"
+#define	_KMODBUS_P_X0				(10000)
+#define	_KMODBUS_P_X1				(10000)
+#define	_KMODBUS_P_X3				(10000)
+#define	_KMODBUS_P_X4				(10000)
+#define	_KMODBUS_P_DIAG				1
+#define	_KMODBUS_P_EXT				1
+#define	_KMODBUS_P_CRC_TABLE		1
+#elif	KMODBUS_PROFILE == KMODBUS_PROFILE_SMALL
+#define	KMODBUS_PROFILE_NAME		"small"
+#define	_KMODBUS_P_X0				(256)
+#define	_KMODBUS_P_X1				(256)
+#define	_KMODBUS_P_X3				(128)
+#define	_KMODBUS_P_X4				(128)
+#define	_KMODBUS_P_DIAG				0
+#define	_KMODBUS_P_EXT				0
+#define	_KMODBUS_P_CRC_TABLE		1
+#elif	KMODBUS_PROFILE == KMODBUS_PROFILE_TINY
+#define	KMODBUS_PROFILE_NAME		"tiny"
+#define	_KMODBUS_P_X0				(0)
+#define	_KMODBUS_P_X1				(0)
+#define	_KMODBUS_P_X3				(16)
+#define	_KMODBUS_P_X4				(32)
+#define	_KMODBUS_P_DIAG				0
+#define	_KMODBUS_P_EXT				0
+#define	_KMODBUS_P_CRC_TABLE		0
+#else
+#error	"KModbusProfile.h: unknown KMODBUS_PROFILE"
+#endif
+
+/* Bank sizes */
+#ifndef	KMODBUS_X0_SIZE
+#define	KMODBUS_X0_SIZE				_KMODBUS_P_X0
+#endif
+#ifndef	KMODBUS_X1_SIZE
+#define	KMODBUS_X1_SIZE				_KMODBUS_P_X1
+#endif
+#ifndef	KMODBUS_X3_SIZE
+#define	KMODBUS_X3_SIZE				_KMODBUS_P_X3
+#endif
+#ifndef	KMODBUS_X4_SIZE
+#define	KMODBUS_X4_SIZE				_KMODBUS_P_X4
+#endif
+
+#define	KMODBUS_X0_BUFSIZE			(((KMODBUS_X0_SIZE)+63)/64)		/* 64-bit words */
+#define	KMODBUS_X1_BUFSIZE			(((KMODBUS_X1_SIZE)+63)/64)
+#define	KMODBUS_X3_BUFSIZE			((KMODBUS_X3_SIZE))
+#define	KMODBUS_X4_BUFSIZE			((KMODBUS_X4_SIZE))
+
+/* Double-buffered process image (two copies of the banks), see KModbus_Commit */
+#ifndef	KMODBUS_PROCESS_IMAGE
+#define	KMODBUS_PROCESS_IMAGE		(0)
+#endif
+#ifndef	KMODBUS_IMAGE_LOG
+#define	KMODBUS_IMAGE_LOG			(1024)	/* Bytes of bus writes held until the commit */
+#endif
+
+/*
+	Registers held as the big-endian bytes of the frame: FC03/FC04/FC16
+	copy them unchanged and the byte swap moves to KModbus_Get/Set and
+	mask writes. Invisible to the API either way.
+*/
+#ifndef	KMODBUS_WIRE_ORDER
+#define	KMODBUS_WIRE_ORDER			(0)
+#endif
+
+/* Static RAM taken by the banks */
+#define	KMODBUS_BANK_BYTES			((8 * (KMODBUS_X0_BUFSIZE + KMODBUS_X1_BUFSIZE) + 2 * (KMODBUS_X3_BUFSIZE + KMODBUS_X4_BUFSIZE)) \
+										* (KMODBUS_PROCESS_IMAGE ? 2 : 1))
+
+/* Function codes, a code is off when its bank is removed */
+#ifndef	KMODBUS_USE_FC01
+#define	KMODBUS_USE_FC01			(KMODBUS_X0_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC02
+#define	KMODBUS_USE_FC02			(KMODBUS_X1_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC03
+#define	KMODBUS_USE_FC03			(KMODBUS_X4_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC04
+#define	KMODBUS_USE_FC04			(KMODBUS_X3_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC05
+#define	KMODBUS_USE_FC05			(KMODBUS_X0_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC06
+#define	KMODBUS_USE_FC06			(KMODBUS_X4_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC08
+#define	KMODBUS_USE_FC08			_KMODBUS_P_DIAG
+#endif
+#ifndef	KMODBUS_USE_FC11
+#define	KMODBUS_USE_FC11			_KMODBUS_P_DIAG
+#endif
+#ifndef	KMODBUS_USE_FC12
+#define	KMODBUS_USE_FC12			_KMODBUS_P_DIAG
+#endif
+#ifndef	KMODBUS_USE_FC15
+#define	KMODBUS_USE_FC15			(KMODBUS_X0_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC16
+#define	KMODBUS_USE_FC16			(KMODBUS_X4_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC17
+#define	KMODBUS_USE_FC17			_KMODBUS_P_DIAG
+#endif
+#ifndef	KMODBUS_USE_FC22
+#define	KMODBUS_USE_FC22			(_KMODBUS_P_EXT && KMODBUS_X4_SIZE > 0)
+#endif
+#ifndef	KMODBUS_USE_FC23
+#define	KMODBUS_USE_FC23			(_KMODBUS_P_EXT && KMODBUS_X4_SIZE > 0)
+#endif
+
+/* CRC engine: 512 byte table (speed) or bitwise loop (flash) */
+#ifndef	KMODBUS_CRC_TABLE
+#define	KMODBUS_CRC_TABLE			_KMODBUS_P_CRC_TABLE
+#endif
+
+#endif	/* __KMODBUSPROFILE_H__ */
@@ -0,0 +1,661 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusRepl.h"
+#include	<memory.h>
+
+#define	LINK_CLOSED			(0)
+#define	LINK_CONNECTING		(1)
+#define	LINK_UP				(2)
+
+#define	REC_PAGE			(1)		/* Data of a range */
+#define	REC_SUM				(2)		/* Checksum of a bank */
+#define	REC_MARK			(3)		/* End of a batch, echoed by the standby */
+#define	REC_RESYNC			(4)		/* Standby asks for a bank again */
+
+#define	REC_HEADER			(8)
+#define	MARK_BYTES			(REC_HEADER + 4)
+
+#define	TICK_REACHED(now, t)	((long)((now) - (t)) >= 0)
+
+#ifdef	MSG_NOSIGNAL
+#define	SEND_FLAGS			MSG_NOSIGNAL
+#else
+#define	SEND_FLAGS			(0)
+#endif
+
+/* Geometry and primary state of one bank */
+typedef struct Bank_t {
+	int				Bank;
+	int				Size;			/* Coils or registers */
+	int				Bits;
+	int				PageItems;
+	unsigned char*	Shadow;
+	unsigned char*	Synced;
+	unsigned long*	Seen;			/* Registers only */
+} Bank_t;
+
+static int	GetBank(PKModbusRepl_t r, int i, Bank_t* b)
+{
+	switch (i) {
+	case 0:
+		b->Bank = 0;
+		b->Size = KMODBUS_X0_SIZE;
+		b->Shadow = r->X0;
+		b->Synced = r->SyncedX0;
+		b->Seen = 0;
+		break;
+	case 1:
+		b->Bank = 1;
+		b->Size = KMODBUS_X1_SIZE;
+		b->Shadow = r->X1;
+		b->Synced = r->SyncedX1;
+		b->Seen = 0;
+		break;
+	case 2:
+		b->Bank = 3;
+		b->Size = KMODBUS_X3_SIZE;
+		b->Shadow = r->X3;
+		b->Synced = r->SyncedX3;
+		b->Seen = r->SeenX3;
+		break;
+	case 3:
+		b->Bank = 4;
+		b->Size = KMODBUS_X4_SIZE;
+		b->Shadow = r->X4;
+		b->Synced = r->SyncedX4;
+		b->Seen = r->SeenX4;
+		break;
+	default:
+		return 0;
+	}
+	b->Bits = (b->Bank == 0 || b->Bank == 1);
+	b->PageItems = b->Bits ? KMODBUS_REPL_PAGE_BITS : KMODBUS_REPL_PAGE_REGS;
+	return b->Size > 0;
+}
+
+/* Bytes of n entries as GetXn returns them */
+static int	ItemBytes(const Bank_t* b, int n)
+{
+	return b->Bits ? (n + 7) / 8 : n * 2;
+}
+
+/* What the masters see, from any thread */
+static KMODBUS_STATUS	ReadBank(int bank, int adrs, unsigned char* dt, int len)
+{
+	switch (bank) {
+	case 0:		return GetX0(adrs, dt, len);
+	case 1:		return GetX1(adrs, dt, len);
+	case 3:		return GetX3(adrs, dt, len);
+	case 4:		return GetX4(adrs, dt, len);
+	}
+	return KMODBUS_INVALID_PARAM;
+}
+
+static unsigned long	Fnv(unsigned long h, const unsigned char* dt, int len)
+{
+	while (len--) {
+		h = (h ^ *dt++) * 16777619UL;
+	}
+	return h & 0xFFFFFFFFUL;
+}
+
+#define	FNV_BASIS			(2166136261UL)
+
+static void	PutHeader(unsigned char* p, int type, int bank, int adrs, int count, int len)
+{
+	p[0] = (unsigned char)type;
+	p[1] = (unsigned char)bank;
+	p[2] = (unsigned char)(adrs >> 8);
+	p[3] = (unsigned char)(adrs & 0x00FF);
+	p[4] = (unsigned char)(count >> 8);
+	p[5] = (unsigned char)(count & 0x00FF);
+	p[6] = (unsigned char)(len >> 8);
+	p[7] = (unsigned char)(len & 0x00FF);
+}
+
+static void	Put32(unsigned char* p, unsigned long v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)(v & 0x00FF);
+}
+
+static unsigned long	Get32(const unsigned char* p)
+{
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+
+static void	Disconnect(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	if (r->Socket != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(r->Socket);
+		r->Socket = KMODBUS_INVALID_SOCKET;
+	}
+	r->State = LINK_CLOSED;
+	r->TxLen = 0;
+	r->TxOfs = 0;
+	r->RxLen = 0;
+	r->NextConnect = now + KMODBUS_REPL_RECONNECT;
+}
+
+static void	Connect(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	int		on = 1;
+
+	r->Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (r->Socket == KMODBUS_INVALID_SOCKET) {
+		Disconnect(r, now);
+		return;
+	}
+	KModbusSocket_NonBlocking(r->Socket);
+	setsockopt(r->Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	if (connect(r->Socket, (struct sockaddr*)&r->Peer, sizeof(r->Peer)) == 0) {
+		r->State = LINK_UP;
+		r->Connects++;
+		KModbusRepl_Resync(r);
+		return;
+	}
+	if (KMODBUS_SOCKERR == KMODBUS_EINPROGRESS || KMODBUS_SOCKERR == KMODBUS_EWOULDBLOCK) {
+		r->State = LINK_CONNECTING;
+		return;
+	}
+	Disconnect(r, now);
+}
+
+static void	Flush(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	int		n;
+
+	while (r->TxOfs < r->TxLen) {
+		n = send(r->Socket, (const char*)&r->TxBuf[r->TxOfs], r->TxLen - r->TxOfs, SEND_FLAGS);
+		if (n < 0) {
+			if (KMODBUS_SOCKERR != KMODBUS_EWOULDBLOCK) {
+				Disconnect(r, now);
+			}
+			return;		/* The rest goes when the socket is writable */
+		}
+		r->TxOfs += n;
+		r->Bytes += n;
+	}
+	r->TxLen = 0;
+	r->TxOfs = 0;
+}
+
+/*
+	Append the changed part of one page, 0 when it is unchanged, -1 when
+	the batch has no room or Rate no budget for it.
+*/
+static int	ScanPage(PKModbusRepl_t r, const Bank_t* b, int page)
+{
+	unsigned char	cur[KMODBUS_REPL_PAGE_REGS * 2];
+	unsigned char*	shadow;
+	unsigned long	ver;
+	int				adrs, n, bytes, first, last, len, count;
+
+	adrs = page * b->PageItems;
+	n = b->Size - adrs;
+	if (n > b->PageItems) {
+		n = b->PageItems;
+	}
+	ver = 0;
+	if (b->Seen) {
+		/* Read before the data, a write racing the read moves it again */
+		ver = KModbus_Version(b->Bank, adrs, n);
+		if (b->Synced[page] && ver == b->Seen[page]) {
+			return 0;
+		}
+	}
+	if (ReadBank(b->Bank, adrs, cur, n) != KMODBUS_OK) {
+		return 0;
+	}
+	bytes = ItemBytes(b, n);
+	shadow = &b->Shadow[ItemBytes(b, adrs)];
+	first = 0;
+	last = bytes - 1;
+	if (b->Synced[page]) {
+		while (first < bytes && cur[first] == shadow[first]) {
+			first++;
+		}
+		if (first == bytes) {
+			if (b->Seen) {
+				b->Seen[page] = ver;
+			}
+			return 0;
+		}
+		while (cur[last] == shadow[last]) {
+			last--;
+		}
+		if (!b->Bits) {
+			first &= ~1;
+			last |= 1;
+		}
+	}
+	len = last - first + 1;
+	if (r->TxLen + REC_HEADER + len + MARK_BYTES > KMODBUS_REPL_TXBUF
+		|| (r->Rate != 0 && r->Tokens < REC_HEADER + len)) {
+		return -1;
+	}
+	if (b->Bits) {
+		count = len * 8;
+		if (first * 8 + count > n) {
+			count = n - first * 8;
+		}
+		PutHeader(&r->TxBuf[r->TxLen], REC_PAGE, b->Bank, adrs + first * 8, count, len);
+	}
+	else {
+		PutHeader(&r->TxBuf[r->TxLen], REC_PAGE, b->Bank, adrs + first / 2, len / 2, len);
+	}
+	memcpy(&r->TxBuf[r->TxLen + REC_HEADER], &cur[first], len);
+	r->TxLen += REC_HEADER + len;
+	r->Tokens -= REC_HEADER + len;
+	r->Records++;
+
+	memcpy(&shadow[first], &cur[first], len);
+	b->Synced[page] = 1;
+	if (b->Seen) {
+		b->Seen[page] = ver;
+	}
+	return 1;
+}
+
+static int	Pages(const Bank_t* b)
+{
+	return (b->Size + b->PageItems - 1) / b->PageItems;
+}
+
+/*
+	One batch of every changed page the budget allows. A scan cut short
+	resumes where it stopped, so the end of the banks is not starved.
+*/
+static void	Scan(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	Bank_t	bank[4];
+	int		i, k, n, total, idx, page, ret, sent;
+
+	if (r->Rate != 0) {
+		r->Tokens += (long)((double)r->Rate * (double)(now - r->Refilled) / 1000.0);
+		if (r->Tokens > (long)r->Rate) {
+			r->Tokens = (long)r->Rate;
+		}
+	}
+	r->Refilled = now;
+
+	total = 0;
+	for (i = 0; i < 4; i++) {
+		total += GetBank(r, i, &bank[i]) ? Pages(&bank[i]) : 0;
+	}
+	sent = 0;
+	ret = 0;
+	for (k = 0; k < total; k++) {
+		idx = (r->Cursor + k) % total;
+		page = idx;
+		for (i = 0; i < 4; i++) {
+			n = (bank[i].Size > 0) ? Pages(&bank[i]) : 0;
+			if (page < n) {
+				break;
+			}
+			page -= n;
+		}
+		ret = ScanPage(r, &bank[i], page);
+		if (ret < 0) {
+			r->Cursor = idx;	/* The rest stays dirty for the next scan */
+			r->Throttled++;
+			break;
+		}
+		sent += ret;
+	}
+	r->Behind = (ret < 0);
+	if (sent) {
+		PutHeader(&r->TxBuf[r->TxLen], REC_MARK, 0, 0, 0, 4);
+		Put32(&r->TxBuf[r->TxLen + REC_HEADER], (unsigned long)now);
+		r->TxLen += MARK_BYTES;
+		r->Batches++;
+	}
+}
+
+/* Checksums of the shadow, the standby holds the same once it applied the batches before them */
+static void	Sums(PKModbusRepl_t r)
+{
+	Bank_t	b;
+	int		i;
+
+	for (i = 0; i < 4; i++) {
+		if (!GetBank(r, i, &b) || r->TxLen + REC_HEADER + 4 > KMODBUS_REPL_TXBUF) {
+			continue;
+		}
+		PutHeader(&r->TxBuf[r->TxLen], REC_SUM, b.Bank, 0, b.Size, 4);
+		Put32(&r->TxBuf[r->TxLen + REC_HEADER], Fnv(FNV_BASIS, b.Shadow, ItemBytes(&b, b.Size)));
+		r->TxLen += REC_HEADER + 4;
+		r->Sums++;
+	}
+}
+
+/* Standby: checksum of the own bank, read a page at a time */
+static unsigned long	BankSum(int bank, int size)
+{
+	unsigned char	buf[KMODBUS_REPL_PAGE_REGS * 2];
+	unsigned long	h;
+	int				bits, adrs, n;
+
+	bits = (bank == 0 || bank == 1);
+	h = FNV_BASIS;
+	for (adrs = 0; adrs < size; adrs += n) {
+		n = size - adrs;
+		if (n > (bits ? KMODBUS_REPL_PAGE_BITS : KMODBUS_REPL_PAGE_REGS)) {
+			n = bits ? KMODBUS_REPL_PAGE_BITS : KMODBUS_REPL_PAGE_REGS;
+		}
+		if (KModbus_Read(bank, adrs, buf, n) != KMODBUS_OK) {
+			return 0;
+		}
+		h = Fnv(h, buf, bits ? (n + 7) / 8 : n * 2);
+	}
+	return h;
+}
+
+static void	Reply(PKModbusRepl_t r, int type, int bank, const unsigned char* data, int len)
+{
+	if (r->TxLen + REC_HEADER + len > KMODBUS_REPL_TXBUF) {
+		return;
+	}
+	PutHeader(&r->TxBuf[r->TxLen], type, bank, 0, 0, len);
+	memcpy(&r->TxBuf[r->TxLen + REC_HEADER], data, len);
+	r->TxLen += REC_HEADER + len;
+}
+
+static void	Record(PKModbusRepl_t r, const unsigned char* p, KMODBUS_TICK now)
+{
+	Bank_t	b;
+	int		i, bank, adrs, count, len, bytes;
+
+	bank = p[1];
+	adrs = KModbud_B2N((unsigned char*)&p[2]);
+	count = KModbud_B2N((unsigned char*)&p[4]);
+	len = KModbud_B2N((unsigned char*)&p[6]);
+
+	switch (p[0]) {
+	case REC_PAGE:
+		if (r->Role != KMODBUS_REPL_STANDBY) {
+			break;
+		}
+		/* The data has to be what count entries take, KModbus_Write would read past a short record */
+		bytes = (bank == 0 || bank == 1) ? (count + 7) / 8 : count * 2;
+		if (count > 0 && len == bytes && KModbus_Write(bank, adrs, (unsigned char*)&p[REC_HEADER], count) == KMODBUS_OK) {
+			r->Records++;
+		}
+		else {
+			r->Mismatches++;
+			Reply(r, REC_RESYNC, bank, 0, 0);
+		}
+		break;
+	case REC_SUM:
+		if (r->Role == KMODBUS_REPL_STANDBY && len == 4) {
+			r->Sums++;
+			if (BankSum(bank, count) != Get32(&p[REC_HEADER])) {
+				r->Mismatches++;
+				Reply(r, REC_RESYNC, bank, 0, 0);
+			}
+		}
+		break;
+	case REC_MARK:
+		if (r->Role == KMODBUS_REPL_STANDBY) {
+			Reply(r, REC_MARK, 0, &p[REC_HEADER], len);
+		}
+		else if (len == 4) {
+			r->Lag = now - (KMODBUS_TICK)Get32(&p[REC_HEADER]);
+			if (r->Lag > r->LagMax) {
+				r->LagMax = r->Lag;
+			}
+		}
+		break;
+	case REC_RESYNC:
+		for (i = 0; i < 4; i++) {
+			if (GetBank(r, i, &b) && b.Bank == bank) {
+				memset(b.Synced, 0x00, Pages(&b));
+				r->Mismatches++;
+			}
+		}
+		break;
+	}
+}
+
+/* Split the received stream into records, a partial one waits for the next read */
+static void	Receive(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	int		n, len, ofs;
+
+	n = recv(r->Socket, (char*)&r->RxBuf[r->RxLen], (int)sizeof(r->RxBuf) - r->RxLen, 0);
+	if (n < 0 && KMODBUS_SOCKERR == KMODBUS_EWOULDBLOCK) {
+		return;
+	}
+	if (n <= 0) {
+		Disconnect(r, now);
+		return;
+	}
+	r->RxLen += n;
+	ofs = 0;
+	while (r->RxLen - ofs >= REC_HEADER) {
+		len = KModbud_B2N(&r->RxBuf[ofs + 6]);
+		if (REC_HEADER + len > KMODBUS_REPL_RXBUF) {
+			Disconnect(r, now);		/* Lost the framing */
+			return;
+		}
+		if (r->RxLen - ofs < REC_HEADER + len) {
+			break;
+		}
+		Record(r, &r->RxBuf[ofs], now);
+		ofs += REC_HEADER + len;
+	}
+	r->RxLen -= ofs;
+	memmove(r->RxBuf, &r->RxBuf[ofs], r->RxLen);
+}
+
+static void	Clear(PKModbusRepl_t r, int role)
+{
+	memset(r, 0x00, sizeof(*r));
+	r->Role = role;
+	r->Listen = KMODBUS_INVALID_SOCKET;
+	r->Socket = KMODBUS_INVALID_SOCKET;
+	r->GetTick = KMODBUS_GETTICKCOUNT;
+}
+
+KMODBUS_STATUS	KModbusRepl_Primary(PKModbusRepl_t r, const char* ip, unsigned short port, KMODBUS_TICK period, unsigned long rate)
+{
+	Clear(r, KMODBUS_REPL_PRIMARY);
+	if (KModbusSocket_Startup() != 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	r->Peer.sin_family = AF_INET;
+	r->Peer.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &r->Peer.sin_addr) != 1) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	r->Period = period;
+	r->SumPeriod = 10000;
+	r->Rate = rate;
+	r->NextConnect = (*r->GetTick)();
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusRepl_Standby(PKModbusRepl_t r, unsigned short port)
+{
+	struct sockaddr_in	sa;
+	int					on = 1;
+
+	Clear(r, KMODBUS_REPL_STANDBY);
+	if (KModbusSocket_Startup() != 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	r->Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (r->Listen == KMODBUS_INVALID_SOCKET) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	setsockopt(r->Listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if (bind(r->Listen, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(r->Listen, 1) != 0
+		|| KModbusSocket_NonBlocking(r->Listen) != 0) {
+		KMODBUS_CLOSESOCKET(r->Listen);
+		r->Listen = KMODBUS_INVALID_SOCKET;
+		return KMODBUS_INVALID_PARAM;
+	}
+	return KMODBUS_OK;
+}
+
+/* The primary reconnected, the new connection replaces the old one */
+static void	Accept(PKModbusRepl_t r, KMODBUS_TICK now)
+{
+	KMODBUS_SOCKET	s;
+	int				on = 1;
+
+	s = accept(r->Listen, NULL, NULL);
+	if (s == KMODBUS_INVALID_SOCKET) {
+		return;
+	}
+	Disconnect(r, now);
+	KModbusSocket_NonBlocking(s);
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	r->Socket = s;
+	r->State = LINK_UP;
+	r->Connects++;
+}
+
+KMODBUS_STATUS	KModbusRepl_Poll(PKModbusRepl_t r, int timeout_ms)
+{
+	fd_set			rfds, wfds;
+	struct timeval	tv;
+	KMODBUS_SOCKET	maxfd;
+	KMODBUS_TICK	now, wait;
+	KMODBUS_SOCKLEN	optlen;
+	int				ret, err;
+
+	now = (*r->GetTick)();
+	if (r->Role == KMODBUS_REPL_PRIMARY) {
+		if (r->State == LINK_CLOSED && TICK_REACHED(now, r->NextConnect)) {
+			Connect(r, now);
+		}
+		/* A new batch only once the last one is out, the socket paces the scans */
+		if (r->State == LINK_UP && r->TxLen == 0) {
+			if (TICK_REACHED(now, r->NextScan)) {
+				Scan(r, now);
+				r->NextScan = now + r->Period;
+			}
+			if (r->SumPeriod != 0 && !r->Behind && TICK_REACHED(now, r->NextSum)) {
+				Sums(r);
+				r->NextSum = now + r->SumPeriod;
+			}
+		}
+		if (r->State == LINK_UP) {
+			Flush(r, now);
+		}
+		/* Wake for the next scan */
+		wait = r->NextScan - now;
+		if (r->State == LINK_UP && r->TxLen == 0 && (long)wait >= 0 && (long)wait < timeout_ms) {
+			timeout_ms = (int)wait;
+		}
+	}
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	maxfd = 0;
+	if (r->Listen != KMODBUS_INVALID_SOCKET) {
+		FD_SET(r->Listen, &rfds);
+		maxfd = r->Listen;
+	}
+	if (r->State != LINK_CLOSED) {
+		if (r->State == LINK_UP) {
+			FD_SET(r->Socket, &rfds);
+		}
+		if (r->State == LINK_CONNECTING || r->TxOfs < r->TxLen) {
+			FD_SET(r->Socket, &wfds);
+		}
+		if (r->Socket > maxfd) {
+			maxfd = r->Socket;
+		}
+	}
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	if (r->Listen == KMODBUS_INVALID_SOCKET && r->State == LINK_CLOSED) {
+		select(0, NULL, NULL, NULL, &tv);		/* Standby unreachable, do not spin */
+		return KMODBUS_TIMEOUT;
+	}
+	ret = select((int)maxfd + 1, &rfds, &wfds, NULL, &tv);
+	if (ret < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (ret == 0) {
+		return KMODBUS_TIMEOUT;
+	}
+
+	now = (*r->GetTick)();
+	if (r->Listen != KMODBUS_INVALID_SOCKET && FD_ISSET(r->Listen, &rfds)) {
+		Accept(r, now);
+		return KMODBUS_OK;
+	}
+	if (r->State == LINK_CONNECTING && FD_ISSET(r->Socket, &wfds)) {
+		err = 0;
+		optlen = sizeof(err);
+		getsockopt(r->Socket, SOL_SOCKET, SO_ERROR, (char*)&err, &optlen);
+		if (err != 0) {
+			Disconnect(r, now);
+		}
+		else {
+			r->State = LINK_UP;
+			r->Connects++;
+			KModbusRepl_Resync(r);
+		}
+		return KMODBUS_OK;
+	}
+	if (r->State == LINK_UP && FD_ISSET(r->Socket, &rfds)) {
+		Receive(r, now);
+	}
+	if (r->State == LINK_UP) {
+		Flush(r, now);		/* Rest of a batch, or the standby's answers */
+	}
+	return KMODBUS_OK;
+}
+
+void	KModbusRepl_Resync(PKModbusRepl_t r)
+{
+	memset(r->SyncedX0, 0x00, sizeof(r->SyncedX0));
+	memset(r->SyncedX1, 0x00, sizeof(r->SyncedX1));
+	memset(r->SyncedX3, 0x00, sizeof(r->SyncedX3));
+	memset(r->SyncedX4, 0x00, sizeof(r->SyncedX4));
+	r->Tokens = (long)r->Rate;
+	r->NextScan = (*r->GetTick)();
+	r->NextSum = r->NextScan + r->SumPeriod;
+}
+
+void	KModbusRepl_Close(PKModbusRepl_t r)
+{
+	Disconnect(r, (*r->GetTick)());
+	if (r->Listen != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(r->Listen);
+		r->Listen = KMODBUS_INVALID_SOCKET;
+	}
+}
@@ -0,0 +1,142 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSREPL_H__
+#define	__KMODBUSREPL_H__
+
+#include "KModbusSocket.h"
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_REPL_TXBUF
+#define	KMODBUS_REPL_TXBUF			(32768)	/* One batch at most */
+#endif
+#ifndef	KMODBUS_REPL_RXBUF
+#define	KMODBUS_REPL_RXBUF			(32768)
+#endif
+#ifndef	KMODBUS_REPL_RECONNECT
+#define	KMODBUS_REPL_RECONNECT		(1000)	/* Ticks between attempts to reach the standby */
+#endif
+
+/* Pages compared and shipped as a unit */
+#define	KMODBUS_REPL_PAGE_BITS		(512)
+#define	KMODBUS_REPL_PAGE_REGS		(64)
+
+#define	KMODBUS_REPL_PAGES(size, per)	(((size) + (per) - 1) / (per) + 1)	/* One spare, banks may be 0 */
+
+#define	KMODBUS_REPL_PRIMARY		(0)
+#define	KMODBUS_REPL_STANDBY		(1)
+
+/*
+	Hot-standby replication of the banks between a redundant pair.
+
+	The primary compares the banks page by page with a shadow of what
+	the standby holds. Register pages whose KModbus_Version did not move
+	are skipped without reading them. A changed page goes out as the
+	range between its first and last changed entry. Each scan is one
+	batch, closed by a mark the standby echoes back for the lag.
+	Rate caps the bytes per second; pages over the budget stay dirty for
+	the next scan, so fast-changing values coalesce. Every SumPeriod the
+	primary sends a checksum of its shadow per bank. A standby that does
+	not match, or gets a page whose byte count is not what its count of
+	entries takes, asks for the bank again.
+
+	The standby writes with KModbus_Write, so with KMODBUS_PROCESS_IMAGE
+	poll it from the thread calling KModbus_Commit. The primary reads
+	what the masters see and may run on any thread.
+
+	Record, big-endian: type, bank, address (2), count (2), byte count (2), data
+*/
+typedef struct KModbusRepl_t {
+	int					Role;
+	KMODBUS_SOCKET		Listen;			/* Standby */
+	KMODBUS_SOCKET		Socket;
+	struct sockaddr_in	Peer;			/* Primary: the standby */
+	int					State;
+	KMODBUS_TICK		(*GetTick)(void);
+	KMODBUS_TICK		NextConnect;
+
+	KMODBUS_TICK		Period;			/* Ticks between scans */
+	KMODBUS_TICK		SumPeriod;		/* Ticks between checksums, 0 for none */
+	unsigned long		Rate;			/* Bytes per second, 0 for no limit */
+	KMODBUS_TICK		NextScan;
+	KMODBUS_TICK		NextSum;
+	KMODBUS_TICK		Refilled;
+	long				Tokens;
+	int					Cursor;			/* Page a throttled scan stopped at */
+	int					Behind;			/* The last scan left dirty pages, checksums wait */
+
+	/* Primary: what the standby holds, the pages it has, the register versions read */
+	unsigned char		X0[(KMODBUS_X0_SIZE + 7) / 8 + 1];
+	unsigned char		X1[(KMODBUS_X1_SIZE + 7) / 8 + 1];
+	unsigned char		X3[KMODBUS_X3_SIZE * 2 + 1];
+	unsigned char		X4[KMODBUS_X4_SIZE * 2 + 1];
+	unsigned char		SyncedX0[KMODBUS_REPL_PAGES(KMODBUS_X0_SIZE, KMODBUS_REPL_PAGE_BITS)];
+	unsigned char		SyncedX1[KMODBUS_REPL_PAGES(KMODBUS_X1_SIZE, KMODBUS_REPL_PAGE_BITS)];
+	unsigned char		SyncedX3[KMODBUS_REPL_PAGES(KMODBUS_X3_SIZE, KMODBUS_REPL_PAGE_REGS)];
+	unsigned char		SyncedX4[KMODBUS_REPL_PAGES(KMODBUS_X4_SIZE, KMODBUS_REPL_PAGE_REGS)];
+	unsigned long		SeenX3[KMODBUS_REPL_PAGES(KMODBUS_X3_SIZE, KMODBUS_REPL_PAGE_REGS)];
+	unsigned long		SeenX4[KMODBUS_REPL_PAGES(KMODBUS_X4_SIZE, KMODBUS_REPL_PAGE_REGS)];
+
+	unsigned char		TxBuf[KMODBUS_REPL_TXBUF];
+	int					TxLen;
+	int					TxOfs;
+	unsigned char		RxBuf[KMODBUS_REPL_RXBUF];
+	int					RxLen;
+
+	unsigned long		Connects;
+	unsigned long		Batches;
+	unsigned long		Records;		/* Page deltas sent or applied */
+	unsigned long		Bytes;			/* Sent */
+	unsigned long		Throttled;		/* Scans cut short by Rate or the buffer */
+	unsigned long		Sums;			/* Checksums sent or checked */
+	unsigned long		Mismatches;		/* Standby: checksums that failed and pages refused, primary: banks sent again */
+	KMODBUS_TICK		Lag;			/* Primary: scan to acknowledgement of the last batch */
+	KMODBUS_TICK		LagMax;
+
+} KModbusRepl_t, *PKModbusRepl_t;
+
+/* Primary replicating to the standby at ip:port */
+KMODBUS_STATUS	KModbusRepl_Primary(PKModbusRepl_t r, const char* ip, unsigned short port, KMODBUS_TICK period, unsigned long rate);
+
+/* Standby taking the primary's connection on port */
+KMODBUS_STATUS	KModbusRepl_Standby(PKModbusRepl_t r, unsigned short port);
+
+/* Connect, scan, send, receive and apply, waiting up to timeout_ms for traffic */
+KMODBUS_STATUS	KModbusRepl_Poll(PKModbusRepl_t r, int timeout_ms);
+
+/* Send every page again at the next scan */
+void			KModbusRepl_Resync(PKModbusRepl_t r);
+
+void			KModbusRepl_Close(PKModbusRepl_t r);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSREPL_H__ */
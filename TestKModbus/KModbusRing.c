@@ -0,0 +1,114 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusRing.h"
+#include	<memory.h>
+
+#define	RING_MASK	((unsigned long)(KMODBUS_RING_SIZE) - 1)
+
+void	KModbusRing_Init(PKModbusRing_t ring)
+{
+	ring->Head = 0;
+	ring->Tail = 0;
+	ring->Overruns = 0;
+}
+
+int		KModbusRing_Write(PKModbusRing_t ring, const unsigned char* buf, int len)
+{
+	unsigned long	head, tail, ofs, n, first;
+
+	head = (unsigned long)ring->Head;
+	tail = (unsigned long)KMODBUS_ATOMIC_LOAD(&ring->Tail);
+	n = KMODBUS_RING_SIZE - (head - tail);
+	if ((unsigned long)len < n) {
+		n = (unsigned long)len;
+	}
+	ring->Overruns += (unsigned long)len - n;
+
+	ofs = head & RING_MASK;
+	first = KMODBUS_RING_SIZE - ofs;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(&ring->Buf[ofs], buf, first);
+	memcpy(&ring->Buf[0], buf + first, n - first);
+
+	KMODBUS_ATOMIC_STORE(&ring->Head, (long)(head + n));
+	return (int)n;
+}
+
+int		KModbusRing_Count(PKModbusRing_t ring)
+{
+	return (int)((unsigned long)KMODBUS_ATOMIC_LOAD(&ring->Head) - (unsigned long)ring->Tail);
+}
+
+int		KModbusRing_Read(PKModbusRing_t ring, unsigned char* buf, int len)
+{
+	unsigned long	head, tail, ofs, n, first;
+
+	tail = (unsigned long)ring->Tail;
+	head = (unsigned long)KMODBUS_ATOMIC_LOAD(&ring->Head);
+	n = head - tail;
+	if ((unsigned long)len < n) {
+		n = (unsigned long)len;
+	}
+
+	ofs = tail & RING_MASK;
+	first = KMODBUS_RING_SIZE - ofs;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(buf, &ring->Buf[ofs], first);
+	memcpy(buf + first, &ring->Buf[0], n - first);
+
+	KMODBUS_ATOMIC_STORE(&ring->Tail, (long)(tail + n));
+	return (int)n;
+}
+
+KMODBUS_STATUS	KModbusRing_Get(PKModbusRing_t ring, unsigned char* c)
+{
+	unsigned long	tail;
+
+	tail = (unsigned long)ring->Tail;
+	if ((unsigned long)KMODBUS_ATOMIC_LOAD(&ring->Head) == tail) {
+		return KMODBUS_NODATA;
+	}
+	*c = ring->Buf[tail & RING_MASK];
+	KMODBUS_ATOMIC_STORE(&ring->Tail, (long)(tail + 1));
+	return KMODBUS_OK;
+}
+
+/* Take exactly len bytes, nothing is consumed when fewer are available */
+KMODBUS_STATUS	KModbusRing_Gets(PKModbusRing_t ring, unsigned char* buf, int len)
+{
+	if (len < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (KModbusRing_Count(ring) < len) {
+		return KMODBUS_NODATA;
+	}
+	KModbusRing_Read(ring, buf, len);
+	return KMODBUS_OK;
+}
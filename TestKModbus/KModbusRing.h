@@ -0,0 +1,82 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSRING_H__
+#define	__KMODBUSRING_H__
+
+#include "KModbus.h"
+#include "KModbusAtomic.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_RING_SIZE
+#define	KMODBUS_RING_SIZE		(4096)	/* Power of two */
+#endif
+
+/*
+	Single producer / single consumer byte ring. The producer (ISR, DMA
+	completion or reader thread) only writes Head, the consumer (protocol
+	thread) only writes Tail, so neither side locks or waits.
+*/
+typedef struct KModbusRing_t {
+	KMODBUS_ATOMIC	Head;
+	unsigned char	HeadPad[KMODBUS_CACHE_LINE - sizeof(KMODBUS_ATOMIC)];
+	KMODBUS_ATOMIC	Tail;
+	unsigned char	TailPad[KMODBUS_CACHE_LINE - sizeof(KMODBUS_ATOMIC)];
+
+	unsigned long	Overruns;		/* Bytes dropped by the producer, ring full */
+	unsigned char	Buf[KMODBUS_RING_SIZE];
+
+} KModbusRing_t, *PKModbusRing_t;
+
+void			KModbusRing_Init(PKModbusRing_t ring);
+
+/* Producer side, returns the number of bytes stored */
+int				KModbusRing_Write(PKModbusRing_t ring, const unsigned char* buf, int len);
+
+/* Consumer side */
+int				KModbusRing_Count(PKModbusRing_t ring);
+int				KModbusRing_Read(PKModbusRing_t ring, unsigned char* buf, int len);
+KMODBUS_STATUS	KModbusRing_Get(PKModbusRing_t ring, unsigned char* c);
+KMODBUS_STATUS	KModbusRing_Gets(PKModbusRing_t ring, unsigned char* buf, int len);
+
+/* Define prefix##Get and prefix##Gets for KModbusIF_t, reading from ring */
+#define	KMODBUS_RING_INTERFACE(prefix, ring)							\
+	static KMODBUS_STATUS	prefix##Get(unsigned char* c)				\
+	{																	\
+		return KModbusRing_Get(&(ring), c);								\
+	}																	\
+	static KMODBUS_STATUS	prefix##Gets(unsigned char* buf, int len)	\
+	{																	\
+		return KModbusRing_Gets(&(ring), buf, len);						\
+	}
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSRING_H__ */
@@ -0,0 +1,134 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define	_GNU_SOURCE				/* pthread_setaffinity_np */
+#endif
+#include	"KModbusRt.h"
+#include	<memory.h>
+
+#ifdef _WIN32
+#include	<windows.h>
+#else
+#include	<pthread.h>
+#include	<sched.h>
+#include	<sys/mman.h>
+#endif
+
+#ifdef _WIN32
+/* Ranges given to KModbusRt_Prefault are locked too (Windows has no mlockall) */
+static int		s_Lock;
+#endif
+
+void	KModbusRt_DefaultConfig(KModbusRtConfig_t* cfg)
+{
+	cfg->Cpu = -1;
+	cfg->Priority = 0;
+	cfg->LockMemory = 0;
+	cfg->StackBytes = KMODBUS_RT_STACK;
+}
+
+/* Grow the stack to its working size now, not on the first deep call */
+static void	PrefaultStack(unsigned long bytes)
+{
+	volatile unsigned char	pad[KMODBUS_RT_STACK];
+	unsigned long			i;
+
+	if (bytes > sizeof(pad)) {
+		bytes = sizeof(pad);
+	}
+	for (i = 0; i < bytes; i += KMODBUS_RT_PAGE) {
+		pad[i] = 0;
+	}
+}
+
+int		KModbusRt_Enter(const KModbusRtConfig_t* cfg)
+{
+	int		done;
+
+	done = 0;
+#ifdef _WIN32
+	if (cfg->Cpu >= 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cfg->Cpu) != 0) {
+		done |= KMODBUS_RT_AFFINITY;
+	}
+	if (cfg->Priority > 0 && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+		done |= KMODBUS_RT_PRIORITY;
+	}
+	if (cfg->LockMemory) {
+		s_Lock = 1;
+		done |= KMODBUS_RT_LOCKED;
+	}
+#else
+	if (cfg->Cpu >= 0) {
+		cpu_set_t	set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cfg->Cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+			done |= KMODBUS_RT_AFFINITY;
+		}
+	}
+	if (cfg->Priority > 0) {
+		struct sched_param	sp;
+
+		memset(&sp, 0x00, sizeof(sp));
+		sp.sched_priority = cfg->Priority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) == 0) {
+			done |= KMODBUS_RT_PRIORITY;
+		}
+	}
+	if (cfg->LockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+		done |= KMODBUS_RT_LOCKED;
+	}
+#endif
+	PrefaultStack(cfg->StackBytes);
+	return done;
+}
+
+void	KModbusRt_Prefault(void* p, unsigned long bytes)
+{
+	volatile unsigned char*	b = (volatile unsigned char*)p;
+	unsigned long			i;
+
+	if (bytes == 0) {
+		return;
+	}
+	/* Write the value back so the page is private and present, not the shared zero page */
+	for (i = 0; i < bytes; i += KMODBUS_RT_PAGE) {
+		b[i] = b[i];
+	}
+	b[bytes - 1] = b[bytes - 1];
+#ifdef _WIN32
+	if (s_Lock) {
+		VirtualLock(p, bytes);
+	}
+#endif
+}
+
+void	KModbusRt_PrefaultHandle(PKModbus_t hd)
+{
+	KModbus_Prefault(KModbusRt_Prefault);
+	KModbusRt_Prefault(hd, sizeof(*hd));
+}
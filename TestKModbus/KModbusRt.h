@@ -0,0 +1,79 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSRT_H__
+#define	__KMODBUSRT_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/*
+	Deterministic mode for the server and master threads. Call
+	KModbusRt_Enter at the start of the thread, prefault everything the
+	thread touches, then run the loop. The receive, dispatch and transmit
+	path of KModbus allocates nothing, so after this no page faults are
+	left on it. KMODBUS_LOOP_SWITCH decides how the idle server waits; on a
+	dedicated core it can be empty.
+*/
+
+#ifndef	KMODBUS_RT_PAGE
+#define	KMODBUS_RT_PAGE				(4096)
+#endif
+#ifndef	KMODBUS_RT_STACK
+#define	KMODBUS_RT_STACK			(64 * 1024)		/* Stack prefaulted by KModbusRt_Enter */
+#endif
+
+/* What KModbusRt_Enter could set, the OS may refuse any part without privileges */
+#define	KMODBUS_RT_AFFINITY			(0x01)
+#define	KMODBUS_RT_PRIORITY			(0x02)
+#define	KMODBUS_RT_LOCKED			(0x04)
+
+typedef struct KModbusRtConfig_t {
+	int				Cpu;			/* -1: any */
+	int				Priority;		/* 0: unchanged, 1-99: SCHED_FIFO (Windows: time critical) */
+	int				LockMemory;		/* mlockall (Windows: locks the prefaulted ranges) */
+	unsigned long	StackBytes;
+
+} KModbusRtConfig_t;
+
+void			KModbusRt_DefaultConfig(KModbusRtConfig_t* cfg);
+
+/* Apply cfg to the calling thread, returns the KMODBUS_RT_* bits that took effect */
+int				KModbusRt_Enter(const KModbusRtConfig_t* cfg);
+
+/* Touch every page of a buffer so the steady state takes no faults on it */
+void			KModbusRt_Prefault(void* p, unsigned long bytes);
+
+/* Banks of KModbus.c and the buffers of hd */
+void			KModbusRt_PrefaultHandle(PKModbus_t hd);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSRT_H__ */
@@ -0,0 +1,283 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define	_POSIX_C_SOURCE			200809L		/* pthread_rwlock_t */
+#endif
+#include	"KModbusSched.h"
+#include	"KModbusAtomic.h"
+#include	<memory.h>
+
+#define	REQ_FREE			(0)
+#define	REQ_QUEUED			(1)
+#define	REQ_RUNNING			(2)
+
+#define	GET_TICK(fd)			(*((fd)->GetTick))()
+
+typedef struct SyncWait_t {
+	KMODBUS_ATOMIC	Done;			/* Stored with release after Status and the response data */
+	KMODBUS_STATUS	Status;
+} SyncWait_t;
+
+static void	SyncDone(void* context, KMODBUS_STATUS status, unsigned short* buf)
+{
+	((SyncWait_t*)context)->Status = status;
+	KMODBUS_ATOMIC_STORE(&((SyncWait_t*)context)->Done, 1);
+}
+
+/* Earliest deadline first, submission order among equal deadlines */
+static int	Before(const KModbusSchedRequest_t* a, const KModbusSchedRequest_t* b)
+{
+	if (a->Deadline != b->Deadline) {
+		return (long)(a->Deadline - b->Deadline) < 0;
+	}
+	return (long)(a->Seq - b->Seq) < 0;
+}
+
+static KModbusSchedRequest_t*	Next(PKModbusSched_t s)
+{
+	KModbusSchedRequest_t*	head[KMODBUS_SCHED_CLASSES];
+	KModbusSchedRequest_t*	rq;
+	int						i, pick;
+
+	for (i = 0; i < KMODBUS_SCHED_CLASSES; i++) {
+		head[i] = 0;
+	}
+	for (i = 0; i < KMODBUS_SCHED_SLOTS; i++) {
+		rq = &s->Req[i];
+		if (rq->State == REQ_QUEUED && (head[rq->Class] == 0 || Before(rq, head[rq->Class]))) {
+			head[rq->Class] = rq;
+		}
+	}
+	if (head[KMODBUS_SCHED_URGENT]) {
+		return head[KMODBUS_SCHED_URGENT];
+	}
+
+	/* Only one class waiting, it takes the slot without building credit */
+	if (head[KMODBUS_SCHED_NORMAL] == 0 || head[KMODBUS_SCHED_BACKGROUND] == 0) {
+		s->Credit[KMODBUS_SCHED_NORMAL] = 0;
+		s->Credit[KMODBUS_SCHED_BACKGROUND] = 0;
+		return head[KMODBUS_SCHED_NORMAL] ? head[KMODBUS_SCHED_NORMAL] : head[KMODBUS_SCHED_BACKGROUND];
+	}
+
+	s->Credit[KMODBUS_SCHED_NORMAL] += s->Weight[KMODBUS_SCHED_NORMAL];
+	s->Credit[KMODBUS_SCHED_BACKGROUND] += s->Weight[KMODBUS_SCHED_BACKGROUND];
+	pick = s->Credit[KMODBUS_SCHED_NORMAL] >= s->Credit[KMODBUS_SCHED_BACKGROUND] ? KMODBUS_SCHED_NORMAL : KMODBUS_SCHED_BACKGROUND;
+	s->Credit[pick] -= s->Weight[KMODBUS_SCHED_NORMAL] + s->Weight[KMODBUS_SCHED_BACKGROUND];
+	return head[pick];
+}
+
+static void	Account(KModbusSchedStats_t* st, KMODBUS_TICK wait)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_SCHED_HIST - 1 && (wait >> i) != 0; i++) {
+	}
+	st->Hist[i]++;
+	st->WaitSum += (double)wait;
+	if (wait > st->WaitMax) {
+		st->WaitMax = wait;
+	}
+}
+
+void	KModbusSched_Init(PKModbusSched_t s, PKModbus_t master)
+{
+	memset(s, 0x00, sizeof(*s));
+	KModbusLock_Init(&s->Lock);
+	s->Master = master;
+	s->Weight[KMODBUS_SCHED_NORMAL] = 4;
+	s->Weight[KMODBUS_SCHED_BACKGROUND] = 1;
+	s->Budget[KMODBUS_SCHED_URGENT] = 50;
+	s->Budget[KMODBUS_SCHED_NORMAL] = 1000;
+	s->Budget[KMODBUS_SCHED_BACKGROUND] = 10000;
+}
+
+KMODBUS_STATUS	KModbusSched_Submit(PKModbusSched_t s, int cls, const unsigned char* frame, int len,
+					unsigned short* buf, KMODBUS_TICK deadline, KModbusSchedDone done, void* context)
+{
+	KModbusSchedRequest_t*	rq;
+	KMODBUS_TICK			now;
+	int						i;
+
+	if (cls < 0 || cls >= KMODBUS_SCHED_CLASSES || len <= 0 || len > KMODBUS_MAX_TXBUF) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	now = GET_TICK(s->Master);
+	KModbusLock_Begin(&s->Lock);
+	rq = 0;
+	for (i = 0; i < KMODBUS_SCHED_SLOTS; i++) {
+		if (s->Req[i].State == REQ_FREE) {
+			rq = &s->Req[i];
+			break;
+		}
+	}
+	if (rq == 0) {
+		s->Stats[cls].Rejected++;
+		KModbusLock_End(&s->Lock);
+		return KMODBUS_SLAVE_BUSY;
+	}
+	rq->State = REQ_QUEUED;
+	rq->Class = cls;
+	rq->Seq = s->NextSeq++;
+	rq->Submitted = now;
+	rq->Deadline = now + (deadline ? deadline : s->Budget[cls]);
+	memcpy(rq->Frame, frame, len);
+	rq->Len = len;
+	rq->Buf = buf;
+	rq->Done = done;
+	rq->Context = context;
+	s->Stats[cls].Submitted++;
+	s->Stats[cls].Queued++;
+	KModbusLock_End(&s->Lock);
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusSched_Step(PKModbusSched_t s)
+{
+	KModbusSchedRequest_t*	rq;
+	KModbusSchedStats_t*	st;
+	KModbusSchedDone		done;
+	void*					context;
+	unsigned short*			buf;
+	KMODBUS_TICK			now;
+	KMODBUS_STATUS			ret;
+
+	KModbusLock_Begin(&s->Lock);
+	if (s->Busy) {
+		KModbusLock_End(&s->Lock);
+		return KMODBUS_SLAVE_BUSY;
+	}
+	now = GET_TICK(s->Master);
+	rq = Next(s);
+	if (rq == 0) {
+		KModbusLock_End(&s->Lock);
+		return KMODBUS_NODATA;
+	}
+	rq->State = REQ_RUNNING;
+	s->Busy = 1;
+	st = &s->Stats[rq->Class];
+	st->Queued--;
+	if ((long)(now - rq->Deadline) > 0) {
+		st->Late++;
+	}
+	Account(st, now - rq->Submitted);
+	KModbusLock_End(&s->Lock);
+
+	/* The bus is ours, TxBuf of the master is not touched by anyone else */
+	memcpy(s->Master->TxBuf, rq->Frame, rq->Len);
+	ret = KModbusMaster_Transaction(s->Master, rq->Len, rq->Buf);
+
+	done = rq->Done;
+	context = rq->Context;
+	buf = rq->Buf;
+	KModbusLock_Begin(&s->Lock);
+	rq->State = REQ_FREE;
+	s->Busy = 0;
+	st->Completed++;
+	KModbusLock_End(&s->Lock);
+	if (done) {
+		done(context, ret, buf);
+	}
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusSched_Transaction(PKModbusSched_t s, int cls, const unsigned char* frame, int len,
+					unsigned short* buf, KMODBUS_TICK deadline)
+{
+	SyncWait_t		w;
+	KMODBUS_STATUS	ret;
+
+	w.Done = 0;
+	w.Status = KMODBUS_OK;
+	ret = KModbusSched_Submit(s, cls, frame, len, buf, deadline, SyncDone, &w);
+	if (ret != KMODBUS_OK) {
+		return ret;
+	}
+	/* Whoever is free drives the bus, possibly for another thread's request first */
+	while (!KMODBUS_ATOMIC_LOAD(&w.Done)) {
+		if (KModbusSched_Step(s) != KMODBUS_OK) {
+			KMODBUS_LOOP_SWITCH; /* Avoidance of monopolization */
+		}
+	}
+	return w.Status;
+}
+
+KMODBUS_TICK	KModbusSched_Percentile(PKModbusSched_t s, int cls, double pct)
+{
+	KModbusSchedStats_t*	st = &s->Stats[cls];
+	unsigned long			total, sum;
+	KMODBUS_TICK			upper;
+	int						i;
+
+	total = 0;
+	for (i = 0; i < KMODBUS_SCHED_HIST; i++) {
+		total += st->Hist[i];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	sum = 0;
+	for (i = 0; i < KMODBUS_SCHED_HIST - 1; i++) {
+		sum += st->Hist[i];
+		if ((double)sum * 100.0 >= pct * (double)total) {
+			break;
+		}
+	}
+	upper = i == 0 ? 0 : ((KMODBUS_TICK)1 << i) - 1;
+	return (i == KMODBUS_SCHED_HIST - 1 || upper > st->WaitMax) ? st->WaitMax : upper;
+}
+
+void	KModbusSched_ResetStats(PKModbusSched_t s)
+{
+	unsigned long	queued;
+	int				i;
+
+	KModbusLock_Begin(&s->Lock);
+	for (i = 0; i < KMODBUS_SCHED_CLASSES; i++) {
+		queued = s->Stats[i].Queued;
+		memset(&s->Stats[i], 0x00, sizeof(s->Stats[i]));
+		s->Stats[i].Queued = queued;
+	}
+	KModbusLock_End(&s->Lock);
+}
+
+/* Transaction hook of a client handle: its request goes through the queue */
+static KMODBUS_STATUS	ClientTransaction(PKModbus_t hd, int txlen, unsigned short* buf)
+{
+	PKModbusSchedClient_t	c = (PKModbusSchedClient_t)hd;
+
+	return KModbusSched_Transaction(c->Sched, c->Class, hd->TxBuf, txlen, buf, c->Deadline);
+}
+
+void	KModbusSched_Client(PKModbusSched_t s, PKModbusSchedClient_t c, int cls, unsigned char id)
+{
+	KModbusMaster_Init(&c->Handle);
+	c->Handle.ID = id;
+	c->Handle.GetTick = s->Master->GetTick;
+	c->Handle.Transaction = ClientTransaction;
+	c->Sched = s;
+	c->Class = cls;
+	c->Deadline = 0;
+}
@@ -0,0 +1,145 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSSCHED_H__
+#define	__KMODBUSSCHED_H__
+
+#include "KModbusMaster.h"
+#include "KModbusLock.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#define	KMODBUS_SCHED_URGENT		(0)		/* Operator commands and safety writes */
+#define	KMODBUS_SCHED_NORMAL		(1)		/* Cyclic polling */
+#define	KMODBUS_SCHED_BACKGROUND	(2)		/* Scans and diagnostics */
+#define	KMODBUS_SCHED_CLASSES		(3)
+
+#ifndef	KMODBUS_SCHED_SLOTS
+#define	KMODBUS_SCHED_SLOTS			(64)	/* Queued requests of all classes */
+#endif
+#ifndef	KMODBUS_SCHED_HIST
+#define	KMODBUS_SCHED_HIST			(24)	/* Wait histogram buckets, powers of two ticks */
+#endif
+
+/* Completion of a request, buf is the one given to Submit */
+typedef void (*KModbusSchedDone)(void* context, KMODBUS_STATUS status, unsigned short* buf);
+
+typedef struct KModbusSchedRequest_t {
+	int					State;
+	int					Class;
+	unsigned long		Seq;			/* Submission order */
+	KMODBUS_TICK		Submitted;
+	KMODBUS_TICK		Deadline;		/* Latest tick the request should get the bus */
+	unsigned char		Frame[KMODBUS_MAX_TXBUF];	/* RTU request with CRC, as built by KModbusMaster_Build* */
+	int					Len;
+	unsigned short*		Buf;
+	KModbusSchedDone	Done;
+	void*				Context;
+
+} KModbusSchedRequest_t;
+
+/* Queueing latency of one class, from Submit until the request gets the bus */
+typedef struct KModbusSchedStats_t {
+	unsigned long		Submitted;
+	unsigned long		Completed;
+	unsigned long		Rejected;		/* Submit found no free slot */
+	unsigned long		Late;			/* Got the bus after its deadline */
+	unsigned long		Queued;
+	KMODBUS_TICK		WaitMax;
+	double				WaitSum;
+	unsigned long		Hist[KMODBUS_SCHED_HIST];	/* [0] no wait, [i] below 2^i ticks */
+
+} KModbusSchedStats_t;
+
+/*
+	Multi-class transaction queue in front of one master. Any thread
+	submits; the bus runs one transaction at a time. The next slot goes
+	to the urgent request with the earliest deadline. Normal and
+	background requests share the remaining slots by Weight (smooth
+	weighted round robin), each class in deadline order, so a scan
+	cannot starve polling and polling cannot starve the scan. The queue
+	has its own lock, the bank lock is not taken.
+*/
+typedef struct KModbusSched_t {
+	KMODBUS_LOCK			Lock;
+	PKModbus_t				Master;
+	KModbusSchedRequest_t	Req[KMODBUS_SCHED_SLOTS];
+	int						Weight[KMODBUS_SCHED_CLASSES];	/* Normal and background, urgent always goes first */
+	KMODBUS_TICK			Budget[KMODBUS_SCHED_CLASSES];	/* Deadline when Submit gives none */
+	long					Credit[KMODBUS_SCHED_CLASSES];
+	unsigned long			NextSeq;
+	int						Busy;
+
+	KModbusSchedStats_t		Stats[KMODBUS_SCHED_CLASSES];
+
+} KModbusSched_t, *PKModbusSched_t;
+
+/*
+	Master handle bound to one class, its ID is the slave addressed. Its
+	FuncTable holds the KModbusMaster_* wrappers and its Transaction hook
+	queues their requests here, so code written against a master runs
+	unchanged through the scheduler: pass &Handle as hd.
+*/
+typedef struct KModbusSchedClient_t {
+	KModbus_t				Handle;			/* First, the hook finds the client from it */
+	PKModbusSched_t			Sched;
+	int						Class;
+	KMODBUS_TICK			Deadline;		/* Relative, 0 for the class budget */
+
+} KModbusSchedClient_t, *PKModbusSchedClient_t;
+
+void			KModbusSched_Init(PKModbusSched_t s, PKModbus_t master);
+
+/*
+	Queue a request, deadline is relative to now (0 for the class
+	budget). done runs from KModbusSched_Step on the thread driving the
+	bus. KMODBUS_SLAVE_BUSY when all slots are taken.
+*/
+KMODBUS_STATUS	KModbusSched_Submit(PKModbusSched_t s, int cls, const unsigned char* frame, int len,
+					unsigned short* buf, KMODBUS_TICK deadline, KModbusSchedDone done, void* context);
+
+/*
+	Run the next request on the bus. KMODBUS_NODATA when nothing is
+	queued, KMODBUS_SLAVE_BUSY when another thread is on the bus.
+*/
+KMODBUS_STATUS	KModbusSched_Step(PKModbusSched_t s);
+
+/* Submit and drive the bus until the request completes */
+KMODBUS_STATUS	KModbusSched_Transaction(PKModbusSched_t s, int cls, const unsigned char* frame, int len,
+					unsigned short* buf, KMODBUS_TICK deadline);
+
+/* Queueing latency in ticks not exceeded by pct percent of the class, bucket resolution */
+KMODBUS_TICK	KModbusSched_Percentile(PKModbusSched_t s, int cls, double pct);
+void			KModbusSched_ResetStats(PKModbusSched_t s);
+
+void			KModbusSched_Client(PKModbusSched_t s, PKModbusSchedClient_t c, int cls, unsigned char id);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSSCHED_H__ */
@@ -0,0 +1,307 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusSim.h"
+#include	<memory.h>
+#include	<stdlib.h>
+
+#define	SIM_MAX_SLAVES		(247)
+
+typedef struct SimLine_t {
+	KModbus_t		Slaves[SIM_MAX_SLAVES];		/* Unit ID is the index + 1 */
+	unsigned char	Offline[SIM_MAX_SLAVES];
+	int				Count;
+	int				Next;
+	KMODBUS_TICK	Now;
+
+} SimLine_t;
+
+/* State of the transaction being simulated, the simulator is single threaded */
+static KMODBUS_TICK		s_Now;
+static unsigned char	s_Rsp[KMODBUS_MAX_TXBUF];
+static int				s_RspLen;
+static unsigned long	s_Random;
+
+static KMODBUS_TICK	SimGetTick(void)
+{
+	return s_Now;
+}
+static KMODBUS_STATUS	SimGet(unsigned char* c)
+{
+	return KMODBUS_NODATA;
+}
+static KMODBUS_STATUS	SimPut(unsigned char c)
+{
+	if (s_RspLen < KMODBUS_MAX_TXBUF) {
+		s_Rsp[s_RspLen++] = c;
+	}
+	return KMODBUS_OK;
+}
+static KMODBUS_STATUS	SimPuts(unsigned char* buf, int len)
+{
+	while (len--) {
+		SimPut(*buf++);
+	}
+	return KMODBUS_OK;
+}
+
+/* xorshift32, runs are reproducible from the seed */
+static unsigned long	Random(void)
+{
+	unsigned long	x = s_Random & 0xFFFFFFFFUL;
+
+	x ^= (x << 13) & 0xFFFFFFFFUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xFFFFFFFFUL;
+	s_Random = x;
+	return x;
+}
+static int	Chance(double p)
+{
+	return p > 0.0 && (double)Random() / 4294967296.0 < p;
+}
+
+/* Pass one byte over the line, 0 when it was lost */
+static int	Transfer(const KModbusSimConfig_t* cfg, unsigned char* c)
+{
+	if (Chance(cfg->DropRate)) {
+		return 0;
+	}
+	if (Chance(cfg->NoiseRate)) {
+		*c ^= (unsigned char)(1 << (Random() % 8));
+	}
+	return 1;
+}
+
+void	KModbusSim_DefaultConfig(KModbusSimConfig_t* cfg)
+{
+	memset(cfg, 0x00, sizeof(*cfg));
+	cfg->Baud = 19200;
+	cfg->Lines = 1;
+	cfg->SlavesPerLine = 32;
+	cfg->Timeout = 100000;
+	cfg->SlaveDelay = 2000;
+	cfg->TurnaroundDelay = 100000;
+	cfg->ReadCount = 10;
+	cfg->WritePercent = 10;
+	cfg->Seed = 1;
+}
+
+static void	Record(KModbusSimStats_t* st, KMODBUS_TICK latency)
+{
+	unsigned long	b;
+
+	b = latency / KMODBUS_SIM_BUCKET;
+	if (b >= KMODBUS_SIM_BUCKETS) {
+		b = KMODBUS_SIM_BUCKETS - 1;
+	}
+	st->Histogram[b]++;
+	if (latency > st->LatencyMax) {
+		st->LatencyMax = latency;
+	}
+}
+
+static KMODBUS_TICK	Percentile(const KModbusSimStats_t* st, unsigned long total, double p)
+{
+	unsigned long	sum, limit;
+	int				b;
+
+	limit = (unsigned long)(total * p);
+	sum = 0;
+	for (b = 0; b < KMODBUS_SIM_BUCKETS; b++) {
+		sum += st->Histogram[b];
+		if (sum > limit) {
+			break;
+		}
+	}
+	/* Upper edge of the bucket, but never above the worst case seen */
+	if ((KMODBUS_TICK)(b + 1) * KMODBUS_SIM_BUCKET > st->LatencyMax) {
+		return st->LatencyMax;
+	}
+	return (KMODBUS_TICK)(b + 1) * KMODBUS_SIM_BUCKET;
+}
+
+/* One master transaction on the line, ln->Now advances to when the line is free again */
+static void	Transaction(const KModbusSimConfig_t* cfg, SimLine_t* ln, KMODBUS_TICK chartime, KMODBUS_TICK silent, KModbusSimStats_t* st)
+{
+	unsigned char	req[KMODBUS_MAX_TXBUF], rsp[KMODBUS_MAX_RXBUF], c;
+	KMODBUS_TICK	t0, t;
+	PKModbus_t		target;
+	KMODBUS_STATUS	ret;
+	int				i, k, len, unit, roll, rxlen, need, broadcast;
+
+	unit = ln->Next + 1;
+	ln->Next = (ln->Next + 1) % ln->Count;
+	roll = (int)(Random() % 100);
+	broadcast = roll < cfg->BroadcastPercent;
+	if (broadcast) {
+		len = KModbusMaster_BuildWriteSingle(req, KMODBUS_BROADCAST_ID, 6, (KMODBUS_ADDRESS)(Random() % 100), (unsigned short)Random());
+	}
+	else if (roll < cfg->BroadcastPercent + cfg->WritePercent) {
+		len = KModbusMaster_BuildWriteSingle(req, (unsigned char)unit, 6, (KMODBUS_ADDRESS)(Random() % 100), (unsigned short)Random());
+	}
+	else {
+		len = KModbusMaster_BuildRead(req, (unsigned char)unit, 3, (KMODBUS_ADDRESS)(Random() % 100), cfg->ReadCount);
+	}
+
+	/* Request, every byte reaches the addressed slave (all of them for a broadcast) */
+	t0 = ln->Now;
+	target = 0;
+	for (i = 0; i < len; i++) {
+		c = req[i];
+		t = t0 + (KMODBUS_TICK)(i + 1) * chartime;
+		if (!Transfer(cfg, &c)) {
+			continue;
+		}
+		s_Now = t;
+		if (broadcast) {
+			for (k = 0; k < ln->Count; k++) {
+				if (!ln->Offline[k]) {
+					KModbus_Feed(&ln->Slaves[k], &c, 1, t);
+				}
+			}
+			continue;
+		}
+		if (i == 0 && c >= 1 && c <= ln->Count && !ln->Offline[c - 1]) {
+			target = &ln->Slaves[c - 1];
+		}
+		if (target) {
+			KModbus_Feed(target, &c, 1, t);
+		}
+	}
+	t = t0 + (KMODBUS_TICK)len * chartime;
+	st->Transactions++;
+
+	/* The slaves execute after the silent interval */
+	s_Now = t + silent + 1;
+	s_RspLen = 0;
+	if (broadcast) {
+		for (k = 0; k < ln->Count; k++) {
+			KModbus_Tick(&ln->Slaves[k], s_Now);
+		}
+		s_RspLen = 0;
+		st->Broadcasts++;
+		Record(st, t - t0);
+		ln->Now = t + cfg->TurnaroundDelay;
+		return;
+	}
+	if (target) {
+		KModbus_Tick(target, s_Now);
+	}
+
+	/* Response, parsed by the master byte by byte */
+	t = s_Now + cfg->SlaveDelay;
+	rxlen = 0;
+	need = 0;
+	for (i = 0; i < s_RspLen && rxlen < KMODBUS_MAX_RXBUF; i++) {
+		c = s_Rsp[i];
+		t += chartime;
+		if (!Transfer(cfg, &c)) {
+			continue;
+		}
+		rsp[rxlen++] = c;
+		need = KModbusMaster_ResponseLength(rsp, rxlen);
+		if (need < 0 || (need > 0 && rxlen >= need)) {
+			break;
+		}
+	}
+	if (rxlen == 0 || need == 0 || (need > 0 && rxlen < need)) {
+		st->Timeouts++;
+		t = t0 + (KMODBUS_TICK)len * chartime + cfg->Timeout;
+		Record(st, t - t0);
+		ln->Now = t;
+		return;
+	}
+	ret = (need < 0) ? KMODBUS_INVALID_RESPONSE : KModbusMaster_Decode(req, rsp, rxlen, 0);
+	if (ret == KMODBUS_OK) {
+		st->Ok++;
+	}
+	else if (ret == KMODBUS_INVALID_RESPONSE) {
+		st->CrcErrors++;
+		/* The master waits for the end of the garbage */
+		t = s_Now + cfg->SlaveDelay + (KMODBUS_TICK)s_RspLen * chartime;
+	}
+	else {
+		st->Exceptions++;
+	}
+	Record(st, t - t0);
+	ln->Now = t + silent;
+}
+
+KMODBUS_STATUS	KModbusSim_Run(const KModbusSimConfig_t* cfg, double seconds, KModbusSimStats_t* st)
+{
+	SimLine_t*		ln;
+	KMODBUS_TICK	chartime, silent, end;
+	unsigned long	total;
+	int				l, i;
+
+	if (cfg->Baud == 0 || cfg->Lines < 1 || cfg->SlavesPerLine < 1 || cfg->SlavesPerLine > SIM_MAX_SLAVES || seconds <= 0.0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	ln = (SimLine_t*)malloc(sizeof(SimLine_t));
+	if (ln == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memset(st, 0x00, sizeof(*st));
+	s_Random = cfg->Seed ? cfg->Seed : 1;
+
+	/* 11 bit characters, 3.5 character silent interval (1750us above 19200 baud) */
+	chartime = (KMODBUS_TICK)(11000000UL / cfg->Baud);
+	silent = (cfg->Baud > 19200) ? 1750 : (chartime * 7 + 1) / 2;
+	end = (KMODBUS_TICK)(seconds * 1000000.0);
+
+	/* Lines are independent, they run one after the other over the same virtual period */
+	for (l = 0; l < cfg->Lines; l++) {
+		ln->Count = cfg->SlavesPerLine;
+		ln->Next = 0;
+		ln->Now = 0;
+		for (i = 0; i < ln->Count; i++) {
+			KModbus_InitHandle(&ln->Slaves[i]);
+			ln->Slaves[i].ID = (unsigned char)(i + 1);
+			ln->Slaves[i].GetTick = SimGetTick;
+			ln->Slaves[i].Interface.Get = SimGet;
+			ln->Slaves[i].Interface.Gets = 0;
+			ln->Slaves[i].Interface.Put = SimPut;
+			ln->Slaves[i].Interface.Puts = SimPuts;
+			ln->Slaves[i].NoCommunicationTime = silent;
+			ln->Offline[i] = (unsigned char)Chance(cfg->OfflineRate);
+		}
+		while (ln->Now < end) {
+			Transaction(cfg, ln, chartime, silent, st);
+		}
+	}
+	free(ln);
+
+	total = st->Transactions;
+	st->VirtualSeconds = seconds;
+	st->TransactionsPerSecond = total / seconds;
+	st->TimeoutRate = total ? (double)st->Timeouts / total : 0.0;
+	if (total) {
+		st->LatencyP50 = Percentile(st, total, 0.50);
+		st->LatencyP90 = Percentile(st, total, 0.90);
+		st->LatencyP99 = Percentile(st, total, 0.99);
+	}
+	return KMODBUS_OK;
+}
@@ -0,0 +1,90 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSSIM_H__
+#define	__KMODBUSSIM_H__
+
+#include "KModbusMaster.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/*
+	Virtual-time RS-485 simulator. Every line has one polling master and
+	up to 247 KModbus_t slaves driven through KModbus_Feed/KModbus_Tick.
+	Times are microseconds of virtual time, nothing waits on the wall clock.
+*/
+
+#define	KMODBUS_SIM_BUCKET			(100)		/* Latency histogram resolution (us) */
+#define	KMODBUS_SIM_BUCKETS			(2000)		/* The last bucket collects the overflow */
+
+typedef struct KModbusSimConfig_t {
+	unsigned long	Baud;
+	int				Lines;
+	int				SlavesPerLine;		/* 1 to 247 */
+	KMODBUS_TICK	Timeout;			/* Master response timeout */
+	KMODBUS_TICK	SlaveDelay;			/* Slave processing time before it answers */
+	KMODBUS_TICK	TurnaroundDelay;	/* Master pause after a broadcast */
+	double			NoiseRate;			/* Per byte probability of a flipped bit */
+	double			DropRate;			/* Per byte probability of a lost byte */
+	double			OfflineRate;		/* Fraction of slaves that never answer */
+	int				ReadCount;			/* Registers read by FC03 */
+	int				WritePercent;		/* Share of FC06 writes */
+	int				BroadcastPercent;	/* Share of FC06 broadcasts */
+	unsigned long	Seed;
+
+} KModbusSimConfig_t;
+
+typedef struct KModbusSimStats_t {
+	unsigned long	Transactions;
+	unsigned long	Ok;
+	unsigned long	Timeouts;
+	unsigned long	CrcErrors;			/* Corrupt or malformed responses */
+	unsigned long	Exceptions;
+	unsigned long	Broadcasts;
+
+	double			VirtualSeconds;
+	double			TransactionsPerSecond;
+	double			TimeoutRate;
+
+	KMODBUS_TICK	LatencyP50;
+	KMODBUS_TICK	LatencyP90;
+	KMODBUS_TICK	LatencyP99;
+	KMODBUS_TICK	LatencyMax;
+	unsigned long	Histogram[KMODBUS_SIM_BUCKETS];
+
+} KModbusSimStats_t;
+
+void			KModbusSim_DefaultConfig(KModbusSimConfig_t* cfg);
+
+/* Run the load generator for the given virtual time on every line */
+KMODBUS_STATUS	KModbusSim_Run(const KModbusSimConfig_t* cfg, double seconds, KModbusSimStats_t* st);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSSIM_H__ */
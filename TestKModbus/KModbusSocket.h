@@ -0,0 +1,116 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSSOCKET_H__
+#define	__KMODBUSSOCKET_H__
+
+/* Socket portability for the network transports, include before KModbus.h */
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+typedef	SOCKET				KMODBUS_SOCKET;
+typedef	int					KMODBUS_SOCKLEN;
+#define	KMODBUS_INVALID_SOCKET		INVALID_SOCKET
+#define	KMODBUS_CLOSESOCKET(s)		closesocket(s)
+#define	KMODBUS_SOCKERR				WSAGetLastError()
+#define	KMODBUS_EWOULDBLOCK			WSAEWOULDBLOCK
+#define	KMODBUS_EINPROGRESS			WSAEWOULDBLOCK
+
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef	int					KMODBUS_SOCKET;
+typedef	socklen_t			KMODBUS_SOCKLEN;
+#define	KMODBUS_INVALID_SOCKET		(-1)
+#define	KMODBUS_CLOSESOCKET(s)		close(s)
+#define	KMODBUS_SOCKERR				errno
+#define	KMODBUS_EWOULDBLOCK			EWOULDBLOCK
+#define	KMODBUS_EINPROGRESS			EINPROGRESS
+
+#endif
+
+#ifdef _MSC_VER
+#define	KMODBUS_THREAD_LOCAL		__declspec(thread)
+#else
+#define	KMODBUS_THREAD_LOCAL		__thread
+#endif
+
+/* Initialize the socket library once per process */
+static __inline int	KModbusSocket_Startup(void)
+{
+#ifdef _WIN32
+	WSADATA	wsa;
+
+	return WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+	return 0;
+#endif
+}
+
+/* Switch a socket to non-blocking mode */
+static __inline int	KModbusSocket_NonBlocking(KMODBUS_SOCKET s)
+{
+#ifdef _WIN32
+	u_long	mode = 1;
+
+	return ioctlsocket(s, FIONBIO, &mode);
+#else
+	int		flags;
+
+	flags = fcntl(s, F_GETFL, 0);
+	if (flags < 0) {
+		return -1;
+	}
+	return fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+/* Wait until the socket is readable (1), timed out (0) or failed (-1) */
+static __inline int	KModbusSocket_WaitRead(KMODBUS_SOCKET s, int timeout_ms)
+{
+	fd_set			rfds;
+	struct timeval	tv;
+
+	FD_ZERO(&rfds);
+	FD_SET(s, &rfds);
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	return select((int)s + 1, &rfds, NULL, NULL, (timeout_ms < 0) ? NULL : &tv);
+}
+
+#endif	/* __KMODBUSSOCKET_H__ */
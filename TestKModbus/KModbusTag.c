@@ -0,0 +1,482 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifdef	_MSC_VER
+#define	_CRT_SECURE_NO_WARNINGS
+#endif
+#include	"KModbusTag.h"
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<memory.h>
+
+#define	MAX_FIELDS		(7)
+
+static const char*	TypeName[] = { "bool", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+static const int	TypeRegs[] = { 1, 1, 1, 2, 2, 2, 4 };
+
+/* FNV-1a */
+static unsigned long	Hash(const char* s)
+{
+	unsigned long	h = 2166136261UL;
+
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h = (h * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return h;
+}
+
+static char*	Trim(char* s)
+{
+	char*	e;
+
+	while (*s == ' ' || *s == '\t') {
+		++s;
+	}
+	e = s + strlen(s);
+	while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+		*--e = '\0';
+	}
+	return s;
+}
+
+static int	ParseBank(const char* s)
+{
+	if (strcmp(s, "coil") == 0 || strcmp(s, "0x") == 0 || strcmp(s, "0") == 0) {
+		return 0;
+	}
+	if (strcmp(s, "input") == 0 || strcmp(s, "1x") == 0 || strcmp(s, "1") == 0) {
+		return 1;
+	}
+	if (strcmp(s, "ireg") == 0 || strcmp(s, "3x") == 0 || strcmp(s, "3") == 0) {
+		return 3;
+	}
+	if (strcmp(s, "hreg") == 0 || strcmp(s, "4x") == 0 || strcmp(s, "4") == 0) {
+		return 4;
+	}
+	return -1;
+}
+
+/* Bits or registers of a bank in this build */
+static long	BankSize(int bank)
+{
+	switch (bank) {
+	case 0:
+		return KMODBUS_X0_SIZE;
+	case 1:
+		return KMODBUS_X1_SIZE;
+	case 3:
+		return KMODBUS_X3_SIZE;
+	}
+	return KMODBUS_X4_SIZE;
+}
+
+static int	ParseType(const char* s)
+{
+	int		i;
+
+	for (i = 0; i < (int)(sizeof(TypeName) / sizeof(TypeName[0])); i++) {
+		if (strcmp(s, TypeName[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int	ParseOrder(const char* s)
+{
+	if (*s == '\0' || strcmp(s, "ABCD") == 0) {
+		return KMODBUS_TAG_ABCD;
+	}
+	if (strcmp(s, "BADC") == 0) {
+		return KMODBUS_TAG_BYTE_SWAP;
+	}
+	if (strcmp(s, "CDAB") == 0) {
+		return KMODBUS_TAG_WORD_SWAP;
+	}
+	if (strcmp(s, "DCBA") == 0) {
+		return KMODBUS_TAG_WORD_SWAP | KMODBUS_TAG_BYTE_SWAP;
+	}
+	return -1;
+}
+
+/* Split one line in place, 1 for a tag, 0 for a line to skip, -1 on an error */
+static int	ParseLine(char* line, int first, PKModbusTag_t tag)
+{
+	char*	field[MAX_FIELDS];
+	char*	end;
+	int		n;
+	long	adrs;
+
+	for (n = 0; n < MAX_FIELDS; n++) {
+		field[n] = "";
+	}
+	n = 0;
+	field[n++] = line;
+	while (*line != '\0') {
+		if (*line == ',') {
+			if (n == MAX_FIELDS) {
+				return -1;
+			}
+			*line = '\0';
+			field[n++] = line + 1;
+		}
+		++line;
+	}
+	for (n = 0; n < MAX_FIELDS; n++) {
+		field[n] = Trim(field[n]);
+	}
+	if (field[0][0] == '\0' || field[0][0] == '#' || (first && strcmp(field[0], "name") == 0)) {
+		return 0;
+	}
+
+	tag->Name = field[0];
+	tag->Hash = Hash(field[0]);
+	tag->Bank = ParseBank(field[1]);
+	tag->Type = ParseType(field[3]);
+	tag->Order = ParseOrder(field[4]);
+	if (tag->Bank < 0 || tag->Type < 0 || tag->Order < 0) {
+		return -1;
+	}
+	if ((tag->Bank == 0 || tag->Bank == 1) != (tag->Type == KMODBUS_TAG_BOOL)) {
+		return -1;		/* Bits are bool, registers are numbers */
+	}
+	tag->Count = TypeRegs[tag->Type];
+	adrs = strtol(field[2], &end, 10);
+	if (end == field[2] || *end != '\0' || adrs < 0 || adrs + tag->Count > BankSize(tag->Bank)) {
+		return -1;		/* Every bit or register of the tag is in its bank */
+	}
+	tag->Adrs = (int)adrs;
+
+	tag->Scale = 1.0;
+	tag->Offset = 0.0;
+	if (field[5][0] != '\0') {
+		tag->Scale = strtod(field[5], &end);
+		if (*end != '\0' || tag->Scale == 0.0) {
+			return -1;
+		}
+	}
+	if (field[6][0] != '\0') {
+		tag->Offset = strtod(field[6], &end);
+		if (*end != '\0') {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+/* Insert the tag number, a duplicate name fails */
+static int	IndexAdd(PKModbusTagMap_t map, int no)
+{
+	PKModbusTag_t	tag, other;
+	unsigned long	i;
+
+	tag = &map->Tag[no];
+	for (i = tag->Hash & map->Mask; map->Index[i] != 0; i = (i + 1) & map->Mask) {
+		other = &map->Tag[map->Index[i] - 1];
+		if (other->Hash == tag->Hash && strcmp(other->Name, tag->Name) == 0) {
+			return 0;
+		}
+	}
+	map->Index[i] = no + 1;
+	return 1;
+}
+
+/* Parse text, which the map takes over */
+static KMODBUS_STATUS	Build(PKModbusTagMap_t map, char* text, long len)
+{
+	char*			line;
+	char*			next;
+	unsigned long	size;
+	long			i, lines;
+	int				ret;
+
+	memset(map, 0x00, sizeof(*map));
+	map->Text = text;
+	text[len] = '\0';
+
+	lines = 1;
+	for (i = 0; i < len; i++) {
+		if (text[i] == '\n') {
+			lines++;
+		}
+	}
+	/* At most half full, so a miss ends after a short probe */
+	for (size = 16; size < (unsigned long)lines * 2; size *= 2) {
+	}
+	map->Tag = (PKModbusTag_t)malloc(sizeof(KModbusTag_t) * lines);
+	map->Index = (int*)calloc(size, sizeof(int));
+	if (map->Tag == 0 || map->Index == 0) {
+		KModbusTag_Free(map);
+		return KMODBUS_INVALID_PARAM;
+	}
+	map->Mask = size - 1;
+
+	for (line = text; line != 0; line = next) {
+		next = strchr(line, '\n');
+		if (next != 0) {
+			*next++ = '\0';
+		}
+		map->Line++;
+		ret = ParseLine(line, map->Line == 1, &map->Tag[map->Count]);
+		if (ret < 0 || (ret > 0 && !IndexAdd(map, map->Count))) {
+			KModbusTag_Free(map);
+			return KMODBUS_INVALID_PARAM;
+		}
+		map->Count += ret;
+	}
+	map->Line = 0;
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusTag_Load(PKModbusTagMap_t map, const char* path)
+{
+	FILE*	fp;
+	char*	text;
+	long	len;
+
+	memset(map, 0x00, sizeof(*map));
+	fp = fopen(path, "rb");
+	if (fp == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+		fclose(fp);
+		return KMODBUS_INVALID_PARAM;
+	}
+	text = (char*)malloc(len + 1);
+	if (text == 0 || (len != 0 && fread(text, len, 1, fp) != 1)) {
+		free(text);
+		fclose(fp);
+		return KMODBUS_INVALID_PARAM;
+	}
+	fclose(fp);
+	return Build(map, text, len);
+}
+
+KMODBUS_STATUS	KModbusTag_Parse(PKModbusTagMap_t map, const char* text, long len)
+{
+	char*	copy;
+
+	memset(map, 0x00, sizeof(*map));
+	copy = (char*)malloc(len + 1);
+	if (copy == 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memcpy(copy, text, len);
+	return Build(map, copy, len);
+}
+
+void	KModbusTag_Free(PKModbusTagMap_t map)
+{
+	int		line;
+
+	line = map->Line;
+	free(map->Tag);
+	free(map->Index);
+	free(map->Text);
+	memset(map, 0x00, sizeof(*map));
+	map->Line = line;
+}
+
+PKModbusTag_t	KModbusTag_Find(PKModbusTagMap_t map, const char* name)
+{
+	PKModbusTag_t	tag;
+	unsigned long	h, i;
+
+	if (map->Index == 0) {
+		return 0;
+	}
+	h = Hash(name);
+	for (i = h & map->Mask; map->Index[i] != 0; i = (i + 1) & map->Mask) {
+		tag = &map->Tag[map->Index[i] - 1];
+		if (tag->Hash == h && strcmp(tag->Name, name) == 0) {
+			return tag;
+		}
+	}
+	return 0;
+}
+
+/* Registers as on the wire to the value in ABCD order */
+static unsigned long long	Decode(const KModbusTag_t* tag, const unsigned char* dt)
+{
+	unsigned long long	u64;
+	unsigned short		u16;
+	int					i, r;
+
+	u64 = 0;
+	for (i = 0; i < tag->Count; i++) {
+		r = (tag->Order & KMODBUS_TAG_WORD_SWAP) ? tag->Count - 1 - i : i;
+		u16 = (unsigned short)((dt[r * 2] << 8) | dt[r * 2 + 1]);
+		if (tag->Order & KMODBUS_TAG_BYTE_SWAP) {
+			u16 = (unsigned short)((u16 << 8) | (u16 >> 8));
+		}
+		u64 = (u64 << 16) | u16;
+	}
+	return u64;
+}
+
+static void	Encode(const KModbusTag_t* tag, unsigned long long u64, unsigned char* dt)
+{
+	unsigned short		u16;
+	int					i, r;
+
+	for (i = tag->Count - 1; i >= 0; i--) {
+		r = (tag->Order & KMODBUS_TAG_WORD_SWAP) ? tag->Count - 1 - i : i;
+		u16 = (unsigned short)(u64 & 0xFFFF);
+		if (tag->Order & KMODBUS_TAG_BYTE_SWAP) {
+			u16 = (unsigned short)((u16 << 8) | (u16 >> 8));
+		}
+		dt[r * 2] = (unsigned char)(u16 >> 8);
+		dt[r * 2 + 1] = (unsigned char)(u16 & 0xFF);
+		u64 >>= 16;
+	}
+}
+
+KMODBUS_STATUS	KModbusTag_Get(const KModbusTag_t* tag, double* value)
+{
+	unsigned char		dt[8];
+	unsigned long long	u64;
+	unsigned long		u32;
+	float				f32;
+	double				f64;
+	double				raw;
+	KMODBUS_STATUS		ret;
+
+	ret = KModbus_Read(tag->Bank, tag->Adrs, dt, tag->Count);
+	if (ret != KMODBUS_OK) {
+		return ret;
+	}
+	if (tag->Type == KMODBUS_TAG_BOOL) {
+		*value = dt[0] & 0x01;
+		return KMODBUS_OK;
+	}
+	u64 = Decode(tag, dt);
+	u32 = (unsigned long)(u64 & 0xFFFFFFFFUL);
+	switch (tag->Type) {
+	case KMODBUS_TAG_INT16:
+		raw = (short)(unsigned short)u32;
+		break;
+	case KMODBUS_TAG_UINT16:
+		raw = (unsigned short)u32;
+		break;
+	case KMODBUS_TAG_INT32:
+		raw = (double)(u32 ^ 0x80000000UL) - 2147483648.0;
+		break;
+	case KMODBUS_TAG_UINT32:
+		raw = (double)u32;
+		break;
+	case KMODBUS_TAG_FLOAT32:
+		{
+			unsigned int	bits = (unsigned int)u32;
+			memcpy(&f32, &bits, sizeof(f32));
+		}
+		raw = f32;
+		break;
+	default:
+		memcpy(&f64, &u64, sizeof(f64));
+		raw = f64;
+		break;
+	}
+	*value = raw * tag->Scale + tag->Offset;
+	return KMODBUS_OK;
+}
+
+/* Clamp to [lo, hi] and round, clamped first: a double out of the range of long long does not convert */
+static double	ToInteger(double v, double lo, double hi)
+{
+	if (v <= lo) {
+		return lo;
+	}
+	if (v >= hi) {
+		return hi;
+	}
+	return (v < 0.0) ? -(double)(long long)(0.5 - v) : (double)(long long)(v + 0.5);
+}
+
+KMODBUS_STATUS	KModbusTag_Set(const KModbusTag_t* tag, double value)
+{
+	unsigned char		dt[8];
+	unsigned long long	u64;
+	unsigned int		bits;
+	float				f32;
+	double				raw;
+
+	if (tag->Type == KMODBUS_TAG_BOOL) {
+		dt[0] = (value != 0.0) ? 0x01 : 0x00;
+		return KModbus_Write(tag->Bank, tag->Adrs, dt, 1);
+	}
+	raw = (value - tag->Offset) / tag->Scale;
+	if (raw != raw && tag->Type < KMODBUS_TAG_FLOAT32) {
+		return KMODBUS_INVALID_PARAM;		/* NaN has no integer */
+	}
+	switch (tag->Type) {
+	case KMODBUS_TAG_INT16:
+		u64 = (unsigned short)(short)ToInteger(raw, -32768.0, 32767.0);
+		break;
+	case KMODBUS_TAG_UINT16:
+		u64 = (unsigned short)ToInteger(raw, 0.0, 65535.0);
+		break;
+	case KMODBUS_TAG_INT32:
+		u64 = (unsigned long)(long long)ToInteger(raw, -2147483648.0, 2147483647.0) & 0xFFFFFFFFUL;
+		break;
+	case KMODBUS_TAG_UINT32:
+		u64 = (unsigned long)ToInteger(raw, 0.0, 4294967295.0);
+		break;
+	case KMODBUS_TAG_FLOAT32:
+		f32 = (float)raw;
+		memcpy(&bits, &f32, sizeof(bits));
+		u64 = bits;
+		break;
+	default:
+		memcpy(&u64, &raw, sizeof(u64));
+		break;
+	}
+	Encode(tag, u64, dt);
+	return KModbus_Write(tag->Bank, tag->Adrs, dt, tag->Count);
+}
+
+KMODBUS_STATUS	KModbusTag_Read(PKModbusTagMap_t map, const char* name, double* value)
+{
+	PKModbusTag_t	tag;
+
+	tag = KModbusTag_Find(map, name);
+	if (tag == 0) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return KModbusTag_Get(tag, value);
+}
+
+KMODBUS_STATUS	KModbusTag_Write(PKModbusTagMap_t map, const char* name, double value)
+{
+	PKModbusTag_t	tag;
+
+	tag = KModbusTag_Find(map, name);
+	if (tag == 0) {
+		return KMODBUS_NON_EXISTENT_ADDRESS;
+	}
+	return KModbusTag_Set(tag, value);
+}
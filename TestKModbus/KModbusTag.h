@@ -0,0 +1,108 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSTAG_H__
+#define	__KMODBUSTAG_H__
+
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+/*
+	Tag map, one point per CSV line:
+
+		name,table,address,type[,order[,scale[,offset]]]
+
+	table	coil, input, ireg or hreg (or 0x, 1x, 3x, 4x)
+	address	0-based, as on the wire; the tag must fit in the bank
+	type	bool, int16, uint16, int32, uint32, float32 or float64
+	order	ABCD (default), CDAB (words swapped), BADC (bytes swapped), DCBA
+	scale	value = raw * scale + offset, default 1 and 0
+
+	Empty lines, lines starting with '#' and a first line starting with
+	"name" are skipped. Names are case sensitive and must be unique.
+	Loading resolves every tag to its bank and address and builds a hash
+	index, KModbusTag_Get/Set then go straight to the bank.
+*/
+
+/* Types */
+#define	KMODBUS_TAG_BOOL			(0)
+#define	KMODBUS_TAG_INT16			(1)
+#define	KMODBUS_TAG_UINT16			(2)
+#define	KMODBUS_TAG_INT32			(3)
+#define	KMODBUS_TAG_UINT32			(4)
+#define	KMODBUS_TAG_FLOAT32			(5)
+#define	KMODBUS_TAG_FLOAT64			(6)
+
+/* Order, bit flags */
+#define	KMODBUS_TAG_ABCD			(0)
+#define	KMODBUS_TAG_BYTE_SWAP		(1)
+#define	KMODBUS_TAG_WORD_SWAP		(2)
+
+typedef struct KModbusTag_t {
+	const char*		Name;
+	unsigned long	Hash;
+	int				Bank;		/* 0, 1, 3 or 4 */
+	int				Adrs;		/* 0-based, as the bank accessors */
+	int				Type;
+	int				Order;
+	int				Count;		/* Bits or registers */
+	double			Scale;
+	double			Offset;
+
+} KModbusTag_t, *PKModbusTag_t;
+
+typedef struct KModbusTagMap_t {
+	PKModbusTag_t	Tag;
+	int				Count;
+	int*			Index;		/* Open addressing, tag number + 1, 0 is empty */
+	unsigned long	Mask;		/* Index entries - 1 */
+	char*			Text;		/* Names point into the loaded file */
+	int				Line;		/* Line of the first error */
+
+} KModbusTagMap_t, *PKModbusTagMap_t;
+
+KMODBUS_STATUS	KModbusTag_Load(PKModbusTagMap_t map, const char* path);
+KMODBUS_STATUS	KModbusTag_Parse(PKModbusTagMap_t map, const char* text, long len);
+void			KModbusTag_Free(PKModbusTagMap_t map);
+
+/* Resolve once and keep the tag, 0 when the name is unknown */
+PKModbusTag_t	KModbusTag_Find(PKModbusTagMap_t map, const char* name);
+
+/* Scaled value of a tag, through KModbus_Read/Write. Integer tags saturate, NaN is refused */
+KMODBUS_STATUS	KModbusTag_Get(const KModbusTag_t* tag, double* value);
+KMODBUS_STATUS	KModbusTag_Set(const KModbusTag_t* tag, double value);
+
+/* Find and Get/Set in one call */
+KMODBUS_STATUS	KModbusTag_Read(PKModbusTagMap_t map, const char* name, double* value);
+KMODBUS_STATUS	KModbusTag_Write(PKModbusTagMap_t map, const char* name, double value);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSTAG_H__ */
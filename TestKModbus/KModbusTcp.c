@@ -0,0 +1,267 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusTcp.h"
+#include	"KModbusMbap.h"
+#include	<memory.h>
+
+/* *reuseport: ask for SO_REUSEPORT, cleared when the system does not have it */
+static KMODBUS_SOCKET	OpenListen(unsigned short port, int* reuseport)
+{
+	struct sockaddr_in	sa;
+	KMODBUS_SOCKET		s;
+	int					on = 1;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == KMODBUS_INVALID_SOCKET) {
+		return s;
+	}
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+#ifdef SO_REUSEPORT
+	if (*reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on)) != 0) {
+		*reuseport = 0;
+	}
+#else
+	*reuseport = 0;
+#endif
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if (bind(s, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(s, 64) != 0
+		|| KModbusSocket_NonBlocking(s) != 0) {
+		KMODBUS_CLOSESOCKET(s);
+		return KMODBUS_INVALID_SOCKET;
+	}
+	return s;
+}
+
+static KMODBUS_STATUS	Open(PKModbusTcp_t t, PKModbus_t hd, unsigned short port, KMODBUS_SOCKET shared, int reuseport)
+{
+	int		i;
+
+	memset(t, 0x00, sizeof(*t));
+	t->hd = hd;
+	for (i = 0; i < KMODBUS_TCP_MAX_CONNECTIONS; i++) {
+		t->Conn[i].Socket = KMODBUS_INVALID_SOCKET;
+	}
+	if (KModbusSocket_Startup() != 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (shared != KMODBUS_INVALID_SOCKET) {
+		t->Listen = shared;
+		t->SharedListen = 1;
+	}
+	else {
+		t->Listen = OpenListen(port, &reuseport);
+		if (t->Listen == KMODBUS_INVALID_SOCKET) {
+			return KMODBUS_INVALID_PARAM;
+		}
+		t->ReusePort = reuseport;
+	}
+
+	/* Responses are collected into the worker buffer instead of a serial port */
+	KModbusMbap_Attach(hd);
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusTcp_Open(PKModbusTcp_t t, PKModbus_t hd, unsigned short port, KMODBUS_SOCKET shared)
+{
+	return Open(t, hd, port, shared, 0);
+}
+
+KMODBUS_STATUS	KModbusTcp_OpenShards(PKModbusTcp_t t, PKModbus_t hd, int n, unsigned short port)
+{
+	KMODBUS_STATUS	ret;
+	int				i;
+
+	for (i = 0; i < n; i++) {
+		/* Without SO_REUSEPORT on worker 0 the others fall back to its socket */
+		if (i == 0 || t[0].ReusePort) {
+			ret = Open(&t[i], &hd[i], port, KMODBUS_INVALID_SOCKET, 1);
+		}
+		else {
+			ret = Open(&t[i], &hd[i], port, t[0].Listen, 0);
+		}
+		if (ret != KMODBUS_OK) {
+			while (i-- > 0) {
+				KModbusTcp_Close(&t[i]);
+			}
+			return ret;
+		}
+	}
+	return KMODBUS_OK;
+}
+
+static void	CloseConn(PKModbusTcp_t t, int ci)
+{
+	if (t->Conn[ci].Socket != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(t->Conn[ci].Socket);
+		t->Conn[ci].Socket = KMODBUS_INVALID_SOCKET;
+	}
+	t->Conn[ci].RxLen = 0;
+}
+
+void	KModbusTcp_Close(PKModbusTcp_t t)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_TCP_MAX_CONNECTIONS; i++) {
+		CloseConn(t, i);
+	}
+	if (t->Listen != KMODBUS_INVALID_SOCKET && !t->SharedListen) {
+		KMODBUS_CLOSESOCKET(t->Listen);
+	}
+	t->Listen = KMODBUS_INVALID_SOCKET;
+}
+
+static void	Accept(PKModbusTcp_t t)
+{
+	KMODBUS_SOCKET	s;
+	int				i, on = 1;
+
+	/* With a shared socket another worker may have taken the connection */
+	s = accept(t->Listen, NULL, NULL);
+	if (s == KMODBUS_INVALID_SOCKET) {
+		return;
+	}
+	for (i = 0; i < KMODBUS_TCP_MAX_CONNECTIONS; i++) {
+		if (t->Conn[i].Socket == KMODBUS_INVALID_SOCKET) {
+			KModbusSocket_NonBlocking(s);
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+			t->Conn[i].Socket = s;
+			t->Conn[i].RxLen = 0;
+			t->Accepted++;
+			return;
+		}
+	}
+	KMODBUS_CLOSESOCKET(s);
+}
+
+/* Execute one MBAP request, 0 when the connection has to be dropped */
+static int	Execute(PKModbusTcp_t t, KModbusTcpConn_t* cn, const unsigned char* rx, int len)
+{
+	t->Requests++;
+	t->TxLen = KModbusMbap_Execute(t->hd, rx, len, t->TxBuf, (int)sizeof(t->TxBuf));
+	if (t->TxLen < 0) {
+		t->Discarded++;
+		return 1;
+	}
+	if (t->TxLen == 0) {
+		return 1;
+	}
+
+	/* Responses are small, a short send means the client stopped reading */
+	return send(cn->Socket, (const char*)t->TxBuf, t->TxLen, 0) == t->TxLen;
+}
+
+/* Split the received stream into MBAP frames */
+static void	ReadConn(PKModbusTcp_t t, int ci)
+{
+	KModbusTcpConn_t*	cn = &t->Conn[ci];
+	int					n, flen, ofs;
+
+	n = recv(cn->Socket, (char*)&cn->RxBuf[cn->RxLen], KMODBUS_TCP_MAX_ADU - cn->RxLen, 0);
+	if (n <= 0) {
+		CloseConn(t, ci);
+		return;
+	}
+	cn->RxLen += n;
+	ofs = 0;
+	while (cn->RxLen - ofs >= 7) {
+		flen = KModbud_B2N(&cn->RxBuf[ofs + 4]) + 6;
+		if (cn->RxBuf[ofs + 2] != 0 || cn->RxBuf[ofs + 3] != 0 || flen < 8 || flen > KMODBUS_TCP_MAX_ADU) {
+			CloseConn(t, ci);
+			return;
+		}
+		if (cn->RxLen - ofs < flen) {
+			break;
+		}
+		if (!Execute(t, cn, &cn->RxBuf[ofs], flen)) {
+			CloseConn(t, ci);
+			return;
+		}
+		ofs += flen;
+	}
+	cn->RxLen -= ofs;
+	memmove(cn->RxBuf, &cn->RxBuf[ofs], cn->RxLen);
+}
+
+KMODBUS_STATUS	KModbusTcp_Poll(PKModbusTcp_t t, int timeout_ms)
+{
+	fd_set			rfds;
+	struct timeval	tv;
+	KMODBUS_SOCKET	maxfd;
+	int				i, ret;
+
+	FD_ZERO(&rfds);
+	FD_SET(t->Listen, &rfds);
+	maxfd = t->Listen;
+	for (i = 0; i < KMODBUS_TCP_MAX_CONNECTIONS; i++) {
+		if (t->Conn[i].Socket != KMODBUS_INVALID_SOCKET) {
+			FD_SET(t->Conn[i].Socket, &rfds);
+			if (t->Conn[i].Socket > maxfd) {
+				maxfd = t->Conn[i].Socket;
+			}
+		}
+	}
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	ret = select((int)maxfd + 1, &rfds, NULL, NULL, &tv);
+	if (ret < 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	if (ret == 0) {
+		return KMODBUS_TIMEOUT;
+	}
+	if (FD_ISSET(t->Listen, &rfds)) {
+		Accept(t);
+	}
+	for (i = 0; i < KMODBUS_TCP_MAX_CONNECTIONS; i++) {
+		if (t->Conn[i].Socket != KMODBUS_INVALID_SOCKET && FD_ISSET(t->Conn[i].Socket, &rfds)) {
+			ReadConn(t, i);
+		}
+	}
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusTcpServer(PKModbusTcp_t t, int* ResQuit)
+{
+	KMODBUS_STATUS	ret;
+
+	for (;;) {
+		/* Monitor quit requests */
+		if (ResQuit) {
+			if (*ResQuit) {
+				break;
+			}
+		}
+		ret = KModbusTcp_Poll(t, 10);
+		if (ret == KMODBUS_INVALID_PARAM) {
+			return ret;
+		}
+	}
+	return KMODBUS_OK;
+}
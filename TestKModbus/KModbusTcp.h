@@ -0,0 +1,95 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSTCP_H__
+#define	__KMODBUSTCP_H__
+
+#include "KModbusSocket.h"
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_TCP_MAX_CONNECTIONS
+#define	KMODBUS_TCP_MAX_CONNECTIONS	(64)	/* Per worker */
+#endif
+
+#define	KMODBUS_TCP_MAX_ADU			(260)
+
+typedef struct KModbusTcpConn_t {
+	KMODBUS_SOCKET		Socket;
+	unsigned char		RxBuf[KMODBUS_TCP_MAX_ADU];
+	int					RxLen;
+
+} KModbusTcpConn_t;
+
+/*
+	One worker of the Modbus TCP server. Each worker owns its listening
+	socket, its connections and its KModbus_t, so workers only share the
+	register banks. Run one worker per thread.
+*/
+typedef struct KModbusTcp_t {
+	PKModbus_t			hd;
+	KMODBUS_SOCKET		Listen;
+	int					SharedListen;		/* Listen belongs to another worker */
+	int					ReusePort;			/* Listen is one of several SO_REUSEPORT sockets */
+
+	KModbusTcpConn_t	Conn[KMODBUS_TCP_MAX_CONNECTIONS];
+
+	unsigned char		TxBuf[KMODBUS_TCP_MAX_ADU + 2];
+	int					TxLen;
+
+	unsigned long		Accepted;
+	unsigned long		Requests;
+	unsigned long		Discarded;
+
+} KModbusTcp_t, *PKModbusTcp_t;
+
+/* shared: listening socket of another worker, KMODBUS_INVALID_SOCKET to open one */
+KMODBUS_STATUS	KModbusTcp_Open(PKModbusTcp_t t, PKModbus_t hd, unsigned short port, KMODBUS_SOCKET shared);
+void			KModbusTcp_Close(PKModbusTcp_t t);
+
+/*
+	Open n workers on one port, worker i serving through hd[i]. Set up
+	hd[0] with KModbus_Init and the others with KModbus_InitHandle, so the
+	banks are cleared once.
+
+	Where SO_REUSEPORT is available (Linux, BSD) each worker listens on a
+	socket of its own and the kernel spreads the connections. Elsewhere
+	(Windows), or when the option is refused, every worker accepts from
+	worker 0's socket (SharedListen, ReusePort 0): each connection wakes
+	all workers, one of them gets it and the others see accept() fail.
+*/
+KMODBUS_STATUS	KModbusTcp_OpenShards(PKModbusTcp_t t, PKModbus_t hd, int n, unsigned short port);
+
+KMODBUS_STATUS	KModbusTcp_Poll(PKModbusTcp_t t, int timeout_ms);
+KMODBUS_STATUS	KModbusTcpServer(PKModbusTcp_t t, int* ResQuit);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSTCP_H__ */
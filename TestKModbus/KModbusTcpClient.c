@@ -0,0 +1,471 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include	"KModbusTcpClient.h"
+#include	<memory.h>
+
+#define	REQ_FREE			(0)
+#define	REQ_QUEUED			(1)
+#define	REQ_SENT			(2)
+
+#define	LINK_CLOSED			(0)
+#define	LINK_CONNECTING		(1)
+#define	LINK_UP				(2)
+
+#define	TICK_REACHED(now, t)	((long)((now) - (t)) >= 0)
+
+#ifdef	MSG_NOSIGNAL
+#define	SEND_FLAGS			MSG_NOSIGNAL
+#else
+#define	SEND_FLAGS			(0)
+#endif
+
+/* Reads can be sent again safely when the connection dropped before the answer */
+static int	IsRead(unsigned char cd)
+{
+	return cd >= 1 && cd <= 4;
+}
+
+static void	Idle(int timeout_ms)
+{
+#ifdef _WIN32
+	Sleep(timeout_ms);
+#else
+	struct timeval	tv;
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+static void	Complete(PKModbusTcpLink_t l, KModbusTcpRequest_t* rq, KMODBUS_STATUS st)
+{
+	if (rq->State == REQ_SENT) {
+		l->InFlight--;
+	}
+	else {
+		l->Queued--;
+	}
+	rq->State = REQ_FREE;
+	rq->TxEnd = 0;
+	if (rq->Done) {
+		(*rq->Done)(rq->Context, st);
+	}
+}
+
+static void	Disconnect(PKModbusTcpLink_t l, KMODBUS_TICK now)
+{
+	PKModbusTcpClient_t	c = l->Client;
+	KModbusTcpRequest_t*	rq;
+	int						i;
+
+	if (l->Socket != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(l->Socket);
+		l->Socket = KMODBUS_INVALID_SOCKET;
+	}
+	l->State = LINK_CLOSED;
+	l->RxLen = 0;
+	l->NextConnect = now + l->Backoff;
+	l->Backoff = (l->Backoff * 2 < KMODBUS_TCPC_RECONNECT_MAX) ? l->Backoff * 2 : KMODBUS_TCPC_RECONNECT_MAX;
+
+	for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+		rq = &l->Req[i];
+		if (rq->State != REQ_SENT) {
+			continue;
+		}
+		/* A write whose last byte never left the send buffer cannot have been executed */
+		if (IsRead(rq->Frame[1]) || rq->TxEnd > l->TxOfs) {
+			rq->State = REQ_QUEUED;
+			rq->TxEnd = 0;
+			rq->Deadline = now + c->Timeout;
+			l->InFlight--;
+			l->Queued++;
+			l->Resent++;
+		}
+		else {
+			l->Lost++;
+			Complete(l, rq, KMODBUS_NOT_RESPONSE);
+		}
+	}
+	l->TxLen = 0;
+	l->TxOfs = 0;
+}
+
+static void	Connect(PKModbusTcpLink_t l, KMODBUS_TICK now)
+{
+	int		on = 1;
+
+	l->Socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (l->Socket == KMODBUS_INVALID_SOCKET) {
+		Disconnect(l, now);
+		return;
+	}
+	KModbusSocket_NonBlocking(l->Socket);
+	setsockopt(l->Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	l->Connects++;
+	if (connect(l->Socket, (struct sockaddr*)&l->Addr, sizeof(l->Addr)) == 0) {
+		l->State = LINK_UP;
+		l->Backoff = KMODBUS_TCPC_RECONNECT_MIN;
+		return;
+	}
+	if (KMODBUS_SOCKERR == KMODBUS_EINPROGRESS || KMODBUS_SOCKERR == KMODBUS_EWOULDBLOCK) {
+		l->State = LINK_CONNECTING;
+		return;
+	}
+	Disconnect(l, now);
+}
+
+/* Move queued requests into the send buffer while the window allows, then write it */
+static void	Flush(PKModbusTcpLink_t l, KMODBUS_TICK now)
+{
+	PKModbusTcpClient_t	c = l->Client;
+	KModbusTcpRequest_t*	rq;
+	unsigned char*			p;
+	int						i, n, pdulen;
+
+	while (l->InFlight < l->Window && l->Queued > 0) {
+		rq = 0;
+		for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+			if (l->Req[i].State == REQ_QUEUED && (rq == 0 || (long)(l->Req[i].Seq - rq->Seq) < 0)) {
+				rq = &l->Req[i];
+			}
+		}
+		/* Unit and PDU go after the MBAP header, the CRC is dropped */
+		pdulen = rq->Len - 2;
+		if (l->TxLen + 6 + pdulen > KMODBUS_TCPC_TXBUF) {
+			break;
+		}
+		rq->Tid = l->NextTid++;
+		p = &l->TxBuf[l->TxLen];
+		p[0] = (unsigned char)(rq->Tid >> 8);
+		p[1] = (unsigned char)(rq->Tid & 0x00FF);
+		p[2] = 0;
+		p[3] = 0;
+		p[4] = (unsigned char)(pdulen >> 8);
+		p[5] = (unsigned char)(pdulen & 0x00FF);
+		memcpy(&p[6], rq->Frame, pdulen);
+		l->TxLen += 6 + pdulen;
+		rq->TxEnd = l->TxLen;
+
+		rq->State = REQ_SENT;
+		rq->Deadline = now + c->Timeout;
+		l->Queued--;
+		l->InFlight++;
+		l->Requests++;
+	}
+
+	while (l->TxOfs < l->TxLen) {
+		n = send(l->Socket, (const char*)&l->TxBuf[l->TxOfs], l->TxLen - l->TxOfs, SEND_FLAGS);
+		if (n < 0) {
+			if (KMODBUS_SOCKERR != KMODBUS_EWOULDBLOCK) {
+				Disconnect(l, now);
+			}
+			return;		/* The rest goes when the socket is writable */
+		}
+		l->TxOfs += n;
+	}
+	for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+		l->Req[i].TxEnd = 0;
+	}
+	l->TxLen = 0;
+	l->TxOfs = 0;
+}
+
+/* Match one MBAP response to its request */
+static void	Response(PKModbusTcpLink_t l, const unsigned char* adu, int len)
+{
+	KModbusTcpRequest_t*	rq;
+	unsigned char			rtu[KMODBUS_TCP_MAX_ADU + 2];
+	unsigned short			tid, crc16;
+	int						i, rtulen;
+
+	tid = KModbud_B2N((unsigned char*)adu);
+	for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+		rq = &l->Req[i];
+		if (rq->State == REQ_SENT && rq->Tid == tid) {
+			break;
+		}
+	}
+	if (i == KMODBUS_TCPC_SLOTS) {
+		l->Stale++;		/* Answer to a request that already timed out */
+		return;
+	}
+	/* Back to an RTU frame so KModbusMaster_Decode checks it against the request */
+	rtulen = len - 6;
+	memcpy(rtu, &adu[6], rtulen);
+	crc16 = KModbus_CalcCRC16(rtu, rtulen);
+	rtu[rtulen++] = (unsigned char)(crc16 & 0x00FF);
+	rtu[rtulen++] = (unsigned char)(crc16 >> 8);
+
+	l->Responses++;
+	Complete(l, rq, KModbusMaster_Decode(rq->Frame, rtu, rtulen, rq->Buf));
+}
+
+/* Split the received stream into MBAP frames, a partial frame waits for the next read */
+static void	Receive(PKModbusTcpLink_t l, KMODBUS_TICK now)
+{
+	int		n, flen, ofs;
+
+	n = recv(l->Socket, (char*)&l->RxBuf[l->RxLen], (int)sizeof(l->RxBuf) - l->RxLen, 0);
+	if (n < 0 && KMODBUS_SOCKERR == KMODBUS_EWOULDBLOCK) {
+		return;
+	}
+	if (n <= 0) {
+		Disconnect(l, now);
+		return;
+	}
+	l->RxLen += n;
+	ofs = 0;
+	while (l->RxLen - ofs >= 7) {
+		flen = KModbud_B2N(&l->RxBuf[ofs + 4]) + 6;
+		if (l->RxBuf[ofs + 2] != 0 || l->RxBuf[ofs + 3] != 0 || flen < 9 || flen > KMODBUS_TCP_MAX_ADU) {
+			Disconnect(l, now);		/* Lost the framing */
+			return;
+		}
+		if (l->RxLen - ofs < flen) {
+			break;
+		}
+		Response(l, &l->RxBuf[ofs], flen);
+		ofs += flen;
+	}
+	l->RxLen -= ofs;
+	memmove(l->RxBuf, &l->RxBuf[ofs], l->RxLen);
+}
+
+/* Sent requests time out from the send, queued ones only while the device is unreachable */
+static void	Expire(PKModbusTcpLink_t l, KMODBUS_TICK now)
+{
+	int		i;
+
+	for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+		if (l->Req[i].State == REQ_FREE || (l->Req[i].State == REQ_QUEUED && l->State == LINK_UP)) {
+			continue;
+		}
+		if (TICK_REACHED(now, l->Req[i].Deadline)) {
+			l->Timeouts++;
+			Complete(l, &l->Req[i], KMODBUS_TIMEOUT);
+		}
+	}
+}
+
+void	KModbusTcpClient_Init(PKModbusTcpClient_t c, KMODBUS_TICK (*gettick)(void), KMODBUS_TICK timeout)
+{
+	memset(c, 0x00, sizeof(*c));
+	c->GetTick = gettick;
+	c->Timeout = timeout;
+	KModbusSocket_Startup();
+}
+
+void	KModbusTcpClient_Close(PKModbusTcpClient_t c)
+{
+	PKModbusTcpLink_t	l;
+	int					i, j;
+
+	for (i = 0; i < c->Links; i++) {
+		l = &c->Link[i];
+		if (l->Socket != KMODBUS_INVALID_SOCKET) {
+			KMODBUS_CLOSESOCKET(l->Socket);
+			l->Socket = KMODBUS_INVALID_SOCKET;
+		}
+		for (j = 0; j < KMODBUS_TCPC_SLOTS; j++) {
+			if (l->Req[j].State != REQ_FREE) {
+				Complete(l, &l->Req[j], KMODBUS_CANCELLED);
+			}
+		}
+		l->State = LINK_CLOSED;
+	}
+	c->Links = 0;
+}
+
+PKModbusTcpLink_t	KModbusTcpClient_Link(PKModbusTcpClient_t c, const char* ip, unsigned short port, int window)
+{
+	PKModbusTcpLink_t	l;
+	struct sockaddr_in	sa;
+	int					i;
+
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &sa.sin_addr) != 1) {
+		return 0;
+	}
+	for (i = 0; i < c->Links; i++) {
+		l = &c->Link[i];
+		if (l->Addr.sin_addr.s_addr == sa.sin_addr.s_addr && l->Addr.sin_port == sa.sin_port) {
+			return l;
+		}
+	}
+	if (c->Links >= KMODBUS_TCPC_LINKS) {
+		return 0;
+	}
+	l = &c->Link[c->Links++];
+	memset(l, 0x00, sizeof(*l));
+	l->Client = c;
+	l->Addr = sa;
+	l->Socket = KMODBUS_INVALID_SOCKET;
+	l->State = LINK_CLOSED;
+	l->Window = (window < 1) ? KMODBUS_TCPC_WINDOW : (window > KMODBUS_TCPC_SLOTS) ? KMODBUS_TCPC_SLOTS : window;
+	l->Backoff = KMODBUS_TCPC_RECONNECT_MIN;
+	l->NextConnect = (*c->GetTick)();
+	return l;
+}
+
+KMODBUS_STATUS	KModbusTcpClient_Submit(PKModbusTcpLink_t l, const unsigned char* frame, int len,
+					unsigned short* buf, KModbusTcpDone done, void* context)
+{
+	KModbusTcpRequest_t*	rq;
+	int						i;
+
+	if (len < 4 || len > KMODBUS_MAX_TXBUF || len - 2 > KMODBUS_TCP_MAX_ADU - 6) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	for (i = 0; i < KMODBUS_TCPC_SLOTS; i++) {
+		if (l->Req[i].State == REQ_FREE) {
+			break;
+		}
+	}
+	if (i == KMODBUS_TCPC_SLOTS) {
+		return KMODBUS_SLAVE_BUSY;		/* Poll until requests complete */
+	}
+	rq = &l->Req[i];
+	memcpy(rq->Frame, frame, len);
+	rq->Len = len;
+	rq->Buf = buf;
+	rq->Done = done;
+	rq->Context = context;
+	rq->Seq = l->NextSeq++;
+	rq->Deadline = (*l->Client->GetTick)() + l->Client->Timeout;
+	rq->State = REQ_QUEUED;
+	l->Queued++;
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusTcpClient_Poll(PKModbusTcpClient_t c, int timeout_ms)
+{
+	PKModbusTcpLink_t	l;
+	fd_set				rfds, wfds;
+	struct timeval		tv;
+	KMODBUS_SOCKET		maxfd;
+	KMODBUS_TICK		now;
+	KMODBUS_SOCKLEN		optlen;
+	int					i, ret, err, active;
+
+	now = (*c->GetTick)();
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	maxfd = 0;
+	active = 0;
+	for (i = 0; i < c->Links; i++) {
+		l = &c->Link[i];
+		if (l->State == LINK_CLOSED && l->Queued > 0 && TICK_REACHED(now, l->NextConnect)) {
+			Connect(l, now);
+		}
+		if (l->State == LINK_UP) {
+			Flush(l, now);
+		}
+		if (l->State == LINK_CLOSED) {
+			continue;
+		}
+		if (l->State == LINK_UP) {
+			FD_SET(l->Socket, &rfds);
+		}
+		if (l->State == LINK_CONNECTING || l->TxOfs < l->TxLen) {
+			FD_SET(l->Socket, &wfds);
+		}
+		if (l->Socket > maxfd) {
+			maxfd = l->Socket;
+		}
+		active++;
+	}
+	if (active == 0) {
+		/* Nothing to wait on, do not spin while the devices are down */
+		Idle(timeout_ms);
+		ret = 0;
+	}
+	else {
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		ret = select((int)maxfd + 1, &rfds, &wfds, NULL, &tv);
+		if (ret < 0) {
+			return KMODBUS_INVALID_PARAM;
+		}
+	}
+
+	now = (*c->GetTick)();
+	for (i = 0; i < c->Links; i++) {
+		l = &c->Link[i];
+		if (ret > 0 && l->State == LINK_CONNECTING && FD_ISSET(l->Socket, &wfds)) {
+			err = 0;
+			optlen = sizeof(err);
+			getsockopt(l->Socket, SOL_SOCKET, SO_ERROR, (char*)&err, &optlen);
+			if (err != 0) {
+				Disconnect(l, now);
+			}
+			else {
+				l->State = LINK_UP;
+				l->Backoff = KMODBUS_TCPC_RECONNECT_MIN;
+			}
+		}
+		else if (ret > 0 && l->State == LINK_UP) {
+			if (FD_ISSET(l->Socket, &rfds)) {
+				Receive(l, now);
+			}
+		}
+		Expire(l, now);
+		if (l->State == LINK_UP) {
+			Flush(l, now);		/* Answers opened the window */
+		}
+	}
+	return (ret == 0) ? KMODBUS_TIMEOUT : KMODBUS_OK;
+}
+
+typedef struct SyncWait_t {
+	int				Done;
+	KMODBUS_STATUS	Status;
+} SyncWait_t;
+
+static void	SyncDone(void* context, KMODBUS_STATUS status)
+{
+	((SyncWait_t*)context)->Status = status;
+	((SyncWait_t*)context)->Done = 1;
+}
+
+KMODBUS_STATUS	KModbusTcpClient_Transaction(PKModbusTcpClient_t c, PKModbusTcpLink_t l, const unsigned char* frame, int len, unsigned short* buf)
+{
+	SyncWait_t		w;
+	KMODBUS_STATUS	ret;
+
+	w.Done = 0;
+	w.Status = KMODBUS_OK;
+	ret = KModbusTcpClient_Submit(l, frame, len, buf, SyncDone, &w);
+	if (ret != KMODBUS_OK) {
+		return ret;
+	}
+	while (!w.Done) {
+		KModbusTcpClient_Poll(c, 10);
+	}
+	return w.Status;
+}
@@ -0,0 +1,143 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSTCPCLIENT_H__
+#define	__KMODBUSTCPCLIENT_H__
+
+#include "KModbusSocket.h"
+#include "KModbusMaster.h"
+#include "KModbusTcp.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#ifndef	KMODBUS_TCPC_LINKS
+#define	KMODBUS_TCPC_LINKS			(8)		/* Connections of one client */
+#endif
+#ifndef	KMODBUS_TCPC_SLOTS
+#define	KMODBUS_TCPC_SLOTS			(32)	/* Queued and outstanding requests per connection */
+#endif
+#ifndef	KMODBUS_TCPC_WINDOW
+#define	KMODBUS_TCPC_WINDOW			(8)		/* Default requests in flight per connection */
+#endif
+#ifndef	KMODBUS_TCPC_TXBUF
+#define	KMODBUS_TCPC_TXBUF			(2048)
+#endif
+#ifndef	KMODBUS_TCPC_RECONNECT_MIN
+#define	KMODBUS_TCPC_RECONNECT_MIN	(100)	/* Ticks, doubled up to MAX while the device is down */
+#endif
+#ifndef	KMODBUS_TCPC_RECONNECT_MAX
+#define	KMODBUS_TCPC_RECONNECT_MAX	(5000)
+#endif
+
+/* Completion of a request, the data is in the buf given to Submit */
+typedef void (*KModbusTcpDone)(void* context, KMODBUS_STATUS status);
+
+typedef struct KModbusTcpRequest_t {
+	int				State;
+	unsigned short	Tid;
+	unsigned long	Seq;			/* Submission order */
+	KMODBUS_TICK	Deadline;
+	int				TxEnd;			/* End of its MBAP frame in TxBuf while not all sent, else 0 */
+	unsigned char	Frame[KMODBUS_MAX_TXBUF];	/* RTU request with CRC, as built by KModbusMaster_Build* */
+	int				Len;
+	unsigned short*	Buf;
+	KModbusTcpDone	Done;
+	void*			Context;
+
+} KModbusTcpRequest_t;
+
+/*
+	One connection. Several unit IDs behind the same address (a gateway)
+	share it. Requests are queued, sent while fewer than Window are
+	outstanding, and matched to the responses by transaction ID.
+*/
+typedef struct KModbusTcpLink_t {
+	struct KModbusTcpClient_t*	Client;
+	struct sockaddr_in		Addr;
+	KMODBUS_SOCKET			Socket;
+	int						State;
+	int						Window;
+	int						InFlight;
+	int						Queued;
+	unsigned short			NextTid;
+	unsigned long			NextSeq;
+	KMODBUS_TICK			NextConnect;
+	KMODBUS_TICK			Backoff;
+
+	KModbusTcpRequest_t		Req[KMODBUS_TCPC_SLOTS];
+
+	unsigned char			RxBuf[KMODBUS_TCP_MAX_ADU * 4];
+	int						RxLen;
+	unsigned char			TxBuf[KMODBUS_TCPC_TXBUF];
+	int						TxLen;
+	int						TxOfs;
+
+	unsigned long			Requests;
+	unsigned long			Responses;
+	unsigned long			Timeouts;
+	unsigned long			Resent;			/* Sent again after a reconnect */
+	unsigned long			Lost;			/* Sent writes failed by a dropped connection */
+	unsigned long			Stale;			/* Responses matching no outstanding request */
+	unsigned long			Connects;
+
+} KModbusTcpLink_t, *PKModbusTcpLink_t;
+
+typedef struct KModbusTcpClient_t {
+	KModbusTcpLink_t		Link[KMODBUS_TCPC_LINKS];
+	int						Links;
+	KMODBUS_TICK			(*GetTick)(void);
+	KMODBUS_TICK			Timeout;		/* Per request from the send, or from the submit while disconnected */
+
+} KModbusTcpClient_t, *PKModbusTcpClient_t;
+
+void				KModbusTcpClient_Init(PKModbusTcpClient_t c, KMODBUS_TICK (*gettick)(void), KMODBUS_TICK timeout);
+void				KModbusTcpClient_Close(PKModbusTcpClient_t c);
+
+/* Connection to ip:port, shared with earlier calls for the same address (0 when the pool is full) */
+PKModbusTcpLink_t	KModbusTcpClient_Link(PKModbusTcpClient_t c, const char* ip, unsigned short port, int window);
+
+/*
+	Queue a request, the unit ID is frame[0]. done runs from
+	KModbusTcpClient_Poll. After a reconnect, reads that were in flight
+	are sent again, and so are writes still (partly) in the send buffer.
+	Writes that went out complete with KMODBUS_NOT_RESPONSE because the
+	device may have executed them.
+*/
+KMODBUS_STATUS		KModbusTcpClient_Submit(PKModbusTcpLink_t l, const unsigned char* frame, int len,
+						unsigned short* buf, KModbusTcpDone done, void* context);
+
+/* Connect, send, receive and expire on all links, waiting up to timeout_ms for traffic */
+KMODBUS_STATUS		KModbusTcpClient_Poll(PKModbusTcpClient_t c, int timeout_ms);
+
+/* Submit and poll until the request completes */
+KMODBUS_STATUS		KModbusTcpClient_Transaction(PKModbusTcpClient_t c, PKModbusTcpLink_t l, const unsigned char* frame, int len, unsigned short* buf);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSTCPCLIENT_H__ */
@@ -0,0 +1,222 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define	_GNU_SOURCE				/* recvmmsg / sendmmsg */
+#endif
+#include	"KModbusUdp.h"
+#include	"KModbusMbap.h"
+#include	<memory.h>
+
+KMODBUS_STATUS	KModbusUdp_Open(PKModbusUdp_t u, PKModbus_t hd, unsigned short port, int framing)
+{
+	struct sockaddr_in	sa;
+
+	memset(u, 0x00, sizeof(*u));
+	u->hd = hd;
+	u->Framing = framing;
+
+	if (KModbusSocket_Startup() != 0) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	u->Socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (u->Socket == KMODBUS_INVALID_SOCKET) {
+		return KMODBUS_INVALID_PARAM;
+	}
+	memset(&sa, 0x00, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	sa.sin_port = htons(port);
+	if (bind(u->Socket, (struct sockaddr*)&sa, sizeof(sa)) != 0 || KModbusSocket_NonBlocking(u->Socket) != 0) {
+		KMODBUS_CLOSESOCKET(u->Socket);
+		u->Socket = KMODBUS_INVALID_SOCKET;
+		return KMODBUS_INVALID_PARAM;
+	}
+
+	/* Responses are collected into the batch instead of a serial port */
+	KModbusMbap_Attach(hd);
+	return KMODBUS_OK;
+}
+
+void	KModbusUdp_Close(PKModbusUdp_t u)
+{
+	if (u->Socket != KMODBUS_INVALID_SOCKET) {
+		KMODBUS_CLOSESOCKET(u->Socket);
+		u->Socket = KMODBUS_INVALID_SOCKET;
+	}
+}
+
+static void	ReceiveBatch(PKModbusUdp_t u)
+{
+#ifdef __linux__
+	struct mmsghdr	msgs[KMODBUS_UDP_BATCH];
+	struct iovec	iov[KMODBUS_UDP_BATCH];
+	int				i, n;
+
+	memset(msgs, 0x00, sizeof(msgs));
+	for (i = 0; i < KMODBUS_UDP_BATCH; i++) {
+		iov[i].iov_base = u->RxData[i];
+		iov[i].iov_len = KMODBUS_UDP_MAX_DATAGRAM;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &u->Peer[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(u->Peer[i]);
+	}
+	n = recvmmsg(u->Socket, msgs, KMODBUS_UDP_BATCH, MSG_DONTWAIT, NULL);
+	u->Count = (n > 0) ? n : 0;
+	for (i = 0; i < u->Count; i++) {
+		u->RxLen[i] = (int)msgs[i].msg_len;
+		u->PeerLen[i] = msgs[i].msg_hdr.msg_namelen;
+	}
+#else
+	int		n;
+
+	u->Count = 0;
+	while (u->Count < KMODBUS_UDP_BATCH) {
+		u->PeerLen[u->Count] = sizeof(u->Peer[u->Count]);
+		n = recvfrom(u->Socket, (char*)u->RxData[u->Count], KMODBUS_UDP_MAX_DATAGRAM, 0,
+			(struct sockaddr*)&u->Peer[u->Count], &u->PeerLen[u->Count]);
+		if (n <= 0) {
+			break;
+		}
+		u->RxLen[u->Count++] = n;
+	}
+#endif
+}
+
+static void	SendBatch(PKModbusUdp_t u)
+{
+#ifdef __linux__
+	struct mmsghdr	msgs[KMODBUS_UDP_BATCH];
+	struct iovec	iov[KMODBUS_UDP_BATCH];
+	int				i, n, sent;
+
+	n = 0;
+	for (i = 0; i < u->Count; i++) {
+		if (u->TxLen[i] <= 0) {
+			continue;
+		}
+		memset(&msgs[n], 0x00, sizeof(msgs[n]));
+		iov[n].iov_base = u->TxData[i];
+		iov[n].iov_len = u->TxLen[i];
+		msgs[n].msg_hdr.msg_iov = &iov[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		msgs[n].msg_hdr.msg_name = &u->Peer[i];
+		msgs[n].msg_hdr.msg_namelen = u->PeerLen[i];
+		++n;
+	}
+	for (i = 0; i < n; i += sent) {
+		sent = sendmmsg(u->Socket, &msgs[i], n - i, 0);
+		if (sent <= 0) {
+			u->Discarded += n - i;
+			break;
+		}
+		u->TxDatagrams += sent;
+	}
+#else
+	int		i;
+
+	for (i = 0; i < u->Count; i++) {
+		if (u->TxLen[i] <= 0) {
+			continue;
+		}
+		if (sendto(u->Socket, (const char*)u->TxData[i], u->TxLen[i], 0,
+			(struct sockaddr*)&u->Peer[i], u->PeerLen[i]) == u->TxLen[i]) {
+			u->TxDatagrams++;
+		}
+		else {
+			u->Discarded++;
+		}
+	}
+#endif
+}
+
+/* RTU framed datagram: address, PDU and CRC */
+static void	ExecuteRtu(PKModbusUdp_t u, int i)
+{
+	KModbusMbap_Sink(u->TxData[i], &u->TxLen[i], KMODBUS_UDP_MAX_DATAGRAM);
+	if (KModbus_Execute(u->hd, u->RxData[i], u->RxLen[i]) != KMODBUS_OK && u->TxLen[i] == 0) {
+		u->Discarded++;
+	}
+}
+
+/* MBAP framed datagram: transaction, protocol, length, unit and PDU */
+static void	ExecuteMbap(PKModbusUdp_t u, int i)
+{
+	u->TxLen[i] = KModbusMbap_Execute(u->hd, u->RxData[i], u->RxLen[i], u->TxData[i], KMODBUS_UDP_MAX_DATAGRAM);
+	if (u->TxLen[i] < 0) {
+		u->TxLen[i] = 0;
+		u->Discarded++;
+	}
+}
+
+KMODBUS_STATUS	KModbusUdp_Poll(PKModbusUdp_t u, int timeout_ms)
+{
+	int		i, ret;
+
+	ret = KModbusSocket_WaitRead(u->Socket, timeout_ms);
+	if (ret <= 0) {
+		return (ret == 0) ? KMODBUS_TIMEOUT : KMODBUS_INVALID_PARAM;
+	}
+	ReceiveBatch(u);
+	if (u->Count == 0) {
+		return KMODBUS_NODATA;
+	}
+	u->RxBatches++;
+	u->RxDatagrams += u->Count;
+
+	for (i = 0; i < u->Count; i++) {
+		u->TxLen[i] = 0;
+		if (u->Framing == KMODBUS_UDP_MBAP) {
+			ExecuteMbap(u, i);
+		}
+		else {
+			ExecuteRtu(u, i);
+		}
+	}
+	KModbusMbap_Sink(0, 0, 0);
+
+	SendBatch(u);
+	return KMODBUS_OK;
+}
+
+KMODBUS_STATUS	KModbusUdpServer(PKModbusUdp_t u, int* ResQuit)
+{
+	KMODBUS_STATUS	ret;
+
+	for (;;) {
+		/* Monitor quit requests */
+		if (ResQuit) {
+			if (*ResQuit) {
+				break;
+			}
+		}
+		ret = KModbusUdp_Poll(u, 10);
+		if (ret == KMODBUS_INVALID_PARAM) {
+			return ret;
+		}
+	}
+	return KMODBUS_OK;
+}
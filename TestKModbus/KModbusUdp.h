@@ -0,0 +1,74 @@
+﻿/*
+MIT License
+
+Copyright © 2024 Koji Kobayashi All Rights Reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the “Software”), to deal in the
+Software without restriction, including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so, subject to the
+following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#ifndef	__KMODBUSUDP_H__
+#define	__KMODBUSUDP_H__
+
+#include "KModbusSocket.h"
+#include "KModbus.h"
+
+#ifdef __cplusplus
+	extern "C" {
+#endif
+
+#define	KMODBUS_UDP_RTU				(0)		/* Datagram holds an RTU frame with CRC */
+#define	KMODBUS_UDP_MBAP			(1)		/* Datagram holds an MBAP header and PDU */
+
+#define	KMODBUS_UDP_BATCH			(32)
+#define	KMODBUS_UDP_MAX_DATAGRAM	(KMODBUS_MAX_TXBUF + 6)
+
+typedef struct KModbusUdp_t {
+	PKModbus_t				hd;
+	KMODBUS_SOCKET			Socket;
+	int						Framing;
+
+	unsigned long			RxDatagrams;
+	unsigned long			TxDatagrams;
+	unsigned long			RxBatches;
+	unsigned long			Discarded;
+
+	/* One batch of requests and their responses */
+	int						Count;
+	unsigned char			RxData[KMODBUS_UDP_BATCH][KMODBUS_UDP_MAX_DATAGRAM];
+	int						RxLen[KMODBUS_UDP_BATCH];
+	unsigned char			TxData[KMODBUS_UDP_BATCH][KMODBUS_UDP_MAX_DATAGRAM];
+	int						TxLen[KMODBUS_UDP_BATCH];
+	struct sockaddr_storage	Peer[KMODBUS_UDP_BATCH];
+	KMODBUS_SOCKLEN			PeerLen[KMODBUS_UDP_BATCH];
+
+} KModbusUdp_t, *PKModbusUdp_t;
+
+KMODBUS_STATUS	KModbusUdp_Open(PKModbusUdp_t u, PKModbus_t hd, unsigned short port, int framing);
+void			KModbusUdp_Close(PKModbusUdp_t u);
+
+/* Receive one batch of datagrams, execute them and send the responses */
+KMODBUS_STATUS	KModbusUdp_Poll(PKModbusUdp_t u, int timeout_ms);
+KMODBUS_STATUS	KModbusUdpServer(PKModbusUdp_t u, int* ResQuit);
+
+#ifdef __cplusplus
+	}
+#endif
+
+#endif	/* __KMODBUSUDP_H__ */